@@ -0,0 +1,225 @@
+#include "allocators.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+
+#ifndef SKIP_IMGUI
+#include "includes.h"
+#endif
+
+size_t FrameArena::capacity = 4 * 1024 * 1024;
+size_t FrameArena::used_last_frame = 0;
+int FrameArena::overflows_last_frame = 0;
+
+std::atomic<size_t> HeapStats::num_allocations(0);
+std::atomic<size_t> HeapStats::bytes_allocated(0);
+size_t HeapStats::allocations_last_frame = 0;
+size_t HeapStats::bytes_last_frame = 0;
+
+struct sArenaBuffer {
+	char* data;
+	size_t size;
+	std::atomic<size_t> offset; //keeps growing past the size, so it says how much the frame needed
+	std::mutex overflow_mutex;
+	std::vector<void*> overflow; //malloc blocks of the allocations that did not fit
+	std::atomic<int> num_overflows;
+};
+
+//the buffers start empty, the first frames go to the heap and say which size is needed
+static sArenaBuffer arena_buffers[2];
+static int current_arena = 0;
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+	sArenaBuffer& buffer = arena_buffers[current_arena];
+	size_t padded = bytes + alignment - 1;
+	size_t start = buffer.offset.fetch_add(padded, std::memory_order_relaxed);
+	if (start + padded <= buffer.size)
+	{
+		uintptr_t address = (uintptr_t)(buffer.data + start);
+		return (void*)((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	}
+
+	void* block = malloc(padded);
+	if (!block)
+		throw std::bad_alloc();
+	buffer.num_overflows++;
+	{
+		std::lock_guard<std::mutex> lock(buffer.overflow_mutex);
+		buffer.overflow.push_back(block);
+	}
+	return (void*)(((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void FrameArena::nextFrame()
+{
+	sArenaBuffer& finished = arena_buffers[current_arena];
+	used_last_frame = finished.offset;
+	overflows_last_frame = finished.num_overflows;
+	capacity = std::max(capacity, used_last_frame + used_last_frame / 2);
+
+	//the one of two frames ago is not used anymore
+	current_arena = 1 - current_arena;
+	sArenaBuffer& buffer = arena_buffers[current_arena];
+	for (size_t i = 0; i < buffer.overflow.size(); ++i)
+		free(buffer.overflow[i]);
+	buffer.overflow.clear();
+	if (buffer.size < capacity)
+	{
+		free(buffer.data);
+		buffer.data = (char*)malloc(capacity);
+		buffer.size = buffer.data ? capacity : 0;
+	}
+	buffer.offset = 0;
+	buffer.num_overflows = 0;
+
+	HeapStats::nextFrame();
+}
+
+void FrameArena::renderInMenu()
+{
+#ifndef SKIP_IMGUI
+	ImGui::Text("Frame arena: %d KB used  %d KB x 2  %d overflows", (int)(used_last_frame / 1024), (int)(capacity / 1024), overflows_last_frame);
+	ImGui::Text("Task blocks in use: %d", (int)SmallObjectPool::get().getNumBlocksInUse());
+#ifdef TRACK_HEAP_ALLOCATIONS
+	ImGui::Text("Heap allocations last frame: %d  (%d KB)", (int)HeapStats::allocations_last_frame, (int)(HeapStats::bytes_last_frame / 1024));
+#endif
+#endif
+}
+
+//*********************
+
+SmallObjectPool::SmallObjectPool()
+{
+	for (int i = 0; i < NUM_CLASSES; ++i)
+	{
+		classes[i].free_list = NULL;
+		classes[i].in_use = 0;
+	}
+}
+
+SmallObjectPool& SmallObjectPool::get()
+{
+	static SmallObjectPool* pool = new SmallObjectPool();
+	return *pool;
+}
+
+int SmallObjectPool::getSizeClass(size_t size)
+{
+	for (int i = 0; i < NUM_CLASSES; ++i)
+		if (size <= ((size_t)64 << i))
+			return i;
+	return -1;
+}
+
+void* SmallObjectPool::allocate(size_t size)
+{
+	int index = getSizeClass(size);
+	if (index == -1)
+		return ::operator new(size);
+
+	SizeClass& size_class = classes[index];
+	std::lock_guard<std::mutex> lock(size_class.mutex);
+	if (!size_class.free_list)
+	{
+		//a new page cut in blocks
+		size_t block_size = (size_t)64 << index;
+		char* page = new char[PAGE_SIZE];
+		size_class.pages.push_back(page);
+		for (size_t offset = 0; offset + block_size <= PAGE_SIZE; offset += block_size)
+		{
+			FreeBlock* block = (FreeBlock*)(page + offset);
+			block->next = size_class.free_list;
+			size_class.free_list = block;
+		}
+	}
+	FreeBlock* block = size_class.free_list;
+	size_class.free_list = block->next;
+	size_class.in_use++;
+	return block;
+}
+
+void SmallObjectPool::deallocate(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	int index = getSizeClass(size);
+	if (index == -1)
+	{
+		::operator delete(ptr);
+		return;
+	}
+
+	SizeClass& size_class = classes[index];
+	std::lock_guard<std::mutex> lock(size_class.mutex);
+	FreeBlock* block = (FreeBlock*)ptr;
+	block->next = size_class.free_list;
+	size_class.free_list = block;
+	size_class.in_use--;
+}
+
+size_t SmallObjectPool::getNumBlocksInUse()
+{
+	size_t total = 0;
+	for (int i = 0; i < NUM_CLASSES; ++i)
+	{
+		std::lock_guard<std::mutex> lock(classes[i].mutex);
+		total += classes[i].in_use;
+	}
+	return total;
+}
+
+//*********************
+
+void HeapStats::nextFrame()
+{
+	static size_t last_allocations = 0;
+	static size_t last_bytes = 0;
+	size_t allocations = num_allocations;
+	size_t bytes = bytes_allocated;
+	allocations_last_frame = allocations - last_allocations;
+	bytes_last_frame = bytes - last_bytes;
+	last_allocations = allocations;
+	last_bytes = bytes;
+}
+
+#ifdef TRACK_HEAP_ALLOCATIONS
+
+//every new of the program goes through here, the counters are atomics so it works before main and in any thread
+void* operator new(size_t size)
+{
+	HeapStats::num_allocations.fetch_add(1, std::memory_order_relaxed);
+	HeapStats::bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	HeapStats::num_allocations.fetch_add(1, std::memory_order_relaxed);
+	HeapStats::bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+
+#endif
@@ -0,0 +1,79 @@
+/*  allocators
+	FrameArena: linear memory for the data that only lives during a frame (render preparation), two buffers so what was
+	allocated in a frame can still be read in the next one, freeing is just moving back the offset.
+	SmallObjectPool: blocks of a few sizes for objects created and deleted all the time by any thread (the Tasks).
+	The global operator new counts the heap allocations of every frame when TRACK_HEAP_ALLOCATIONS is defined,
+	the Debug configurations of Visual Studio and Xcode define it, with make uncomment the CPPFLAGS line of Makefile.inc.
+*/
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+class FrameArena {
+public:
+	static size_t capacity; //bytes of every buffer, grows when a frame needed more
+	static size_t used_last_frame;
+	static int overflows_last_frame; //allocations that did not fit and went to the heap
+
+	//any thread, valid until the end of the next frame
+	static void* allocate(size_t bytes, size_t alignment = 16);
+
+	//main thread, once per frame: the buffer of two frames ago is reused
+	static void nextFrame();
+
+	static void renderInMenu();
+};
+
+//to use the arena in the STL containers, freeing does nothing
+template<typename T>
+class FrameAllocator {
+public:
+	typedef T value_type;
+	FrameAllocator() {}
+	template<typename U> FrameAllocator(const FrameAllocator<U>&) {}
+	T* allocate(size_t n) { return (T*)FrameArena::allocate(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16); }
+	void deallocate(T*, size_t) {}
+	template<typename U> bool operator == (const FrameAllocator<U>&) const { return true; }
+	template<typename U> bool operator != (const FrameAllocator<U>&) const { return false; }
+};
+
+template<typename T> using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+//free lists of blocks of 64, 128, 256 and 512 bytes taken from pages, bigger sizes use the heap
+class SmallObjectPool {
+public:
+	static SmallObjectPool& get(); //never deleted, objects can be freed after the static ones at exit
+
+	void* allocate(size_t size);
+	void deallocate(void* ptr, size_t size);
+
+	size_t getNumBlocksInUse();
+
+private:
+	enum { NUM_CLASSES = 4, PAGE_SIZE = 64 * 1024 };
+	struct FreeBlock { FreeBlock* next; };
+	struct SizeClass {
+		std::mutex mutex;
+		FreeBlock* free_list;
+		std::vector<char*> pages;
+		size_t in_use;
+	};
+	SizeClass classes[NUM_CLASSES];
+
+	SmallObjectPool();
+	static int getSizeClass(size_t size);
+};
+
+//counters of the global operator new (zero when not tracked)
+class HeapStats {
+public:
+	static std::atomic<size_t> num_allocations;
+	static std::atomic<size_t> bytes_allocated;
+	static size_t allocations_last_frame;
+	static size_t bytes_last_frame;
+
+	static void nextFrame(); //called by FrameArena::nextFrame
+};
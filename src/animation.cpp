@@ -6,8 +6,8 @@
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
-
-#include <sys/stat.h>
+
+#include <sys/stat.h>
 
 Skeleton::Skeleton()
 {
@@ -161,7 +161,7 @@ void Skeleton::assignLayer( Bone* bone, uint8 layer )
 	}
 }
 
-Animation::Animation()
+Animation::Animation() : Resource(RESOURCE_ANIMATION)
 {
 	duration = 0.0f;
 	keyframes = NULL;
@@ -173,6 +173,13 @@ Animation::~Animation()
 {
 	if (keyframes)
 		delete[] keyframes;
+
+	for (auto it = sAnimationsLoaded.begin(); it != sAnimationsLoaded.end(); ++it)
+		if (it->second == this)
+		{
+			sAnimationsLoaded.erase(it);
+			break;
+		}
 }
 
 void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
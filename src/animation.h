@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <iostream>
 #include "mesh.h"
+#include "resources.h"
 
 
 class Camera;
@@ -61,7 +62,7 @@ public:
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer = 0xFF);
 
 //This class contains one animation loaded from a file (it also uses a skeleton to store the current snapshot)
-class Animation {
+class Animation : public Resource {
 public:
 
 	Skeleton skeleton;
@@ -77,6 +78,8 @@ public:
 	Animation();
 	~Animation();	//we need the dtor to remove the keyframes memory
 
+	void getMemoryUsage(size_t& cpu, size_t& gpu) { cpu = sizeof(Animation) + (keyframes ? num_keyframes * num_animated_bones * sizeof(Matrix44) : 0); gpu = 0; }
+
 	//change the skeleton to the given pose according to time
 	void assignTime(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
 
@@ -10,6 +10,8 @@
 #include "prefab.h"
 #include "gltf_loader.h"
 #include "renderer.h"
+#include "upload_ring.h"
+#include "allocators.h"
 
 #include <cmath>
 #include <string>
@@ -244,12 +246,21 @@ void Application::renderDebugGUI(void)
 
 	//System stats
 	ImGui::Text(getGPUStats().c_str());					   // Display some text (you can use a format strings too)
+	ImGui::Text("Quantized meshes saved: %d KB disk, %d KB VRAM", (int)(Mesh::quantization_saved_disk / 1024), (int)(Mesh::quantization_saved_vram / 1024));
 
 
 	//Choose Render Pipeline
 	ImGui::Combo("Render Pipeline", (int*)&renderer->rendering_pipeline, "FORWARD\0DEFERRED\0");
 
 	ImGui::Checkbox("Wireframe", &render_wireframe);
+	ImGui::Checkbox("Meshlet culling", &renderer->use_meshlet_culling);
+	ImGui::Checkbox("Prepare frame in workers", &renderer->use_frame_jobs); //off to debug the jobs in the main thread
+	ImGui::Checkbox("LODs", &renderer->use_lods);
+	if (renderer->use_lods)
+	{
+		ImGui::SliderFloat("LOD error (px)", &renderer->lod_error_pixels, 0.1f, 16.0f);
+		ImGui::SliderInt("Shadow LOD bias", &renderer->shadow_lod_bias, 0, 3);
+	}
 	ImGui::ColorEdit3("BG color", scene->background_color.v);
 	ImGui::ColorEdit3("Ambient Light", scene->ambient_light.v);
 
@@ -287,6 +298,21 @@ void Application::renderDebugGUI(void)
 		ImGui::TreePop();
 	}
 
+	//memory used by every manager and the budgets
+	if (ImGui::TreeNode("Resources")) {
+		ResourceManager::renderInMenu();
+		Texture::renderStreamingInMenu();
+		UploadRing::renderInMenu();
+		FrameArena::renderInMenu();
+		ImGui::TreePop();
+	}
+
+	//uploads and callbacks run in the main thread
+	if (ImGui::TreeNode("Main thread tasks")) {
+		TaskManager::foreground.renderInMenu();
+		ImGui::TreePop();
+	}
+
 	//add info to the debug panel about the camera
 	if (ImGui::TreeNode(camera, "Camera")) {
 		camera->renderInMenu();
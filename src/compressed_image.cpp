@@ -0,0 +1,906 @@
+#include "compressed_image.h"
+#include "texture.h"
+#include "utils.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <cassert>
+#include <thread>
+#include <algorithm>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+	#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+	#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+	#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+	#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+	#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+#define FOURCC(a, b, c, d) ((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+//DXGI_FORMAT values of the DX10 header
+#define DXGI_BC1_UNORM 71
+#define DXGI_BC1_UNORM_SRGB 72
+#define DXGI_BC3_UNORM 77
+#define DXGI_BC3_UNORM_SRGB 78
+#define DXGI_BC4_UNORM 80
+#define DXGI_BC5_UNORM 83
+#define DXGI_BC7_UNORM 98
+#define DXGI_BC7_UNORM_SRGB 99
+
+int getBlockBytes(eBlockFormat format)
+{
+	return format == BLOCK_BC1 || format == BLOCK_BC4 ? 8 : 16;
+}
+
+int getBlockChannels(eBlockFormat format)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: return 3;
+	case BLOCK_BC4: return 1;
+	case BLOCK_BC5: return 2;
+	default: return 4;
+	}
+}
+
+const char* getBlockFormatName(eBlockFormat format)
+{
+	const char* names[] = { "NONE", "BC1", "BC3", "BC4", "BC5", "BC7" };
+	return names[format];
+}
+
+unsigned int getBlockFormatGL(eBlockFormat format)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BLOCK_BC4: return GL_COMPRESSED_RED_RGTC1;
+	case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case BLOCK_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return 0;
+	}
+}
+
+// BLOCK ENCODING *******************************
+
+//principal axis of the colors of the block (power iteration over the covariance), the mean is returned too
+static void computePrincipalAxis(const unsigned char* rgba, int num_channels, float* mean, float* axis)
+{
+	float cov[4][4];
+	memset(cov, 0, sizeof(cov));
+	for (int c = 0; c < num_channels; ++c)
+	{
+		mean[c] = 0;
+		for (int i = 0; i < 16; ++i)
+			mean[c] += rgba[i * 4 + c];
+		mean[c] /= 16.0f;
+	}
+	for (int i = 0; i < 16; ++i)
+		for (int a = 0; a < num_channels; ++a)
+			for (int b = a; b < num_channels; ++b)
+				cov[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+	for (int a = 0; a < num_channels; ++a)
+		for (int b = 0; b < a; ++b)
+			cov[a][b] = cov[b][a];
+
+	for (int c = 0; c < num_channels; ++c)
+		axis[c] = 1.0f;
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float v[4] = { 0, 0, 0, 0 };
+		float length = 0;
+		for (int a = 0; a < num_channels; ++a)
+		{
+			for (int b = 0; b < num_channels; ++b)
+				v[a] += cov[a][b] * axis[b];
+			length += v[a] * v[a];
+		}
+		if (length < 1e-8f) //flat block, any axis works
+			break;
+		length = 1.0f / sqrtf(length);
+		for (int c = 0; c < num_channels; ++c)
+			axis[c] = v[c] * length;
+	}
+}
+
+//the two pixels at the extremes of the principal axis
+static void findEndpoints(const unsigned char* rgba, int num_channels, float* e0, float* e1)
+{
+	float mean[4], axis[4];
+	computePrincipalAxis(rgba, num_channels, mean, axis);
+	float min_proj = FLT_MAX, max_proj = -FLT_MAX;
+	int min_index = 0, max_index = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		float proj = 0;
+		for (int c = 0; c < num_channels; ++c)
+			proj += (rgba[i * 4 + c] - mean[c]) * axis[c];
+		if (proj < min_proj) { min_proj = proj; min_index = i; }
+		if (proj > max_proj) { max_proj = proj; max_index = i; }
+	}
+	for (int c = 0; c < num_channels; ++c)
+	{
+		e0[c] = rgba[max_index * 4 + c];
+		e1[c] = rgba[min_index * 4 + c];
+	}
+}
+
+//least squares endpoints for the given weights of the second endpoint, false if they can't be solved
+static bool solveEndpoints(const unsigned char* rgba, int num_channels, const float* weights, float* e0, float* e1)
+{
+	float aa = 0, ab = 0, bb = 0;
+	float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		float b = weights[i];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < num_channels; ++c)
+		{
+			ax[c] += a * rgba[i * 4 + c];
+			bx[c] += b * rgba[i * 4 + c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+	det = 1.0f / det;
+	for (int c = 0; c < num_channels; ++c)
+	{
+		e0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) * det, 0.0f), 255.0f);
+		e1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) * det, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+static inline int colorDistance(const unsigned char* a, const int* b, int num_channels)
+{
+	int dist = 0;
+	for (int c = 0; c < num_channels; ++c)
+		dist += (a[c] - b[c]) * (a[c] - b[c]);
+	return dist;
+}
+
+static inline unsigned short to565(const float* color)
+{
+	int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static inline void from565(unsigned short color, int* rgb)
+{
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+//palette of a color block in 4 colors mode, as the GPU decodes it
+static void buildColorPalette(unsigned short c0, unsigned short c1, int palette[4][4], bool four_colors)
+{
+	from565(c0, palette[0]);
+	from565(c1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		if (four_colors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	for (int i = 0; i < 4; ++i)
+		palette[i][3] = 255;
+}
+
+struct sColorBlock {
+	unsigned short c0, c1;
+	unsigned int indices;
+	int error;
+};
+
+//quantizes the endpoints and picks the closest palette color for every pixel
+static sColorBlock fitColorBlock(const unsigned char* rgba, const float* e0, const float* e1)
+{
+	sColorBlock block;
+	block.c0 = to565(e0);
+	block.c1 = to565(e1);
+	if (block.c0 < block.c1) //c0 > c1 selects the 4 colors mode
+		std::swap(block.c0, block.c1);
+
+	int palette[4][4];
+	buildColorPalette(block.c0, block.c1, palette, true);
+	block.indices = 0;
+	block.error = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0, best_dist = colorDistance(rgba + i * 4, palette[0], 3);
+		if (block.c0 != block.c1) //when equal the decoder uses 3 colors mode, index 0 is still right
+			for (int j = 1; j < 4; ++j)
+			{
+				int dist = colorDistance(rgba + i * 4, palette[j], 3);
+				if (dist < best_dist) { best = j; best_dist = dist; }
+			}
+		block.indices |= best << (i * 2);
+		block.error += best_dist;
+	}
+	return block;
+}
+
+//BC1 block, also the color part of BC3
+static void encodeColorBlock(const unsigned char* rgba, unsigned char* dest)
+{
+	float e0[4], e1[4];
+	findEndpoints(rgba, 3, e0, e1);
+	sColorBlock best = fitColorBlock(rgba, e0, e1);
+
+	//refine the endpoints with the indices found
+	const float index_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	for (int iteration = 0; iteration < 2 && best.error; ++iteration)
+	{
+		float weights[16];
+		for (int i = 0; i < 16; ++i)
+			weights[i] = index_weights[(best.indices >> (i * 2)) & 3];
+		if (!solveEndpoints(rgba, 3, weights, e0, e1))
+			break;
+		sColorBlock block = fitColorBlock(rgba, e0, e1);
+		if (block.error >= best.error)
+			break;
+		best = block;
+	}
+
+	memcpy(dest, &best.c0, 2);
+	memcpy(dest + 2, &best.c1, 2);
+	memcpy(dest + 4, &best.indices, 4);
+}
+
+//BC4 block, also the alpha of BC3 and every channel of BC5
+static void encodeValueBlock(const unsigned char* rgba, int channel, unsigned char* dest)
+{
+	int min_value = 255, max_value = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		min_value = std::min(min_value, (int)rgba[i * 4 + channel]);
+		max_value = std::max(max_value, (int)rgba[i * 4 + channel]);
+	}
+
+	//8 values mode (r0 > r1): the endpoints and 6 values between them
+	int palette[8];
+	palette[0] = max_value;
+	palette[1] = min_value;
+	for (int i = 1; i < 7; ++i)
+		palette[i + 1] = ((7 - i) * max_value + i * min_value) / 7;
+
+	unsigned long long bits = 0;
+	if (max_value != min_value)
+		for (int i = 0; i < 16; ++i)
+		{
+			int value = rgba[i * 4 + channel];
+			int best = 0, best_dist = 256;
+			for (int j = 0; j < 8; ++j)
+			{
+				int dist = abs(value - palette[j]);
+				if (dist < best_dist) { best = j; best_dist = dist; }
+			}
+			bits |= (unsigned long long)best << (i * 3);
+		}
+
+	dest[0] = (unsigned char)max_value;
+	dest[1] = (unsigned char)min_value;
+	for (int i = 0; i < 6; ++i)
+		dest[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+//BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each and indices of 4 bits
+static const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct sBC7Block {
+	int endpoints[2][4]; //7 bits
+	int pbits[2];
+	unsigned char indices[16];
+	int error;
+};
+
+static void fitBC7Block(const unsigned char* rgba, const float* e0, const float* e1, sBC7Block& best)
+{
+	best.error = INT_MAX;
+	for (int p = 0; p < 4; ++p) //every combination of p-bits
+	{
+		sBC7Block block;
+		block.pbits[0] = p & 1;
+		block.pbits[1] = p >> 1;
+		int colors[2][4];
+		for (int c = 0; c < 4; ++c)
+		{
+			block.endpoints[0][c] = std::min(std::max((int)floorf((e0[c] - block.pbits[0]) * 0.5f + 0.5f), 0), 127);
+			block.endpoints[1][c] = std::min(std::max((int)floorf((e1[c] - block.pbits[1]) * 0.5f + 0.5f), 0), 127);
+			colors[0][c] = (block.endpoints[0][c] << 1) | block.pbits[0];
+			colors[1][c] = (block.endpoints[1][c] << 1) | block.pbits[1];
+		}
+
+		int palette[16][4];
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+				palette[i][c] = ((64 - bc7_weights4[i]) * colors[0][c] + bc7_weights4[i] * colors[1][c] + 32) >> 6;
+
+		block.error = 0;
+		for (int i = 0; i < 16 && block.error < best.error; ++i)
+		{
+			int best_index = 0, best_dist = INT_MAX;
+			for (int j = 0; j < 16; ++j)
+			{
+				int dist = colorDistance(rgba + i * 4, palette[j], 4);
+				if (dist < best_dist) { best_index = j; best_dist = dist; }
+			}
+			block.indices[i] = (unsigned char)best_index;
+			block.error += best_dist;
+		}
+		if (block.error < best.error)
+			best = block;
+	}
+}
+
+struct sBitWriter {
+	unsigned char* dest;
+	int pos;
+	void write(unsigned int value, int bits) {
+		for (int i = 0; i < bits; ++i, ++pos)
+			if (value & (1 << i))
+				dest[pos >> 3] |= 1 << (pos & 7);
+	}
+};
+
+struct sBitReader {
+	const unsigned char* src;
+	int pos;
+	unsigned int read(int bits) {
+		unsigned int value = 0;
+		for (int i = 0; i < bits; ++i, ++pos)
+			value |= ((src[pos >> 3] >> (pos & 7)) & 1) << i;
+		return value;
+	}
+};
+
+static void encodeBC7Block(const unsigned char* rgba, unsigned char* dest)
+{
+	float e0[4], e1[4];
+	findEndpoints(rgba, 4, e0, e1);
+	sBC7Block best;
+	fitBC7Block(rgba, e0, e1, best);
+
+	//refine the endpoints with the indices found
+	for (int iteration = 0; iteration < 2 && best.error; ++iteration)
+	{
+		float weights[16];
+		for (int i = 0; i < 16; ++i)
+			weights[i] = bc7_weights4[best.indices[i]] / 64.0f;
+		if (!solveEndpoints(rgba, 4, weights, e0, e1))
+			break;
+		sBC7Block block;
+		fitBC7Block(rgba, e0, e1, block);
+		if (block.error >= best.error)
+			break;
+		best = block;
+	}
+
+	//the msb of the first index is implicit (0), swapping the endpoints ensures it
+	if (best.indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+		std::swap(best.pbits[0], best.pbits[1]);
+		for (int i = 0; i < 16; ++i)
+			best.indices[i] = 15 - best.indices[i];
+	}
+
+	memset(dest, 0, 16);
+	sBitWriter writer = { dest, 0 };
+	writer.write(1 << 6, 7); //mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		writer.write(best.endpoints[0][c], 7);
+		writer.write(best.endpoints[1][c], 7);
+	}
+	writer.write(best.pbits[0], 1);
+	writer.write(best.pbits[1], 1);
+	writer.write(best.indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.write(best.indices[i], 4);
+}
+
+void encodeBlock(eBlockFormat format, const unsigned char* rgba, unsigned char* dest)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: encodeColorBlock(rgba, dest); break;
+	case BLOCK_BC3: encodeValueBlock(rgba, 3, dest); encodeColorBlock(rgba, dest + 8); break;
+	case BLOCK_BC4: encodeValueBlock(rgba, 0, dest); break;
+	case BLOCK_BC5: encodeValueBlock(rgba, 0, dest); encodeValueBlock(rgba, 1, dest + 8); break;
+	case BLOCK_BC7: encodeBC7Block(rgba, dest); break;
+	default: assert(0 && "unknown block format");
+	}
+}
+
+// BLOCK DECODING *******************************
+
+static void decodeColorBlock(const unsigned char* src, unsigned char* rgba, bool allow_three_colors)
+{
+	unsigned short c0, c1;
+	unsigned int indices;
+	memcpy(&c0, src, 2);
+	memcpy(&c1, src + 2, 2);
+	memcpy(&indices, src + 4, 4);
+	int palette[4][4];
+	buildColorPalette(c0, c1, palette, c0 > c1 || !allow_three_colors);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = (indices >> (i * 2)) & 3;
+		for (int c = 0; c < 3; ++c)
+			rgba[i * 4 + c] = (unsigned char)palette[index][c];
+		rgba[i * 4 + 3] = allow_three_colors && c0 <= c1 && index == 3 ? 0 : 255;
+	}
+}
+
+static void decodeValueBlock(const unsigned char* src, unsigned char* rgba, int channel)
+{
+	int palette[8];
+	palette[0] = src[0];
+	palette[1] = src[1];
+	if (palette[0] > palette[1])
+		for (int i = 1; i < 7; ++i)
+			palette[i + 1] = ((7 - i) * palette[0] + i * palette[1]) / 7;
+	else
+	{
+		for (int i = 1; i < 5; ++i)
+			palette[i + 1] = ((5 - i) * palette[0] + i * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; ++i)
+		bits |= (unsigned long long)src[2 + i] << (i * 8);
+	for (int i = 0; i < 16; ++i)
+		rgba[i * 4 + channel] = (unsigned char)palette[(bits >> (i * 3)) & 7];
+}
+
+static void decodeBC7Block(const unsigned char* src, unsigned char* rgba)
+{
+	if ((src[0] & 0x7F) != (1 << 6)) //other modes are not supported
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			rgba[i * 4] = rgba[i * 4 + 2] = rgba[i * 4 + 3] = 255;
+			rgba[i * 4 + 1] = 0;
+		}
+		return;
+	}
+
+	sBitReader reader = { src, 7 };
+	int colors[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		colors[0][c] = reader.read(7) << 1;
+		colors[1][c] = reader.read(7) << 1;
+	}
+	int p0 = reader.read(1), p1 = reader.read(1);
+	for (int c = 0; c < 4; ++c)
+	{
+		colors[0][c] |= p0;
+		colors[1][c] |= p1;
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		int weight = bc7_weights4[reader.read(i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (unsigned char)(((64 - weight) * colors[0][c] + weight * colors[1][c] + 32) >> 6);
+	}
+}
+
+void decodeBlock(eBlockFormat format, const unsigned char* src, unsigned char* rgba)
+{
+	//channels that are not stored are decoded like the GPU does
+	for (int i = 0; i < 16; ++i)
+	{
+		rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+		rgba[i * 4 + 3] = 255;
+	}
+
+	switch (format)
+	{
+	case BLOCK_BC1: decodeColorBlock(src, rgba, true); break;
+	case BLOCK_BC3: decodeColorBlock(src + 8, rgba, false); decodeValueBlock(src, rgba, 3); break;
+	case BLOCK_BC4: decodeValueBlock(src, rgba, 0); break;
+	case BLOCK_BC5: decodeValueBlock(src, rgba, 0); decodeValueBlock(src + 8, rgba, 1); break;
+	case BLOCK_BC7: decodeBC7Block(src, rgba); break;
+	default: assert(0 && "unknown block format");
+	}
+}
+
+// COMPRESSED IMAGE *******************************
+
+size_t CompressedImage::getMipBytes(eBlockFormat format, unsigned int width, unsigned int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(format);
+}
+
+//the pixels of a block, the ones outside the image repeat the border
+static void readBlock(Image& image, int block_x, int block_y, unsigned char* rgba)
+{
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x)
+		{
+			int px = std::min(block_x * 4 + x, (int)image.width - 1);
+			int py = std::min(block_y * 4 + y, (int)image.height - 1);
+			const unsigned char* pixel = image.data + (py * image.width + px) * image.num_channels;
+			unsigned char* dest = rgba + (y * 4 + x) * 4;
+			dest[0] = pixel[0];
+			dest[1] = image.num_channels > 1 ? pixel[1] : pixel[0];
+			dest[2] = image.num_channels > 2 ? pixel[2] : pixel[0];
+			dest[3] = image.num_channels > 3 ? pixel[3] : 255;
+		}
+}
+
+static void encodeImage(Image& image, eBlockFormat format, std::vector<unsigned char>& dest, int num_threads)
+{
+	int blocks_x = (image.width + 3) / 4;
+	int blocks_y = (image.height + 3) / 4;
+	int block_bytes = getBlockBytes(format);
+	dest.resize((size_t)blocks_x * blocks_y * block_bytes);
+
+	auto encodeRows = [&](int start, int end) {
+		unsigned char rgba[64];
+		for (int y = start; y < end; ++y)
+			for (int x = 0; x < blocks_x; ++x)
+			{
+				readBlock(image, x, y, rgba);
+				encodeBlock(format, rgba, &dest[((size_t)y * blocks_x + x) * block_bytes]);
+			}
+	};
+
+	//small mips are not worth a thread
+	num_threads = std::min(num_threads, blocks_y / 4);
+	if (num_threads <= 1)
+	{
+		encodeRows(0, blocks_y);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(encodeRows, blocks_y * i / num_threads, blocks_y * (i + 1) / num_threads));
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+void CompressedImage::compress(Image& image, eBlockFormat format, bool mipmaps, int num_threads, int mip_flags, float alpha_cutoff)
+{
+	assert(image.data && format != BLOCK_NONE);
+	this->format = format;
+	gl_format = 0;
+	width = image.width;
+	height = image.height;
+	mips.clear();
+
+	mips.resize(1);
+	encodeImage(image, format, mips[0], num_threads);
+	if (!mipmaps || (width == 1 && height == 1))
+		return;
+
+	float coverage = (mip_flags & MIP_ALPHA_COVERAGE) ? image.getAlphaCoverage(alpha_cutoff) : 0;
+
+	//every mip is built from the previous one, the two buffers are swapped
+	Image levels[2];
+	Image* source = &image;
+	for (int i = 0; source->width > 1 || source->height > 1; ++i)
+	{
+		Image& mip = levels[i % 2];
+		source->buildMip(mip, mip_flags);
+		if (mip_flags & MIP_ALPHA_COVERAGE)
+			mip.scaleAlphaToCoverage(coverage, alpha_cutoff);
+		mips.resize(mips.size() + 1);
+		encodeImage(mip, format, mips.back(), num_threads);
+		source = &mip;
+	}
+}
+
+void CompressedImage::decompress(Image& image, int mip)
+{
+	assert(mip < (int)mips.size());
+	unsigned int w = getMipWidth(mip), h = getMipHeight(mip);
+	image.resize(w, h, 4);
+	int blocks_x = (w + 3) / 4;
+	int block_bytes = getBlockBytes(format);
+	unsigned char rgba[64];
+	for (unsigned int by = 0; by < (h + 3) / 4; ++by)
+		for (int bx = 0; bx < blocks_x; ++bx)
+		{
+			decodeBlock(format, &mips[mip][((size_t)by * blocks_x + bx) * block_bytes], rgba);
+			for (unsigned int y = 0; y < 4 && by * 4 + y < h; ++y)
+				for (unsigned int x = 0; x < 4 && bx * 4 + x < w; ++x)
+					memcpy(image.data + ((by * 4 + y) * w + bx * 4 + x) * 4, rgba + (y * 4 + x) * 4, 4);
+		}
+}
+
+double CompressedImage::computePSNR(Image& a, Image& b, int num_channels)
+{
+	assert(a.width == b.width && a.height == b.height);
+	double error = 0;
+	size_t num_pixels = (size_t)a.width * a.height;
+	for (size_t i = 0; i < num_pixels; ++i)
+		for (int c = 0; c < num_channels; ++c)
+		{
+			int pa = c < (int)a.num_channels ? a.data[i * a.num_channels + c] : 255;
+			int pb = c < (int)b.num_channels ? b.data[i * b.num_channels + c] : 255;
+			error += (pa - pb) * (pa - pb);
+		}
+	double mse = error / ((double)num_pixels * num_channels);
+	if (mse == 0)
+		return 99.0; //identical
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+bool CompressedImage::load(const char* filename)
+{
+	std::string str = filename;
+	size_t pos = str.find_last_of('.');
+	std::string ext = pos == std::string::npos ? "" : str.substr(pos + 1);
+	if (ext == "dds" || ext == "DDS")
+		return loadDDS(filename);
+	if (ext == "ktx2" || ext == "KTX2")
+		return loadKTX2(filename);
+	return false;
+}
+
+bool CompressedImage::loadForTexture(const char* filename)
+{
+	std::string str = filename;
+	size_t pos = str.find_last_of('.');
+	std::string ext = pos == std::string::npos ? "" : str.substr(pos + 1);
+	if (ext == "dds" || ext == "DDS" || ext == "ktx2" || ext == "KTX2")
+		return load(filename);
+	return Image::use_cooked && isFileUpToDate(str + ".dds", str) && loadDDS((str + ".dds").c_str());
+}
+
+//reads the mips stored one after another
+static bool readMips(FILE* file, CompressedImage& image, int num_mips)
+{
+	image.mips.resize(num_mips);
+	for (int i = 0; i < num_mips; ++i)
+	{
+		image.mips[i].resize(CompressedImage::getMipBytes(image.format, image.getMipWidth(i), image.getMipHeight(i)));
+		if (fread(&image.mips[i][0], 1, image.mips[i].size(), file) != image.mips[i].size())
+			return false;
+	}
+	return true;
+}
+
+bool CompressedImage::loadDDS(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL)
+		return false;
+
+	sDDSHeader header;
+	if (fread(&header, 1, sizeof(header), file) != sizeof(header) || header.magic != DDS_MAGIC || !(header.format.flags & DDPF_FOURCC))
+	{
+		fclose(file);
+		return false;
+	}
+
+	format = BLOCK_NONE;
+	gl_format = 0;
+	switch (header.format.fourCC)
+	{
+	case FOURCC('D', 'X', 'T', '1'): format = BLOCK_BC1; break;
+	case FOURCC('D', 'X', 'T', '5'): format = BLOCK_BC3; break;
+	case FOURCC('A', 'T', 'I', '1'): case FOURCC('B', 'C', '4', 'U'): format = BLOCK_BC4; break;
+	case FOURCC('A', 'T', 'I', '2'): case FOURCC('B', 'C', '5', 'U'): format = BLOCK_BC5; break;
+	case FOURCC('D', 'X', '1', '0'):
+		{
+			sDDSHeaderDX10 header10;
+			if (fread(&header10, 1, sizeof(header10), file) != sizeof(header10) || header10.array_size > 1)
+				break;
+			switch (header10.dxgi_format)
+			{
+			case DXGI_BC1_UNORM: case DXGI_BC1_UNORM_SRGB: format = BLOCK_BC1; break;
+			case DXGI_BC3_UNORM: case DXGI_BC3_UNORM_SRGB: format = BLOCK_BC3; break;
+			case DXGI_BC4_UNORM: format = BLOCK_BC4; break;
+			case DXGI_BC5_UNORM: format = BLOCK_BC5; break;
+			case DXGI_BC7_UNORM: case DXGI_BC7_UNORM_SRGB: format = BLOCK_BC7; break;
+			}
+		}
+		break;
+	}
+	if (format == BLOCK_NONE || !header.width || !header.height)
+	{
+		fclose(file);
+		return false;
+	}
+
+	width = header.width;
+	height = header.height;
+	int num_mips = (header.flags & DDSD_MIPMAPCOUNT) && header.mipmaps ? header.mipmaps : 1;
+	bool ok = readMips(file, *this, num_mips);
+	fclose(file);
+	if (!ok)
+	{
+		std::cout << "[ERROR] truncated DDS: " << filename << std::endl;
+		mips.clear();
+	}
+	return ok;
+}
+
+bool CompressedImage::saveDDS(const char* filename)
+{
+	assert(format != BLOCK_NONE && mips.size());
+	sDDSHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = DDS_MAGIC;
+	header.size = sizeof(sDDSHeader) - 4;
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+	header.width = width;
+	header.height = height;
+	header.pitch = (unsigned int)mips[0].size(); //linear size
+	header.mipmaps = (unsigned int)mips.size();
+	header.format.size = sizeof(sDDSPixelFormat);
+	header.format.flags = DDPF_FOURCC;
+	header.caps[0] = DDSCAPS_TEXTURE | (mips.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	sDDSHeaderDX10 header10;
+	memset(&header10, 0, sizeof(header10));
+	switch (format)
+	{
+	case BLOCK_BC1: header.format.fourCC = FOURCC('D', 'X', 'T', '1'); break;
+	case BLOCK_BC3: header.format.fourCC = FOURCC('D', 'X', 'T', '5'); break;
+	case BLOCK_BC4: header.format.fourCC = FOURCC('A', 'T', 'I', '1'); break;
+	case BLOCK_BC5: header.format.fourCC = FOURCC('A', 'T', 'I', '2'); break;
+	case BLOCK_BC7: //only in the DX10 header
+		header.format.fourCC = FOURCC('D', 'X', '1', '0');
+		header10.dxgi_format = DXGI_BC7_UNORM;
+		header10.resource_dimension = 3; //texture 2D
+		header10.array_size = 1;
+		break;
+	default: return false;
+	}
+
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+	if (format == BLOCK_BC7)
+		ok = ok && fwrite(&header10, 1, sizeof(header10), file) == sizeof(header10);
+	for (size_t i = 0; i < mips.size() && ok; ++i)
+		ok = fwrite(&mips[i][0], 1, mips[i].size(), file) == mips[i].size();
+	fclose(file);
+	return ok;
+}
+
+//VkFormat values used by KTX2
+#define VK_FORMAT_BC1_RGB_UNORM_BLOCK 131
+#define VK_FORMAT_BC1_RGB_SRGB_BLOCK 132
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133
+#define VK_FORMAT_BC1_RGBA_SRGB_BLOCK 134
+#define VK_FORMAT_BC3_UNORM_BLOCK 137
+#define VK_FORMAT_BC3_SRGB_BLOCK 138
+#define VK_FORMAT_BC4_UNORM_BLOCK 139
+#define VK_FORMAT_BC5_UNORM_BLOCK 141
+#define VK_FORMAT_BC7_UNORM_BLOCK 145
+#define VK_FORMAT_BC7_SRGB_BLOCK 146
+
+struct sKTX2Header {
+	unsigned char identifier[12];
+	unsigned int vk_format;
+	unsigned int type_size;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int layers;
+	unsigned int faces;
+	unsigned int levels;
+	unsigned int supercompression;
+	unsigned int dfd_offset;
+	unsigned int dfd_bytes;
+	unsigned int kvd_offset;
+	unsigned int kvd_bytes;
+	unsigned long long sgd_offset;
+	unsigned long long sgd_bytes;
+};
+
+struct sKTX2Level {
+	unsigned long long offset;
+	unsigned long long bytes;
+	unsigned long long uncompressed_bytes;
+};
+
+bool CompressedImage::loadKTX2(const char* filename)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL)
+		return false;
+
+	sKTX2Header header;
+	if (fread(&header, 1, sizeof(header), file) != sizeof(header) || memcmp(header.identifier, identifier, 12) != 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	format = BLOCK_NONE;
+	gl_format = 0;
+	if (header.vk_format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && header.vk_format <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK)
+	{
+		//same blocks, the alpha ones use the transparent color of the three colors mode
+		format = BLOCK_BC1;
+		if (header.vk_format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+			gl_format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+		else if (header.vk_format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK)
+			gl_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		else if (header.vk_format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK)
+			gl_format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+	}
+	else if (header.vk_format == VK_FORMAT_BC3_UNORM_BLOCK || header.vk_format == VK_FORMAT_BC3_SRGB_BLOCK)
+		format = BLOCK_BC3;
+	else if (header.vk_format == VK_FORMAT_BC4_UNORM_BLOCK)
+		format = BLOCK_BC4;
+	else if (header.vk_format == VK_FORMAT_BC5_UNORM_BLOCK)
+		format = BLOCK_BC5;
+	else if (header.vk_format == VK_FORMAT_BC7_UNORM_BLOCK || header.vk_format == VK_FORMAT_BC7_SRGB_BLOCK)
+		format = BLOCK_BC7;
+
+	if (format == BLOCK_NONE || header.supercompression != 0 || header.faces != 1 || header.layers > 1 || header.depth > 1 || !header.width || !header.height)
+	{
+		std::cout << "[ERROR] KTX2 not supported (only 2D BC1/3/4/5/7 without supercompression): " << filename << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	width = header.width;
+	height = header.height;
+	int num_mips = header.levels ? header.levels : 1;
+	std::vector<sKTX2Level> levels(num_mips);
+	bool ok = fread(&levels[0], sizeof(sKTX2Level), num_mips, file) == (size_t)num_mips;
+
+	//the levels are not always stored in order, every one has its offset
+	mips.resize(num_mips);
+	for (int i = 0; i < num_mips && ok; ++i)
+	{
+		size_t bytes = getMipBytes(format, getMipWidth(i), getMipHeight(i));
+		ok = levels[i].bytes == bytes && fseek(file, (long)levels[i].offset, SEEK_SET) == 0;
+		if (!ok)
+			break;
+		mips[i].resize(bytes);
+		ok = fread(&mips[i][0], 1, bytes, file) == bytes;
+	}
+	fclose(file);
+	if (!ok)
+	{
+		std::cout << "[ERROR] wrong KTX2 levels: " << filename << std::endl;
+		mips.clear();
+	}
+	return ok;
+}
@@ -0,0 +1,107 @@
+/*  block compressed images (BC1/BC3/BC4/BC5/BC7)
+	The cook tool encodes the textures with CompressedImage::compress and saves them as DDS,
+	the runtime loads DDS or KTX2 files and uploads the precompressed mips as they are.
+*/
+#pragma once
+
+#include <vector>
+#include <string>
+
+class Image;
+
+enum eBlockFormat {
+	BLOCK_NONE,
+	BLOCK_BC1, //RGB, 4 bits per pixel
+	BLOCK_BC3, //RGBA, 8 bits per pixel
+	BLOCK_BC4, //one channel, 4 bits per pixel
+	BLOCK_BC5, //two channels (normal maps), 8 bits per pixel
+	BLOCK_BC7 //RGBA, 8 bits per pixel, better quality than BC1/BC3
+};
+
+int getBlockBytes(eBlockFormat format); //bytes of every 4x4 block
+int getBlockChannels(eBlockFormat format); //channels that store information
+const char* getBlockFormatName(eBlockFormat format);
+unsigned int getBlockFormatGL(eBlockFormat format); //GL internal format for glCompressedTexImage2D
+
+//rgba: the 16 pixels of the block in rows, 4 bytes per pixel
+void encodeBlock(eBlockFormat format, const unsigned char* rgba, unsigned char* dest);
+void decodeBlock(eBlockFormat format, const unsigned char* src, unsigned char* rgba); //BC7 only decodes mode 6 (the one the encoder uses)
+
+class CompressedImage
+{
+public:
+	eBlockFormat format;
+	unsigned int gl_format; //0: the one of the block format, some KTX2 files ask for a variant (BC1 with alpha or sRGB)
+	unsigned int width; //of the first mip
+	unsigned int height;
+	std::vector< std::vector<unsigned char> > mips; //blocks of every mip, the first one is the biggest
+
+	CompressedImage() { format = BLOCK_NONE; gl_format = 0; width = height = 0; }
+
+	unsigned int getGLFormat() { return gl_format ? gl_format : getBlockFormatGL(format); }
+
+	unsigned int getMipWidth(int mip) { return (width >> mip) ? (width >> mip) : 1; }
+	unsigned int getMipHeight(int mip) { return (height >> mip) ? (height >> mip) : 1; }
+	static size_t getMipBytes(eBlockFormat format, unsigned int width, unsigned int height);
+
+	//encodes the image and the mips built from it with Image::buildMip (mip_flags are eMipFlags), the rows of blocks are split between the threads
+	void compress(Image& image, eBlockFormat format, bool mipmaps = true, int num_threads = 1, int mip_flags = 0, float alpha_cutoff = 0.5f);
+	void decompress(Image& image, int mip = 0); //to RGBA
+
+	bool load(const char* filename); //DDS or KTX2 by the extension
+	bool loadForTexture(const char* filename); //the file if it is a DDS/KTX2 with blocks, otherwise the cooked DDS next to it (when Image::use_cooked)
+	bool loadDDS(const char* filename); //false if it doesn't contain blocks
+	bool loadKTX2(const char* filename); //without supercompression
+	bool saveDDS(const char* filename);
+
+	//peak signal to noise ratio in dB of the first channels of two RGBA images of the same size
+	static double computePSNR(Image& a, Image& b, int num_channels);
+};
+
+//DDS container, shared with the uncompressed files of Image
+#define DDS_MAGIC 0x20534444 //"DDS "
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PITCH 0x8
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_ALPHAPIXELS 0x1
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+
+struct sDDSPixelFormat {
+	unsigned int size;
+	unsigned int flags;
+	unsigned int fourCC;
+	unsigned int bitcount;
+	unsigned int masks[4]; //r,g,b,a
+};
+
+struct sDDSHeader {
+	unsigned int magic;
+	unsigned int size;
+	unsigned int flags;
+	unsigned int height;
+	unsigned int width;
+	unsigned int pitch;
+	unsigned int depth;
+	unsigned int mipmaps;
+	unsigned int reserved[11];
+	sDDSPixelFormat format;
+	unsigned int caps[4];
+	unsigned int reserved2;
+};
+
+//after the header when fourCC is "DX10"
+struct sDDSHeaderDX10 {
+	unsigned int dxgi_format;
+	unsigned int resource_dimension;
+	unsigned int misc_flag;
+	unsigned int array_size;
+	unsigned int misc_flags2;
+};
@@ -12,6 +12,146 @@
 
 #define M_PI_2 1.57079632679489661923
 
+//SIMD for the matrix math, define NO_SIMD to use the scalar code
+#if !defined(NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+	#define MATH_SSE
+	#include <xmmintrin.h>
+#elif !defined(NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	#define MATH_NEON
+	#include <arm_neon.h>
+#endif
+
+#if defined(MATH_SSE) || defined(MATH_NEON)
+#define MATH_SIMD
+
+//the few operations the matrix code needs, so every function is written once for both instruction sets
+//the rows of Matrix44 are not aligned (it lives inside other classes), so loads and stores are unaligned
+#ifdef MATH_SSE
+typedef __m128 simd4;
+static inline simd4 simdLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void simdStore(float* p, simd4 v) { _mm_storeu_ps(p, v); }
+static inline simd4 simdSet(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+static inline simd4 simdSplat(float f) { return _mm_set1_ps(f); }
+static inline simd4 simdAdd(simd4 a, simd4 b) { return _mm_add_ps(a, b); }
+static inline simd4 simdSub(simd4 a, simd4 b) { return _mm_sub_ps(a, b); }
+static inline simd4 simdMul(simd4 a, simd4 b) { return _mm_mul_ps(a, b); }
+static inline simd4 simdAbs(simd4 v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+static inline float simdFirst(simd4 v) { return _mm_cvtss_f32(v); }
+//lanes x,y from a and z,w from b
+template<int x, int y, int z, int w> static inline simd4 simdShuffle(simd4 a, simd4 b) { return _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x)); }
+static inline void simdTranspose(simd4& r0, simd4& r1, simd4& r2, simd4& r3) { _MM_TRANSPOSE4_PS(r0, r1, r2, r3); }
+#else
+typedef float32x4_t simd4;
+static inline simd4 simdLoad(const float* p) { return vld1q_f32(p); }
+static inline void simdStore(float* p, simd4 v) { vst1q_f32(p, v); }
+static inline simd4 simdSet(float x, float y, float z, float w) { float v[4] = { x, y, z, w }; return vld1q_f32(v); }
+static inline simd4 simdSplat(float f) { return vdupq_n_f32(f); }
+static inline simd4 simdAdd(simd4 a, simd4 b) { return vaddq_f32(a, b); }
+static inline simd4 simdSub(simd4 a, simd4 b) { return vsubq_f32(a, b); }
+static inline simd4 simdMul(simd4 a, simd4 b) { return vmulq_f32(a, b); } //not vmla, it would round differently than the scalar code
+static inline simd4 simdAbs(simd4 v) { return vabsq_f32(v); }
+static inline float simdFirst(simd4 v) { return vgetq_lane_f32(v, 0); }
+template<int x, int y, int z, int w> static inline simd4 simdShuffle(simd4 a, simd4 b)
+{
+	simd4 r = vdupq_n_f32(vgetq_lane_f32(a, x));
+	r = vsetq_lane_f32(vgetq_lane_f32(a, y), r, 1);
+	r = vsetq_lane_f32(vgetq_lane_f32(b, z), r, 2);
+	return vsetq_lane_f32(vgetq_lane_f32(b, w), r, 3);
+}
+static inline void simdTranspose(simd4& r0, simd4& r1, simd4& r2, simd4& r3)
+{
+	float32x4x2_t t01 = vtrnq_f32(r0, r1);
+	float32x4x2_t t23 = vtrnq_f32(r2, r3);
+	r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+#endif
+
+template<int x, int y, int z, int w> static inline simd4 simdSwizzle(simd4 v) { return simdShuffle<x, y, z, w>(v, v); }
+
+//a*x + b*y + c*z + d, in the same order as the scalar code so the results match
+static inline simd4 simdCombine(simd4 a, simd4 b, simd4 c, simd4 d, float x, float y, float z)
+{
+	simd4 r = simdMul(a, simdSplat(x));
+	r = simdAdd(r, simdMul(b, simdSplat(y)));
+	r = simdAdd(r, simdMul(c, simdSplat(z)));
+	return simdAdd(r, d);
+}
+
+static inline simd4 simdCross(simd4 a, simd4 b)
+{
+	return simdSub(simdMul(simdSwizzle<1, 2, 0, 3>(a), simdSwizzle<2, 0, 1, 3>(b)), simdMul(simdSwizzle<2, 0, 1, 3>(a), simdSwizzle<1, 2, 0, 3>(b)));
+}
+
+//2x2 matrices stored in a register as (_11,_12,_21,_22)
+static inline simd4 mat2Mul(simd4 a, simd4 b) //a*b
+{
+	return simdAdd(simdMul(a, simdSwizzle<0, 3, 0, 3>(b)), simdMul(simdSwizzle<1, 0, 3, 2>(a), simdSwizzle<2, 1, 2, 1>(b)));
+}
+
+static inline simd4 mat2AdjMul(simd4 a, simd4 b) //adjugate(a)*b
+{
+	return simdSub(simdMul(simdSwizzle<3, 3, 0, 0>(a), b), simdMul(simdSwizzle<1, 1, 2, 2>(a), simdSwizzle<2, 3, 0, 1>(b)));
+}
+
+static inline simd4 mat2MulAdj(simd4 a, simd4 b) //a*adjugate(b)
+{
+	return simdSub(simdMul(a, simdSwizzle<3, 0, 3, 0>(b)), simdMul(simdSwizzle<1, 0, 3, 2>(a), simdSwizzle<2, 1, 2, 1>(b)));
+}
+#endif
+
+uint16 floatToHalf(float v)
+{
+	uint32 f;
+	memcpy(&f, &v, sizeof(f));
+	uint32 sign = (f >> 16) & 0x8000;
+	f &= 0x7FFFFFFF;
+
+	if (f >= 0x7F800000) //inf or nan
+		return sign | 0x7C00 | (f > 0x7F800000 ? 0x200 : 0);
+	if (f >= 0x477FF000) //too big, rounds to inf
+		return sign | 0x7C00;
+	if (f < 0x38800000) //denormal, adding 0.5 leaves the half mantissa in the low bits rounded to nearest even
+	{
+		float a;
+		memcpy(&a, &f, sizeof(a));
+		a += 0.5f;
+		memcpy(&f, &a, sizeof(f));
+		return sign | (f - 0x3F000000);
+	}
+
+	//rebias the exponent and round the mantissa to nearest even
+	uint32 h = (f - 0x38000000) >> 13;
+	uint32 rest = f & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;
+	return sign | h;
+}
+
+float halfToFloat(uint16 h)
+{
+	uint32 sign = (uint32)(h & 0x8000) << 16;
+	uint32 exponent = (h >> 10) & 0x1F;
+	uint32 mantissa = h & 0x3FF;
+	uint32 f;
+
+	if (exponent == 0) //zero or denormal
+	{
+		float v = mantissa / 16777216.0f;
+		return sign ? -v : v;
+	}
+	if (exponent == 31)
+		f = sign | 0x7F800000 | (mantissa << 13);
+	else
+		f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float v;
+	memcpy(&v, &f, sizeof(v));
+	return v;
+}
+
 //**************************************
 float Vector2::distance(const Vector2& v)
 {
@@ -227,8 +367,14 @@ void Matrix44::setIdentity()
 
 void Matrix44::transpose()
 {
+#ifdef MATH_SIMD
+	simd4 r0 = simdLoad(m), r1 = simdLoad(m + 4), r2 = simdLoad(m + 8), r3 = simdLoad(m + 12);
+	simdTranspose(r0, r1, r2, r3);
+	simdStore(m, r0); simdStore(m + 4, r1); simdStore(m + 8, r2); simdStore(m + 12, r3);
+#else
    std::swap(m[1],m[4]); std::swap(m[2],m[8]); std::swap(m[3],m[12]);
    std::swap(m[6],m[9]); std::swap(m[7],m[13]); std::swap(m[11],m[14]);
+#endif
 }
 
 Vector3 Matrix44::rotateVector(const Vector3& v) const
@@ -441,6 +587,19 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
 
+#ifdef MATH_SIMD
+	//every row of the result is a combination of the rows of the other matrix
+	simd4 b0 = simdLoad(matrix.m), b1 = simdLoad(matrix.m + 4), b2 = simdLoad(matrix.m + 8), b3 = simdLoad(matrix.m + 12);
+	for (int i = 0; i < 4; ++i)
+	{
+		const float* a = M[i];
+		simd4 r = simdMul(simdSplat(a[0]), b0);
+		r = simdAdd(r, simdMul(simdSplat(a[1]), b1));
+		r = simdAdd(r, simdMul(simdSplat(a[2]), b2));
+		r = simdAdd(r, simdMul(simdSplat(a[3]), b3));
+		simdStore(ret.M[i], r);
+	}
+#else
 	unsigned int i,j,k;
 	for (i=0;i<4;i++) 	
 	{
@@ -451,6 +610,7 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 				ret.M[i][j] += M[i][k] * matrix.M[k][j];
 		}
 	}
+#endif
 
 	return ret;
 }
@@ -458,20 +618,33 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 //Multiplies a vector by a matrix and returns the new vector
 Vector3 operator * (const Matrix44& matrix, const Vector3& v) 
 {   
+#ifdef MATH_SIMD
+	float r[4];
+	simdStore(r, simdCombine(simdLoad(matrix.m), simdLoad(matrix.m + 4), simdLoad(matrix.m + 8), simdLoad(matrix.m + 12), v.x, v.y, v.z));
+	return Vector3(r[0], r[1], r[2]);
+#else
    float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12]; 
    float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13]; 
    float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14];
    return Vector3(x,y,z);
+#endif
 }
 
 //Multiplies a vector by a matrix and returns the new vector
 Vector4 operator * (const Matrix44& matrix, const Vector4& v)
 {
+#ifdef MATH_SIMD
+	Vector4 r;
+	simd4 row3 = simdMul(simdSplat(v.w), simdLoad(matrix.m + 12));
+	simdStore(r.v, simdCombine(simdLoad(matrix.m), simdLoad(matrix.m + 4), simdLoad(matrix.m + 8), row3, v.x, v.y, v.z));
+	return r;
+#else
 	float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + v.w * matrix.m[12];
 	float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + v.w * matrix.m[13];
 	float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + v.w * matrix.m[14];
 	float w = matrix.m[3] * v.x + matrix.m[7] * v.y + matrix.m[11] * v.z + v.w * matrix.m[15];
 	return Vector4(x, y, z, w);
+#endif
 }
 
 void Matrix44::setUpAndOrthonormalize(Vector3 up)
@@ -547,8 +720,86 @@ void Matrix44::setFrontAndOrthonormalize(Vector3 front)
 	
 }
 
+//the largest determinant the rows could give (the product of their lengths), rows that are only independent because
+//of the rounding give a tiny fraction of it, this rejects them like the pivot threshold of the scalar inverse
+static bool isAlmostSingular(float det, const float* lengths2, int size)
+{
+	double max_det2 = 1.0; //squared, in doubles so it does not overflow
+	for (int i = 0; i < size; ++i)
+		max_det2 *= lengths2[i];
+	return !((double)det * det > max_det2 * 1e-10); //also for NaN
+}
+
+#ifdef MATH_SIMD
+//squared length of every row
+static inline void simdRowLengths2(simd4 r0, simd4 r1, simd4 r2, simd4 r3, float* lengths2)
+{
+	r0 = simdMul(r0, r0);
+	r1 = simdMul(r1, r1);
+	r2 = simdMul(r2, r2);
+	r3 = simdMul(r3, r3);
+	simdTranspose(r0, r1, r2, r3);
+	simdStore(lengths2, simdAdd(simdAdd(r0, r1), simdAdd(r2, r3)));
+}
+#endif
+
 bool Matrix44::inverse()
 {
+	//model and view matrices have a cheaper inverse
+	if (m[3] == 0.0f && m[7] == 0.0f && m[11] == 0.0f && m[15] == 1.0f)
+		return inverseAffine();
+
+#ifdef MATH_SIMD
+	//by blocks: M = |A B| with 2x2 matrices, the inverse is built from their adjugates and determinants
+	//               |C D|
+	simd4 r0 = simdLoad(m), r1 = simdLoad(m + 4), r2 = simdLoad(m + 8), r3 = simdLoad(m + 12);
+	simd4 A = simdShuffle<0, 1, 0, 1>(r0, r1);
+	simd4 B = simdShuffle<2, 3, 2, 3>(r0, r1);
+	simd4 C = simdShuffle<0, 1, 0, 1>(r2, r3);
+	simd4 D = simdShuffle<2, 3, 2, 3>(r2, r3);
+
+	//determinants of A, B, C and D in one go
+	simd4 det_sub = simdSub(simdMul(simdShuffle<0, 2, 0, 2>(r0, r2), simdShuffle<1, 3, 1, 3>(r1, r3)), simdMul(simdShuffle<1, 3, 1, 3>(r0, r2), simdShuffle<0, 2, 0, 2>(r1, r3)));
+	simd4 det_A = simdSwizzle<0, 0, 0, 0>(det_sub);
+	simd4 det_B = simdSwizzle<1, 1, 1, 1>(det_sub);
+	simd4 det_C = simdSwizzle<2, 2, 2, 2>(det_sub);
+	simd4 det_D = simdSwizzle<3, 3, 3, 3>(det_sub);
+
+	simd4 D_C = mat2AdjMul(D, C);
+	simd4 A_B = mat2AdjMul(A, B);
+	simd4 X = simdSub(simdMul(det_D, A), mat2Mul(B, D_C));
+	simd4 W = simdSub(simdMul(det_A, D), mat2Mul(C, A_B));
+	simd4 Y = simdSub(simdMul(det_B, C), mat2MulAdj(D, A_B));
+	simd4 Z = simdSub(simdMul(det_C, B), mat2MulAdj(A, D_C));
+
+	//|M| = |A|*|D| + |B|*|C| - trace(A#B * D#C)
+	simd4 tr = simdMul(A_B, simdSwizzle<0, 2, 1, 3>(D_C));
+	tr = simdAdd(tr, simdSwizzle<2, 3, 0, 1>(tr));
+	tr = simdAdd(tr, simdSwizzle<1, 0, 3, 2>(tr));
+	simd4 det = simdSub(simdAdd(simdMul(det_A, det_D), simdMul(det_B, det_C)), tr);
+
+	//singular, leave it as it is like the scalar version
+	float lengths2[4];
+	simdRowLengths2(r0, r1, r2, r3, lengths2);
+	if (isAlmostSingular(simdFirst(det), lengths2, 4))
+		return false;
+	float inv_det = 1.0f / simdFirst(det);
+	if (!std::isfinite(inv_det))
+		return false;
+
+	simd4 scale = simdMul(simdSet(1.0f, -1.0f, -1.0f, 1.0f), simdSplat(inv_det));
+	X = simdMul(X, scale);
+	Y = simdMul(Y, scale);
+	Z = simdMul(Z, scale);
+	W = simdMul(W, scale);
+
+	//the adjugate of every block is applied while storing
+	simdStore(m, simdShuffle<3, 1, 3, 1>(X, Y));
+	simdStore(m + 4, simdShuffle<2, 0, 2, 0>(X, Y));
+	simdStore(m + 8, simdShuffle<3, 1, 3, 1>(Z, W));
+	simdStore(m + 12, simdShuffle<2, 0, 2, 0>(Z, W));
+	return true;
+#else
    unsigned int i, j, k, swap;
    float t;
    Matrix44 temp, final;
@@ -618,6 +869,71 @@ bool Matrix44::inverse()
    *this = final;
 
    return true;
+#endif
+}
+
+//only for matrices without projection (last column 0,0,0,1), the 3x3 part can have scale or shear
+bool Matrix44::inverseAffine()
+{
+#ifdef MATH_SIMD
+	simd4 r0 = simdLoad(m), r1 = simdLoad(m + 4), r2 = simdLoad(m + 8), r3 = simdLoad(m + 12);
+
+	//the inverse of the 3x3 has the cross products of the axis as columns
+	simd4 c0 = simdCross(r1, r2);
+	simd4 c1 = simdCross(r2, r0);
+	simd4 c2 = simdCross(r0, r1);
+	float d[4];
+	simdStore(d, simdMul(r0, c0));
+	float det = d[0] + d[1] + d[2];
+	float lengths2[4];
+	simdRowLengths2(r0, r1, r2, simdSplat(0.0f), lengths2);
+#else
+	float c0[3] = { m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8] };
+	float det = m[0] * c0[0] + m[1] * c0[1] + m[2] * c0[2];
+	float lengths2[3];
+	for (int i = 0; i < 3; ++i)
+		lengths2[i] = M[i][0] * M[i][0] + M[i][1] * M[i][1] + M[i][2] * M[i][2];
+#endif
+
+	//singular, leave it as it is like the general inverse
+	if (isAlmostSingular(det, lengths2, 3))
+		return false;
+	float inv_det = 1.0f / det;
+	if (!std::isfinite(inv_det))
+		return false;
+
+#ifdef MATH_SIMD
+	simd4 scale = simdSplat(inv_det);
+	c0 = simdMul(c0, scale);
+	c1 = simdMul(c1, scale);
+	c2 = simdMul(c2, scale);
+	simd4 zero = simdSplat(0.0f);
+	simdTranspose(c0, c1, c2, zero);
+
+	//the translation goes back through the inverted axis, the w lanes are 0 so the last one ends as 1
+	float t[4];
+	simdStore(t, r3);
+	simd4 translation = simdSub(simdSet(0.0f, 0.0f, 0.0f, 1.0f), simdCombine(c0, c1, c2, simdSplat(0.0f), t[0], t[1], t[2]));
+	simdStore(m, c0);
+	simdStore(m + 4, c1);
+	simdStore(m + 8, c2);
+	simdStore(m + 12, translation);
+#else
+	Matrix44 inv;
+	inv.m[0] = c0[0] * inv_det;
+	inv.m[4] = c0[1] * inv_det;
+	inv.m[8] = c0[2] * inv_det;
+	inv.m[1] = (m[9] * m[2] - m[10] * m[1]) * inv_det;
+	inv.m[5] = (m[10] * m[0] - m[8] * m[2]) * inv_det;
+	inv.m[9] = (m[8] * m[1] - m[9] * m[0]) * inv_det;
+	inv.m[2] = (m[1] * m[6] - m[2] * m[5]) * inv_det;
+	inv.m[6] = (m[2] * m[4] - m[0] * m[6]) * inv_det;
+	inv.m[10] = (m[0] * m[5] - m[1] * m[4]) * inv_det;
+	for (int i = 0; i < 3; ++i)
+		inv.m[12 + i] = -(inv.m[i] * m[12] + inv.m[4 + i] * m[13] + inv.m[8 + i] * m[14]);
+	*this = inv;
+#endif
+	return true;
 }
 
 #ifdef FIXEDPIPELINE
@@ -1306,25 +1622,22 @@ float signedDistanceToPlane( const Vector4& plane, const Vector3& point )
 	return dot(plane.xyz(), point) + plane.w;
 }
 
-const Vector3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
-
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
+//same box as transforming the 8 corners: the center is transformed and every axis adds its absolute extent
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box)
 {
-	Vector3 box_min(10000000.0f,1000000.0f, 1000000.0f);
-	Vector3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
-
-	for (int i = 0; i < 8; ++i)
-	{
-		Vector3 corner = corners[i];
-		corner = box.halfsize * corner;
-		corner = corner + box.center;
-		corner = m * corner;
-		box_min.setMin(corner);
-		box_max.setMax(corner);
-	}
-
-	Vector3 halfsize = (box_max - box_min) * 0.5;
-	return BoundingBox(box_max - halfsize, halfsize );
+#ifdef MATH_SIMD
+	simd4 r0 = simdLoad(m.m), r1 = simdLoad(m.m + 4), r2 = simdLoad(m.m + 8);
+	float center[4], halfsize[4];
+	simdStore(center, simdCombine(r0, r1, r2, simdLoad(m.m + 12), box.center.x, box.center.y, box.center.z));
+	simdStore(halfsize, simdCombine(simdAbs(r0), simdAbs(r1), simdAbs(r2), simdSplat(0.0f), box.halfsize.x, box.halfsize.y, box.halfsize.z));
+	return BoundingBox(Vector3(center[0], center[1], center[2]), Vector3(halfsize[0], halfsize[1], halfsize[2]));
+#else
+	Vector3 center = m * box.center;
+	Vector3 halfsize;
+	for (int i = 0; i < 3; ++i)
+		halfsize.v[i] = fabsf(m.m[i]) * box.halfsize.x + fabsf(m.m[4 + i]) * box.halfsize.y + fabsf(m.m[8 + i]) * box.halfsize.z;
+	return BoundingBox(center, halfsize);
+#endif
 }
 
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
@@ -25,6 +25,10 @@ typedef unsigned int uint32;
 inline float clamp(float v, float a, float b) { return v < a ? a : (v > b ? b : v); }
 inline float lerp(float a, float b, float v ) { return a*(1.0f-v) + b*v; }
 
+//half float conversion, used by compressed vertex and image formats
+uint16 floatToHalf(float v);
+float halfToFloat(uint16 h);
+
 enum {
 	CLIP_OUTSIDE = 0,
 	CLIP_OVERLAP,
@@ -229,6 +233,7 @@ class Matrix44
 		Vector3 frontVector() { return Vector3(m[8],m[9],m[10]); }
 
 		bool inverse();
+		bool inverseAffine(); //faster, only when the last column is 0,0,0,1
 		void setUpAndOrthonormalize(Vector3 up);
 		void setFrontAndOrthonormalize(Vector3 front);
 
@@ -372,7 +377,7 @@ public:
 
 //applies a transform to a AABB from object to world
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b);
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box);
 
 float signedDistanceToPlane(const Vector4& plane, const Vector3& point);
 int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3& halfsize );
@@ -10,11 +10,27 @@
 #include "material.h"
 #include "prefab.h"
 #include "utils.h"
+#include "mesh_optimizer.h"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 
 //** PARSING GLTF IS UGLY
 std::string base_folder;
+std::string gltf_filename; //used to find the cooked meshes
+cgltf_data* gltf_data = NULL;
+sGLTFLoadState* gltf_load_state = NULL; //meshes and images built in worker threads (see Prefab::Preload)
+
+//keeps the data of the glTF alive while its embedded images are decoded in the background
+struct sGLTFDataRef {
+	cgltf_data* data;
+	std::atomic<int> refs;
+	sGLTFDataRef(cgltf_data* data) { this->data = data; refs = 1; }
+	void addRef() { refs++; }
+	void release() { if (--refs == 0) { cgltf_free(data); delete this; } }
+};
+sGLTFDataRef* gltf_data_ref = NULL;
 
 #ifdef _DEBUG2
 	bool load_textures = false; //must textures be loadead?
@@ -22,134 +38,246 @@ std::string base_folder;
 	bool load_textures = true; //must textures be loadead?
 #endif
 
-void parseGLTFBufferVector3(std::vector<Vector3>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+//cgltf reads non-normalized signed integers as unsigned, KHR_mesh_quantization positions use them
+inline float readGLTFComponent(const unsigned char* data, cgltf_component_type type, bool normalized)
 {
-	int i = 0;
+	switch (type)
+	{
+	case cgltf_component_type_r_32f: return *(const float*)data;
+	case cgltf_component_type_r_8: return normalized ? std::max(*(const signed char*)data / 127.0f, -1.0f) : (float)*(const signed char*)data;
+	case cgltf_component_type_r_8u: return normalized ? *data / 255.0f : (float)*data;
+	case cgltf_component_type_r_16: return normalized ? std::max(*(const short*)data / 32767.0f, -1.0f) : (float)*(const short*)data;
+	case cgltf_component_type_r_16u: return normalized ? *(const unsigned short*)data / 65535.0f : (float)*(const unsigned short*)data;
+	case cgltf_component_type_r_32u: return (float)*(const unsigned int*)data;
+	default: return 0.0f;
+	}
+}
 
-	assert(acc->buffer_view->buffer->data);
-	unsigned char* data = (unsigned char*)(acc->buffer_view->buffer->data) + acc->buffer_view->offset + acc->offset;
-	if (acc->normalized)
+inline unsigned int readGLTFIndex(const unsigned char* data, cgltf_component_type type)
+{
+	switch (type)
 	{
-		//denormalize
-		assert(!"TO DO");
-	}
-	int num_elements = acc->count;
-	std::vector<Vector3> unindexed;
-	unindexed.resize(num_elements);
-	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec3);
-	if (acc->stride == sizeof(Vector3))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector3));
+	case cgltf_component_type_r_8u: return *data;
+	case cgltf_component_type_r_16u: return *(const unsigned short*)data;
+	case cgltf_component_type_r_32u: return *(const unsigned int*)data;
+	default: return 0;
+	}
+}
+
+//decodes count elements, missing components are 1 (RGB colors in a RGBA stream)
+void readGLTFElements(float* dest, int num_components, const unsigned char* data, int count, int stride, cgltf_accessor* acc)
+{
+	int acc_components = (int)cgltf_num_components(acc->type);
+	int component_size = (int)cgltf_calc_size(cgltf_type_scalar, acc->component_type);
+	for (int i = 0; i < count; ++i, data += stride, dest += num_components)
+		for (int j = 0; j < num_components; ++j)
+			dest[j] = j < acc_components ? readGLTFComponent(data + j * component_size, acc->component_type, acc->normalized) : 1.0f;
+}
+
+//reads the accessor straight into the mesh stream (no intermediate arrays, indices are kept)
+//tightly packed floats are a single memcpy, KHR_mesh_quantization and normalized integers are decoded while copying
+template<typename T> void parseGLTFBuffer(std::vector<T>& container, cgltf_accessor* acc)
+{
+	const int num_components = sizeof(T) / sizeof(float);
+
+	container.resize(acc->count);
+	if (!acc->count)
+		return;
+	float* dest = (float*)&container[0];
+
+	if (!acc->buffer_view) //only sparse values
+		memset(dest, 0, acc->count * sizeof(T));
 	else
 	{
-		for (int i = 0; i < num_elements; ++i)
-		{
-			memcpy(&unindexed[i], data, sizeof(Vector3));
-			data += acc->stride;
-		}
+		assert(acc->buffer_view->buffer->data);
+		const unsigned char* data = (const unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+		if (acc->component_type == cgltf_component_type_r_32f && cgltf_num_components(acc->type) == num_components && acc->stride == sizeof(T))
+			memcpy(dest, data, acc->count * sizeof(T));
+		else
+			readGLTFElements(dest, num_components, data, (int)acc->count, (int)acc->stride, acc);
 	}
 
-	if (!indices_acc)
-	{
-		container = unindexed;
+	if (!acc->is_sparse)
 		return;
+
+	//overwrite the sparse values
+	cgltf_accessor_sparse& sparse = acc->sparse;
+	const unsigned char* indices = (const unsigned char*)sparse.indices_buffer_view->buffer->data + sparse.indices_buffer_view->offset + sparse.indices_byte_offset;
+	const unsigned char* values = (const unsigned char*)sparse.values_buffer_view->buffer->data + sparse.values_buffer_view->offset + sparse.values_byte_offset;
+	int index_size = (int)cgltf_calc_size(cgltf_type_scalar, sparse.indices_component_type);
+	int value_size = (int)cgltf_calc_size(acc->type, acc->component_type);
+	for (size_t i = 0; i < sparse.count; ++i)
+	{
+		unsigned int index = readGLTFIndex(indices + i * index_size, sparse.indices_component_type);
+		if (index < acc->count)
+			readGLTFElements(dest + index * num_components, num_components, values + i * value_size, 1, value_size, acc);
 	}
+}
 
-	container.resize(indices_acc->count);
+void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor* acc)
+{
+	container.resize(acc->count);
+	if (!acc->count)
+		return;
+	unsigned int *final_indices = (unsigned int*)&container[0];
+
+	assert(!acc->is_sparse && "sparse indices not supported");
 
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (int i = 0; i < indices_acc->count; ++i)
+	unsigned char* indices = (unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+	int stride = acc->stride;
+	switch (acc->component_type)
 	{
-		int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = (int)*pos; break;
-		case cgltf_component_type_r_16u: index = (int)*(unsigned short*)pos; break;
-		case cgltf_component_type_r_32u: index = (int)*(unsigned int*)pos; break;
-		}
-		if (index < unindexed.size()) //sometimes indices are out of bounds
-			container[i] = unindexed[index];
+	case cgltf_component_type_r_8u:
+		for (size_t i = 0; i < acc->count; ++i)
+			final_indices[i] = indices[i * stride];
+		break;
+	case cgltf_component_type_r_16u:
+		for (size_t i = 0; i < acc->count; ++i)
+			final_indices[i] = *(unsigned short*)(indices + i * stride);
+		break;
+	case cgltf_component_type_r_32u:
+		if (stride == sizeof(unsigned int))
+			memcpy(final_indices, indices, acc->count * sizeof(unsigned int));
 		else
-			std::cout << "index out of bounds:" << index << std::endl;
+			for (size_t i = 0; i < acc->count; ++i)
+				final_indices[i] = *(unsigned int*)(indices + i * stride);
+		break;
+	default:
+		assert(!"invalid index type");
 	}
 }
 
-void parseGLTFBufferVector2(std::vector<Vector2>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+//accessors already in the VRAM layout of the mesh (see eVertexQuantization) are copied as they are, without decoding them to floats
+bool readGLTFSourcePositions(Mesh* mesh, cgltf_accessor* acc)
 {
-	assert(acc->buffer_view->buffer->data);
-	unsigned char* data = (unsigned char*)(acc->buffer_view->buffer->data) + acc->offset + acc->buffer_view->offset;
-	if (acc->normalized)
-	{
-		//denormalize
-		assert(!"TO DO");
-	}
-	int num_elements = acc->count;
-	std::vector<Vector2> unindexed;
-	unindexed.resize(num_elements);
-	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec2);
-	if (acc->stride == sizeof(Vector2))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector2));
+	if (acc->is_sparse || !acc->buffer_view || !acc->count || acc->component_type != cgltf_component_type_r_16u || acc->type != cgltf_type_vec3)
+		return false;
+
+	const unsigned char* data = (const unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+	mesh->source_vertices.resize(acc->count * sizeof(unsigned short) * 4);
+	unsigned short* dest = (unsigned short*)&mesh->source_vertices[0];
+	if (acc->stride == sizeof(unsigned short) * 4)
+		memcpy(dest, data, mesh->source_vertices.size());
 	else
-	{
-		for (int i = 0; i < num_elements; ++i)
+		for (size_t i = 0; i < acc->count; ++i, data += acc->stride, dest += 4)
 		{
-			memcpy(&unindexed[i], data, sizeof(Vector2));
-			data += acc->stride;
+			memcpy(dest, data, sizeof(unsigned short) * 3);
+			dest[3] = 0;
 		}
-	}
 
-	if (!indices_acc)
-	{
-		container = unindexed;
-		return;
-	}
+	//the shader reads them normalized, integer ones are scaled back (KHR_mesh_quantization)
+	float scale = acc->normalized ? 1.0f : 65535.0f;
+	mesh->quant_offset.set(0.0f, 0.0f, 0.0f);
+	mesh->quant_scale.set(scale, scale, scale);
+	mesh->quantization |= QUANTIZE_POSITIONS;
+	return true;
+}
 
-	container.resize(indices_acc->count);
+bool readGLTFSourceColors(Mesh* mesh, cgltf_accessor* acc)
+{
+	if (acc->is_sparse || !acc->buffer_view || !acc->count || acc->component_type != cgltf_component_type_r_8u || !acc->normalized || acc->type != cgltf_type_vec4)
+		return false;
 
-	assert(indices_acc->sparse.count == 0); //sparse not supported yet
+	const unsigned char* data = (const unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+	mesh->source_colors.resize(acc->count * 4);
+	if (acc->stride == 4)
+		memcpy(&mesh->source_colors[0], data, mesh->source_colors.size());
+	else
+		for (size_t i = 0; i < acc->count; ++i, data += acc->stride)
+			memcpy(&mesh->source_colors[i * 4], data, 4);
+	mesh->quantization |= QUANTIZE_COLORS;
+	return true;
+}
 
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (int i = 0; i < indices_acc->count; ++i)
-	{
-		unsigned int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = static_cast<unsigned int>(*pos); break;
-		case cgltf_component_type_r_16u: index = static_cast<unsigned int>(*(unsigned short*)pos); break;
-		case cgltf_component_type_r_32u: index = static_cast<unsigned int>(*(unsigned int*)pos); break;
-		}
-		if (index < unindexed.size())  //sometimes indices are out of bounds
-			container[i] = unindexed[index];
-		else
-			std::cout << "index out of bounds:" << index << std::endl;
-	}
+std::string getGLTFCookedMeshName(const char* filename, int mesh_index, int primitive_index)
+{
+	return std::string(filename) + "." + std::to_string(mesh_index) + "_" + std::to_string(primitive_index);
+}
 
+std::string getGLTFCookedImageName(const char* filename, int image_index)
+{
+	return std::string(filename) + ".image" + std::to_string(image_index) + ".dds";
 }
 
-void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor* acc)
+//a cooked file is used only if it is newer than the glTF and its external buffers
+bool isGLTFCookedFileUpToDate(const std::string& cooked_name, const char* filename, cgltf_data* data)
 {
-	container.resize(acc->count);
-	unsigned int *final_indices = (unsigned int*)&container[0];
+	if (!isFileUpToDate(cooked_name, filename))
+		return false;
+
+	std::string folder = filename;
+	size_t pos = folder.find_last_of("/");
+	folder = pos == std::string::npos ? "" : folder.substr(0, pos + 1);
+	for (size_t i = 0; i < data->buffers_count; ++i)
+		if (data->buffers[i].uri && strncmp(data->buffers[i].uri, "data:", 5) != 0 && !isFileUpToDate(cooked_name, folder + data->buffers[i].uri))
+			return false;
+	return true;
+}
 
-	assert(acc->sparse.count == 0); //sparse not supported yet
+//creates the mesh in RAM, it doesn't upload it to the GPU
+Mesh* parseGLTFPrimitive(cgltf_primitive* primitive)
+{
+	Mesh* mesh = new Mesh();
 
-	unsigned char* indices = (unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
-	int stride = acc->stride;
-	for (int i = 0; i < acc->count; ++i)
+	//the cook passes need floats, the runtime uploads the matching accessors as they are
+	bool keep_source_layout = Mesh::auto_upload_to_vram && !Mesh::optimize_meshes && !Mesh::quantize_meshes;
+
+	//streams
+	for (size_t j = 0; j < primitive->attributes_count; ++j)
 	{
-		unsigned int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (acc->component_type)
+		cgltf_attribute* attr = &primitive->attributes[j];
+
+		//std::string attrname = attr->name;
+		if (attr->type == cgltf_attribute_type_position)
 		{
-		case cgltf_component_type_r_8u: index = static_cast<unsigned int>(*pos); break;
-		case cgltf_component_type_r_16u: index = static_cast<unsigned int>(*(unsigned short*)pos); break;
-		case cgltf_component_type_r_32u: index = static_cast<unsigned int>(*(unsigned int*)pos); break;
+			if (keep_source_layout && readGLTFSourcePositions(mesh, attr->data))
+				mesh->updateBoundingBox();
+			else
+			{
+				parseGLTFBuffer(mesh->vertices, attr->data);
+				//min/max are stored in the component type, normalized ones must be recomputed
+				if (attr->data->has_min && attr->data->has_max && !attr->data->normalized)
+				{
+					mesh->aabb_min = attr->data->min;
+					mesh->aabb_max = attr->data->max;
+					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
+				}
+				else
+					mesh->updateBoundingBox();
+			}
+		}
+		else
+		if (attr->type == cgltf_attribute_type_normal)
+			parseGLTFBuffer(mesh->normals, attr->data);
+		else
+		if (attr->type == cgltf_attribute_type_texcoord)
+		{
+			if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
+				parseGLTFBuffer(mesh->m_uvs1, attr->data);
+			else
+				parseGLTFBuffer(mesh->uvs, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_color && attr->index == 0)
+		{
+			if (!keep_source_layout || !readGLTFSourceColors(mesh, attr->data))
+				parseGLTFBuffer(mesh->colors, attr->data);
 		}
-		final_indices[i] = index;
 	}
+
+	if (primitive->indices && primitive->indices->count)
+		parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+
+	//reorder for the GPU caches, meshlets and LODs, only when cooking (the runtime maps the cooked .mbin)
+	if (Mesh::optimize_meshes && mesh->m_indices.size())
+		optimizeMesh(mesh);
+
+	//pick the compressed vertex layouts used in VRAM, also only when cooking
+	if (Mesh::quantize_meshes)
+		mesh->chooseQuantization();
+
+	return mesh;
 }
 
 std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
@@ -159,8 +287,10 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
 	if (meshdata->name)
 		stdlog( std::string("\t<- MESH: ") + meshdata->name);
 
+	int mesh_index = gltf_data ? (int)(meshdata - gltf_data->meshes) : 0;
+
     //submeshes
-	for (int i = 0; i < meshdata->primitives_count; ++i)
+	for (size_t i = 0; i < meshdata->primitives_count; ++i)
 	{
 		cgltf_primitive* primitive = &meshdata->primitives[i];
 		Mesh* mesh = NULL;
@@ -177,43 +307,30 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
 			}
 		}
 
-		mesh = new Mesh();
-
-        //streams
-		for (int j = 0; j < primitive->attributes_count; ++j)
+		//use the version written by the cook tool
+		if (Mesh::use_binary && gltf_data)
 		{
-			cgltf_attribute* attr = &primitive->attributes[j];
+			std::string cooked_name = getGLTFCookedMeshName(gltf_filename.c_str(), mesh_index, i) + ".mbin";
+			if (isGLTFCookedFileUpToDate(cooked_name, gltf_filename.c_str(), gltf_data))
+				mesh = Mesh::Get(cooked_name.c_str());
+		}
 
-            //std::string attrname = attr->name;
-			if (attr->type == cgltf_attribute_type_position)
-			{
-				parseGLTFBufferVector3(mesh->vertices, attr->data);
-				if (attr->data->has_min && attr->data->has_max)
-				{
-					mesh->aabb_min = attr->data->min;
-					mesh->aabb_max = attr->data->max;
-					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
-					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
-				}
-				else
-					mesh->updateBoundingBox();
-			}
-			else
-			if (attr->type == cgltf_attribute_type_normal)
-				parseGLTFBufferVector3(mesh->normals, attr->data);
-			else
-			if (attr->type == cgltf_attribute_type_texcoord)
-			{
-				if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
-					parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
-				else
-					parseGLTFBufferVector2(mesh->uvs, attr->data);
-			}
+		//built in a worker thread
+		if (!mesh && gltf_load_state && gltf_load_state->data == gltf_data)
+		{
+			mesh = gltf_load_state->meshes[mesh_index][i];
+			gltf_load_state->meshes[mesh_index][i] = NULL;
+			if (mesh && Mesh::auto_upload_to_vram)
+				mesh->uploadToVRAM();
+		}
 
-			if (primitive->indices && primitive->indices->count)
-				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+		if (!mesh)
+		{
+			mesh = parseGLTFPrimitive(primitive);
+			if (Mesh::auto_upload_to_vram)
+				mesh->uploadToVRAM();
 		}
-		mesh->uploadToVRAM();
+
 		if (meshdata->name)
 			mesh->registerMesh(submesh_name);
 		result.push_back(mesh);
@@ -224,16 +341,77 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
 
 int GLTF_TEXTURE_LAST_ID = 1;
 
+//decodes an image embedded in a buffer view straight from the buffer, it doesn't use the GPU
+bool decodeGLTFImage(cgltf_image* image, Image& img)
+{
+	const unsigned char* buffer = (const unsigned char*)image->buffer_view->buffer->data + image->buffer_view->offset;
+	size_t size = image->buffer_view->size;
+
+	if (image->mime_type && !strcmp(image->mime_type, "image/png"))
+		img.loadPNG(buffer, size);
+	else if (image->mime_type && !strcmp(image->mime_type, "image/jpeg"))
+		img.loadJPG(buffer, size);
+	else
+	{
+		stdlog(std::string("image format not supported: ") + (image->mime_type ? image->mime_type : ""));
+		return false;
+	}
+	if (!img.width)
+	{
+		stdlog(std::string("image encoding has error: ") + image->mime_type);
+		return false;
+	}
+	return true;
+}
+
+//decodes an embedded image in the background thread, the placeholder texture is replaced when it is uploaded
+class DecodeGLTFImageTask : public LoadTextureTask {
+public:
+	sGLTFDataRef* data_ref;
+	cgltf_image* gltf_image;
+	bool save_cooked; //the cooked prefab references the image by its filename
+
+	DecodeGLTFImageTask(sGLTFDataRef* data_ref, cgltf_image* gltf_image, const char* filename, bool streamed, bool save_cooked) : LoadTextureTask(filename, streamed)
+	{
+		this->data_ref = data_ref;
+		this->gltf_image = gltf_image;
+		this->save_cooked = save_cooked;
+		data_ref->addRef();
+	}
+	~DecodeGLTFImageTask() { data_ref->release(); }
+
+	bool loadCompressed() { return false; }
+
+	bool loadImage()
+	{
+		if (!decodeGLTFImage(gltf_image, *image))
+			return false;
+		if (save_cooked && !image->saveDDS(filename.c_str()))
+			std::cout << "[ERROR] cannot write " << filename << std::endl;
+		return true;
+	}
+};
+
 Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 {
 	if (!load_textures || !image )
 		return NULL;
 
 	std::string fullpath = filename ? filename : "";
+	int image_index = gltf_data ? (int)(image - gltf_data->images) : -1;
+	bool save_cooked = GTR::Prefab::use_binary && image->buffer_view && image_index != -1;
 
 	if (image->uri)
 		return Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str());
 	else
+	if (save_cooked) //the cooked prefab references the embedded images by this file
+	{
+		fullpath = getGLTFCookedImageName(gltf_filename.c_str(), image_index);
+		Texture* tex = Texture::Find(fullpath.c_str());
+		if (tex)
+			return tex;
+	}
+	else
 	if (filename)
 	{
 		fullpath = std::string(base_folder) + "/" + filename;
@@ -250,28 +428,30 @@ Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 
 	if (image->buffer_view)
 	{
-		Image img;
-		std::vector<unsigned char> buffer;
-		buffer.resize(image->buffer_view->size);
-		memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
-
-		if (!strcmp(image->mime_type, "image/png"))
-			img.loadPNG(buffer);
-		else if (!strcmp(image->mime_type, "image/jpeg"))
-			img.loadJPG(buffer);
-		else
+		//decoded in a worker thread
+		Image* img = NULL;
+		if (gltf_load_state && gltf_load_state->data == gltf_data)
 		{
-			stdlog(std::string("image format not supported: ") + image->mime_type);
-			return NULL;
+			img = gltf_load_state->images[image_index];
+			gltf_load_state->images[image_index] = NULL;
 		}
-		if (!img.width)
+
+		//not decoded yet, it goes to the background like the files (the saved DDS can be streamed)
+		if (!img)
 		{
-			stdlog(std::string("image encoding has error: ") + image->mime_type);
-			return NULL;
+			Texture* tex = Texture::createPlaceholder(fullpath.c_str(), save_cooked && Texture::use_streaming);
+			TaskManager::background.addTask(new DecodeGLTFImageTask(gltf_data_ref, image, fullpath.c_str(), tex->streamed, save_cooked));
+			stdlog(std::string("\t<- TEXTURE (async): ") + fullpath);
+			return tex;
 		}
+
+		if (save_cooked && !img->saveDDS(fullpath.c_str()))
+			std::cout << "[ERROR] cannot write " << fullpath << std::endl;
+
 		Texture* tex = new Texture();
-		tex->loadFromImage(&img);
-		if (filename)
+		tex->loadFromImage(img);
+		delete img;
+		if (filename || save_cooked)
 		{
 			tex->setName(fullpath.c_str());
 			stdlog(std::string("\t<- TEXTURE: ") + fullpath);
@@ -394,7 +574,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL)
 			std::vector<Mesh*> meshes;
 			meshes = parseGLTFMesh(node->mesh);
 
-			for (int i = 0; i < node->mesh->primitives_count; ++i)
+			for (size_t i = 0; i < node->mesh->primitives_count; ++i)
 			{
 				GTR::Node* subnode = new GTR::Node();
 				subnode->mesh = meshes[i];
@@ -423,7 +603,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL)
 		}
 	}
 
-	for (int i = 0; i < node->children_count; ++i)
+	for (size_t i = 0; i < node->children_count; ++i)
 		scenenode->addChild(parseGLTFNode(node->children[i]));
 
 	return scenenode;
@@ -472,6 +652,8 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	char* name_start = strrchr(folder, '/');
 	*name_start = '\0';
 	base_folder = folder; //global
+	gltf_filename = filename;
+	gltf_data = data;
 
 	{
 		result = cgltf_load_buffers(&options, data, filename);
@@ -480,6 +662,7 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 			return NULL;
 		}
 	}
+	gltf_data_ref = new sGLTFDataRef(data);
 
 	GTR::Prefab* prefab = new GTR::Prefab();
 
@@ -488,7 +671,7 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 		{
 			cgltf_node *root = nullptr;
 			float fiTotal = 1.0f / (float) scene->nodes_count;
-			for (int i = 0; i < scene->nodes_count; ++i)
+			for (size_t i = 0; i < scene->nodes_count; ++i)
 			{
 				float fProgress = ((float) i * fiTotal) * 100.0f;
 				GTR::Node *node = parseGLTFNode(scene->nodes[i]);
@@ -521,8 +704,10 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	prefab->updateNodesByName();
 	prefab->updateBounding();
 
-	//frees all data, including bin
-	cgltf_free(data);
+	//frees all data, including bin, once the embedded images are decoded
+	gltf_data_ref->release();
+	gltf_data_ref = NULL;
+	gltf_data = NULL;
 
     stdlog( std::string(" - Loaded ") + filename );
 
@@ -566,3 +751,187 @@ GTR::Prefab* loadGLTF(const char* filename)
 	return loadGLTF(filename, data, options);
 }
 
+bool getGLTFDependencies(const char* filename, std::vector<std::string>& files)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	cgltf_data* data = NULL;
+	if (cgltf_parse_file(&options, filename, &data) != cgltf_result_success)
+		return false;
+
+	std::string folder = filename;
+	size_t pos = folder.find_last_of("/");
+	folder = pos == std::string::npos ? "" : folder.substr(0, pos + 1);
+
+	files.push_back(filename);
+	for (size_t i = 0; i < data->buffers_count; ++i)
+		if (data->buffers[i].uri && strncmp(data->buffers[i].uri, "data:", 5) != 0)
+			files.push_back(folder + data->buffers[i].uri);
+	cgltf_free(data);
+	return true;
+}
+
+bool getGLTFCookedFiles(const char* filename, std::vector<std::string>& files)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	cgltf_data* data = NULL;
+	if (cgltf_parse_file(&options, filename, &data) != cgltf_result_success)
+		return false;
+
+	for (size_t i = 0; i < data->meshes_count; ++i)
+		for (size_t j = 0; j < data->meshes[i].primitives_count; ++j)
+			files.push_back(getGLTFCookedMeshName(filename, i, j) + ".mbin");
+	cgltf_free(data);
+	return true;
+}
+
+bool getGLTFTextureUsage(const char* filename, sGLTFTextureUsage& usage)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	cgltf_data* data = NULL;
+	if (cgltf_parse_file(&options, filename, &data) != cgltf_result_success)
+		return false;
+
+	std::string folder = filename;
+	size_t pos = folder.find_last_of("/");
+	folder = pos == std::string::npos ? "" : folder.substr(0, pos + 1);
+
+	//only the external images, the embedded ones are decoded at runtime
+	auto getPath = [&](cgltf_texture* texture) {
+		if (!texture || !texture->image || !texture->image->uri || strncmp(texture->image->uri, "data:", 5) == 0)
+			return std::string();
+		return folder + texture->image->uri;
+	};
+
+	for (size_t i = 0; i < data->materials_count; ++i)
+	{
+		cgltf_material& material = data->materials[i];
+		std::string path = getPath(material.normal_texture.texture);
+		if (!path.empty())
+			usage.normal_maps.insert(path);
+		path = getPath(material.occlusion_texture.texture);
+		if (!path.empty())
+			usage.linear.insert(path);
+		if (!material.has_pbr_metallic_roughness)
+			continue;
+		path = getPath(material.pbr_metallic_roughness.metallic_roughness_texture.texture);
+		if (!path.empty())
+			usage.linear.insert(path);
+		path = getPath(material.pbr_metallic_roughness.base_color_texture.texture);
+		if (!path.empty() && material.alpha_mode == cgltf_alpha_mode_mask)
+			usage.alpha_cutoffs[path] = material.alpha_cutoff;
+	}
+	cgltf_free(data);
+	return true;
+}
+
+bool cookGLTF(const char* filename)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	options.file.read = internalOpenFile;
+	cgltf_data* data = NULL;
+	if (cgltf_parse_file(&options, filename, &data) != cgltf_result_success)
+		return false;
+
+	if (cgltf_load_buffers(&options, data, filename) != cgltf_result_success)
+	{
+		stdlog(std::string("[BIN NOT FOUND]:") + filename);
+		cgltf_free(data);
+		return false;
+	}
+
+	//one MBIN per primitive, parseGLTFMesh picks them when Mesh::use_binary is set
+	bool ok = true;
+	for (size_t i = 0; i < data->meshes_count; ++i)
+		for (size_t j = 0; j < data->meshes[i].primitives_count; ++j)
+		{
+			Mesh* mesh = parseGLTFPrimitive(&data->meshes[i].primitives[j]);
+			if (!mesh->writeBin(getGLTFCookedMeshName(filename, i, j).c_str()))
+				ok = false;
+			delete mesh;
+		}
+
+	cgltf_free(data);
+	return ok;
+}
+
+bool parseGLTFFile(sGLTFLoadState* state)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	options.file.read = internalOpenFile;
+	state->data = NULL;
+	if (cgltf_parse_file(&options, state->filename.c_str(), &state->data) != cgltf_result_success)
+	{
+		std::cout << "[NOT FOUND] " << state->filename << std::endl;
+		state->data = NULL;
+		return false;
+	}
+
+	if (cgltf_load_buffers(&options, state->data, state->filename.c_str()) != cgltf_result_success)
+	{
+		stdlog(std::string("[BIN NOT FOUND]:") + state->filename);
+		cgltf_free(state->data);
+		state->data = NULL;
+		return false;
+	}
+
+	state->meshes.resize(state->data->meshes_count);
+	for (size_t i = 0; i < state->data->meshes_count; ++i)
+		state->meshes[i].resize(state->data->meshes[i].primitives_count, NULL);
+	state->images.resize(state->data->images_count, NULL);
+	return true;
+}
+
+void buildGLTFMesh(sGLTFLoadState* state, int mesh_index)
+{
+	cgltf_mesh* meshdata = &state->data->meshes[mesh_index];
+	for (size_t i = 0; i < meshdata->primitives_count; ++i)
+	{
+		//the cooked ones are mapped in the main thread
+		if (Mesh::use_binary && isGLTFCookedFileUpToDate(getGLTFCookedMeshName(state->filename.c_str(), mesh_index, i) + ".mbin", state->filename.c_str(), state->data))
+			continue;
+		state->meshes[mesh_index][i] = parseGLTFPrimitive(&meshdata->primitives[i]);
+	}
+}
+
+void decodeGLTFImage(sGLTFLoadState* state, int image_index)
+{
+	cgltf_image* image = &state->data->images[image_index];
+	if (!load_textures || !image->buffer_view) //files go through Texture::GetAsync
+		return;
+	Image* img = new Image();
+	if (decodeGLTFImage(image, *img))
+		state->images[image_index] = img;
+	else
+		delete img;
+}
+
+GTR::Prefab* finishGLTF(sGLTFLoadState* state)
+{
+	if (!state->data)
+		return NULL;
+
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	options.file.read = internalOpenFile;
+
+	gltf_load_state = state;
+	GTR::Prefab* prefab = loadGLTF(state->filename.c_str(), state->data, options); //frees the data
+	gltf_load_state = NULL;
+	state->data = NULL;
+
+	//the ones that were found in the managers
+	for (size_t i = 0; i < state->meshes.size(); ++i)
+		for (size_t j = 0; j < state->meshes[i].size(); ++j)
+			delete state->meshes[i][j];
+	for (size_t i = 0; i < state->images.size(); ++i)
+		delete state->images[i];
+	state->meshes.clear();
+	state->images.clear();
+
+	return prefab;
+}
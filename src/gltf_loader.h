@@ -1,7 +1,39 @@
 #pragma once
 
 #include "prefab.h"
+#include <set>
+
+class Mesh;
+class Image;
+struct cgltf_data;
+
+//the loading split in steps so it can run as jobs (see Prefab::Preload)
+struct sGLTFLoadState {
+	std::string filename;
+	cgltf_data* data;
+	std::vector< std::vector<Mesh*> > meshes; //per mesh and primitive, built in worker threads
+	std::vector<Image*> images; //embedded images decoded in worker threads
+	sGLTFLoadState() { data = NULL; }
+};
+
+//how the materials use the external images, the cook tool picks the format and the mip filter with it
+struct sGLTFTextureUsage {
+	std::set<std::string> normal_maps;
+	std::set<std::string> linear; //data instead of colors (metallic roughness, occlusion)
+	std::map<std::string, float> alpha_cutoffs; //color textures of MASK materials
+};
 
 GTR::Prefab* loadGLTF(const char* filename);
 //GTR::Prefab* loadGLTF(const char* filename, cgltf_data* data, cgltf_options& options);
 GTR::Prefab* loadGLTF(const std::vector<unsigned char>& data, const std::string& path);
+
+//used by the cook tool, writes an MBIN per primitive next to the glTF
+bool cookGLTF(const char* filename);
+bool getGLTFDependencies(const char* filename, std::vector<std::string>& files); //the glTF and its external buffers
+bool getGLTFCookedFiles(const char* filename, std::vector<std::string>& files); //every MBIN cookGLTF writes
+bool getGLTFTextureUsage(const char* filename, sGLTFTextureUsage& usage); //adds the external images of the materials
+
+bool parseGLTFFile(sGLTFLoadState* state); //reads the file and its buffers, any thread
+void buildGLTFMesh(sGLTFLoadState* state, int mesh_index); //any thread
+void decodeGLTFImage(sGLTFLoadState* state, int image_index); //any thread
+GTR::Prefab* finishGLTF(sGLTFLoadState* state); //main thread, creates the nodes and materials and uploads to the GPU
@@ -0,0 +1,474 @@
+#include "image_ops.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if !defined(IMAGE_OPS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define IMAGE_OPS_SSE2
+	#include <emmintrin.h>
+#endif
+
+#define LINEAR_TO_SRGB_STEPS 16384 //in the darkest values one step is less than a fifth of a sRGB level
+
+//built once, it is thread safe since C++11
+struct sColorTables {
+	float srgb_to_linear[256];
+	uint8 linear_to_srgb[LINEAR_TO_SRGB_STEPS + 1];
+
+	sColorTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i <= LINEAR_TO_SRGB_STEPS; ++i)
+		{
+			float c = i / (float)LINEAR_TO_SRGB_STEPS;
+			float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			linear_to_srgb[i] = (uint8)(srgb * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const sColorTables& getColorTables()
+{
+	static sColorTables tables;
+	return tables;
+}
+
+void flipRows(void* data, size_t row_bytes, int num_rows)
+{
+	assert(data);
+	uint8* bytes = (uint8*)data;
+	std::vector<uint8> temp(row_bytes);
+	for (int y = 0; y < num_rows / 2; ++y)
+	{
+		uint8* top = bytes + y * row_bytes;
+		uint8* bottom = bytes + (num_rows - y - 1) * row_bytes;
+		memcpy(&temp[0], top, row_bytes);
+		memcpy(top, bottom, row_bytes);
+		memcpy(bottom, &temp[0], row_bytes);
+	}
+}
+
+void swapRedBlue(uint8* data, size_t num_pixels, int num_channels)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	if (num_channels == 4)
+	{
+		//R is the lowest byte of every pixel, B the third one
+		const __m128i mask_ga = _mm_set1_epi32(0xFF00FF00);
+		const __m128i mask_low = _mm_set1_epi32(0xFF);
+		for (; i + 4 <= num_pixels; i += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)(data + i * 4));
+			__m128i r = _mm_slli_epi32(_mm_and_si128(p, mask_low), 16);
+			__m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), mask_low);
+			_mm_storeu_si128((__m128i*)(data + i * 4), _mm_or_si128(_mm_and_si128(p, mask_ga), _mm_or_si128(r, b)));
+		}
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		uint8* pixel = data + i * num_channels;
+		uint8 temp = pixel[0];
+		pixel[0] = pixel[2];
+		pixel[2] = temp;
+	}
+}
+
+void expandRGBToRGBA(const uint8* src, uint8* dst, size_t num_pixels, uint8 alpha)
+{
+	assert(src != dst);
+	//SSE2 has no byte shuffle, the compiler does better with the plain loop
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		dst[i * 4] = src[i * 3];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = alpha;
+	}
+}
+
+void dropAlpha(const uint8* src, uint8* dst, size_t num_pixels)
+{
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		dst[i * 3] = src[i * 4];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+//exact x / 255 rounded for x <= 255 * 255
+inline unsigned int div255(unsigned int x) { x += 128; return (x + (x >> 8)) >> 8; }
+
+void premultiplyAlpha(uint8* data, size_t num_pixels)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask_rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0); //the alpha is multiplied by 1
+	const __m128i c128 = _mm_set1_epi16(128);
+	for (; i + 4 <= num_pixels; i += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(data + i * 4));
+		__m128i result[2];
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i v = half ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero);
+			__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			a = _mm_or_si128(_mm_and_si128(a, mask_rgb), alpha_one);
+			__m128i x = _mm_add_epi16(_mm_mullo_epi16(v, a), c128);
+			result[half] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i*)(data + i * 4), _mm_packus_epi16(result[0], result[1]));
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		uint8* pixel = data + i * 4;
+		for (int c = 0; c < 3; ++c)
+			pixel[c] = (uint8)div255(pixel[c] * pixel[3]);
+	}
+}
+
+void convertSRGBToLinear(const uint8* src, float* dst, size_t num_pixels, int num_channels)
+{
+	const float* table = getColorTables().srgb_to_linear;
+	size_t count = num_pixels * num_channels;
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = table[src[i]];
+	if (num_channels == 4)
+		for (size_t i = 3; i < count; i += 4)
+			dst[i] = src[i] * (1.0f / 255.0f);
+}
+
+void convertLinearToSRGB(const float* src, uint8* dst, size_t num_pixels, int num_channels)
+{
+	const uint8* table = getColorTables().linear_to_srgb;
+	size_t count = num_pixels * num_channels;
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 steps = _mm_set1_ps((float)LINEAR_TO_SRGB_STEPS);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one);
+		int indices[4];
+		_mm_storeu_si128((__m128i*)indices, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, steps), half)));
+		for (int j = 0; j < 4; ++j)
+			dst[i + j] = table[indices[j]];
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = table[(int)(clamp(src[i], 0.0f, 1.0f) * LINEAR_TO_SRGB_STEPS + 0.5f)];
+	if (num_channels == 4)
+		for (size_t i = 3; i < count; i += 4)
+			dst[i] = (uint8)(clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void convertUnorm8ToFloat(const uint8* src, float* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = src[i] * (1.0f / 255.0f);
+}
+
+void convertFloatToUnorm8(const float* src, uint8* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			__m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + j * 4), zero), one);
+			v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half)); //same rounding as the scalar version
+		}
+		__m128i lo = _mm_packs_epi32(v[0], v[1]);
+		__m128i hi = _mm_packs_epi32(v[2], v[3]);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = (uint8)(clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void addScaledRow(const float* src, float weight, float* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	const __m128 w = _mm_set1_ps(weight);
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), w)));
+		_mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), w)));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] += weight * src[i];
+}
+
+void convertFloatToHalf(const float* src, uint16* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	//branchless version of floatToHalf, the subnormals round with a magic number add
+	const __m128i mask_sign = _mm_set1_epi32(0x80000000);
+	const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23); //from here it rounds to inf
+	const __m128i nan_bit = _mm_set1_epi32(0x200);
+	const __m128i inf_half = _mm_set1_epi32(0x7C00);
+	const __m128i min_normal = _mm_set1_epi32((127 - 14) << 23);
+	const __m128i subnormal_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i normal_bias = _mm_set1_epi32(0xFFF - ((127 - 15) << 23)); //rebias the exponent and round
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i result[2];
+		for (int j = 0; j < 2; ++j)
+		{
+			__m128 f = _mm_loadu_ps(src + i + j * 4);
+			__m128 sign = _mm_and_ps(_mm_castsi128_ps(mask_sign), f);
+			__m128 abs_f = _mm_xor_ps(f, sign);
+			__m128i abs_i = _mm_castps_si128(abs_f);
+
+			__m128i is_nan = _mm_castps_si128(_mm_cmpunord_ps(abs_f, abs_f));
+			__m128i is_regular = _mm_cmpgt_epi32(f16_max, abs_i);
+			__m128i inf_or_nan = _mm_or_si128(_mm_and_si128(is_nan, nan_bit), inf_half);
+
+			__m128i is_subnormal = _mm_cmpgt_epi32(min_normal, abs_i);
+			__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(abs_f, _mm_castsi128_ps(subnormal_magic))), subnormal_magic);
+
+			__m128i odd = _mm_srai_epi32(_mm_slli_epi32(abs_i, 31 - 13), 31); //-1 when the half mantissa is odd
+			__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(abs_i, normal_bias), odd), 13);
+
+			__m128i value = _mm_or_si128(_mm_and_si128(subnormal, is_subnormal), _mm_andnot_si128(is_subnormal, normal));
+			value = _mm_or_si128(_mm_and_si128(value, is_regular), _mm_andnot_si128(is_regular, inf_or_nan));
+			result[j] = _mm_or_si128(value, _mm_srai_epi32(_mm_castps_si128(sign), 16)); //sign extended so the pack keeps it
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(result[0], result[1]));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = floatToHalf(src[i]);
+}
+
+void convertHalfToFloat(const uint16* src, float* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_OPS_SSE2
+	//the exponent is rebiased with a multiplication, it also handles the subnormals (slow on x86 but rare in images)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask_no_sign = _mm_set1_epi32(0x7FFF);
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+	const __m128i max_finite = _mm_set1_epi32(0x7BFF);
+	const __m128 inf_exponent = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i h8 = _mm_loadu_si128((const __m128i*)(src + i));
+		for (int j = 0; j < 2; ++j)
+		{
+			__m128i h = j ? _mm_unpackhi_epi16(h8, zero) : _mm_unpacklo_epi16(h8, zero);
+			__m128i exp_mantissa = _mm_and_si128(h, mask_no_sign);
+			__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, exp_mantissa), 16);
+			__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exp_mantissa, 13)), magic);
+			__m128 inf_or_nan = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(exp_mantissa, max_finite)), inf_exponent);
+			_mm_storeu_ps(dst + i + j * 4, _mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(sign), inf_or_nan)));
+		}
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = halfToFloat(src[i]);
+}
+
+#define RGB9E5_MANTISSA_BITS 9
+#define RGB9E5_EXPONENT_BIAS 15
+#define RGB9E5_MAX_EXPONENT 31
+#define RGB9E5_MAX_VALUE 65408.0f //(511 / 512) * 2^16
+
+void convertFloatToRGB9E5(const float* src, uint32* dst, size_t num_pixels)
+{
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		const float* rgb = src + i * 3;
+		float r = rgb[0] > 0 ? std::min(rgb[0], RGB9E5_MAX_VALUE) : 0.0f; //NaN becomes 0 too
+		float g = rgb[1] > 0 ? std::min(rgb[1], RGB9E5_MAX_VALUE) : 0.0f;
+		float b = rgb[2] > 0 ? std::min(rgb[2], RGB9E5_MAX_VALUE) : 0.0f;
+		float max_value = std::max(r, std::max(g, b));
+
+		//the exponent of the biggest component decides the scale of all of them
+		int exponent = 0;
+		frexpf(max_value, &exponent); //max_value = m * 2^exponent, m in [0.5, 1)
+		int shared = std::max(exponent, -RGB9E5_EXPONENT_BIAS) + RGB9E5_EXPONENT_BIAS;
+		float scale = ldexpf(1.0f, RGB9E5_MANTISSA_BITS + RGB9E5_EXPONENT_BIAS - shared);
+		if ((int)(max_value * scale + 0.5f) == (1 << RGB9E5_MANTISSA_BITS)) //rounded up to the next exponent
+		{
+			shared++;
+			scale *= 0.5f;
+		}
+
+		uint32 rm = (uint32)(r * scale + 0.5f);
+		uint32 gm = (uint32)(g * scale + 0.5f);
+		uint32 bm = (uint32)(b * scale + 0.5f);
+		dst[i] = rm | (gm << 9) | (bm << 18) | ((uint32)shared << 27);
+	}
+}
+
+void convertRGB9E5ToFloat(const uint32* src, float* dst, size_t num_pixels)
+{
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		uint32 v = src[i];
+		float scale = ldexpf(1.0f, (int)(v >> 27) - RGB9E5_EXPONENT_BIAS - RGB9E5_MANTISSA_BITS);
+		dst[i * 3] = (v & 0x1FF) * scale;
+		dst[i * 3 + 1] = ((v >> 9) & 0x1FF) * scale;
+		dst[i * 3 + 2] = ((v >> 18) & 0x1FF) * scale;
+	}
+}
+
+void downsample2x(const uint8* src, int width, int height, int num_channels, uint8* dst)
+{
+	assert(src && dst && src != dst);
+	int new_width = std::max(width / 2, 1);
+	int new_height = std::max(height / 2, 1);
+	int x_step = width > 1 ? 1 : 0; //the side that is already 1 pixel is not averaged
+	int y_step = height > 1 ? 1 : 0;
+	for (int y = 0; y < new_height; ++y)
+	{
+		const uint8* row0 = src + (size_t)(y * 2) * width * num_channels;
+		const uint8* row1 = src + (size_t)(y * 2 + y_step) * width * num_channels;
+		uint8* dest = dst + (size_t)y * new_width * num_channels;
+		int x = 0;
+#ifdef IMAGE_OPS_SSE2
+		if (num_channels == 4 && x_step)
+		{
+			//8 source pixels of both rows give 4 pixels
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i two = _mm_set1_epi16(2);
+			for (; x + 4 <= new_width; x += 4)
+			{
+				__m128i sums[2];
+				for (int j = 0; j < 2; ++j)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(row0 + (x * 2 + j * 4) * 4));
+					__m128i b = _mm_loadu_si128((const __m128i*)(row1 + (x * 2 + j * 4) * 4));
+					__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); //columns 0 and 1
+					__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); //columns 2 and 3
+					__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+					sums[j] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+				}
+				_mm_storeu_si128((__m128i*)(dest + x * 4), _mm_packus_epi16(sums[0], sums[1]));
+			}
+		}
+#endif
+		for (; x < new_width; ++x)
+		{
+			int x0 = x * 2 * num_channels;
+			int x1 = (x * 2 + x_step) * num_channels;
+			for (int c = 0; c < num_channels; ++c)
+				dest[x * num_channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+		}
+	}
+}
+
+void resizeBilinear(const uint8* src, int width, int height, int num_channels, uint8* dst, int dst_width, int dst_height)
+{
+	assert(src && dst && src != dst);
+	int row_size = dst_width * num_channels;
+
+	//source column and weight of every destination column
+	std::vector<int> columns(dst_width);
+	std::vector<float> weights(dst_width);
+	float scale_x = width / (float)dst_width;
+	for (int x = 0; x < dst_width; ++x)
+	{
+		float sx = clamp((x + 0.5f) * scale_x - 0.5f, 0.0f, (float)(width - 1));
+		columns[x] = std::min((int)sx, width - 2 < 0 ? 0 : width - 2);
+		weights[x] = width > 1 ? sx - columns[x] : 0.0f;
+	}
+
+	auto filterRow = [&](int sy, float* r) {
+		const uint8* s = src + (size_t)sy * width * num_channels;
+		for (int x = 0; x < dst_width; ++x)
+		{
+			const uint8* p0 = s + columns[x] * num_channels;
+			const uint8* p1 = width > 1 ? p0 + num_channels : p0;
+			for (int c = 0; c < num_channels; ++c)
+				r[x * num_channels + c] = p0[c] + (p1[c] - p0[c]) * weights[x];
+		}
+	};
+
+	//the two source rows already filtered horizontally, reused while they don't change
+	std::vector<float> rows[2] = { std::vector<float>(row_size), std::vector<float>(row_size) };
+	int cached[2] = { -1, -1 };
+	std::vector<float> result(row_size);
+	float scale_y = height / (float)dst_height;
+	for (int y = 0; y < dst_height; ++y)
+	{
+		float sy = clamp((y + 0.5f) * scale_y - 0.5f, 0.0f, (float)(height - 1));
+		int y0 = std::min((int)sy, height - 2 < 0 ? 0 : height - 2);
+		int y1 = std::min(y0 + 1, height - 1);
+		float wy = height > 1 ? sy - y0 : 0.0f;
+
+		if (y0 != cached[0])
+		{
+			if (y0 == cached[1]) //going down, the second row becomes the first
+			{
+				rows[0].swap(rows[1]);
+				cached[1] = -1;
+			}
+			else
+				filterRow(y0, &rows[0][0]);
+			cached[0] = y0;
+		}
+		if (y1 != cached[1])
+		{
+			filterRow(y1, &rows[1][0]);
+			cached[1] = y1;
+		}
+
+		const float* r0 = &rows[0][0];
+		const float* r1 = &rows[1][0];
+		int i = 0;
+#ifdef IMAGE_OPS_SSE2
+		const __m128 w = _mm_set1_ps(wy);
+		const __m128 to_unit = _mm_set1_ps(1.0f / 255.0f);
+		for (; i + 4 <= row_size; i += 4)
+		{
+			__m128 a = _mm_loadu_ps(r0 + i);
+			__m128 v = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(r1 + i), a), w));
+			_mm_storeu_ps(&result[i], _mm_mul_ps(v, to_unit));
+		}
+#endif
+		for (; i < row_size; ++i)
+			result[i] = (r0[i] + (r1[i] - r0[i]) * wy) * (1.0f / 255.0f);
+		convertFloatToUnorm8(&result[0], dst + (size_t)y * row_size, row_size);
+	}
+}
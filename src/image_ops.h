@@ -0,0 +1,39 @@
+/*  batch pixel operations
+	Used by the image loaders, the readbacks and the mip building instead of per pixel code.
+	The hot ones have an SSE2 version next to the scalar one (x64 always has it), both give the same result.
+	IMAGE_OPS_NO_SIMD builds only the scalar code, src/tests/test_image_ops.cpp compares both.
+*/
+#pragma once
+
+#include "framework.h"
+
+//swaps the first and the last rows and so on, any pixel format
+void flipRows(void* data, size_t row_bytes, int num_rows);
+
+//BGR(A) <-> RGB(A) in place
+void swapRedBlue(uint8* data, size_t num_pixels, int num_channels);
+//RGB -> RGBA with a constant alpha, and back
+void expandRGBToRGBA(const uint8* src, uint8* dst, size_t num_pixels, uint8 alpha = 255);
+void dropAlpha(const uint8* src, uint8* dst, size_t num_pixels);
+void premultiplyAlpha(uint8* data, size_t num_pixels); //RGBA
+
+//the alpha (the fourth channel) is always linear
+void convertSRGBToLinear(const uint8* src, float* dst, size_t num_pixels, int num_channels);
+void convertLinearToSRGB(const float* src, uint8* dst, size_t num_pixels, int num_channels); //clamps to 0..1
+
+//counts are values, not pixels
+void convertUnorm8ToFloat(const uint8* src, float* dst, size_t count);
+void convertFloatToUnorm8(const float* src, uint8* dst, size_t count); //clamps to 0..1 and rounds
+void convertFloatToHalf(const float* src, uint16* dst, size_t count); //round to nearest even, like floatToHalf
+void convertHalfToFloat(const uint16* src, float* dst, size_t count);
+//shared exponent HDR colors (GL_RGB9_E5), 3 floats per pixel, negative values become 0
+void convertFloatToRGB9E5(const float* src, uint32* dst, size_t num_pixels);
+void convertRGB9E5ToFloat(const uint32* src, float* dst, size_t num_pixels);
+
+//dst += src * weight, the rows of the separable filters
+void addScaledRow(const float* src, float weight, float* dst, size_t count);
+
+//averages every 2x2 block, sides of one pixel are not averaged (dst is max(w/2,1) x max(h/2,1))
+void downsample2x(const uint8* src, int width, int height, int num_channels, uint8* dst);
+//any size, the pixel centers are aligned and the borders clamp
+void resizeBilinear(const uint8* src, int width, int height, int num_channels, uint8* dst, int dst_width, int dst_height);
@@ -11,11 +11,15 @@
 
 #include "framework.h"
 #include "mesh.h"
+#include "texture.h"
 #include "camera.h"
 #include "utils.h"
 #include "input.h"
 #include "application.h"
 #include "task.h"
+#include "resources.h"
+#include "upload_ring.h"
+#include "allocators.h"
 
 #include <iostream> //to output
 
@@ -136,6 +140,8 @@ void mainLoop(SDL_Window* window)
 			renderDebug(window, app);
 		// swap between front buffer and back buffer
 		SDL_GL_SwapWindow(window);
+		if (app->frame == 0)
+			std::cout << " * Time to first frame: " << SDL_GetTicks() * 0.001 << "sec" << std::endl;
 
 		//update events
 		while(SDL_PollEvent(&sdlEvent))
@@ -200,8 +206,20 @@ void mainLoop(SDL_Window* window)
 		//update app logic
 		app->update(elapsed_time);
 
-		//execute a task in the main task manager (blocking)
-		TaskManager::foreground.fetchTask();
+		//execute the tasks of the main task manager (blocking) until its budget is spent
+		TaskManager::foreground.drainTasks();
+
+		//send the rows of the textures staged by the loaders
+		UploadRing::update();
+
+		//stream the mips requested while rendering
+		Texture::updateStreaming();
+
+		//free the unused resources if over budget
+		ResourceManager::update();
+
+		//the transient data of two frames ago is not needed anymore
+		FrameArena::nextFrame();
 
 		//check errors in opengl only when working in debug
 		#ifdef _DEBUG
@@ -255,6 +273,9 @@ int main(int argc, char **argv)
 
 	Input::init(window);
 
+	//staging buffers for the textures loaded in background
+	UploadRing::init();
+
 	//launch the application (app is a global variable)
 	app = new Application(window_width, window_height, window);
 
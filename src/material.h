@@ -1,6 +1,7 @@
 #pragma once
 
 #include "framework.h"
+#include "resources.h"
 #include <cassert>
 #include <map>
 #include <string>
@@ -28,14 +29,14 @@ namespace GTR {
 	};
 
 	struct Sampler {
-		Texture* texture;
+		ResourceHandle<Texture> texture;
 		int uv_channel;
 
-		Sampler() { texture = NULL; uv_channel = 0; }
+		Sampler() { uv_channel = 0; }
 	};
 
 	//this class contains all info relevant of how something must be rendered
-	class Material {
+	class Material : public Resource {
 	public:
 		//static manager to reuse materials
 		static std::map<std::string, Material*> sMaterials;
@@ -65,12 +66,14 @@ namespace GTR {
 		Sampler normal_texture;	//normalmap
 
 		//ctors
-		Material() : alpha_mode(NO_ALPHA), alpha_cutoff(0.5), color(1, 1, 1, 1), _zMin(0.0f), _zMax(1.0f), two_sided(false), roughness_factor(1), metallic_factor(0) {
+		Material() : Resource(RESOURCE_MATERIAL), alpha_mode(NO_ALPHA), alpha_cutoff(0.5), two_sided(false), _zMin(0.0f), _zMax(1.0f), color(1, 1, 1, 1), roughness_factor(1), metallic_factor(0) {
 			//color_texture = emissive_texture = metallic_roughness_texture = occlusion_texture = normal_texture = NULL;
 		}
 		Material(Texture* texture) : Material() { color_texture.texture = texture; }
 		virtual ~Material();
 
+		void getMemoryUsage(size_t& cpu, size_t& gpu) { cpu = sizeof(Material) + name.size(); gpu = 0; }
+
 		static void Release();
 
 		void renderInMenu();
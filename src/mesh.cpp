@@ -4,10 +4,13 @@
 #include "shader.h"
 #include "includes.h"
 #include "framework.h"
+#include "mesh_optimizer.h"
+#include "obj_loader.h"
 
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <set>
 #include <sys/stat.h>
 
 #include "camera.h"
@@ -17,9 +20,13 @@
 
 //#include "engine/application.h"
 
-bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tries to read it instead of the other file
+bool Mesh::use_binary = true;			//reads the .mbin instead of the source when it is not older than it, and writes it after loading the source
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::quantize_meshes = false;		//uses compressed vertex layouts if the error is small, only the cook tool enables it
+bool Mesh::optimize_meshes = false;		//cache/overdraw/fetch order, meshlets and LODs, only the cook tool enables it (the runtime loads them from the .mbin)
+std::atomic<size_t> Mesh::quantization_saved_disk(0);
+std::atomic<size_t> Mesh::quantization_saved_vram(0);
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
@@ -30,11 +37,13 @@ long Mesh::num_triangles_rendered = 0;
 #define FORMAT_MBIN 3
 #define FORMAT_MESH 4
 
-Mesh::Mesh()
+Mesh::Mesh() : Resource(RESOURCE_MESH)
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	mapped_file = NULL;
+	mapped_bin = NULL;
 
 	clear();
 }
@@ -42,6 +51,27 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
 	clear();
+
+	//it can be registered with several names
+	for (auto it = sMeshesLoaded.begin(); it != sMeshesLoaded.end(); )
+	{
+		if (it->second == this)
+			it = sMeshesLoaded.erase(it);
+		else
+			++it;
+	}
+}
+
+template<typename T> size_t getVectorBytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+void Mesh::getMemoryUsage(size_t& cpu, size_t& gpu)
+{
+	cpu = getVectorBytes(vertices) + getVectorBytes(normals) + getVectorBytes(uvs) + getVectorBytes(m_uvs1) + getVectorBytes(colors) +
+		getVectorBytes(interleaved) + getVectorBytes(m_indices) + getVectorBytes(bones) + getVectorBytes(weights) + getVectorBytes(bones_info) +
+		getVectorBytes(source_vertices) + getVectorBytes(source_colors) + getVectorBytes(submeshes) + getVectorBytes(meshlets) + getVectorBytes(lods);
+	gpu = 0;
+	if (vertices_vbo_id || interleaved_vbo_id)
+		gpu = (size_t)gpu_num_vertices * getVertexSize(quantization) + (size_t)gpu_num_indices * index_bytes;
 }
 
 
@@ -99,12 +129,325 @@ void Mesh::clear()
 	colors.clear();
 	interleaved.clear();
 	m_indices.clear();
+	source_vertices.clear();
+	source_colors.clear();
 	bones.clear();
 	weights.clear();
 	m_uvs1.clear();
+	meshlets.clear();
+	lods.clear();
+
+	gpu_num_vertices = gpu_num_indices = 0;
+	index_bytes = 4;
+	quantization = 0;
+	quant_offset.set(0.0f, 0.0f, 0.0f);
+	quant_scale.set(1.0f, 1.0f, 1.0f);
+	uv_density = -1;
+
+	if (mapped_file)
+		mapped_file->release();
+	mapped_file = NULL;
+	mapped_bin = NULL;
 
 	if (collision_model)
 		delete (CollisionModel3D*)collision_model;
+	collision_model = NULL;
+}
+
+//vertex quantization *************************
+
+#ifndef GL_HALF_FLOAT
+	#define GL_HALF_FLOAT 0x140B
+#endif
+
+#define QUANTIZATION_MAX_POSITION_ERROR 0.0001f //relative to the aabb diagonal
+#define QUANTIZATION_MAX_UV_ERROR (1.0f / 2048.0f) //half texel in a 1024 texture
+
+//attributes keep 4 bytes alignment, positions use ushort4 with w unused
+void getInterleavedLayout(int quantization, int& stride, int& offset_normal, int& offset_uv)
+{
+	offset_normal = (quantization & QUANTIZE_POSITIONS) ? 8 : 12;
+	offset_uv = offset_normal + ((quantization & QUANTIZE_NORMALS) ? 4 : 12);
+	stride = offset_uv + ((quantization & QUANTIZE_UVS) ? 4 : 8);
+}
+
+inline Vector3 getQuantizationInvSize(const Vector3& min, const Vector3& max)
+{
+	Vector3 size = max - min;
+	return Vector3(size.x > 0.0f ? 1.0f / size.x : 0.0f, size.y > 0.0f ? 1.0f / size.y : 0.0f, size.z > 0.0f ? 1.0f / size.z : 0.0f);
+}
+
+inline void quantizePosition(const Vector3& v, const Vector3& min, const Vector3& inv_size, uint16* out)
+{
+	out[0] = (uint16)(clamp((v.x - min.x) * inv_size.x, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	out[1] = (uint16)(clamp((v.y - min.y) * inv_size.y, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	out[2] = (uint16)(clamp((v.z - min.z) * inv_size.z, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	out[3] = 0;
+}
+
+inline Vector3 dequantizePosition(const uint16* q, const Vector3& min, const Vector3& size)
+{
+	return Vector3(min.x + q[0] / 65535.0f * size.x, min.y + q[1] / 65535.0f * size.y, min.z + q[2] / 65535.0f * size.z);
+}
+
+inline float getHalfError(float v) { return fabsf(halfToFloat(floatToHalf(v)) - v); }
+
+inline float signNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+//the normal is projected to an octahedron and the lower half folded over the upper one
+inline void encodeOctahedral(const Vector3& n, int16* out)
+{
+	float l = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if (l == 0.0f)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	float x = n.x / l;
+	float y = n.y / l;
+	if (n.z < 0.0f)
+	{
+		float ox = x;
+		x = (1.0f - fabs(y)) * signNotZero(ox);
+		y = (1.0f - fabs(ox)) * signNotZero(y);
+	}
+	out[0] = (int16)floor(clamp(x, -1.0f, 1.0f) * 32767.0f + 0.5f);
+	out[1] = (int16)floor(clamp(y, -1.0f, 1.0f) * 32767.0f + 0.5f);
+}
+
+inline Vector3 decodeOctahedral(const int16* q)
+{
+	Vector3 n(clamp(q[0] / 32767.0f, -1.0f, 1.0f), clamp(q[1] / 32767.0f, -1.0f, 1.0f), 0.0f);
+	n.z = 1.0f - fabs(n.x) - fabs(n.y);
+	if (n.z < 0.0f)
+	{
+		float ox = n.x;
+		n.x = (1.0f - fabs(n.y)) * signNotZero(ox);
+		n.y = (1.0f - fabs(ox)) * signNotZero(n.y);
+	}
+	n.normalize();
+	return n;
+}
+
+void encodeInterleaved(const std::vector<Mesh::tInterleaved>& src, int quantization, const Vector3& min, const Vector3& max, std::vector<uint8>& out)
+{
+	int stride, offset_normal, offset_uv;
+	getInterleavedLayout(quantization, stride, offset_normal, offset_uv);
+	Vector3 inv_size = getQuantizationInvSize(min, max);
+	out.resize(src.size() * stride);
+	for (size_t i = 0; i < src.size(); ++i)
+	{
+		const Mesh::tInterleaved& v = src[i];
+		uint8* dst = &out[i * stride];
+		if (quantization & QUANTIZE_POSITIONS)
+			quantizePosition(v.vertex, min, inv_size, (uint16*)dst);
+		else
+			memcpy(dst, v.vertex.v, sizeof(Vector3));
+		if (quantization & QUANTIZE_NORMALS)
+			encodeOctahedral(v.normal, (int16*)(dst + offset_normal));
+		else
+			memcpy(dst + offset_normal, v.normal.v, sizeof(Vector3));
+		if (quantization & QUANTIZE_UVS)
+		{
+			uint16* uv = (uint16*)(dst + offset_uv);
+			uv[0] = floatToHalf(v.uv.x);
+			uv[1] = floatToHalf(v.uv.y);
+		}
+		else
+			memcpy(dst + offset_uv, v.uv.value, sizeof(Vector2));
+	}
+}
+
+void decodeInterleaved(const uint8* src, int num, int quantization, const Vector3& min, const Vector3& max, std::vector<Mesh::tInterleaved>& out)
+{
+	int stride, offset_normal, offset_uv;
+	getInterleavedLayout(quantization, stride, offset_normal, offset_uv);
+	out.resize(num);
+	for (int i = 0; i < num; ++i)
+	{
+		Mesh::tInterleaved& v = out[i];
+		const uint8* data = src + i * stride;
+		if (quantization & QUANTIZE_POSITIONS)
+			v.vertex = dequantizePosition((const uint16*)data, min, max - min);
+		else
+			memcpy(v.vertex.v, data, sizeof(Vector3));
+		if (quantization & QUANTIZE_NORMALS)
+			v.normal = decodeOctahedral((const int16*)(data + offset_normal));
+		else
+			memcpy(v.normal.v, data + offset_normal, sizeof(Vector3));
+		if (quantization & QUANTIZE_UVS)
+		{
+			const uint16* uv = (const uint16*)(data + offset_uv);
+			v.uv.set(halfToFloat(uv[0]), halfToFloat(uv[1]));
+		}
+		else
+			memcpy(v.uv.value, data + offset_uv, sizeof(Vector2));
+	}
+}
+
+void encodePositions(const std::vector<Vector3>& src, const Vector3& min, const Vector3& max, std::vector<uint8>& out)
+{
+	Vector3 inv_size = getQuantizationInvSize(min, max);
+	out.resize(src.size() * sizeof(uint16) * 4);
+	uint16* dst = (uint16*)&out[0];
+	for (size_t i = 0; i < src.size(); ++i)
+		quantizePosition(src[i], min, inv_size, dst + i * 4);
+}
+
+void decodePositions(const uint8* src, int num, const Vector3& min, const Vector3& max, std::vector<Vector3>& out)
+{
+	out.resize(num);
+	const uint16* q = (const uint16*)src;
+	for (int i = 0; i < num; ++i)
+		out[i] = dequantizePosition(q + i * 4, min, max - min);
+}
+
+void encodeNormals(const std::vector<Vector3>& src, std::vector<uint8>& out)
+{
+	out.resize(src.size() * sizeof(int16) * 2);
+	int16* dst = (int16*)&out[0];
+	for (size_t i = 0; i < src.size(); ++i)
+		encodeOctahedral(src[i], dst + i * 2);
+}
+
+void decodeNormals(const uint8* src, int num, std::vector<Vector3>& out)
+{
+	out.resize(num);
+	const int16* q = (const int16*)src;
+	for (int i = 0; i < num; ++i)
+		out[i] = decodeOctahedral(q + i * 2);
+}
+
+void encodeUVs(const std::vector<Vector2>& src, std::vector<uint8>& out)
+{
+	out.resize(src.size() * sizeof(uint16) * 2);
+	uint16* dst = (uint16*)&out[0];
+	for (size_t i = 0; i < src.size(); ++i)
+	{
+		dst[i * 2] = floatToHalf(src[i].x);
+		dst[i * 2 + 1] = floatToHalf(src[i].y);
+	}
+}
+
+void decodeUVs(const uint8* src, int num, std::vector<Vector2>& out)
+{
+	out.resize(num);
+	const uint16* q = (const uint16*)src;
+	for (int i = 0; i < num; ++i)
+		out[i].set(halfToFloat(q[i * 2]), halfToFloat(q[i * 2 + 1]));
+}
+
+void encodeColors(const std::vector<Vector4>& src, std::vector<uint8>& out)
+{
+	out.resize(src.size() * 4);
+	for (size_t i = 0; i < src.size(); ++i)
+		for (int j = 0; j < 4; ++j)
+			out[i * 4 + j] = (uint8)(clamp(src[i].v[j], 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void decodeColors(const uint8* src, int num, std::vector<Vector4>& out)
+{
+	out.resize(num);
+	for (int i = 0; i < num; ++i)
+		out[i].set(src[i * 4] / 255.0f, src[i * 4 + 1] / 255.0f, src[i * 4 + 2] / 255.0f, src[i * 4 + 3] / 255.0f);
+}
+
+void encodeShortIndices(const std::vector<unsigned int>& src, std::vector<uint8>& out)
+{
+	out.resize(src.size() * sizeof(uint16));
+	uint16* dst = (uint16*)&out[0];
+	for (size_t i = 0; i < src.size(); ++i)
+		dst[i] = (uint16)src[i];
+}
+
+void decodeShortIndices(const uint8* src, int num, std::vector<unsigned int>& out)
+{
+	out.resize(num);
+	const uint16* q = (const uint16*)src;
+	for (int i = 0; i < num; ++i)
+		out[i] = q[i];
+}
+
+unsigned int Mesh::getVertexSize(int quantization)
+{
+	bool is_interleaved = interleaved.size() != 0;
+	unsigned int size = (quantization & QUANTIZE_POSITIONS) ? 8 : 12;
+	if (is_interleaved || normals.size())
+		size += (quantization & QUANTIZE_NORMALS) ? 4 : 12;
+	if (is_interleaved || uvs.size())
+		size += (quantization & QUANTIZE_UVS) ? 4 : 8;
+	if (m_uvs1.size())
+		size += (quantization & QUANTIZE_UVS) ? 4 : 8;
+	if (colors.size() || source_colors.size())
+		size += (quantization & QUANTIZE_COLORS) ? 4 : 16;
+	if (bones.size())
+		size += sizeof(Vector4ub);
+	if (weights.size())
+		size += sizeof(Vector4);
+	return size;
+}
+
+int Mesh::chooseQuantization()
+{
+	if (!isMaterialized())
+		materializeStreams();
+
+	quantization = 0;
+	int num = getNumVertices();
+	if (!num)
+		return 0;
+
+	//positions are stored relative to the aabb so it must be exact
+	updateBoundingBox();
+	Vector3 size = aabb_max - aabb_min;
+	Vector3 inv_size = getQuantizationInvSize(aabb_min, aabb_max);
+
+	bool is_interleaved = interleaved.size() != 0;
+	bool has_normals = is_interleaved || normals.size();
+	bool has_uvs = is_interleaved || uvs.size() || m_uvs1.size();
+	float max_position_error = 0.0f;
+	float max_uv_error = 0.0f;
+
+	for (int i = 0; i < num; ++i)
+	{
+		const Vector3& v = is_interleaved ? interleaved[i].vertex : vertices[i];
+		uint16 q[4];
+		quantizePosition(v, aabb_min, inv_size, q);
+		max_position_error = std::max(max_position_error, (float)(dequantizePosition(q, aabb_min, size) - v).length());
+
+		//degenerated normals would not survive the encoding
+		if (has_normals)
+		{
+			const Vector3& n = is_interleaved ? interleaved[i].normal : normals[i];
+			if (n.length() < 0.5f)
+				has_normals = false;
+		}
+
+		Vector2 uv = is_interleaved ? interleaved[i].uv : uvs.size() ? uvs[i] : Vector2();
+		max_uv_error = std::max(max_uv_error, std::max(getHalfError(uv.x), getHalfError(uv.y)));
+		if (m_uvs1.size())
+		{
+			const Vector2& uv1 = m_uvs1[i];
+			max_uv_error = std::max(max_uv_error, std::max(getHalfError(uv1.x), getHalfError(uv1.y)));
+		}
+	}
+
+	//HDR colors cannot be stored in RGBA8
+	bool valid_colors = colors.size() != 0;
+	for (size_t i = 0; i < colors.size() && valid_colors; ++i)
+		for (int j = 0; j < 4; ++j)
+			if (colors[i].v[j] < 0.0f || colors[i].v[j] > 1.0f)
+				valid_colors = false;
+
+	if (max_position_error <= size.length() * QUANTIZATION_MAX_POSITION_ERROR)
+		quantization |= QUANTIZE_POSITIONS;
+	if (has_normals)
+		quantization |= QUANTIZE_NORMALS;
+	if (has_uvs && max_uv_error <= QUANTIZATION_MAX_UV_ERROR)
+		quantization |= QUANTIZE_UVS;
+	if (valid_colors)
+		quantization |= QUANTIZE_COLORS;
+	return quantization;
 }
 
 int vertex_location = -1;
@@ -124,16 +467,28 @@ void Mesh::enableBuffers(Shader* sh)
 		return;
 	*/
 
+	//layout of the data in the VBOs, streams in RAM are always floats
+	int layout = (vertices_vbo_id || interleaved_vbo_id) ? quantization : 0;
+
 	int spacing = 0;
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	if (interleaved.size() || interleaved_vbo_id)
+		getInterleavedLayout(layout, spacing, offset_normal, offset_uv);
+
+	//decoding parameters for quantized meshes, see basic.vs
+	if (layout & QUANTIZE_POSITIONS)
 	{
-		spacing = sizeof(tInterleaved);
-		offset_normal = sizeof(Vector3);
-		offset_uv = sizeof(Vector3) + sizeof(Vector3);
+		sh->setUniform("u_quant_pos_offset", quant_offset);
+		sh->setUniform("u_quant_pos_scale", quant_scale);
 	}
+	else
+	{
+		sh->setUniform("u_quant_pos_offset", Vector3(0.0f, 0.0f, 0.0f));
+		sh->setUniform("u_quant_pos_scale", Vector3(1.0f, 1.0f, 1.0f));
+	}
+	sh->setUniform("u_quant_oct_normals", (layout & QUANTIZE_NORMALS) != 0);
 
 	if (vertex_location != -1)
 	{
@@ -141,7 +496,10 @@ void Mesh::enableBuffers(Shader* sh)
 		if (vertices_vbo_id || interleaved_vbo_id)
 		{
 			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+			if (layout & QUANTIZE_POSITIONS)
+				glVertexAttribPointer(vertex_location, 3, GL_UNSIGNED_SHORT, GL_TRUE, spacing ? spacing : sizeof(uint16) * 4, 0);
+			else
+				glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
 		}
 		else
 			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
@@ -149,7 +507,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	normal_location = -1;
-	if (normals.size() || spacing)
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -158,7 +516,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				if (layout & QUANTIZE_NORMALS)
+					glVertexAttribPointer(normal_location, 2, GL_SHORT, GL_TRUE, spacing, (void*)(size_t)offset_normal);
+				else
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)(size_t)offset_normal);
 			}
 			else
 				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
@@ -167,7 +528,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv_location = -1;
-	if (uvs.size() || spacing)
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = sh->getAttribLocation("a_coord");
 		if (uv_location != -1)
@@ -176,7 +537,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				if (layout & QUANTIZE_UVS)
+					glVertexAttribPointer(uv_location, 2, GL_HALF_FLOAT, GL_FALSE, spacing, (void*)(size_t)offset_uv);
+				else
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)(size_t)offset_uv);
 			}
 			else
 				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
@@ -185,7 +549,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv1_location = -1;
-	if (m_uvs1.size())
+	if (m_uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = sh->getAttribLocation("a_coord1");
 		if (uv1_location != -1)
@@ -194,7 +558,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs1_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+				glVertexAttribPointer(uv1_location, 2, (layout & QUANTIZE_UVS) ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, 0, (void*)0);
 			}
 			else
 				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, &m_uvs1[0]);
@@ -203,7 +567,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -212,7 +576,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (colors_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				if (layout & QUANTIZE_COLORS)
+					glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+				else
+					glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
@@ -221,7 +588,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -237,7 +604,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -265,7 +632,7 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
@@ -282,31 +649,27 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 {
+	bool indexed = getNumIndices() != 0;
 	int start = 0; //in primitives
-	int size = (int)vertices.size();
-	if (m_indices.size())
-		size = (int)m_indices.size();
-	else
-	if (interleaved.size())
-		size = (int)interleaved.size();
+	int size = indexed ? (int)getLODRange(0).length : (int)getNumVertices();
 
 	if (submesh_id > -1)
 	{
 		assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
 		sSubmeshInfo& submesh = submeshes[submesh_id];
 		start = submesh.start;
-		size = submesh.start + submesh.length;
+		size = submesh.length;
 	}
 
 	//DRAW
-	if (m_indices.size())
+	if (indexed)
 	{
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3u)), num_instances);
+				glDrawElementsInstanced(primitive, size, index_bytes == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(start * index_bytes), num_instances);
             #else
 				assert(0 && "not supported in OpenGL ES2");
             #endif
@@ -318,13 +681,13 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 			{
 				/*if (size != 90)*/ {
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
+					glDrawElements(primitive, size, index_bytes == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void *)(size_t)(start * index_bytes));
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 				}
 				checkGLErrors();
 			}
 			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its an unsigned int pointer
 		}
 	}
 	else
@@ -345,6 +708,121 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 	num_meshes_rendered++;
 }
 
+sDrawRange Mesh::getLODRange(int lod)
+{
+	sDrawRange range;
+	range.start = 0;
+	range.length = getNumIndices();
+	if (lods.size())
+	{
+		const sMeshLOD& level = lods[std::max(0, std::min(lod, (int)lods.size() - 1))];
+		range.start = level.start;
+		range.length = level.length;
+	}
+	return range;
+}
+
+//reused between calls to avoid allocations every frame
+std::vector<GLsizei> draw_ranges_counts;
+std::vector<const void*> draw_ranges_offsets;
+
+void Mesh::drawRanges(unsigned int primitive, const std::vector<sDrawRange>& ranges)
+{
+	if (ranges.empty())
+		return;
+
+	int num_indices = 0;
+	if (indices_vbo_id)
+	{
+		draw_ranges_counts.resize(ranges.size());
+		draw_ranges_offsets.resize(ranges.size());
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			draw_ranges_counts[i] = ranges[i].length;
+			draw_ranges_offsets[i] = (const void*)(size_t)(ranges[i].start * index_bytes);
+			num_indices += ranges[i].length;
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+		glMultiDrawElements(primitive, &draw_ranges_counts[0], index_bytes == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, &draw_ranges_offsets[0], (GLsizei)ranges.size());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else
+	{
+		assert(m_indices.size() && "ranges can only be used with indexed meshes");
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			glDrawElements(primitive, ranges[i].length, GL_UNSIGNED_INT, (void*)(&m_indices[0] + ranges[i].start));
+			num_indices += ranges[i].length;
+		}
+	}
+	checkGLErrors();
+
+	num_triangles_rendered += num_indices / 3;
+	num_meshes_rendered++;
+}
+
+void Mesh::renderRanges(unsigned int primitive, const std::vector<sDrawRange>& ranges)
+{
+	Shader* shader = Shader::current;
+	if (!shader || !shader->compiled)
+	{
+		assert(0 && "no shader or shader not compiled or enabled");
+		return;
+	}
+
+	enableBuffers(shader);
+	drawRanges(primitive, ranges);
+	disableBuffers(shader);
+	checkGLErrors();
+}
+
+bool Mesh::cullMeshlets(const Matrix44& model, Camera* camera, std::vector<sDrawRange>& ranges, bool cone_culling)
+{
+	ranges.clear();
+
+	//bounds are in local space, the radius grows with the biggest scale of the model
+	const float* m = model.m;
+	float scale = sqrtf(std::max(m[0] * m[0] + m[1] * m[1] + m[2] * m[2], std::max(m[4] * m[4] + m[5] * m[5] + m[6] * m[6], m[8] * m[8] + m[9] * m[9] + m[10] * m[10])));
+	Vector3 view_dir = camera->center - camera->eye;
+	view_dir.normalize();
+
+	for (size_t i = 0; i < meshlets.size(); ++i)
+	{
+		const sMeshlet& meshlet = meshlets[i];
+		if (!camera->testSphereInFrustum(model * meshlet.center, meshlet.radius * scale))
+			continue;
+
+		//all its triangles face away from the camera (the cone is not exact with non uniform scales)
+		if (cone_culling && meshlet.cone_cutoff < 1.0f)
+		{
+			Vector3 axis = model.rotateVector(meshlet.cone_axis);
+			axis.normalize();
+			Vector3 dir = view_dir; //orthographic cameras look from the same direction everywhere
+			if (camera->type == Camera::PERSPECTIVE)
+			{
+				dir = model * meshlet.cone_apex - camera->eye;
+				dir.normalize();
+			}
+			if (dot(dir, axis) >= meshlet.cone_cutoff)
+				continue;
+		}
+
+		//meshlets are contiguous, merge them to reduce the number of draws
+		if (ranges.size() && ranges.back().start + ranges.back().length == meshlet.start)
+			ranges.back().length += meshlet.length;
+		else
+		{
+			sDrawRange range;
+			range.start = meshlet.start;
+			range.length = meshlet.length;
+			ranges.push_back(range);
+		}
+	}
+
+	return ranges.size() != 0;
+}
+
 void Mesh::disableBuffers(Shader* shader)
 {
 	if (vertex_location != -1) glDisableVertexAttribArray(vertex_location);
@@ -499,9 +977,20 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 #define GL_ARRAY_BUFFER_ARB GL_ARRAY_BUFFER
 #define GL_STATIC_DRAW_ARB GL_STATIC_DRAW
 
+void uploadBuffer(unsigned int& vbo_id, unsigned int target, const void* data, size_t bytes)
+{
+	if (vbo_id == 0)
+		glGenBuffersARB(1, &vbo_id);
+	glBindBufferARB(target, vbo_id);
+	glBufferDataARB(target, bytes, data, GL_STATIC_DRAW_ARB);
+	glBindBufferARB(target, 0);
+}
+
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	if (mapped_bin)
+		materializeStreams();
+	assert(vertices.size() || interleaved.size() || source_vertices.size());
 
 	if (glGenBuffersARB == nullptr)
 	{
@@ -509,85 +998,109 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
+	std::vector<uint8> encoded; //streams using a compressed layout
+
 	if (interleaved.size())
 	{
 		// Vertex,Normal,UV
-		if (interleaved_vbo_id == 0)
-			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		if (quantization & (QUANTIZE_POSITIONS | QUANTIZE_NORMALS | QUANTIZE_UVS))
+		{
+			encodeInterleaved(interleaved, quantization, aabb_min, aabb_max, encoded);
+			uploadBuffer(interleaved_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+			quant_offset = aabb_min;
+			quant_scale = aabb_max - aabb_min;
+		}
+		else
+			uploadBuffer(interleaved_vbo_id, GL_ARRAY_BUFFER_ARB, &interleaved[0], interleaved.size() * sizeof(tInterleaved));
 	}
 	else
 	{
-		// Vertices
-		if (vertices_vbo_id == 0)
-			glGenBuffersARB(1, &vertices_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
+		// Vertices, the ones in the source layout already have their quant_offset and quant_scale
+		if (source_vertices.size())
+			uploadBuffer(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, &source_vertices[0], source_vertices.size());
+		else if (quantization & QUANTIZE_POSITIONS)
+		{
+			encodePositions(vertices, aabb_min, aabb_max, encoded);
+			uploadBuffer(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+			quant_offset = aabb_min;
+			quant_scale = aabb_max - aabb_min;
+		}
+		else
+			uploadBuffer(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, &vertices[0], vertices.size() * sizeof(Vector3));
 
 		// UVs
 		if (uvs.size())
 		{
-			if (uvs_vbo_id == 0)
-				glGenBuffersARB(1, &uvs_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			if (quantization & QUANTIZE_UVS)
+			{
+				encodeUVs(uvs, encoded);
+				uploadBuffer(uvs_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+			}
+			else
+				uploadBuffer(uvs_vbo_id, GL_ARRAY_BUFFER_ARB, &uvs[0], uvs.size() * sizeof(Vector2));
 		}
 
 		// Normals
 		if (normals.size())
 		{
-			if (normals_vbo_id == 0)
-				glGenBuffersARB(1, &normals_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			if (quantization & QUANTIZE_NORMALS)
+			{
+				encodeNormals(normals, encoded);
+				uploadBuffer(normals_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+			}
+			else
+				uploadBuffer(normals_vbo_id, GL_ARRAY_BUFFER_ARB, &normals[0], normals.size() * sizeof(Vector3));
 		}
 	}
 
 	// UVs
 	if (m_uvs1.size())
 	{
-		if (uvs1_vbo_id == 0)
-			glGenBuffersARB(1, &uvs1_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2), &m_uvs1[0], GL_STATIC_DRAW_ARB);
+		if (quantization & QUANTIZE_UVS)
+		{
+			encodeUVs(m_uvs1, encoded);
+			uploadBuffer(uvs1_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+		}
+		else
+			uploadBuffer(uvs1_vbo_id, GL_ARRAY_BUFFER_ARB, &m_uvs1[0], m_uvs1.size() * sizeof(Vector2));
 	}
 
 	// Colors
-	if (colors.size())
+	if (source_colors.size())
+		uploadBuffer(colors_vbo_id, GL_ARRAY_BUFFER_ARB, &source_colors[0], source_colors.size());
+	else if (colors.size())
 	{
-		if (colors_vbo_id == 0)
-			glGenBuffersARB(1, &colors_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
+		if (quantization & QUANTIZE_COLORS)
+		{
+			encodeColors(colors, encoded);
+			uploadBuffer(colors_vbo_id, GL_ARRAY_BUFFER_ARB, &encoded[0], encoded.size());
+		}
+		else
+			uploadBuffer(colors_vbo_id, GL_ARRAY_BUFFER_ARB, &colors[0], colors.size() * sizeof(Vector4));
 	}
 
 	if (bones.size())
-	{
-		if (bones_vbo_id == 0)
-			glGenBuffersARB(1, &bones_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
-	}
+		uploadBuffer(bones_vbo_id, GL_ARRAY_BUFFER_ARB, &bones[0], bones.size() * sizeof(Vector4ub));
 	if (weights.size())
-	{
-		if (weights_vbo_id == 0)
-			glGenBuffersARB(1, &weights_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
-	}
+		uploadBuffer(weights_vbo_id, GL_ARRAY_BUFFER_ARB, &weights[0], weights.size() * sizeof(Vector4));
 
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-
-	// Indices
+	// Indices, 16 bits when possible
+	index_bytes = getNumVertices() <= 65536 ? 2 : 4;
 	if (m_indices.size())
 	{
-		if (indices_vbo_id == 0)
-			glGenBuffersARB(1, &indices_vbo_id);
-		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
+		if (index_bytes == 2)
+		{
+			encodeShortIndices(m_indices, encoded);
+			uploadBuffer(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, &encoded[0], encoded.size());
+		}
+		else
+			uploadBuffer(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, &m_indices[0], m_indices.size() * sizeof(unsigned int));
 	}
-	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	gpu_num_vertices = getNumVertices();
+	gpu_num_indices = (unsigned int)m_indices.size();
+	if (quantization)
+		quantization_saved_vram += gpu_num_vertices * (getVertexSize(0) - getVertexSize(quantization));
 
 	checkGLErrors();
 	//clear buffers to save memory
@@ -598,14 +1111,18 @@ bool Mesh::createCollisionModel(bool is_static)
 	if (collision_model)
 		return true;
 
+	if (!isMaterialized())
+		materializeStreams();
+
 	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
 
 	if (m_indices.size()) //indexed
 	{
-		collision_model->setTriangleNumber((int)m_indices.size() / 3);
+		unsigned int num_indices = getLODRange(0).length; //the simplified levels are not used for collisions
+		collision_model->setTriangleNumber((int)num_indices / 3);
 
 		if (interleaved.size())
-			for (unsigned int i = 0; i < m_indices.size(); i+=3)
+			for (unsigned int i = 0; i < num_indices; i+=3)
 			{
 				auto v1 = interleaved[m_indices[i+0]];
 				auto v2 = interleaved[m_indices[i+1]];
@@ -613,7 +1130,7 @@ bool Mesh::createCollisionModel(bool is_static)
 				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
 			}
 		else
-		for (unsigned int i = 0; i < m_indices.size(); i+=3)
+		for (unsigned int i = 0; i < num_indices; i+=3)
 		{
 			auto v1 = vertices[m_indices[i+0]];
 			auto v2 = vertices[m_indices[i+1]];
@@ -696,95 +1213,502 @@ bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vec
 	if (collision_model->sphereCollision(center.v, radius) == false)
 		return false;
 
-	collision_model->getCollisionPoint(collision.v, false);
-
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
-
-	Vector3 v1;
-	Vector3 v2;
-	v1 = Vector3(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	collision_model->getCollisionPoint(collision.v, false);
+
+	float t1[9], t2[9];
+	collision_model->getCollidingTriangles(t1, t2, false);
+
+	Vector3 v1;
+	Vector3 v2;
+	v1 = Vector3(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
+	v2 = Vector3(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
+	v1.normalize();
+	v2.normalize();
+	normal = v1.cross(v2);
+
+	return true;
+}
+
+bool Mesh::interleaveBuffers()
+{
+	if (!isMaterialized())
+		materializeStreams();
+
+	if (!vertices.size() || !normals.size() || !uvs.size())
+		return false;
+
+	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
+
+	interleaved.resize(vertices.size());
+
+	for (unsigned int i = 0; i < vertices.size(); ++i)
+	{
+		interleaved[i].vertex = vertices[i];
+		interleaved[i].normal = normals[i];
+		interleaved[i].uv = uvs[i];
+	}
+
+	vertices.resize(0);
+	normals.resize(0);
+	uvs.resize(0);
+
+	return true;
+}
+
+//FNV-1a of the attributes of a vertex
+inline unsigned int hashVertexKey(const float* key, int size)
+{
+	const unsigned char* bytes = (const unsigned char*)key;
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < size * (int)sizeof(float); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+template<typename T> void compactStream(std::vector<T>& stream, const std::vector<unsigned int>& unique)
+{
+	if (!stream.size())
+		return;
+	std::vector<T> result(unique.size());
+	for (size_t i = 0; i < unique.size(); ++i)
+		result[i] = stream[unique[i]];
+	stream.swap(result);
+}
+
+bool Mesh::weldVertices()
+{
+	if (!isMaterialized())
+		materializeStreams();
+
+	bool is_interleaved = interleaved.size() != 0;
+	size_t num = getNumVertices();
+	if (!num)
+		return false;
+
+	//all the streams must have one element per vertex
+	if ((normals.size() && normals.size() != num) || (uvs.size() && uvs.size() != num) || (m_uvs1.size() && m_uvs1.size() != num) ||
+		(colors.size() && colors.size() != num) || (bones.size() && bones.size() != num) || (weights.size() && weights.size() != num))
+		return false;
+
+	//every vertex is flattened to a key with all its attributes
+	int key_size = is_interleaved ? 8 : 3 + (normals.size() ? 3 : 0) + (uvs.size() ? 2 : 0);
+	key_size += (m_uvs1.size() ? 2 : 0) + (colors.size() ? 4 : 0) + (weights.size() ? 4 : 0);
+	int float_key_size = key_size;
+	key_size += bones.size() ? 1 : 0;
+
+	std::vector<float> keys(num * key_size);
+	for (size_t i = 0; i < num; ++i)
+	{
+		float* key = &keys[i * key_size];
+		float* pos = key;
+		if (is_interleaved)
+		{
+			memcpy(pos, &interleaved[i], sizeof(tInterleaved));
+			pos += 8;
+		}
+		else
+		{
+			memcpy(pos, vertices[i].v, sizeof(Vector3)); pos += 3;
+			if (normals.size()) { memcpy(pos, normals[i].v, sizeof(Vector3)); pos += 3; }
+			if (uvs.size()) { memcpy(pos, uvs[i].value, sizeof(Vector2)); pos += 2; }
+		}
+		if (m_uvs1.size()) { memcpy(pos, m_uvs1[i].value, sizeof(Vector2)); pos += 2; }
+		if (colors.size()) { memcpy(pos, colors[i].v, sizeof(Vector4)); pos += 4; }
+		if (weights.size()) { memcpy(pos, weights[i].v, sizeof(Vector4)); pos += 4; }
+
+		//-0 and 0 must produce the same key
+		for (int j = 0; j < float_key_size; ++j)
+			if (key[j] == 0.0f)
+				key[j] = 0.0f;
+
+		if (bones.size())
+			memcpy(pos, &bones[i], sizeof(Vector4ub));
+	}
+
+	//open addressing table that stores the position in 'unique' of every different key
+	size_t table_size = 1;
+	while (table_size < num * 2)
+		table_size <<= 1;
+	std::vector<int> table(table_size, -1);
+	std::vector<unsigned int> remap(num);
+	std::vector<unsigned int> unique; //first vertex with every key
+	unique.reserve(num);
+
+	for (size_t i = 0; i < num; ++i)
+	{
+		const float* key = &keys[i * key_size];
+		size_t slot = hashVertexKey(key, key_size) & (table_size - 1);
+		while (true)
+		{
+			int u = table[slot];
+			if (u == -1)
+			{
+				table[slot] = (int)unique.size();
+				remap[i] = (unsigned int)unique.size();
+				unique.push_back((unsigned int)i);
+				break;
+			}
+			if (memcmp(&keys[unique[u] * key_size], key, key_size * sizeof(float)) == 0)
+			{
+				remap[i] = u;
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+
+	//nothing to share, an index buffer would only add memory
+	if (unique.size() == num && !m_indices.size())
+		return false;
+
+	compactStream(interleaved, unique);
+	compactStream(vertices, unique);
+	compactStream(normals, unique);
+	compactStream(uvs, unique);
+	compactStream(m_uvs1, unique);
+	compactStream(colors, unique);
+	compactStream(bones, unique);
+	compactStream(weights, unique);
+
+	//the submesh ranges stay valid, the index of every corner is in the same place the vertex was
+	if (m_indices.size())
+		for (size_t i = 0; i < m_indices.size(); ++i)
+			m_indices[i] = remap[m_indices[i]];
+	else
+		m_indices.swap(remap);
+
+	return true;
+}
+
+//MBIN v12: "MBIN" + sMeshInfo + one section per stream, every section starts aligned from the beginning of the bin
+//so the streams can be uploaded or used straight from a memory mapping
+#define MBIN_STREAM_ALIGNMENT 4096
+#define MBIN_MAX_STREAMS 16
+
+#define MBIN_SHORT_INDICES 1 //format of the indices stream when stored as 16 bits
+
+enum eMeshBinStream {
+	MBIN_INTERLEAVED,
+	MBIN_VERTICES,
+	MBIN_NORMALS,
+	MBIN_UVS,
+	MBIN_UVS1,
+	MBIN_COLORS,
+	MBIN_INDICES,
+	MBIN_BONES,
+	MBIN_WEIGHTS,
+	MBIN_BONES_INFO,
+	MBIN_SUBMESHES,
+	MBIN_MESHLETS,
+	MBIN_LODS
+};
+
+typedef struct
+{
+	unsigned int offset; //from the start of the bin (the watermark)
+	unsigned int bytes;
+	unsigned int format; //eVertexQuantization flags used by the stream (MBIN_SHORT_INDICES for indices), 0: same layout as in memory
+	unsigned int reserved;
+} sMeshStreamInfo;
+
+typedef struct 
+{
+	int version;
+	int header_bytes;
+	int size;
+	int num_indices;
+	Vector3 aabb_min;
+	Vector3	aabb_max;
+	Vector3	center;
+	Vector3	halfsize;
+	float radius;
+	int num_bones;
+	int num_submeshes;
+	Matrix44 bind_matrix;
+	sMeshStreamInfo streams[MBIN_MAX_STREAMS];
+	float uv_density; //0 in older files
+	char extra[28]; //unused
+} sMeshInfo;
+
+//header of the old format, only used to read v11 files
+typedef struct 
+{
+	int version;
+	int header_bytes;
+	int size;
+	int num_indices;
+	Vector3 aabb_min;
+	Vector3	aabb_max;
+	Vector3	center;
+	Vector3	halfsize;
+	float radius;
+	int num_bones;
+	int num_submeshes;
+	Matrix44 bind_matrix;
+	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
+	char extra[32]; //unused
+} sMeshInfoV11;
+
+bool Mesh::readBin(const char* filename, bool bFromNetwork)
+{
+	assert(filename);
+
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		file->release();
+		return false;
+	}
+
+	bool result = readBinFromMemory(file->data, file->size, file);
+	if(!result)
+		std::cout << "[ERROR] loading BIN: " << filename << std::endl;
+
+	file->release(); //the mesh keeps its own reference if it still needs the data
+	return result;
+}
+
+template<typename T> void copyBinStream(std::vector<T>& dst, const char* bin, const sMeshStreamInfo& stream)
+{
+	dst.resize(stream.bytes / sizeof(T));
+	if (dst.size())
+		memcpy((void*)&dst[0], bin + stream.offset, dst.size() * sizeof(T));
+}
+
+//bytes of every element of a stream in the given format, the decoders and the GPU read info.size or info.num_indices of them
+static size_t getBinStreamStride(int stream, unsigned int format)
+{
+	int stride, offset_normal, offset_uv;
+	switch (stream)
+	{
+		case MBIN_INTERLEAVED:
+			if (!format)
+				return sizeof(Mesh::tInterleaved);
+			getInterleavedLayout(format, stride, offset_normal, offset_uv);
+			return stride;
+		case MBIN_VERTICES: return format ? sizeof(uint16) * 4 : sizeof(Vector3);
+		case MBIN_NORMALS: return format ? sizeof(int16) * 2 : sizeof(Vector3);
+		case MBIN_UVS:
+		case MBIN_UVS1: return format ? sizeof(uint16) * 2 : sizeof(Vector2);
+		case MBIN_COLORS: return format ? 4 : sizeof(Vector4);
+		case MBIN_INDICES: return format == MBIN_SHORT_INDICES ? sizeof(uint16) : sizeof(unsigned int);
+		case MBIN_BONES: return sizeof(Vector4ub);
+		case MBIN_WEIGHTS: return sizeof(Vector4);
+	}
+	return 0;
+}
+
+template<typename T> bool checkBinRanges(const std::vector<T>& ranges, size_t max)
+{
+	for (size_t i = 0; i < ranges.size(); ++i)
+		if ((long long)ranges[i].start < 0 || (long long)ranges[i].length < 0 || (size_t)ranges[i].start + (size_t)ranges[i].length > max)
+			return false;
+	return true;
+}
+
+bool Mesh::readBinFromMemory(const char* data, size_t size, MappedFile* owner)
+{
+	//watermark
+	if (size < 8 || memcmp(data, "MBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading BIN: invalid content" << std::endl;
+		return false;
+	}
+
+	int version = 0;
+	memcpy(&version, data + 4, sizeof(int));
+	if (version == 11)
+		return readBinV11(data, size);
+
+	sMeshInfo info;
+	if (version != MESH_BIN_VERSION || size < 4 + sizeof(sMeshInfo))
+	{
+		std::cout << "[WARN] loading BIN: old version" << std::endl;
+		return false;
+	}
+	memcpy(&info, data + 4, sizeof(sMeshInfo));
+	if (info.header_bytes != sizeof(sMeshInfo))
+	{
+		std::cout << "[WARN] loading BIN: old version" << std::endl;
+		return false;
+	}
+
+	for (int i = 0; i < MBIN_MAX_STREAMS; ++i)
+		if (info.streams[i].bytes && (size_t)info.streams[i].offset + info.streams[i].bytes > size)
+		{
+			std::cout << "[ERROR] loading BIN: truncated file" << std::endl;
+			return false;
+		}
+
+	//the streams must have all the elements of the header
+	if (info.size < 0 || info.num_indices < 0)
+	{
+		std::cout << "[ERROR] loading BIN: wrong counts" << std::endl;
+		return false;
+	}
+	for (int i = MBIN_INTERLEAVED; i <= MBIN_WEIGHTS; ++i)
+	{
+		size_t count = i == MBIN_INDICES ? info.num_indices : info.size;
+		if (info.streams[i].bytes && info.streams[i].bytes < count * getBinStreamStride(i, info.streams[i].format))
+		{
+			std::cout << "[ERROR] loading BIN: stream smaller than its elements" << std::endl;
+			return false;
+		}
+	}
+
+	aabb_max = info.aabb_max;
+	aabb_min = info.aabb_min;
+	box.center = info.center;
+	box.halfsize = info.halfsize;
+	radius = info.radius;
+	bind_matrix = info.bind_matrix;
+	uv_density = info.uv_density > 0 ? info.uv_density : -1;
+
+	//compressed layouts are stored in the format of every stream
+	quantization = 0;
+	for (int i = MBIN_INTERLEAVED; i <= MBIN_COLORS; ++i)
+		quantization |= info.streams[i].format;
+	index_bytes = info.streams[MBIN_INDICES].format == MBIN_SHORT_INDICES ? 2 : 4;
+
+	//small tables are always copied
+	copyBinStream(bones_info, data, info.streams[MBIN_BONES_INFO]);
+	copyBinStream(submeshes, data, info.streams[MBIN_SUBMESHES]);
+	copyBinStream(meshlets, data, info.streams[MBIN_MESHLETS]);
+	copyBinStream(lods, data, info.streams[MBIN_LODS]);
+
+	//the ranges that are drawn must be inside the index buffer (or the vertices when there are no indices)
+	size_t num_elements = info.streams[MBIN_INDICES].bytes ? info.num_indices : info.size;
+	if (!checkBinRanges(submeshes, num_elements) || !checkBinRanges(meshlets, info.num_indices) || !checkBinRanges(lods, info.num_indices))
+	{
+		std::cout << "[ERROR] loading BIN: draw ranges out of bounds" << std::endl;
+		submeshes.clear();
+		meshlets.clear();
+		lods.clear();
+		bones_info.clear();
+		return false;
+	}
+
+	mapped_bin = data;
+	if (owner && auto_upload_to_vram)
+	{
+		//zero copy: the VBOs are filled from the mapping, RAM streams are created only if something needs them
+		mapped_file = owner;
+		owner->addRef();
+		uploadFromBin(data);
+	}
+	else
+		materializeStreams();
 
 	return true;
 }
 
-bool Mesh::interleaveBuffers()
+bool Mesh::materializeStreams()
 {
-	if (!vertices.size() || !normals.size() || !uvs.size())
-		return false;
-
-	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
-
-	interleaved.resize(vertices.size());
-
-	for (unsigned int i = 0; i < vertices.size(); ++i)
+	//streams in the source layout
+	if (source_vertices.size())
 	{
-		interleaved[i].vertex = vertices[i];
-		interleaved[i].normal = normals[i];
-		interleaved[i].uv = uvs[i];
+		decodePositions(&source_vertices[0], (int)source_vertices.size() / 8, quant_offset, quant_offset + quant_scale, vertices);
+		std::vector<uint8>().swap(source_vertices);
+	}
+	if (source_colors.size())
+	{
+		decodeColors(&source_colors[0], (int)source_colors.size() / 4, colors);
+		std::vector<uint8>().swap(source_colors);
 	}
 
-	vertices.resize(0);
-	normals.resize(0);
-	uvs.resize(0);
+	if (!mapped_bin)
+		return true;
+
+	sMeshInfo info;
+	memcpy(&info, mapped_bin + 4, sizeof(sMeshInfo));
+
+	const sMeshStreamInfo* streams = info.streams;
+	const uint8* bin = (const uint8*)mapped_bin;
 
+	//quantized streams are decoded back to floats
+	if (streams[MBIN_INTERLEAVED].format)
+		decodeInterleaved(bin + streams[MBIN_INTERLEAVED].offset, info.size, streams[MBIN_INTERLEAVED].format, info.aabb_min, info.aabb_max, interleaved);
+	else
+		copyBinStream(interleaved, mapped_bin, streams[MBIN_INTERLEAVED]);
+	if (streams[MBIN_VERTICES].format)
+		decodePositions(bin + streams[MBIN_VERTICES].offset, info.size, info.aabb_min, info.aabb_max, vertices);
+	else
+		copyBinStream(vertices, mapped_bin, streams[MBIN_VERTICES]);
+	if (streams[MBIN_NORMALS].format)
+		decodeNormals(bin + streams[MBIN_NORMALS].offset, info.size, normals);
+	else
+		copyBinStream(normals, mapped_bin, streams[MBIN_NORMALS]);
+	if (streams[MBIN_UVS].format)
+		decodeUVs(bin + streams[MBIN_UVS].offset, info.size, uvs);
+	else
+		copyBinStream(uvs, mapped_bin, streams[MBIN_UVS]);
+	if (streams[MBIN_UVS1].format)
+		decodeUVs(bin + streams[MBIN_UVS1].offset, info.size, m_uvs1);
+	else
+		copyBinStream(m_uvs1, mapped_bin, streams[MBIN_UVS1]);
+	if (streams[MBIN_COLORS].format)
+		decodeColors(bin + streams[MBIN_COLORS].offset, info.size, colors);
+	else
+		copyBinStream(colors, mapped_bin, streams[MBIN_COLORS]);
+	if (streams[MBIN_INDICES].format == MBIN_SHORT_INDICES)
+		decodeShortIndices(bin + streams[MBIN_INDICES].offset, info.num_indices, m_indices);
+	else
+		copyBinStream(m_indices, mapped_bin, streams[MBIN_INDICES]);
+	copyBinStream(bones, mapped_bin, info.streams[MBIN_BONES]);
+	copyBinStream(weights, mapped_bin, info.streams[MBIN_WEIGHTS]);
+
+	//the mapping is not needed anymore
+	mapped_bin = NULL;
+	if (mapped_file)
+		mapped_file->release();
+	mapped_file = NULL;
 	return true;
 }
 
-typedef struct 
+void uploadBinStream(unsigned int& vbo_id, unsigned int target, const char* bin, const sMeshStreamInfo& stream)
 {
-	int version;
-	int header_bytes;
-	int size;
-	int num_indices;
-	Vector3 aabb_min;
-	Vector3	aabb_max;
-	Vector3	center;
-	Vector3	halfsize;
-	float radius;
-	int num_bones;
-	int num_submeshes;
-	Matrix44 bind_matrix;
-	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
-} sMeshInfo;
+	if (stream.bytes)
+		uploadBuffer(vbo_id, target, bin + stream.offset, stream.bytes);
+}
 
-bool Mesh::readBin(const char* filename, bool bFromNetwork)
+void Mesh::uploadFromBin(const char* bin)
 {
-	FILE *f;
-	assert(filename);
-
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
-		return false;
-
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	sMeshInfo info;
+	memcpy(&info, bin + 4, sizeof(sMeshInfo));
+
+	uploadBinStream(interleaved_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_INTERLEAVED]);
+	uploadBinStream(vertices_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_VERTICES]);
+	uploadBinStream(normals_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_NORMALS]);
+	uploadBinStream(uvs_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_UVS]);
+	uploadBinStream(uvs1_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_UVS1]);
+	uploadBinStream(colors_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_COLORS]);
+	uploadBinStream(bones_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_BONES]);
+	uploadBinStream(weights_vbo_id, GL_ARRAY_BUFFER, bin, info.streams[MBIN_WEIGHTS]);
+	uploadBinStream(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, bin, info.streams[MBIN_INDICES]);
+	quant_offset = info.aabb_min;
+	quant_scale = info.aabb_max - info.aabb_min;
+
+	gpu_num_vertices = info.size;
+	gpu_num_indices = info.num_indices;
+	checkGLErrors();
+}
 
-	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
-	{
-		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+//old format, streams are packed one after another
+bool Mesh::readBinV11(const char* data, size_t size)
+{
+	const char* pos = data + 4;
+	sMeshInfoV11 info;
+	if (size < 4 + sizeof(sMeshInfoV11))
 		return false;
-	}
+	memcpy(&info,pos,sizeof(sMeshInfoV11));
+	pos += sizeof(sMeshInfoV11);
 
-	char* pos = data + 4;
-	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
-
-	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
+	if(info.header_bytes != sizeof(sMeshInfoV11) )
 	{
-		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		std::cout << "[WARN] loading BIN: old version" << std::endl;
 		return false;
 	}
 
@@ -826,7 +1750,7 @@ bool Mesh::readBin(const char* filename, bool bFromNetwork)
 	{
 		m_indices.resize(info.num_indices);
 		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+		pos += sizeof(unsigned int) * info.num_indices;
 	}
 
 	if (info.streams[5] == 'B')
@@ -843,13 +1767,7 @@ bool Mesh::readBin(const char* filename, bool bFromNetwork)
 		pos += sizeof(Vector4) * info.size;
 	}
 
-	if (info.streams[7] == 'u')
-	{
-		m_uvs1.resize(info.size);
-		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
-	}
-
+	//same order used by the v11 writer
 	if (info.num_bones)
 	{
 		bones_info.resize(info.num_bones);
@@ -857,6 +1775,13 @@ bool Mesh::readBin(const char* filename, bool bFromNetwork)
 		pos += sizeof(BoneInfo) * info.num_bones;
 	}
 
+	if (info.streams[7] == 'u')
+	{
+		m_uvs1.resize(info.size);
+		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2) * info.size);
+		pos += sizeof(Vector2) * info.size;
+	}
+
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
 	box.center = info.center;
@@ -865,28 +1790,37 @@ bool Mesh::readBin(const char* filename, bool bFromNetwork)
 	bind_matrix = info.bind_matrix;
 
 	submeshes.resize(info.num_submeshes);
-	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
+	if (info.num_submeshes)
+		memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
 	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
 
-	createCollisionModel();
 	return true;
 }
 
 bool Mesh::writeBin(const char* filename)
 {
-	assert( vertices.size() || interleaved.size() );
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
+	std::vector<char> buffer;
+	writeBinToBuffer(buffer);
+
 	FILE* f = fopen(s_filename.c_str(),"wb");
 	if (f == NULL)
 	{
 		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
 		return false;
 	}
+	fwrite(&buffer[0], buffer.size(), 1, f);
+	fclose(f);
+	return true;
+}
 
-	//watermark
-	fwrite("MBIN",sizeof(char),4,f);
+void Mesh::writeBinToBuffer(std::vector<char>& buffer)
+{
+	if (!isMaterialized())
+		materializeStreams();
+	assert( vertices.size() || interleaved.size() );
 
 	sMeshInfo info;
 	memset(&info, 0, sizeof(info));
@@ -899,53 +1833,93 @@ bool Mesh::writeBin(const char* filename)
 	info.center = box.center;
 	info.halfsize = box.halfsize;
 	info.radius = radius;
+	info.uv_density = getUVDensity();
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
 
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
-	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = m_indices.size() ? 'I' : ' ';
-	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
-	info.streams[7] = m_uvs1.size() ? 'u' : ' '; //uv second set
+	const void* streams_data[MBIN_MAX_STREAMS];
+	memset(streams_data, 0, sizeof(streams_data));
 
-	//write info
-	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
+	#define SET_BIN_STREAM(INDEX, CONTAINER) if (CONTAINER.size()) { streams_data[INDEX] = &CONTAINER[0]; info.streams[INDEX].bytes = (unsigned int)(CONTAINER.size() * sizeof(CONTAINER[0])); }
+	SET_BIN_STREAM(MBIN_INTERLEAVED, interleaved);
+	SET_BIN_STREAM(MBIN_VERTICES, vertices);
+	SET_BIN_STREAM(MBIN_NORMALS, normals);
+	SET_BIN_STREAM(MBIN_UVS, uvs);
+	SET_BIN_STREAM(MBIN_UVS1, m_uvs1);
+	SET_BIN_STREAM(MBIN_COLORS, colors);
+	SET_BIN_STREAM(MBIN_INDICES, m_indices);
+	SET_BIN_STREAM(MBIN_BONES, bones);
+	SET_BIN_STREAM(MBIN_WEIGHTS, weights);
+	SET_BIN_STREAM(MBIN_BONES_INFO, bones_info);
+	SET_BIN_STREAM(MBIN_SUBMESHES, submeshes);
+	SET_BIN_STREAM(MBIN_MESHLETS, meshlets);
+	SET_BIN_STREAM(MBIN_LODS, lods);
+	#undef SET_BIN_STREAM
 
-	//write streams
-	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
-	else
+	//replace the streams that use a compressed layout
+	std::vector<uint8> encoded[MBIN_MAX_STREAMS];
+	if (interleaved.size() && (quantization & (QUANTIZE_POSITIONS | QUANTIZE_NORMALS | QUANTIZE_UVS)))
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2), 1, f);
+		encodeInterleaved(interleaved, quantization, aabb_min, aabb_max, encoded[MBIN_INTERLEAVED]);
+		info.streams[MBIN_INTERLEAVED].format = quantization & (QUANTIZE_POSITIONS | QUANTIZE_NORMALS | QUANTIZE_UVS);
 	}
+	if (vertices.size() && (quantization & QUANTIZE_POSITIONS))
+	{
+		encodePositions(vertices, aabb_min, aabb_max, encoded[MBIN_VERTICES]);
+		info.streams[MBIN_VERTICES].format = QUANTIZE_POSITIONS;
+	}
+	if (normals.size() && (quantization & QUANTIZE_NORMALS))
+	{
+		encodeNormals(normals, encoded[MBIN_NORMALS]);
+		info.streams[MBIN_NORMALS].format = QUANTIZE_NORMALS;
+	}
+	if (uvs.size() && (quantization & QUANTIZE_UVS))
+	{
+		encodeUVs(uvs, encoded[MBIN_UVS]);
+		info.streams[MBIN_UVS].format = QUANTIZE_UVS;
+	}
+	if (m_uvs1.size() && (quantization & QUANTIZE_UVS))
+	{
+		encodeUVs(m_uvs1, encoded[MBIN_UVS1]);
+		info.streams[MBIN_UVS1].format = QUANTIZE_UVS;
+	}
+	if (colors.size() && (quantization & QUANTIZE_COLORS))
+	{
+		encodeColors(colors, encoded[MBIN_COLORS]);
+		info.streams[MBIN_COLORS].format = QUANTIZE_COLORS;
+	}
+	if (m_indices.size() && info.size <= 65536)
+	{
+		encodeShortIndices(m_indices, encoded[MBIN_INDICES]);
+		info.streams[MBIN_INDICES].format = MBIN_SHORT_INDICES;
+	}
+	for (int i = 0; i < MBIN_MAX_STREAMS; ++i)
+		if (encoded[i].size())
+		{
+			if (i != MBIN_INDICES)
+				quantization_saved_disk += info.streams[i].bytes - encoded[i].size();
+			streams_data[i] = &encoded[i][0];
+			info.streams[i].bytes = (unsigned int)encoded[i].size();
+		}
 
-	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4), 1, f);
-
-	if (m_indices.size())
-		fwrite((void*)&m_indices[0], m_indices.size() * sizeof(unsigned int), 1, f);
-
-	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
-	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (m_uvs1.size())
-		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2), 1, f);
-
-	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
+	//place every stream in its own aligned section
+	size_t pos = 4 + sizeof(sMeshInfo);
+	for (int i = 0; i < MBIN_MAX_STREAMS; ++i)
+	{
+		if (!info.streams[i].bytes)
+			continue;
+		pos = (pos + MBIN_STREAM_ALIGNMENT - 1) & ~(size_t)(MBIN_STREAM_ALIGNMENT - 1);
+		info.streams[i].offset = (unsigned int)pos;
+		pos += info.streams[i].bytes;
+	}
 
-	fclose(f);
-	return true;
+	buffer.assign(pos, 0);
+	memcpy(&buffer[0], "MBIN", 4); //watermark
+	memcpy(&buffer[4], &info, sizeof(sMeshInfo));
+	for (int i = 0; i < MBIN_MAX_STREAMS; ++i)
+		if (info.streams[i].bytes)
+			memcpy(&buffer[info.streams[i].offset], streams_data[i], info.streams[i].bytes);
 }
 
 bool Mesh::loadASE(const char* filename)
@@ -1080,139 +2054,16 @@ bool Mesh::loadASE(const char* filename)
 
 bool Mesh::loadOBJ(const char* filename)
 {
-	std::string data;
-	if(!readFile(filename,data))
-		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
-
-	unsigned int vertex_i = 0;
-
-	sSubmeshInfo submesh_info;
-	int last_submesh_vertex = 0;
-	memset(&submesh_info, 0, sizeof(submesh_info));
-
-	//parse file
-	while(*pos != 0)
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
-		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
-			}
-		}
+		file->release();
+		return false;
 	}
 
-	box.center = (aabb_max + aabb_min) * 0.5;
-	box.halfsize = (aabb_max - box.center);
-	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
-
-	submesh_info.length = vertices.size() - last_submesh_vertex;
-	submeshes.push_back(submesh_info);
-	return true;
+	bool result = parseOBJ(this, file->data, file->size);
+	file->release();
+	return result;
 }
 
 bool Mesh::loadMESH(const char* filename)
@@ -1440,6 +2291,8 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered )
 void Mesh::displace(Image* heightmap, float altitude)
 {
 	assert(heightmap && heightmap->data && "image without data");
+	if (!isMaterialized())
+		materializeStreams();
 	assert(uvs.size() && "cannot displace without uvs");
 
 	bool is_interleaved = interleaved.size() != 0;
@@ -1483,10 +2336,28 @@ void Mesh::createGrid(float dist)
 
 void Mesh::updateBoundingBox()
 {
-	if (vertices.size())
+	if (mapped_bin)
+		materializeStreams();
+
+	if (source_vertices.size() && !vertices.size())
+	{
+		//the min and max of the quantized values are enough
+		const uint16* q = (const uint16*)&source_vertices[0];
+		uint16 qmin[4] = { q[0], q[1], q[2], 0 };
+		uint16 qmax[4] = { q[0], q[1], q[2], 0 };
+		for (size_t i = 4; i < source_vertices.size() / 2; i += 4)
+			for (int j = 0; j < 3; ++j)
+			{
+				qmin[j] = std::min(qmin[j], q[i + j]);
+				qmax[j] = std::max(qmax[j], q[i + j]);
+			}
+		aabb_min = dequantizePosition(qmin, quant_offset, quant_scale);
+		aabb_max = dequantizePosition(qmax, quant_offset, quant_scale);
+	}
+	else if (vertices.size())
 	{
 		aabb_max = aabb_min = vertices[0];
-		for (int i = 1; i < vertices.size(); ++i)
+		for (size_t i = 1; i < vertices.size(); ++i)
 		{
 			aabb_min.setMin(vertices[i]);
 			aabb_max.setMax(vertices[i]);
@@ -1495,7 +2366,7 @@ void Mesh::updateBoundingBox()
 	else if (interleaved.size())
 	{
 		aabb_max = aabb_min = interleaved[0].vertex;
-		for (int i = 1; i < vertices.size(); ++i)
+		for (size_t i = 1; i < interleaved.size(); ++i)
 		{
 			aabb_min.setMin(interleaved[i].vertex);
 			aabb_max.setMax(interleaved[i].vertex);
@@ -1505,6 +2376,47 @@ void Mesh::updateBoundingBox()
 	box.halfsize = aabb_max - box.center;
 }
 
+float Mesh::getUVDensity()
+{
+	if (uv_density > 0)
+		return uv_density;
+
+	//positions in the source layout are decoded just for this
+	std::vector<Vector3> decoded;
+	if (source_vertices.size() && !vertices.size())
+		decodePositions(&source_vertices[0], (int)source_vertices.size() / 8, quant_offset, quant_offset + quant_scale, decoded);
+	const std::vector<Vector3>& positions = decoded.size() ? decoded : vertices;
+
+	//sum of the areas of every triangle in uv space and in object space
+	unsigned int num_vertices = interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)positions.size();
+	bool has_uvs = interleaved.size() || uvs.size() == positions.size();
+	unsigned int num_indices = m_indices.size() ? (unsigned int)m_indices.size() : num_vertices;
+	double uv_area = 0, area = 0;
+	if (num_vertices && has_uvs)
+		for (unsigned int i = 0; i + 2 < num_indices; i += 3)
+		{
+			unsigned int a = i, b = i + 1, c = i + 2;
+			if (m_indices.size())
+			{
+				a = m_indices[a]; b = m_indices[b]; c = m_indices[c];
+			}
+			const Vector3& va = interleaved.size() ? interleaved[a].vertex : positions[a];
+			const Vector3& vb = interleaved.size() ? interleaved[b].vertex : positions[b];
+			const Vector3& vc = interleaved.size() ? interleaved[c].vertex : positions[c];
+			const Vector2& ta = interleaved.size() ? interleaved[a].uv : uvs[a];
+			const Vector2& tb = interleaved.size() ? interleaved[b].uv : uvs[b];
+			const Vector2& tc = interleaved.size() ? interleaved[c].uv : uvs[c];
+			area += (vb - va).cross(vc - va).length() * 0.5;
+			uv_area += fabs((tb.x - ta.x) * (tc.y - ta.y) - (tc.x - ta.x) * (tb.y - ta.y)) * 0.5;
+		}
+
+	if (area > 0 && uv_area > 0)
+		uv_density = (float)sqrt(uv_area / area);
+	else //assume the uvs cover the biggest side of the box once
+		uv_density = 1.0f / std::max(2.0f * std::max(box.halfsize.x, std::max(box.halfsize.y, box.halfsize.z)), 0.0001f);
+	return uv_density;
+}
+
 Mesh* wire_box = NULL;
 
 void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
@@ -1556,6 +2468,63 @@ Mesh* Mesh::getQuad()
 	return quad;
 }
 
+static char getMeshFileFormat(const char* filename)
+{
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of(".")+1);
+	if (ext == "ase" || ext == "ASE")
+		return FORMAT_ASE;
+	if (ext == "obj" || ext == "OBJ")
+		return FORMAT_OBJ;
+	if (ext == "mbin" || ext == "MBIN")
+		return FORMAT_MBIN;
+	if (ext == "mesh" || ext == "MESH")
+		return FORMAT_MESH;
+	return 0;
+}
+
+bool Mesh::loadSource(const char* filename)
+{
+	char file_format = getMeshFileFormat(filename);
+
+	//load the ascii version
+	bool loaded = false;
+	if (file_format == FORMAT_OBJ)
+		loaded = loadOBJ(filename);
+	else if (file_format == FORMAT_ASE)
+		loaded = loadASE(filename);
+	else if (file_format == FORMAT_MESH)
+		loaded = loadMESH(filename);
+
+	if (!loaded)
+		return false;
+
+	//share the repeated vertices of the triangle soups using an index buffer
+	if (file_format == FORMAT_OBJ || file_format == FORMAT_ASE)
+	{
+		unsigned int num_vertices = getNumVertices();
+		if (weldVertices())
+			std::cout << "[WELD " << num_vertices << "->" << getNumVertices() << "] ";
+	}
+
+	//reorder for the post-transform cache, overdraw and vertex fetch (the result is stored in the MBIN)
+	if (optimize_meshes && m_indices.size())
+		optimizeMesh(this);
+
+	//to optimize, interleave the meshes
+	if (interleave_meshes)
+	{
+		std::cout << "[INTERL] ";
+		interleaveBuffers();
+	}
+
+	//pick the compressed vertex layouts used in VRAM and in the MBIN
+	if (quantize_meshes && chooseQuantization())
+		std::cout << "[QUANT " << getVertexSize(0) << "->" << getVertexSize(quantization) << " bytes/vertex] ";
+
+	return true;
+}
+
 Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 {
 	assert(filename);
@@ -1566,26 +2535,18 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	if (skip_load)
 		return NULL;
 
-	Mesh* m = new Mesh();
 	std::string name = filename;
 
 	//detect format
-	char file_format = 0;
-	std::string ext = name.substr(name.find_last_of(".")+1);
-	if (ext == "ase" || ext == "ASE")
-		file_format = FORMAT_ASE;
-	else if (ext == "obj" || ext == "OBJ")
-		file_format = FORMAT_OBJ;
-	else if (ext == "mbin" || ext == "MBIN")
-		file_format = FORMAT_MBIN;
-	else if (ext == "mesh" || ext == "MESH")
-		file_format = FORMAT_MESH;
-	else 
+	char file_format = getMeshFileFormat(filename);
+	if (!file_format)
 	{
 		//if (ext.size()) std::cerr << "Unknown mesh format: " << filename << std::endl;
 		return NULL;
 	}
 
+	Mesh* m = new Mesh();
+
 	//stats
 	double time = getTime();
 	std::cout << " + Mesh loading: " << filename << " ... ";
@@ -1594,51 +2555,42 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	if (file_format != FORMAT_MBIN)
 		binfilename = binfilename + ".mbin";
 
-	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str(), bFromNetwork) )
+	//try loading the binary version, unless the source was edited after cooking it
+	if (use_binary && (file_format == FORMAT_MBIN || isFileUpToDate(binfilename, filename)) && m->readBin(binfilename.c_str(), bFromNetwork) )
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
+		//mapped bins are already in VRAM
+		if (m->mapped_bin)
+			std::cout << "[MAPPED] ";
+		else
 		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
+			if (interleave_meshes && m->interleaved.size() == 0)
+			{
+				std::cout << "[INTERL] ";
+				m->interleaveBuffers();
+			}
 
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
+			if (auto_upload_to_vram)
+			{
+				std::cout << "[VRAM] ";
+				m->uploadToVRAM();
+			}
 		}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		std::cout << "[OK BIN]  Faces: " << (m->getNumIndices() ? m->getLODRange(0).length : m->getNumVertices()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 		sMeshesLoaded[filename] = m;
 		return m;
 	}
 
 	assert(!bFromNetwork);
 
-	//load the ascii version
-	bool loaded = false;
-	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
-	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
-	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
-
-	if (!loaded)
+	//load the source file and apply the cooking passes
+	if (!m->loadSource(filename))
 	{
 		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
 		return NULL;
 	}
 
-	//to optimize, interleave the meshes
-	if (interleave_meshes)
-	{
-		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
-	}
-
 	//and upload them to VRAM
 	if (auto_upload_to_vram)
 	{
@@ -1646,7 +2598,7 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 		m->uploadToVRAM();
 	}
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	std::cout << "[OK]  Faces: " << (m->getNumIndices() ? m->getLODRange(0).length : m->getNumVertices()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
@@ -1666,10 +2618,15 @@ void Mesh::registerMesh( std::string name )
 
 void Mesh::Release()
 {
+	//the destructor erases its names from the map and a mesh can be registered with two names
+	std::set<Mesh*> meshes;
 	for (auto m : sMeshesLoaded)
 	{
-        stdlog("Destroy mesh: " + m.first );
-		delete m.second;
+		stdlog("Destroy mesh: " + m.first);
+		meshes.insert(m.second);
 	}
+
+	for (Mesh* m : meshes)
+		delete m;
 	sMeshesLoaded.clear();
 }
@@ -3,22 +3,36 @@
 
 #include <vector>
 #include "framework.h"
+#include "resources.h"
 
 #include <map>
+#include <atomic>
 #include <string>
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class MappedFile; //for meshes read from a memory mapped MBIN
+class Camera; //for meshlet culling
 
-//version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+//version 12: stream table with page aligned sections, so they can be used straight from a memory mapping
+//version 13: meshlets stream
+//version 14: levels of detail stream
+#define MESH_BIN_VERSION 14 //this is used to regenerate bins if the format changes
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
 	Matrix44 bind_pose;
 };
 
+//compressed vertex layouts, chosen per mesh when cooking and used in MBIN and VRAM
+enum eVertexQuantization {
+	QUANTIZE_POSITIONS = 1, //16 bits per axis, relative to the mesh aabb
+	QUANTIZE_NORMALS = 2, //octahedral encoding in 2x16 bits
+	QUANTIZE_UVS = 4, //half floats
+	QUANTIZE_COLORS = 8 //RGBA8
+};
+
 struct sSubmeshInfo
 {
 	char name[64];
@@ -27,19 +41,53 @@ struct sSubmeshInfo
 	int length;//in primitive
 };
 
-class Mesh
+//small cluster of triangles of a mesh with its bounds, so parts of big meshes can be culled
+struct sMeshlet
+{
+	Vector3 center; //bounding sphere
+	float radius;
+	Vector3 cone_apex; //normal cone: backfacing if dot(normalize(cone_apex - eye), cone_axis) >= cone_cutoff
+	float cone_cutoff; //1 if it can't be culled by the cone
+	Vector3 cone_axis;
+	unsigned int start; //in indices, the triangles of every meshlet are contiguous in the index buffer
+	unsigned int length;
+};
+
+//range of the index buffer to draw
+struct sDrawRange
+{
+	unsigned int start; //in indices
+	unsigned int length;
+};
+
+//simplified version of the mesh, its triangles are appended to the index buffer
+struct sMeshLOD
+{
+	unsigned int start; //in indices
+	unsigned int length;
+	float error; //max distance to the full detail surface, in object space
+	unsigned int reserved;
+};
+
+class Mesh : public Resource
 {
 public:
 	static std::map<std::string, Mesh*> sMeshesLoaded;
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool quantize_meshes; //cooked meshes use compressed vertex layouts when the error is small enough (off at runtime)
+	static bool optimize_meshes; //cooked meshes reorder triangles and vertices for the GPU caches and get meshlets and LODs (off at runtime)
+	static std::atomic<size_t> quantization_saved_disk; //bytes saved by the compressed layouts (for stats, atomic because the cook tool writes from several threads)
+	static std::atomic<size_t> quantization_saved_vram;
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 
 	std::string name;
 
 	std::vector<sSubmeshInfo> submeshes; //contains info about every submesh
+	std::vector<sMeshlet> meshlets; //clusters of triangles to cull big meshes, empty if the mesh is small
+	std::vector<sMeshLOD> lods; //levels of detail, the first one is the full mesh (meshlets and submeshes only cover it)
 
 	std::vector< Vector3 > vertices; //here we store the vertices
 	std::vector< Vector3 > normals;	 //here we store the normals
@@ -68,6 +116,15 @@ public:
 	BoundingBox box;
 
 	float radius;
+	float uv_density; //uv units per object unit (sqrt of the uv area / surface area), negative until computed
+
+	int quantization; //eVertexQuantization flags used in VRAM and MBIN
+	Vector3 quant_offset; //dequantization of the positions in VRAM, usually the aabb
+	Vector3 quant_scale;
+
+	//streams that arrived already in the VRAM layout (glTF quantized accessors), uploaded as they are and decoded to RAM only if needed
+	std::vector<uint8> source_vertices; //ushort4, see quant_offset
+	std::vector<uint8> source_colors; //RGBA8
 
 	unsigned int vertices_vbo_id;
 	unsigned int uvs_vbo_id;
@@ -80,9 +137,18 @@ public:
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
 
+	//meshes read from a mapped MBIN upload the streams straight to VRAM, the RAM copy is created only if needed
+	MappedFile* mapped_file;
+	const char* mapped_bin; //start of the MBIN inside the mapping
+	unsigned int gpu_num_vertices; //valid once uploaded, even if the streams are not in RAM
+	unsigned int gpu_num_indices;
+	unsigned char index_bytes; //2 or 4, size of every index in VRAM and MBIN
+
 	Mesh();
 	~Mesh();
 
+	void getMemoryUsage(size_t& cpu, size_t& gpu);
+
 	void clear();
 
 	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0 );
@@ -93,13 +159,25 @@ public:
 
 	void enableBuffers(Shader* shader);
 	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
+	void drawRanges(unsigned int primitive, const std::vector<sDrawRange>& ranges); //one multi-draw for all the ranges
+	void renderRanges(unsigned int primitive, const std::vector<sDrawRange>& ranges);
+
+	//fills ranges with the meshlets inside the camera frustum (and not backfacing if cone_culling), returns false if none is visible
+	bool cullMeshlets(const Matrix44& model, Camera* camera, std::vector<sDrawRange>& ranges, bool cone_culling = true);
 	void disableBuffers(Shader* shader);
 
 	bool readBin(const char* filename, bool bFromNetwork);
+	bool readBinFromMemory(const char* data, size_t size, MappedFile* owner = NULL); //if owner is passed the mesh can keep using the memory
 	bool writeBin(const char* filename);
+	void writeBinToBuffer(std::vector<char>& buffer);
+	bool materializeStreams(); //copies the streams of a mapped MBIN or in the source layout to RAM (needed for collisions or editing)
+	bool isMaterialized() { return !mapped_bin && !source_vertices.size() && !source_colors.size(); }
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int getNumVertices() { return interleaved.size() ? (unsigned int)interleaved.size() : vertices.size() ? (unsigned int)vertices.size() : source_vertices.size() ? (unsigned int)source_vertices.size() / 8 : gpu_num_vertices; }
+	unsigned int getNumIndices() { return m_indices.size() ? (unsigned int)m_indices.size() : gpu_num_indices; }
+	unsigned int getNumLODs() { return lods.size() ? (unsigned int)lods.size() : 1; }
+	sDrawRange getLODRange(int lod); //clamped to the coarsest level
 
 	//collision testing
 	void* collision_model;
@@ -110,6 +188,7 @@ public:
 
 	//loader
 	static Mesh* Get(const char* filename, bool bFromNetwork = false, bool skip_load = false);
+	bool loadSource(const char* filename); //loads an OBJ/ASE/MESH and applies the cooking passes, doesn't touch the GPU (safe in worker threads)
 	static void Release();
 	void registerMesh(std::string name);
 
@@ -124,12 +203,18 @@ public:
 	static Mesh* getQuad(); //get global quad
 
 	void updateBoundingBox();
+	float getUVDensity(); //computed from the streams in RAM the first time, estimated from the bounding box if they are not there
 
 	//optimize meshes
 	void uploadToVRAM();
 	bool interleaveBuffers();
+	bool weldVertices(); //removes repeated vertices and creates the index buffer
+	int chooseQuantization(); //picks the compressed layouts that keep the error low, returns the flags
+	unsigned int getVertexSize(int quantization); //bytes per vertex in VRAM for the given layout
 
 private:
+	bool readBinV11(const char* data, size_t size);
+	void uploadFromBin(const char* bin);
 	bool loadASE(const char* filename);
 	bool loadOBJ(const char* filename);
 	bool loadMESH(const char* filename); //personal format used for animations
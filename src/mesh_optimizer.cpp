@@ -0,0 +1,802 @@
+#include "mesh_optimizer.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#define FORSYTH_CACHE_SIZE 32
+#define MESHLETS_MIN_TRIANGLES 512 //smaller meshes are culled as a whole
+#define LODS_MIN_TRIANGLES 256 //smaller meshes are not simplified
+#define LODS_MAX_ERROR 0.05f //relative to the size of the mesh, coarser levels are discarded
+
+void getMeshPositions(Mesh* mesh, std::vector<Vector3>& positions)
+{
+	if (mesh->interleaved.size())
+	{
+		positions.resize(mesh->interleaved.size());
+		for (size_t i = 0; i < positions.size(); ++i)
+			positions[i] = mesh->interleaved[i].vertex;
+	}
+	else
+		positions = mesh->vertices;
+}
+
+//the submeshes, or the whole full detail level if there are none
+void getMeshRanges(Mesh* mesh, std::vector<sSubmeshInfo>& ranges)
+{
+	ranges = mesh->submeshes;
+	if (ranges.empty())
+	{
+		sSubmeshInfo all;
+		memset(&all, 0, sizeof(all));
+		all.length = (int)mesh->getLODRange(0).length;
+		ranges.push_back(all);
+	}
+}
+
+sVertexCacheStats analyzeVertexCache(const unsigned int* indices, int num_indices, int num_vertices, int cache_size)
+{
+	sVertexCacheStats stats;
+	stats.acmr = stats.atvr = 0.0f;
+	if (num_indices < 3)
+		return stats;
+
+	//a vertex is in the FIFO if less than cache_size misses happened since it was loaded
+	std::vector<int> timestamp(num_vertices, -1);
+	int misses = 0;
+	int used = 0;
+	for (int i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (timestamp[v] == -1)
+			used++;
+		if (timestamp[v] == -1 || misses - timestamp[v] >= cache_size)
+			timestamp[v] = misses++;
+	}
+
+	stats.acmr = misses / (float)(num_indices / 3);
+	stats.atvr = used ? misses / (float)used : 0.0f;
+	return stats;
+}
+
+//score of a vertex given its position in the LRU cache and the triangles still using it
+float getForsythVertexScore(int cache_position, int remaining_triangles)
+{
+	if (remaining_triangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3) //used by the last triangle, avoid using it again right away
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cache_position - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+	}
+
+	//boost vertices with few triangles left, so they are finished and leave the cache
+	score += 2.0f * powf((float)remaining_triangles, -0.5f);
+	return score;
+}
+
+void optimizeVertexCache(unsigned int* indices, int num_indices, int num_vertices)
+{
+	int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	//triangles that use every vertex
+	std::vector<int> remaining(num_vertices, 0);
+	for (int i = 0; i < num_triangles * 3; ++i)
+		remaining[indices[i]]++;
+	std::vector<int> adjacency_offset(num_vertices + 1, 0);
+	for (int v = 0; v < num_vertices; ++v)
+		adjacency_offset[v + 1] = adjacency_offset[v] + remaining[v];
+	std::vector<int> adjacency(num_triangles * 3);
+	std::vector<int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+	for (int t = 0; t < num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (int v = 0; v < num_vertices; ++v)
+		vertex_score[v] = getForsythVertexScore(-1, remaining[v]);
+
+	std::vector<float> triangle_score(num_triangles);
+	int best = 0;
+	for (int t = 0; t < num_triangles; ++t)
+	{
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		if (triangle_score[t] > triangle_score[best])
+			best = t;
+	}
+
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+
+	int cache[FORSYTH_CACHE_SIZE + 3];
+	int cache_count = 0;
+	int scan_cursor = 0;
+
+	while (best != -1)
+	{
+		emitted[best] = 1;
+		const unsigned int* tri = indices + best * 3;
+		result.push_back(tri[0]);
+		result.push_back(tri[1]);
+		result.push_back(tri[2]);
+
+		//the triangle is not pending anymore for its vertices
+		for (int k = 0; k < 3; ++k)
+		{
+			int v = tri[k];
+			int* adj = &adjacency[adjacency_offset[v]];
+			for (int j = 0; j < remaining[v]; ++j)
+				if (adj[j] == best)
+				{
+					adj[j] = adj[remaining[v] - 1];
+					break;
+				}
+			remaining[v]--;
+		}
+
+		//LRU: the vertices of the triangle go to the front
+		int new_cache[FORSYTH_CACHE_SIZE + 3];
+		int new_count = 0;
+		for (int k = 0; k < 3; ++k)
+			if (std::find(new_cache, new_cache + new_count, (int)tri[k]) == new_cache + new_count)
+				new_cache[new_count++] = tri[k];
+		for (int j = 0; j < cache_count; ++j)
+			if (std::find(new_cache, new_cache + new_count, cache[j]) == new_cache + new_count)
+				new_cache[new_count++] = cache[j];
+
+		for (int j = 0; j < new_count; ++j)
+			cache_position[new_cache[j]] = j < FORSYTH_CACHE_SIZE ? j : -1;
+		cache_count = std::min(new_count, FORSYTH_CACHE_SIZE);
+		memcpy(cache, new_cache, cache_count * sizeof(int));
+
+		//update the scores of the vertices that changed (including the evicted ones)
+		for (int j = 0; j < new_count; ++j)
+		{
+			int v = new_cache[j];
+			float score = getForsythVertexScore(cache_position[v], remaining[v]);
+			float diff = score - vertex_score[v];
+			vertex_score[v] = score;
+			const int* adj = &adjacency[adjacency_offset[v]];
+			for (int k = 0; k < remaining[v]; ++k)
+				triangle_score[adj[k]] += diff;
+		}
+
+		//next triangle: the best one using a vertex in the cache
+		best = -1;
+		float best_score = -1.0f;
+		for (int j = 0; j < cache_count; ++j)
+		{
+			int v = cache[j];
+			const int* adj = &adjacency[adjacency_offset[v]];
+			for (int k = 0; k < remaining[v]; ++k)
+				if (triangle_score[adj[k]] > best_score)
+				{
+					best_score = triangle_score[adj[k]];
+					best = adj[k];
+				}
+		}
+
+		//dead end, continue with any triangle left
+		if (best == -1)
+		{
+			while (scan_cursor < num_triangles && emitted[scan_cursor])
+				scan_cursor++;
+			best = scan_cursor < num_triangles ? scan_cursor : -1;
+		}
+	}
+
+	memcpy(indices, &result[0], result.size() * sizeof(unsigned int));
+}
+
+struct sTriangleCluster {
+	int start; //in triangles
+	int count;
+	float sort_key;
+};
+
+void optimizeOverdraw(unsigned int* indices, int num_indices, const std::vector<Vector3>& positions, float threshold)
+{
+	int num_triangles = num_indices / 3;
+	if (num_triangles < 64)
+		return;
+
+	int num_vertices = (int)positions.size();
+	sVertexCacheStats input_stats = analyzeVertexCache(indices, num_indices, num_vertices);
+
+	//split in clusters: where the cache is empty (all the vertices missed) or where the cluster
+	//is already as efficient as the whole buffer, so cutting there does not hurt the cache much
+	std::vector<sTriangleCluster> clusters;
+	std::vector<int> timestamp(num_vertices, -1);
+	int misses = 0;
+	int cluster_misses = 0;
+	for (int t = 0; t < num_triangles; ++t)
+	{
+		int triangle_misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = indices[t * 3 + k];
+			if (timestamp[v] == -1 || misses - timestamp[v] >= 16)
+			{
+				timestamp[v] = misses++;
+				triangle_misses++;
+			}
+		}
+
+		bool split = clusters.empty() || triangle_misses == 3;
+		if (!split)
+		{
+			sTriangleCluster& current = clusters.back();
+			split = current.count >= 32 && cluster_misses / (float)current.count <= input_stats.acmr;
+		}
+		if (split)
+		{
+			sTriangleCluster cluster;
+			cluster.start = t;
+			cluster.count = 0;
+			cluster.sort_key = 0;
+			clusters.push_back(cluster);
+			cluster_misses = 0;
+		}
+		clusters.back().count++;
+		cluster_misses += triangle_misses;
+	}
+
+	if (clusters.size() < 2)
+		return;
+
+	//clusters far from the center and facing outwards are more likely to occlude the others
+	Vector3 mesh_center;
+	for (int i = 0; i < num_vertices; ++i)
+		mesh_center = mesh_center + positions[i];
+	mesh_center = mesh_center * (1.0f / num_vertices);
+
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		sTriangleCluster& cluster = clusters[i];
+		Vector3 center;
+		Vector3 normal;
+		float area = 0.0f;
+		for (int t = cluster.start; t < cluster.start + cluster.count; ++t)
+		{
+			const Vector3& a = positions[indices[t * 3]];
+			const Vector3& b = positions[indices[t * 3 + 1]];
+			const Vector3& c = positions[indices[t * 3 + 2]];
+			Vector3 n = cross(b - a, c - a); //length is twice the area
+			float triangle_area = (float)n.length();
+			center = center + (a + b + c) * (triangle_area / 3.0f);
+			normal = normal + n;
+			area += triangle_area;
+		}
+		if (area > 0.0f)
+			center = center * (1.0f / area);
+		float normal_length = (float)normal.length();
+		if (normal_length > 0.0f)
+			normal = normal * (1.0f / normal_length);
+		cluster.sort_key = dot(center - mesh_center, normal);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const sTriangleCluster& a, const sTriangleCluster& b) { return a.sort_key > b.sort_key; });
+
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+	for (size_t i = 0; i < clusters.size(); ++i)
+		result.insert(result.end(), indices + clusters[i].start * 3, indices + (clusters[i].start + clusters[i].count) * 3);
+
+	//keep the input if the cache efficiency got too bad
+	sVertexCacheStats result_stats = analyzeVertexCache(&result[0], (int)result.size(), num_vertices);
+	if (result_stats.acmr > input_stats.acmr * threshold)
+		return;
+	memcpy(indices, &result[0], result.size() * sizeof(unsigned int));
+}
+
+template<typename T> void reorderStream(std::vector<T>& stream, const std::vector<unsigned int>& remap)
+{
+	if (!stream.size())
+		return;
+	std::vector<T> result(stream.size());
+	for (size_t i = 0; i < stream.size(); ++i)
+		result[remap[i]] = stream[i];
+	stream.swap(result);
+}
+
+void optimizeVertexFetch(Mesh* mesh)
+{
+	int num_vertices = mesh->getNumVertices();
+	std::vector<unsigned int>& indices = mesh->m_indices;
+
+	//new position of every vertex, in order of first use (unused ones go at the end)
+	std::vector<unsigned int> remap(num_vertices, 0xFFFFFFFF);
+	unsigned int next = 0;
+	for (size_t i = 0; i < indices.size(); ++i)
+		if (remap[indices[i]] == 0xFFFFFFFF)
+			remap[indices[i]] = next++;
+	for (int i = 0; i < num_vertices; ++i)
+		if (remap[i] == 0xFFFFFFFF)
+			remap[i] = next++;
+
+	reorderStream(mesh->interleaved, remap);
+	reorderStream(mesh->vertices, remap);
+	reorderStream(mesh->normals, remap);
+	reorderStream(mesh->uvs, remap);
+	reorderStream(mesh->m_uvs1, remap);
+	reorderStream(mesh->colors, remap);
+	reorderStream(mesh->bones, remap);
+	reorderStream(mesh->weights, remap);
+
+	for (size_t i = 0; i < indices.size(); ++i)
+		indices[i] = remap[indices[i]];
+}
+
+void computeMeshletBounds(sMeshlet& meshlet, const unsigned int* indices, const std::vector<Vector3>& positions)
+{
+	int num_triangles = meshlet.length / 3;
+
+	//sphere around the center of the aabb
+	Vector3 min_pos(1e10f, 1e10f, 1e10f);
+	Vector3 max_pos(-1e10f, -1e10f, -1e10f);
+	for (unsigned int i = 0; i < meshlet.length; ++i)
+	{
+		const Vector3& p = positions[indices[i]];
+		min_pos.set(std::min(min_pos.x, p.x), std::min(min_pos.y, p.y), std::min(min_pos.z, p.z));
+		max_pos.set(std::max(max_pos.x, p.x), std::max(max_pos.y, p.y), std::max(max_pos.z, p.z));
+	}
+	meshlet.center = (min_pos + max_pos) * 0.5f;
+	float radius2 = 0.0f;
+	for (unsigned int i = 0; i < meshlet.length; ++i)
+		radius2 = std::max(radius2, (positions[indices[i]] - meshlet.center).dot(positions[indices[i]] - meshlet.center));
+	meshlet.radius = sqrtf(radius2);
+
+	//normal cone: average of the normals and the widest angle to them
+	std::vector<Vector3> normals(num_triangles);
+	Vector3 axis;
+	for (int t = 0; t < num_triangles; ++t)
+	{
+		const Vector3& a = positions[indices[t * 3]];
+		Vector3 n = cross(positions[indices[t * 3 + 1]] - a, positions[indices[t * 3 + 2]] - a);
+		float length = (float)n.length();
+		normals[t] = length > 0.0f ? n * (1.0f / length) : Vector3();
+		axis = axis + normals[t];
+	}
+
+	meshlet.cone_axis = Vector3(0, 0, 1);
+	meshlet.cone_apex = meshlet.center;
+	meshlet.cone_cutoff = 1.0f; //can't be culled
+	float axis_length = (float)axis.length();
+	if (axis_length == 0.0f)
+		return;
+	axis = axis * (1.0f / axis_length);
+
+	float min_dot = 1.0f;
+	for (int t = 0; t < num_triangles; ++t)
+		if (normals[t].x != 0.0f || normals[t].y != 0.0f || normals[t].z != 0.0f)
+			min_dot = std::min(min_dot, dot(axis, normals[t]));
+	if (min_dot <= 0.0f) //wider than a hemisphere, some triangle is always visible
+		return;
+
+	//the apex goes back along the axis until it is behind the plane of every triangle
+	float max_t = 0.0f;
+	for (int t = 0; t < num_triangles; ++t)
+	{
+		float dn = dot(axis, normals[t]);
+		if (dn <= 0.0f)
+			continue;
+		float dc = dot(meshlet.center - positions[indices[t * 3]], normals[t]);
+		max_t = std::max(max_t, dc / dn);
+	}
+
+	meshlet.cone_axis = axis;
+	meshlet.cone_apex = meshlet.center - axis * max_t;
+	meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+void buildMeshlets(Mesh* mesh, int max_vertices, int max_triangles)
+{
+	std::vector<unsigned int>& indices = mesh->m_indices;
+	int num_vertices = mesh->getNumVertices();
+	mesh->meshlets.clear();
+	if ((int)mesh->getLODRange(0).length < MESHLETS_MIN_TRIANGLES * 3)
+		return;
+
+	std::vector<Vector3> positions;
+	getMeshPositions(mesh, positions);
+
+	//meshlets never cross the ranges of the submeshes
+	std::vector<sSubmeshInfo> ranges;
+	getMeshRanges(mesh, ranges);
+
+	//vertex_owner tells the last meshlet that used every vertex
+	std::vector<int> vertex_owner(num_vertices, -1);
+	int meshlet_id = -1;
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		int end = ranges[r].start + ranges[r].length;
+		int meshlet_vertices = 0;
+		sMeshlet meshlet{}; //zeroed
+		meshlet.start = ranges[r].start;
+		meshlet_id++;
+
+		for (int i = ranges[r].start; i + 2 < end; i += 3)
+		{
+			unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+			int new_vertices = (vertex_owner[a] != meshlet_id) + (vertex_owner[b] != meshlet_id && b != a) + (vertex_owner[c] != meshlet_id && c != a && c != b);
+
+			//full, start a new one
+			if (meshlet.length && (meshlet_vertices + new_vertices > max_vertices || (int)meshlet.length / 3 + 1 > max_triangles))
+			{
+				computeMeshletBounds(meshlet, &indices[meshlet.start], positions);
+				mesh->meshlets.push_back(meshlet);
+				meshlet.start = i;
+				meshlet.length = 0;
+				meshlet_vertices = 0;
+				meshlet_id++;
+			}
+
+			for (int k = 0; k < 3; ++k)
+				if (vertex_owner[indices[i + k]] != meshlet_id)
+				{
+					vertex_owner[indices[i + k]] = meshlet_id;
+					meshlet_vertices++;
+				}
+			meshlet.length += 3;
+		}
+
+		if (meshlet.length)
+		{
+			computeMeshletBounds(meshlet, &indices[meshlet.start], positions);
+			mesh->meshlets.push_back(meshlet);
+		}
+	}
+}
+
+//symmetric 4x4 matrix, sum of squared distances to a set of planes
+struct sQuadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+};
+
+void addQuadric(sQuadric& q, const sQuadric& other)
+{
+	double* a = &q.a2;
+	const double* b = &other.a2;
+	for (int i = 0; i < 10; ++i)
+		a[i] += b[i];
+}
+
+void addPlaneQuadric(sQuadric& q, const Vector3& normal, float distance, float weight)
+{
+	double a = normal.x, b = normal.y, c = normal.z, d = distance;
+	q.a2 += a * a * weight; q.ab += a * b * weight; q.ac += a * c * weight; q.ad += a * d * weight;
+	q.b2 += b * b * weight; q.bc += b * c * weight; q.bd += b * d * weight;
+	q.c2 += c * c * weight; q.cd += c * d * weight;
+	q.d2 += d * d * weight;
+}
+
+double evaluateQuadric(const sQuadric& q, const Vector3& p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double result = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+		+ q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+		+ q.c2 * z * z + 2 * q.cd * z + q.d2;
+	return result > 0 ? result : 0;
+}
+
+struct sCollapse {
+	unsigned int from; //removed vertex, its triangles are moved to the other one
+	unsigned int to;
+	double cost;
+};
+
+float simplifyIndices(std::vector<unsigned int>& result, const unsigned int* indices, int num_indices, const std::vector<Vector3>& positions, int target_indices, float max_error)
+{
+	int num_vertices = (int)positions.size();
+	result.assign(indices, indices + num_indices);
+
+	//plane of every triangle goes to the quadric of its vertices
+	std::vector<sQuadric> quadrics(num_vertices);
+	memset(&quadrics[0], 0, num_vertices * sizeof(sQuadric));
+	for (int i = 0; i + 2 < num_indices; i += 3)
+	{
+		const Vector3& a = positions[indices[i]];
+		Vector3 n = cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+		float length = (float)n.length();
+		if (length == 0.0f)
+			continue;
+		n = n * (1.0f / length);
+		for (int k = 0; k < 3; ++k)
+			addPlaneQuadric(quadrics[indices[i + k]], n, -dot(n, a), 1.0f);
+	}
+
+	//vertices that share position with others (attribute seams) and vertices on open borders can't move
+	std::vector<char> locked(num_vertices, 0);
+	{
+		std::vector<unsigned int> sorted(num_vertices);
+		for (int i = 0; i < num_vertices; ++i)
+			sorted[i] = i;
+		std::sort(sorted.begin(), sorted.end(), [&](unsigned int a, unsigned int b) {
+			const Vector3& pa = positions[a];
+			const Vector3& pb = positions[b];
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z; });
+		for (int i = 1; i < num_vertices; ++i)
+		{
+			const Vector3& pa = positions[sorted[i - 1]];
+			const Vector3& pb = positions[sorted[i]];
+			if (pa.x == pb.x && pa.y == pb.y && pa.z == pb.z)
+				locked[sorted[i - 1]] = locked[sorted[i]] = 1;
+		}
+
+		std::vector<unsigned long long> edges;
+		edges.reserve(num_indices);
+		for (int i = 0; i + 2 < num_indices; i += 3)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned long long a = indices[i + k], b = indices[i + (k + 1) % 3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size(); )
+		{
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i == 1)
+				locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFF] = 1;
+			i = j;
+		}
+	}
+
+	double max_cost = (double)max_error * max_error;
+	double result_cost = 0.0;
+	std::vector<unsigned int> remap(num_vertices);
+	std::vector<char> touched(num_vertices);
+	std::vector<int> adjacency_offset(num_vertices + 1);
+	std::vector<int> adjacency;
+	std::vector<unsigned long long> edges;
+	std::vector<sCollapse> collapses;
+
+	//every pass does the cheapest collapses that don't affect each other
+	while ((int)result.size() > target_indices)
+	{
+		int num_triangles = (int)result.size() / 3;
+
+		std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0);
+		for (size_t i = 0; i < result.size(); ++i)
+			adjacency_offset[result[i] + 1]++;
+		for (int v = 0; v < num_vertices; ++v)
+			adjacency_offset[v + 1] += adjacency_offset[v];
+		adjacency.resize(result.size());
+		std::vector<int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+		for (int t = 0; t < num_triangles; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[result[t * 3 + k]]++] = t;
+
+		edges.clear();
+		for (int t = 0; t < num_triangles; ++t)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned long long a = result[t * 3 + k], b = result[t * 3 + (k + 1) % 3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		//the cheapest direction of every edge, the error is the one of the moved vertex at its new position
+		collapses.clear();
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)(edges[i] & 0xFFFFFFFF);
+			sCollapse collapse;
+			collapse.cost = 1e30;
+			if (!locked[a])
+			{
+				collapse.from = a;
+				collapse.to = b;
+				collapse.cost = evaluateQuadric(quadrics[a], positions[b]) + evaluateQuadric(quadrics[b], positions[b]);
+			}
+			if (!locked[b])
+			{
+				double cost = evaluateQuadric(quadrics[a], positions[a]) + evaluateQuadric(quadrics[b], positions[a]);
+				if (cost < collapse.cost)
+				{
+					collapse.from = b;
+					collapse.to = a;
+					collapse.cost = cost;
+				}
+			}
+			if (collapse.cost <= max_cost)
+				collapses.push_back(collapse);
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const sCollapse& a, const sCollapse& b) { return a.cost < b.cost; });
+
+		//every collapse removes two triangles
+		int triangles_to_remove = ((int)result.size() - target_indices) / 3;
+		int removed = 0;
+		for (int v = 0; v < num_vertices; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (size_t i = 0; i < collapses.size() && removed < triangles_to_remove; ++i)
+		{
+			const sCollapse& collapse = collapses[i];
+			unsigned int from = collapse.from, to = collapse.to;
+			if (touched[from] || touched[to])
+				continue;
+
+			//the triangles that move can't flip
+			bool flips = false;
+			int shared = 0;
+			for (int j = adjacency_offset[from]; j < adjacency_offset[from + 1] && !flips; ++j)
+			{
+				const unsigned int* tri = &result[adjacency[j] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					shared++;
+					continue;
+				}
+				Vector3 p[3], q[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					p[k] = positions[tri[k]];
+					q[k] = tri[k] == from ? positions[to] : p[k];
+				}
+				Vector3 n0 = cross(p[1] - p[0], p[2] - p[0]);
+				Vector3 n1 = cross(q[1] - q[0], q[2] - q[0]);
+				flips = dot(n0, n1) <= 0.0f;
+			}
+			if (flips)
+				continue;
+
+			//the neighbours can't collapse in this pass, the flip test would not be valid
+			for (int j = adjacency_offset[from]; j < adjacency_offset[from + 1]; ++j)
+				for (int k = 0; k < 3; ++k)
+					touched[result[adjacency[j] * 3 + k]] = 1;
+			touched[to] = 1;
+
+			remap[from] = to;
+			addQuadric(quadrics[to], quadrics[from]);
+			result_cost = std::max(result_cost, collapse.cost);
+			removed += shared;
+		}
+		if (!removed)
+			break;
+
+		//apply the collapses and remove the degenerated triangles
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return (float)sqrt(result_cost);
+}
+
+void buildLODs(Mesh* mesh, int max_levels)
+{
+	std::vector<unsigned int>& indices = mesh->m_indices;
+	int num_vertices = mesh->getNumVertices();
+
+	//remove the previous levels
+	indices.resize(mesh->getLODRange(0).length);
+	mesh->lods.clear();
+	if ((int)indices.size() < LODS_MIN_TRIANGLES * 3)
+		return;
+
+	std::vector<Vector3> positions;
+	getMeshPositions(mesh, positions);
+	float max_error = (float)mesh->box.halfsize.length() * LODS_MAX_ERROR;
+	if (max_error <= 0.0f)
+		return;
+
+	std::vector<sSubmeshInfo> ranges;
+	getMeshRanges(mesh, ranges);
+
+	sMeshLOD level;
+	level.start = 0;
+	level.length = (unsigned int)indices.size();
+	level.error = 0.0f;
+	level.reserved = 0;
+	mesh->lods.push_back(level);
+
+	//every level halves the triangles of the previous one, always simplifying the full mesh
+	std::vector<unsigned int> simplified;
+	for (int i = 1; i < max_levels; ++i)
+	{
+		level.start = (unsigned int)indices.size();
+		level.error = 0.0f;
+		for (size_t r = 0; r < ranges.size(); ++r)
+		{
+			int target = (ranges[r].length >> i) / 3 * 3;
+			level.error = std::max(level.error, simplifyIndices(simplified, &indices[ranges[r].start], ranges[r].length, positions, target, max_error));
+			if (simplified.size() >= 3)
+				optimizeVertexCache(&simplified[0], (int)simplified.size(), num_vertices);
+			indices.insert(indices.end(), simplified.begin(), simplified.end());
+		}
+		level.length = (unsigned int)indices.size() - level.start;
+
+		//not worth it if it didn't reduce enough
+		const sMeshLOD& previous = mesh->lods.back();
+		if (level.length > previous.length * 0.8f)
+		{
+			indices.resize(level.start);
+			break;
+		}
+		mesh->lods.push_back(level);
+	}
+
+	if (mesh->lods.size() == 1)
+		mesh->lods.clear();
+}
+
+bool optimizeMesh(Mesh* mesh)
+{
+	if (!mesh->isMaterialized())
+		mesh->materializeStreams();
+
+	std::vector<unsigned int>& indices = mesh->m_indices;
+	int num_vertices = mesh->getNumVertices();
+	if (indices.size() < 3 || !num_vertices)
+		return false;
+
+	//every submesh is optimized on its own so the ranges stay valid
+	std::vector<sSubmeshInfo> ranges;
+	getMeshRanges(mesh, ranges);
+
+	std::vector<Vector3> positions;
+	getMeshPositions(mesh, positions);
+
+	sVertexCacheStats stats[4];
+	stats[0] = analyzeVertexCache(&indices[0], (int)indices.size(), num_vertices);
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+		if (ranges[i].length >= 3)
+			optimizeVertexCache(&indices[ranges[i].start], ranges[i].length, num_vertices);
+	stats[1] = analyzeVertexCache(&indices[0], (int)indices.size(), num_vertices);
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+		if (ranges[i].length >= 3)
+			optimizeOverdraw(&indices[ranges[i].start], ranges[i].length, positions);
+	stats[2] = analyzeVertexCache(&indices[0], (int)indices.size(), num_vertices);
+
+	optimizeVertexFetch(mesh);
+	stats[3] = analyzeVertexCache(&indices[0], (int)indices.size(), num_vertices);
+
+	//the meshlets follow the final order of the triangles
+	buildMeshlets(mesh);
+	buildLODs(mesh);
+
+	//before -> vertex cache -> overdraw -> vertex fetch
+	//it runs in worker threads, the line is built apart and written once so the global stream state is not touched
+	std::ostringstream line;
+	line.precision(3);
+	line << "[OPT ACMR " << stats[0].acmr << "->" << stats[1].acmr << "->" << stats[2].acmr << "->" << stats[3].acmr;
+	line << " ATVR " << stats[0].atvr << "->" << stats[1].atvr << "->" << stats[2].atvr << "->" << stats[3].atvr << "] ";
+	if (mesh->meshlets.size())
+		line << "[MESHLETS " << mesh->meshlets.size() << "] ";
+	if (mesh->lods.size())
+	{
+		line << "[LODS";
+		for (size_t i = 0; i < mesh->lods.size(); ++i)
+			line << " " << mesh->lods[i].length / 3;
+		line << "] ";
+	}
+	std::cout << line.str();
+	return true;
+}
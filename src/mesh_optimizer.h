@@ -0,0 +1,35 @@
+#pragma once
+
+#include "mesh.h"
+
+//post-transform cache simulation (FIFO) used to measure an index buffer
+struct sVertexCacheStats {
+	float acmr; //average cache miss ratio: vertices transformed per triangle (0.5 is the best possible)
+	float atvr; //average transformed vertex ratio: vertices transformed per vertex used (1.0 is the best possible)
+};
+
+sVertexCacheStats analyzeVertexCache(const unsigned int* indices, int num_indices, int num_vertices, int cache_size = 16);
+
+//reorders the triangles to reuse the post-transform cache (Forsyth's linear speed algorithm)
+void optimizeVertexCache(unsigned int* indices, int num_indices, int num_vertices);
+
+//splits the triangles in clusters and draws first the ones facing outwards, so less pixels are overdrawn
+//threshold is how much worse the ACMR can get compared to the input
+void optimizeOverdraw(unsigned int* indices, int num_indices, const std::vector<Vector3>& positions, float threshold = 1.05f);
+
+//renumbers the vertices in the order they are used by the index buffer, so vertex fetching is linear
+void optimizeVertexFetch(Mesh* mesh);
+
+//splits the index buffer in contiguous meshlets of up to max_vertices and max_triangles, with their bounding sphere and normal cone
+//the index buffer should be already optimized for the vertex cache, so consecutive triangles are close to each other
+void buildMeshlets(Mesh* mesh, int max_vertices = 64, int max_triangles = 124);
+
+//quadric error edge collapse, reduces the triangles until target_indices or max_error (object space) is reached
+//borders and attribute seams are kept, returns the error of the result (max distance to the input surface)
+float simplifyIndices(std::vector<unsigned int>& result, const unsigned int* indices, int num_indices, const std::vector<Vector3>& positions, int target_indices, float max_error);
+
+//appends simplified levels of detail to the index buffer and fills mesh->lods (level 0 is the full mesh)
+void buildLODs(Mesh* mesh, int max_levels = 4);
+
+//runs all the passes over every submesh of an indexed mesh (used when cooking) and builds the meshlets and LODs, prints the statistics
+bool optimizeMesh(Mesh* mesh);
@@ -0,0 +1,417 @@
+#include "obj_loader.h"
+#include "mesh.h"
+#include "task.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define OBJ_MIN_CHUNK_SIZE (4 << 20) //smaller files are parsed in one thread
+#define OBJ_RELATIVE_POSITION 1 //negative indices are relative to the vertices read so far
+#define OBJ_RELATIVE_UV 2
+#define OBJ_RELATIVE_NORMAL 4
+
+//one corner of a triangle, indices are 1-based (0 means missing) or relative to the start of the chunk
+struct sOBJCorner {
+	int position;
+	int uv;
+	int normal;
+	int relative; //OBJ_RELATIVE flags
+};
+
+//usemtl or g, replayed in order when merging the chunks
+struct sOBJEvent {
+	size_t corner; //corners of the chunk before the event
+	bool is_group;
+	char name[64];
+};
+
+struct sOBJChunk {
+	const char* start;
+	const char* end;
+
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
+	std::vector<sOBJCorner> corners;
+	std::vector<sOBJEvent> events;
+
+	//corners written before the first vt/vn of the chunk, the old loader only added those streams after the first one
+	size_t first_uv_corner;
+	size_t first_normal_corner;
+
+	Vector3 aabb_min;
+	Vector3 aabb_max;
+};
+
+static const double obj_powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+inline bool isOBJSpace(char c) { return c == ' ' || c == '\t'; }
+
+inline const char* skipOBJSpaces(const char* pos, const char* end)
+{
+	while (pos < end && isOBJSpace(*pos))
+		pos++;
+	return pos;
+}
+
+inline const char* skipOBJToken(const char* pos, const char* end)
+{
+	while (pos < end && !isOBJSpace(*pos))
+		pos++;
+	return pos;
+}
+
+//fast path: when the digits fit in the mantissa of a double and the power of ten is exact the result is the same as atof
+float parseOBJFloat(const char*& pos, const char* end)
+{
+	const char* start = pos;
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any_digit = false;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*pos - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exponent++;
+		any_digit = true;
+		pos++;
+	}
+	if (pos < end && *pos == '.')
+	{
+		pos++;
+		while (pos < end && *pos >= '0' && *pos <= '9')
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*pos - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			any_digit = true;
+			pos++;
+		}
+	}
+	if (any_digit && pos < end && (*pos == 'e' || *pos == 'E'))
+	{
+		const char* exp_pos = pos + 1;
+		bool exp_negative = false;
+		if (exp_pos < end && (*exp_pos == '-' || *exp_pos == '+'))
+			exp_negative = *exp_pos++ == '-';
+		if (exp_pos < end && *exp_pos >= '0' && *exp_pos <= '9')
+		{
+			int value = 0;
+			while (exp_pos < end && *exp_pos >= '0' && *exp_pos <= '9')
+			{
+				if (value < 10000)
+					value = value * 10 + (*exp_pos - '0');
+				exp_pos++;
+			}
+			exponent += exp_negative ? -value : value;
+			pos = exp_pos;
+		}
+	}
+
+	if (any_digit && (pos == end || isOBJSpace(*pos) || *pos == '/') && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double value = exponent < 0 ? mantissa / obj_powers_of_ten[-exponent] : mantissa * obj_powers_of_ten[exponent];
+		return (float)(negative ? -value : value);
+	}
+
+	//anything else (long mantissas, huge exponents, inf, nan...) goes to the C library
+	char buffer[64];
+	const char* token_end = skipOBJToken(start, end);
+	size_t length = std::min((size_t)(token_end - start), sizeof(buffer) - 1);
+	memcpy(buffer, start, length);
+	buffer[length] = 0;
+	pos = token_end;
+	return (float)atof(buffer);
+}
+
+inline int parseOBJInt(const char*& pos, const char* end)
+{
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+	int value = 0;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		value = value * 10 + (*pos++ - '0');
+	return negative ? -value : value;
+}
+
+//reads the floats of a v/vn/vt line, returns how many there were
+int parseOBJFloats(const char* pos, const char* end, float* values, int max_values)
+{
+	int count = 0;
+	while (true)
+	{
+		pos = skipOBJSpaces(pos, end);
+		if (pos == end)
+			break;
+		if (count < max_values)
+			values[count] = parseOBJFloat(pos, end);
+		pos = skipOBJToken(pos, end);
+		count++;
+	}
+	return count;
+}
+
+//p, p/t, p/t/n or p//n
+void parseOBJCorner(const char* pos, const char* end, sOBJChunk& chunk, sOBJCorner& corner)
+{
+	corner.position = parseOBJInt(pos, end);
+	corner.uv = corner.normal = corner.relative = 0;
+	if (pos < end && *pos == '/')
+	{
+		pos++;
+		if (pos < end && *pos != '/')
+			corner.uv = parseOBJInt(pos, end);
+		if (pos < end && *pos == '/')
+		{
+			pos++;
+			corner.normal = parseOBJInt(pos, end);
+		}
+	}
+
+	//negative indices count back from the last vertex, stored as 0-based index from the start of the chunk (can be negative)
+	if (corner.position < 0)
+	{
+		corner.position += (int)chunk.positions.size();
+		corner.relative |= OBJ_RELATIVE_POSITION;
+	}
+	if (corner.uv < 0)
+	{
+		corner.uv += (int)chunk.uvs.size();
+		corner.relative |= OBJ_RELATIVE_UV;
+	}
+	if (corner.normal < 0)
+	{
+		corner.normal += (int)chunk.normals.size();
+		corner.relative |= OBJ_RELATIVE_NORMAL;
+	}
+}
+
+void readOBJName(const char* pos, const char* end, char* name)
+{
+	pos = skipOBJSpaces(pos, end);
+	const char* name_end = skipOBJToken(pos, end);
+	size_t length = std::min((size_t)(name_end - pos), (size_t)63);
+	memcpy(name, pos, length);
+	name[length] = 0;
+}
+
+void parseOBJChunk(sOBJChunk* chunk)
+{
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	chunk->aabb_min.set(max_float, max_float, max_float);
+	chunk->aabb_max.set(min_float, min_float, min_float);
+	chunk->first_uv_corner = chunk->first_normal_corner = (size_t)-1;
+
+	sOBJCorner polygon[3];
+	const char* pos = chunk->start;
+	const char* end = chunk->end;
+	while (pos < end)
+	{
+		//one line
+		const char* line_end = (const char*)memchr(pos, '\n', end - pos);
+		if (!line_end)
+			line_end = end;
+		const char* next = line_end + (line_end < end ? 1 : 0);
+		if (line_end > pos && line_end[-1] == '\r')
+			line_end--;
+
+		pos = skipOBJSpaces(pos, line_end);
+		const char* keyword_end = skipOBJToken(pos, line_end);
+		size_t keyword_length = keyword_end - pos;
+
+		if (keyword_length == 1 && pos[0] == 'v')
+		{
+			float values[3];
+			if (parseOBJFloats(keyword_end, line_end, values, 3) >= 3)
+			{
+				Vector3 v(values[0], values[1], values[2]);
+				chunk->positions.push_back(v);
+				chunk->aabb_min.setMin(v);
+				chunk->aabb_max.setMax(v);
+			}
+		}
+		else if (keyword_length == 2 && pos[0] == 'v' && pos[1] == 't')
+		{
+			float values[2];
+			if (parseOBJFloats(keyword_end, line_end, values, 2) >= 2)
+			{
+				if (chunk->uvs.empty())
+					chunk->first_uv_corner = chunk->corners.size();
+				chunk->uvs.push_back(Vector2(values[0], 1.0f - values[1]));
+			}
+		}
+		else if (keyword_length == 2 && pos[0] == 'v' && pos[1] == 'n')
+		{
+			float values[3];
+			if (parseOBJFloats(keyword_end, line_end, values, 3) >= 3)
+			{
+				if (chunk->normals.empty())
+					chunk->first_normal_corner = chunk->corners.size();
+				chunk->normals.push_back(Vector3(values[0], values[1], values[2]));
+			}
+		}
+		else if (keyword_length == 1 && pos[0] == 'f')
+		{
+			//triangle fan
+			int count = 0;
+			const char* token = skipOBJSpaces(keyword_end, line_end);
+			while (token < line_end)
+			{
+				const char* token_end = skipOBJToken(token, line_end);
+				parseOBJCorner(token, token_end, *chunk, polygon[count < 2 ? count : 2]);
+				if (count >= 2)
+				{
+					chunk->corners.push_back(polygon[0]);
+					chunk->corners.push_back(polygon[1]);
+					chunk->corners.push_back(polygon[2]);
+					polygon[1] = polygon[2];
+				}
+				count++;
+				token = skipOBJSpaces(token_end, line_end);
+			}
+		}
+		else if ((keyword_length == 6 && memcmp(pos, "usemtl", 6) == 0) || (keyword_length == 1 && pos[0] == 'g'))
+		{
+			sOBJEvent event;
+			event.corner = chunk->corners.size();
+			event.is_group = pos[0] == 'g';
+			readOBJName(keyword_end, line_end, event.name);
+			chunk->events.push_back(event);
+		}
+		//comments, s, o, mtllib... are ignored
+
+		pos = next;
+	}
+}
+
+template<typename T> const T& getOBJElement(const std::vector<T>& container, int index, int relative_offset, bool relative)
+{
+	static T empty;
+	size_t i = relative ? (size_t)(relative_offset + index) : (size_t)(index - 1);
+	return i < container.size() ? container[i] : empty;
+}
+
+bool parseOBJ(Mesh* mesh, const char* data, size_t size)
+{
+	//split in chunks at line boundaries
+	int num_threads = ThreadPool::get().getNumThreads() + 1; //the caller helps
+	int num_chunks = (int)std::min((size_t)num_threads, size / OBJ_MIN_CHUNK_SIZE + 1);
+	std::vector<sOBJChunk> chunks(num_chunks);
+	const char* pos = data;
+	const char* end = data + size;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		chunks[i].start = pos;
+		const char* chunk_end = i == num_chunks - 1 ? end : std::min(end, data + size / num_chunks * (i + 1));
+		while (chunk_end < end && chunk_end[-1] != '\n')
+			chunk_end++;
+		chunks[i].end = pos = std::max(pos, chunk_end);
+	}
+
+	ThreadPool& pool = ThreadPool::get();
+	pool.parallel_for(0, num_chunks, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+			parseOBJChunk(&chunks[i]);
+	});
+
+	//offsets of every chunk in the merged arrays
+	std::vector<size_t> position_offset(num_chunks + 1, 0), uv_offset(num_chunks + 1, 0), normal_offset(num_chunks + 1, 0);
+	std::vector<size_t> corner_offset(num_chunks + 1, 0), uv_corner_offset(num_chunks + 1, 0), normal_corner_offset(num_chunks + 1, 0);
+	std::vector<size_t> first_uv_corner(num_chunks), first_normal_corner(num_chunks);
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		position_offset[i + 1] = position_offset[i] + chunk.positions.size();
+		uv_offset[i + 1] = uv_offset[i] + chunk.uvs.size();
+		normal_offset[i + 1] = normal_offset[i] + chunk.normals.size();
+		corner_offset[i + 1] = corner_offset[i] + chunk.corners.size();
+
+		//faces only get uvs and normals once some were declared
+		first_uv_corner[i] = uv_offset[i] ? 0 : std::min(chunk.first_uv_corner, chunk.corners.size());
+		first_normal_corner[i] = normal_offset[i] ? 0 : std::min(chunk.first_normal_corner, chunk.corners.size());
+		uv_corner_offset[i + 1] = uv_corner_offset[i] + chunk.corners.size() - first_uv_corner[i];
+		normal_corner_offset[i + 1] = normal_corner_offset[i] + chunk.corners.size() - first_normal_corner[i];
+	}
+
+	std::vector<Vector3> indexed_positions(position_offset[num_chunks]);
+	std::vector<Vector2> indexed_uvs(uv_offset[num_chunks]);
+	std::vector<Vector3> indexed_normals(normal_offset[num_chunks]);
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	mesh->aabb_min.set(max_float, max_float, max_float);
+	mesh->aabb_max.set(min_float, min_float, min_float);
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), indexed_positions.begin() + position_offset[i]);
+		std::copy(chunk.uvs.begin(), chunk.uvs.end(), indexed_uvs.begin() + uv_offset[i]);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), indexed_normals.begin() + normal_offset[i]);
+		mesh->aabb_min.setMin(chunk.aabb_min);
+		mesh->aabb_max.setMax(chunk.aabb_max);
+	}
+
+	//expand the triangles, every chunk writes its own part
+	mesh->vertices.resize(corner_offset[num_chunks]);
+	mesh->uvs.resize(uv_corner_offset[num_chunks]);
+	mesh->normals.resize(normal_corner_offset[num_chunks]);
+	auto expand = [&](int i) {
+		const sOBJChunk& chunk = chunks[i];
+		for (size_t j = 0; j < chunk.corners.size(); ++j)
+		{
+			const sOBJCorner& corner = chunk.corners[j];
+			mesh->vertices[corner_offset[i] + j] = getOBJElement(indexed_positions, corner.position, (int)position_offset[i], (corner.relative & OBJ_RELATIVE_POSITION) != 0);
+			if (j >= first_uv_corner[i])
+				mesh->uvs[uv_corner_offset[i] + j - first_uv_corner[i]] = getOBJElement(indexed_uvs, corner.uv, (int)uv_offset[i], (corner.relative & OBJ_RELATIVE_UV) != 0);
+			if (j >= first_normal_corner[i])
+				mesh->normals[normal_corner_offset[i] + j - first_normal_corner[i]] = getOBJElement(indexed_normals, corner.normal, (int)normal_offset[i], (corner.relative & OBJ_RELATIVE_NORMAL) != 0);
+		}
+	};
+	pool.parallel_for(0, num_chunks, [&](int start, int end) {
+		for (int i = start; i < end; ++i)
+			expand(i);
+	});
+
+	//submeshes start with every usemtl or g that comes after some triangles
+	sSubmeshInfo submesh_info;
+	size_t last_submesh_vertex = 0;
+	memset(&submesh_info, 0, sizeof(submesh_info));
+	for (int i = 0; i < num_chunks; ++i)
+		for (size_t j = 0; j < chunks[i].events.size(); ++j)
+		{
+			const sOBJEvent& event = chunks[i].events[j];
+			size_t num_vertices = corner_offset[i] + event.corner;
+			if (last_submesh_vertex != num_vertices)
+			{
+				submesh_info.length = (int)(num_vertices - submesh_info.start);
+				last_submesh_vertex = num_vertices;
+				mesh->submeshes.push_back(submesh_info);
+				memset(&submesh_info, 0, sizeof(submesh_info));
+				strcpy(submesh_info.name, event.name);
+				submesh_info.start = (int)last_submesh_vertex;
+			}
+			else if (!event.is_group)
+				strcpy(submesh_info.material, event.name);
+		}
+	submesh_info.length = (int)(mesh->vertices.size() - last_submesh_vertex);
+	mesh->submeshes.push_back(submesh_info);
+
+	mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5;
+	mesh->box.halfsize = (mesh->aabb_max - mesh->box.center);
+	mesh->radius = (float)fmax(mesh->aabb_max.length(), mesh->aabb_min.length());
+	return true;
+}
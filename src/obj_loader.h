@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+
+class Mesh;
+
+//parses an OBJ in memory into the streams of the mesh (triangle soup, polygons are triangulated as fans)
+//it works over spans of the buffer without copying lines, big files are split in chunks parsed in parallel
+bool parseOBJ(Mesh* mesh, const char* data, size_t size);
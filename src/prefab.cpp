@@ -9,6 +9,7 @@
 
 #include "gltf_loader.h"
 #include "utils.h"
+#include "task.h"
 #include "framework.h"
 #include "application.h"
 
@@ -18,7 +19,7 @@ using namespace GTR;
 
 int Node::s_NodeID = 0;
 
-Node::Node() : parent(NULL), mesh(NULL), material(NULL), visible(true), layers(0xFF)
+Node::Node() : parent(NULL), visible(true), layers(0xFF)
 {
 	m_Id = s_NodeID++;
 }
@@ -177,10 +178,24 @@ void Node::renderInMenu()
 #endif
 }
 
-Prefab::Prefab()
+Prefab::Prefab() : Resource(RESOURCE_PREFAB)
 {
 }
 
+int countNodes(Node* node)
+{
+	int num = 1;
+	for (size_t i = 0; i < node->children.size(); ++i)
+		num += countNodes(node->children[i]);
+	return num;
+}
+
+void Prefab::getMemoryUsage(size_t& cpu, size_t& gpu)
+{
+	cpu = sizeof(Prefab) + (countNodes(&root) - 1) * sizeof(Node);
+	gpu = 0;
+}
+
 Prefab::~Prefab()
 {
 	if (name.size())
@@ -197,6 +212,7 @@ void Prefab::updateBounding()
 }
 
 std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+bool Prefab::use_binary = true;
 
 Prefab* Prefab::Get(const char* filename)
 {
@@ -207,8 +223,21 @@ Prefab* Prefab::Get(const char* filename)
 
 	Prefab* prefab = nullptr;
 	{
+		if (use_binary)
+		{
+			prefab = new Prefab();
+			if (!prefab->readBin(filename))
+			{
+				delete prefab;
+				prefab = nullptr;
+			}
+		}
 		if (!prefab)
+		{
 			prefab = loadGLTF(filename);
+			if (prefab && use_binary)
+				prefab->writeBin(filename);
+		}
 		if (!prefab) {
 			std::cout << "[ERROR]: Prefab not found" << std::endl;
 			return NULL;
@@ -221,6 +250,462 @@ Prefab* Prefab::Get(const char* filename)
 	return prefab;
 }
 
+//file reading, parsing, mesh building and image decoding run in worker threads,
+//the last job of every prefab creates the nodes and uploads to the GPU in this thread
+void Prefab::Preload(const std::vector<std::string>& filenames)
+{
+	long time = getTime();
+	JobGraph graph;
+	std::vector<sGLTFLoadState*> states;
+	std::vector<int> finish_jobs(filenames.size(), -1);
+
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		const std::string& filename = filenames[i];
+		bool repeated = sPrefabsLoaded.find(filename) != sPrefabsLoaded.end();
+		for (size_t j = 0; j < states.size() && !repeated; ++j)
+			repeated = states[j]->filename == filename;
+		if (repeated)
+			continue;
+
+		//the cooked ones are already fast to load
+		if (use_binary)
+		{
+			Prefab* prefab = new Prefab();
+			if (prefab->readBin(filename.c_str()))
+			{
+				prefab->registerPrefab(filename);
+				prefab->updateBounding();
+				continue;
+			}
+			delete prefab;
+		}
+
+		sGLTFLoadState* state = new sGLTFLoadState();
+		state->filename = filename;
+		states.push_back(state);
+
+		//the finish job is created before running, the parse job adds its dependencies
+		int parse_job = graph.addJob([&graph, &finish_jobs, state, i]() {
+			if (!parseGLTFFile(state))
+				return;
+			for (size_t j = 0; j < state->meshes.size(); ++j)
+				graph.addDependency(finish_jobs[i], graph.addJob([state, j]() { buildGLTFMesh(state, (int)j); }));
+			for (size_t j = 0; j < state->images.size(); ++j)
+				graph.addDependency(finish_jobs[i], graph.addJob([state, j]() { decodeGLTFImage(state, (int)j); }));
+		});
+
+		finish_jobs[i] = graph.addJob([state]() {
+			Prefab* prefab = finishGLTF(state);
+			if (!prefab)
+				std::cout << "[ERROR]: Prefab not found: " << state->filename << std::endl;
+			else
+			{
+				if (use_binary)
+					prefab->writeBin(state->filename.c_str());
+				prefab->registerPrefab(state->filename);
+				prefab->updateBounding();
+			}
+			delete state;
+		}, true, std::vector<int>(1, parse_job));
+	}
+
+	if (!states.size())
+		return;
+
+	graph.run();
+	std::cout << " + Prefabs preloaded: " << states.size() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+}
+
+//PBIN: header + tables of fixed size structs + string table + inlined MBINs, everything addressed by offsets from the start
+#define PREFAB_BIN_VERSION 2 //v2: the cooked meshes are in the sources
+#define PREFAB_BIN_ALIGNMENT 4096 //the inlined MBINs keep their streams page aligned in the mapping
+#define PREFAB_BIN_NONE 0xFFFFFFFF
+
+struct sPrefabBinHeader {
+	char watermark[4]; //"PBIN"
+	int version;
+	int mesh_bin_version;
+	int num_sources;
+	int num_nodes;
+	int num_materials;
+	int num_meshes;
+	unsigned int sources_offset;
+	unsigned int nodes_offset;
+	unsigned int materials_offset;
+	unsigned int meshes_offset;
+	unsigned int strings_offset;
+	unsigned int strings_size;
+};
+
+struct sPrefabBinSource { //files used to build it, if any changes the prefab is rebuilt (size -1 if it did not exist, like a mesh not cooked yet)
+	unsigned int name;
+	int padding;
+	long long size;
+	long long modified;
+};
+
+struct sPrefabBinNode { //in depth first order, parents always go before their children
+	int parent;
+	unsigned int name;
+	int visible;
+	int layers;
+	float model[16];
+	unsigned int mesh;
+	unsigned int material;
+};
+
+struct sPrefabBinSampler {
+	unsigned int texture; //filename in the strings
+	int uv_channel;
+};
+
+struct sPrefabBinMaterial {
+	unsigned int name;
+	int alpha_mode;
+	float alpha_cutoff;
+	int two_sided;
+	float color[4];
+	float roughness_factor;
+	float metallic_factor;
+	float emissive_factor[3];
+	sPrefabBinSampler samplers[6]; //color, emissive, opacity, metallic_roughness, occlusion, normal
+};
+
+struct sPrefabBinMesh {
+	unsigned int name;
+	unsigned int offset;
+	unsigned int size;
+};
+
+Sampler* getMaterialSamplers(Material* material, int index)
+{
+	Sampler* samplers[] = { &material->color_texture, &material->emissive_texture, &material->opacity_texture, &material->metallic_roughness_texture, &material->occlusion_texture, &material->normal_texture };
+	return samplers[index];
+}
+
+unsigned int addBinString(std::vector<char>& strings, const std::string& str)
+{
+	unsigned int offset = (unsigned int)strings.size();
+	strings.insert(strings.end(), str.begin(), str.end());
+	strings.push_back(0);
+	return offset;
+}
+
+void addBinNodes(Node* node, int parent, std::vector<sPrefabBinNode>& nodes, std::vector<char>& strings, std::map<Mesh*, unsigned int>& meshes, std::map<Material*, unsigned int>& materials)
+{
+	sPrefabBinNode bin;
+	bin.parent = parent;
+	bin.name = addBinString(strings, node->name);
+	bin.visible = node->visible;
+	bin.layers = node->layers;
+	memcpy(bin.model, node->model.m, sizeof(bin.model));
+	bin.mesh = PREFAB_BIN_NONE;
+	bin.material = PREFAB_BIN_NONE;
+	if (node->mesh)
+	{
+		if (meshes.find(node->mesh) == meshes.end())
+		{
+			unsigned int index = (unsigned int)meshes.size();
+			meshes[node->mesh] = index;
+		}
+		bin.mesh = meshes[node->mesh];
+	}
+	if (node->material)
+	{
+		if (materials.find(node->material) == materials.end())
+		{
+			unsigned int index = (unsigned int)materials.size();
+			materials[node->material] = index;
+		}
+		bin.material = materials[node->material];
+	}
+
+	int index = (int)nodes.size();
+	nodes.push_back(bin);
+	for (size_t i = 0; i < node->children.size(); ++i)
+		addBinNodes(node->children[i], index, nodes, strings, meshes, materials);
+}
+
+template<typename T> void appendBinTable(std::vector<char>& buffer, const std::vector<T>& table, unsigned int& offset)
+{
+	buffer.resize((buffer.size() + 7) & ~7, 0); //so the tables can be read in place
+	offset = (unsigned int)buffer.size();
+	if (table.size())
+		buffer.insert(buffer.end(), (const char*)&table[0], (const char*)&table[0] + table.size() * sizeof(T));
+}
+
+bool Prefab::writeBin(const char* filename)
+{
+	std::vector<char> strings;
+	strings.push_back(0); //offset 0 is the empty string
+
+	//the glTF and its buffers
+	std::vector<std::string> files;
+	std::vector<sPrefabBinSource> sources;
+	if (!getGLTFDependencies(filename, files))
+		return false;
+	size_t num_dependencies = files.size();
+
+	//and the cooked meshes, so cooking the glTF again rebuilds the prefab with them
+	if (!getGLTFCookedFiles(filename, files))
+		return false;
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		sPrefabBinSource source;
+		source.name = addBinString(strings, files[i]);
+		source.padding = 0;
+		if (!getFileStamp(files[i], source.size, source.modified))
+		{
+			if (i < num_dependencies)
+				return false;
+			source.size = -1;
+			source.modified = 0;
+		}
+		sources.push_back(source);
+	}
+
+	std::vector<sPrefabBinNode> nodes;
+	std::map<Mesh*, unsigned int> mesh_indices;
+	std::map<Material*, unsigned int> material_indices;
+	addBinNodes(&root, -1, nodes, strings, mesh_indices, material_indices);
+
+	std::vector<sPrefabBinMaterial> materials(material_indices.size());
+	for (auto it = material_indices.begin(); it != material_indices.end(); ++it)
+	{
+		Material* material = it->first;
+		sPrefabBinMaterial& bin = materials[it->second];
+		memset(&bin, 0, sizeof(bin));
+		bin.name = addBinString(strings, material->name);
+		bin.alpha_mode = material->alpha_mode;
+		bin.alpha_cutoff = material->alpha_cutoff;
+		bin.two_sided = material->two_sided;
+		memcpy(bin.color, material->color.v, sizeof(bin.color));
+		bin.roughness_factor = material->roughness_factor;
+		bin.metallic_factor = material->metallic_factor;
+		memcpy(bin.emissive_factor, material->emissive_factor.v, sizeof(bin.emissive_factor));
+		for (int i = 0; i < 6; ++i)
+		{
+			Sampler* sampler = getMaterialSamplers(material, i);
+			bin.samplers[i].texture = sampler->texture && sampler->texture->filename.size() ? addBinString(strings, sampler->texture->filename) : PREFAB_BIN_NONE;
+			bin.samplers[i].uv_channel = sampler->uv_channel;
+		}
+	}
+
+	std::vector<sPrefabBinMesh> meshes(mesh_indices.size());
+	std::vector< std::vector<char> > mesh_bins(mesh_indices.size());
+	for (auto it = mesh_indices.begin(); it != mesh_indices.end(); ++it)
+	{
+		meshes[it->second].name = addBinString(strings, it->first->name);
+		it->first->writeBinToBuffer(mesh_bins[it->second]);
+	}
+
+	sPrefabBinHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.watermark, "PBIN", 4);
+	header.version = PREFAB_BIN_VERSION;
+	header.mesh_bin_version = MESH_BIN_VERSION;
+	header.num_sources = (int)sources.size();
+	header.num_nodes = (int)nodes.size();
+	header.num_materials = (int)materials.size();
+	header.num_meshes = (int)meshes.size();
+
+	std::vector<char> buffer(sizeof(header));
+	appendBinTable(buffer, sources, header.sources_offset);
+	appendBinTable(buffer, nodes, header.nodes_offset);
+	appendBinTable(buffer, materials, header.materials_offset);
+	appendBinTable(buffer, meshes, header.meshes_offset);
+	appendBinTable(buffer, strings, header.strings_offset);
+	header.strings_size = (unsigned int)strings.size();
+
+	for (size_t i = 0; i < mesh_bins.size(); ++i)
+	{
+		buffer.resize((buffer.size() + PREFAB_BIN_ALIGNMENT - 1) / PREFAB_BIN_ALIGNMENT * PREFAB_BIN_ALIGNMENT, 0);
+		sPrefabBinMesh& bin = ((sPrefabBinMesh*)&buffer[header.meshes_offset])[i];
+		bin.offset = (unsigned int)buffer.size();
+		bin.size = (unsigned int)mesh_bins[i].size();
+		buffer.insert(buffer.end(), mesh_bins[i].begin(), mesh_bins[i].end());
+	}
+	memcpy(&buffer[0], &header, sizeof(header));
+
+	std::string bin_filename = std::string(filename) + ".pbin";
+	FILE* f = fopen(bin_filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write prefab BIN: " << bin_filename << std::endl;
+		return false;
+	}
+	fwrite(&buffer[0], 1, buffer.size(), f);
+	fclose(f);
+	return true;
+}
+
+bool Prefab::readBin(const char* filename)
+{
+	long time = getTime();
+	std::string bin_filename = std::string(filename) + ".pbin";
+	MappedFile* file = new MappedFile();
+	if (!file->open(bin_filename.c_str()))
+	{
+		file->release();
+		return false;
+	}
+
+	const char* data = file->data;
+	sPrefabBinHeader header;
+	bool valid = file->size >= sizeof(header);
+	if (valid)
+	{
+		memcpy(&header, data, sizeof(header));
+		valid = memcmp(header.watermark, "PBIN", 4) == 0 && header.version == PREFAB_BIN_VERSION && header.mesh_bin_version == MESH_BIN_VERSION &&
+			header.num_nodes > 0 && header.num_materials >= 0 && header.num_meshes >= 0 && header.num_sources >= 0 && header.strings_size > 0 && (size_t)header.strings_offset + header.strings_size <= file->size && data[header.strings_offset + header.strings_size - 1] == 0 &&
+			(size_t)header.nodes_offset + header.num_nodes * sizeof(sPrefabBinNode) <= file->size &&
+			(size_t)header.materials_offset + header.num_materials * sizeof(sPrefabBinMaterial) <= file->size &&
+			(size_t)header.meshes_offset + header.num_meshes * sizeof(sPrefabBinMesh) <= file->size &&
+			(size_t)header.sources_offset + header.num_sources * sizeof(sPrefabBinSource) <= file->size;
+	}
+	if (!valid)
+	{
+		std::cout << "[WARN] prefab BIN invalid or old version: " << bin_filename << std::endl;
+		file->release();
+		return false;
+	}
+
+	const char* strings = data + header.strings_offset;
+	const sPrefabBinSource* sources = (const sPrefabBinSource*)(data + header.sources_offset);
+	const sPrefabBinNode* bin_nodes = (const sPrefabBinNode*)(data + header.nodes_offset);
+	const sPrefabBinMaterial* bin_materials = (const sPrefabBinMaterial*)(data + header.materials_offset);
+	const sPrefabBinMesh* bin_meshes = (const sPrefabBinMesh*)(data + header.meshes_offset);
+
+	//every string must start inside the block, as it ends with a 0 all of them are terminated inside too
+	for (int i = 0; i < header.num_sources && valid; ++i)
+		valid = sources[i].name < header.strings_size;
+	for (int i = 0; i < header.num_nodes && valid; ++i)
+		valid = bin_nodes[i].name < header.strings_size;
+	for (int i = 0; i < header.num_meshes && valid; ++i)
+		valid = bin_meshes[i].name < header.strings_size;
+	for (int i = 0; i < header.num_materials && valid; ++i)
+	{
+		valid = bin_materials[i].name < header.strings_size;
+		for (int j = 0; j < 6 && valid; ++j)
+			valid = bin_materials[i].samplers[j].texture == PREFAB_BIN_NONE || bin_materials[i].samplers[j].texture < header.strings_size;
+	}
+	if (!valid)
+	{
+		std::cout << "[WARN] prefab BIN with strings out of bounds: " << bin_filename << std::endl;
+		file->release();
+		return false;
+	}
+
+	//rebuild if the glTF changed
+	for (int i = 0; i < header.num_sources; ++i)
+	{
+		long long size = -1, modified = 0;
+		getFileStamp(strings + sources[i].name, size, modified);
+		if (size != sources[i].size || modified != sources[i].modified)
+		{
+			file->release();
+			return false;
+		}
+	}
+
+	//the cooked images of the glTF are written by the decode tasks after the BIN, rebuild if one never got saved
+	std::string cooked_prefix = std::string(filename) + ".image";
+	for (int i = 0; i < header.num_materials; ++i)
+		for (int j = 0; j < 6; ++j)
+		{
+			if (bin_materials[i].samplers[j].texture == PREFAB_BIN_NONE)
+				continue;
+			const char* texture = strings + bin_materials[i].samplers[j].texture;
+			long long size = -1, modified = 0;
+			if (std::string(texture).compare(0, cooked_prefix.size(), cooked_prefix) == 0 && (!getFileStamp(texture, size, modified) || size <= 0))
+			{
+				std::cout << "[WARN] prefab BIN with a missing cooked image: " << texture << std::endl;
+				file->release();
+				return false;
+			}
+		}
+
+	//meshes are used straight from the mapping when possible
+	std::vector<Mesh*> meshes(header.num_meshes, NULL);
+	for (int i = 0; i < header.num_meshes; ++i)
+	{
+		const sPrefabBinMesh& bin = bin_meshes[i];
+		const char* name = strings + bin.name;
+		Mesh* mesh = name[0] ? Mesh::Get(name, false, true) : NULL;
+		if (!mesh && (size_t)bin.offset + bin.size <= file->size)
+		{
+			mesh = new Mesh();
+			if (!mesh->readBinFromMemory(data + bin.offset, bin.size, file))
+			{
+				delete mesh;
+				mesh = NULL;
+			}
+			else
+			{
+				if (!mesh->mapped_file && Mesh::auto_upload_to_vram)
+					mesh->uploadToVRAM();
+				if (name[0])
+					mesh->registerMesh(name);
+			}
+		}
+		meshes[i] = mesh;
+	}
+
+	std::vector<Material*> materials(header.num_materials, NULL);
+	for (int i = 0; i < header.num_materials; ++i)
+	{
+		const sPrefabBinMaterial& bin = bin_materials[i];
+		const char* name = strings + bin.name;
+		Material* material = name[0] ? Material::Get(name) : NULL;
+		if (!material)
+		{
+			material = new Material();
+			if (name[0])
+				material->registerMaterial(name);
+			material->alpha_mode = (eAlphaMode)bin.alpha_mode;
+			material->alpha_cutoff = bin.alpha_cutoff;
+			material->two_sided = bin.two_sided != 0;
+			material->color.set(bin.color[0], bin.color[1], bin.color[2], bin.color[3]);
+			material->roughness_factor = bin.roughness_factor;
+			material->metallic_factor = bin.metallic_factor;
+			material->emissive_factor.set(bin.emissive_factor[0], bin.emissive_factor[1], bin.emissive_factor[2]);
+			for (int j = 0; j < 6; ++j)
+			{
+				Sampler* sampler = getMaterialSamplers(material, j);
+				if (bin.samplers[j].texture != PREFAB_BIN_NONE)
+					sampler->texture = Texture::GetAsync(strings + bin.samplers[j].texture);
+				sampler->uv_channel = bin.samplers[j].uv_channel;
+			}
+		}
+		materials[i] = material;
+	}
+
+	std::vector<Node*> nodes(header.num_nodes, NULL);
+	for (int i = 0; i < header.num_nodes; ++i)
+	{
+		const sPrefabBinNode& bin = bin_nodes[i];
+		Node* node = i == 0 ? &root : new Node();
+		node->name = strings + bin.name;
+		node->visible = bin.visible != 0;
+		node->layers = bin.layers;
+		memcpy(node->model.m, bin.model, sizeof(bin.model));
+		node->mesh = bin.mesh < meshes.size() ? meshes[bin.mesh] : NULL;
+		node->material = bin.material < materials.size() ? materials[bin.material] : NULL;
+		if (i > 0)
+			(bin.parent >= 0 && bin.parent < i ? nodes[bin.parent] : &root)->addChild(node);
+		nodes[i] = node;
+	}
+
+	file->release(); //the meshes keep their references
+
+	updateNodesByName();
+	updateBounding();
+	std::cout << " + Prefab loading: " << bin_filename << " [OK BIN] Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
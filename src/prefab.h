@@ -4,9 +4,11 @@
 #include <cassert>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "material.h"
 #include "scene.h"
+#include "resources.h"
 
 //forward declaration
 class Mesh;
@@ -37,9 +39,9 @@ namespace GTR {
 		bool visible;
 		int layers;
 
-		Mesh* mesh;
+		ResourceHandle<Mesh> mesh;
 		//std::vector<Primitive*> primitives;
-		Material* material;
+		ResourceHandle<Material> material;
 
 		Matrix44 model;	//the matrix that defines where is the object (in relation to its parent)
 		Matrix44 global_model;	//the matrix that defines where is the object (in relation to the world)
@@ -90,7 +92,7 @@ namespace GTR {
 
 	//a Prefab represent a set of objects in a tree structure
 	//used to load info from GLTF files
-	class Prefab
+	class Prefab : public Resource
 	{
 	public:
 
@@ -106,13 +108,21 @@ namespace GTR {
 		Prefab();
 		~Prefab();
 
+		void getMemoryUsage(size_t& cpu, size_t& gpu);
+
 		void updateBounding();
 		void updateNodesByName();
 		Node* getNodeByName(const char* name);
 
+		//cooked version: nodes, materials and inlined MBINs in one flat file next to the glTF (filename + ".pbin")
+		static bool use_binary; //read it when it is up to date, write it after loading the glTF
+		bool readBin(const char* filename); //fails if the sources changed
+		bool writeBin(const char* filename);
+
 				//Manager to cache loaded prefabs
 		static std::map<std::string, Prefab*> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static void Preload(const std::vector<std::string>& filenames); //loads them at once using all the cores, repeated ones only once
 		void registerPrefab(std::string name);
 	};
 
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include "fbo.h"
 #include "application.h"
+#include "task.h"
 using namespace GTR;
 
 
@@ -33,6 +34,13 @@ GTR::Renderer::Renderer(){
     show_probes = true;
     add_irradiance = true;
     interpolate_irradiance = true;
+    use_meshlet_culling = true;
+    use_lods = true;
+    lod_error_pixels = 1.0;
+    lod_hysteresis = 0.25;
+    shadow_lod_bias = 1;
+    culled_mesh = NULL;
+    use_frame_jobs = true;
     tone_mapper = LUMA_BASED_REINHARD;
     
     float w = Application::instance->window_width;
@@ -85,43 +93,15 @@ struct sortRCVector{
 
 void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 {
-    //reset vectors
-    this->render_call_vector.resize(0);
-    this->lights.resize(0);
-    
-	//render entities
-	for (int i = 0; i < scene->entities.size(); ++i)
-	{
-		BaseEntity* ent = scene->entities[i];
-		if (!ent->visible)
-			continue;
-
-		//is a prefab!
-		if (ent->entity_type == PREFAB)
-		{
-			PrefabEntity* pent = (GTR::PrefabEntity*)ent;
-			if(pent->prefab)
-				renderPrefab(ent->model, pent->prefab, camera);
-		}
-        
-        //is a light!
-        if (ent->entity_type == LIGHT)
-        {
-            LightEntity* light = (GTR::LightEntity*)ent;
-            this->lights.push_back(light);
-        }
-	}
-    
-    // sort render_call_vector before rendering
-    std::sort(std::begin(this->render_call_vector), std::end(this->render_call_vector), sortRCVector());
-    
+    // everything before the GL calls
+    prepareFrame(scene, camera);
     
     // generate shadowmaps
     for(int i=0; i < this->lights.size(); i++){
         LightEntity* light = lights[i];
         // if this light casts any shadow, generate shadow map
         if(light->cast_shadows)
-            generateShadowmap(light);
+            generateShadowmap(light, shadow_casters[i]);
     }
     
     if(rendering_pipeline == FORWARD)
@@ -148,13 +128,116 @@ void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
     //glViewport(0, 0, Application::instance->window_width, Application::instance->window_height);
 }
 
+// the jobs of the frame: gather every group of entities -> sort -> cull for the camera and for every shadow light at the same time
+// every job writes to its own place and the gathered calls are joined in the order of the entities, so the result does not depend on the threads
+void Renderer::prepareFrame(GTR::Scene* scene, Camera* camera)
+{
+    //reset vectors
+    this->render_call_vector.resize(0);
+    this->lights.resize(0);
+    
+    // the temporary containers of the frame come from the frame arena
+    FrameVector<PrefabEntity*> prefabs;
+    for (size_t i = 0; i < scene->entities.size(); ++i)
+    {
+        BaseEntity* ent = scene->entities[i];
+        if (!ent->visible)
+            continue;
+        if (ent->entity_type == PREFAB && ((PrefabEntity*)ent)->prefab)
+            prefabs.push_back((PrefabEntity*)ent);
+        if (ent->entity_type == LIGHT)
+            this->lights.push_back((LightEntity*)ent);
+    }
+    
+    shadow_casters.resize(lights.size());
+    for (size_t i = 0; i < shadow_casters.size(); ++i)
+        shadow_casters[i].resize(0);
+    
+    const int entities_per_job = 16;
+    int num_groups = ((int)prefabs.size() + entities_per_job - 1) / entities_per_job;
+    FrameVector< FrameVector<RenderCall> > gathered(num_groups);
+    
+    JobGraph graph;
+    std::vector<int> gather_jobs;
+    for (int g = 0; g < num_groups; ++g)
+        gather_jobs.push_back(graph.addJob([&, g]() {
+            int end = std::min((g + 1) * entities_per_job, (int)prefabs.size());
+            for (int i = g * entities_per_job; i < end; ++i)
+                gatherEntityRenderCalls(prefabs[i]->model, prefabs[i]->prefab, camera, prefabs[i], gathered[g]);
+        }));
+    
+    int sort_job = graph.addJob([&]() {
+        for (int g = 0; g < num_groups; ++g)
+            render_call_vector.insert(render_call_vector.end(), gathered[g].begin(), gathered[g].end());
+        std::sort(std::begin(this->render_call_vector), std::end(this->render_call_vector), sortRCVector());
+    }, false, gather_jobs);
+    
+    int camera_job = graph.addJob([&]() {
+        for (size_t i = 0; i < render_call_vector.size(); ++i)
+        {
+            RenderCall& rc = render_call_vector[i];
+            rc.visible = camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) != 0;
+        }
+    }, false, sort_job);
+    
+    // only the visible ones decide the detail of the streamed textures, the textures are not thread safe
+    graph.addJob([&]() {
+        for (size_t i = 0; i < render_call_vector.size(); ++i)
+            if (render_call_vector[i].visible)
+                requestTextureMips(render_call_vector[i].material, render_call_vector[i].mesh, render_call_vector[i].pixels_per_unit);
+    }, true, camera_job);
+    
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        if (!lights[i]->cast_shadows || lights[i]->light_type == eLightType::POINT)
+            continue;
+        graph.addJob([&, i]() {
+            LightEntity* light = lights[i];
+            updateLightCamera(light);
+            for (size_t j = 0; j < render_call_vector.size(); ++j)
+            {
+                RenderCall& rc = render_call_vector[j];
+                if (rc.material->alpha_mode == eAlphaMode::BLEND)
+                    continue; //asume that transparent elements don't generate shadows
+                if (light->light_camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize))
+                    shadow_casters[i].push_back((int)j);
+            }
+        }, false, sort_job);
+    }
+    
+    graph.addJob([&]() { packLightUniforms(); });
+    
+    graph.runInPool(use_frame_jobs ? &ThreadPool::get() : NULL);
+}
+
 //renders all the prefab
-void Renderer::renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera)
+void Renderer::renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera, GTR::PrefabEntity* entity)
 {
     assert(prefab && "PREFAB IS NULL");
     //assign the model to the root node
     //renderNode(model, &prefab->root, camera);
-    setRenderCallVector(model, &prefab->root, camera);
+    FrameVector<RenderCall> calls;
+    gatherEntityRenderCalls(model, prefab, camera, entity, calls);
+    render_call_vector.insert(render_call_vector.end(), calls.begin(), calls.end());
+}
+
+// the levels of the last frame are stored in the entity in the order of the calls, so there is nothing to clean when it is deleted
+void Renderer::gatherEntityRenderCalls(const Matrix44& model, GTR::Prefab* prefab, Camera* camera, GTR::PrefabEntity* entity, FrameVector<RenderCall>& calls)
+{
+    size_t first = calls.size();
+    gatherRenderCalls(model, &prefab->root, NULL, camera, calls);
+    size_t num_calls = calls.size() - first;
+    
+    // the visible nodes changed, the old levels do not belong to the same nodes
+    if (entity && entity->node_lods.size() != num_calls)
+        entity->node_lods.assign(num_calls, -1);
+    
+    for (size_t i = 0; i < num_calls; ++i)
+    {
+        RenderCall& rc = calls[first + i];
+        rc.last_lod = entity ? &entity->node_lods[i] : NULL;
+        updateRenderCallLOD(rc);
+    }
 }
 
 //renders a node of the prefab and its children
@@ -187,13 +270,14 @@ void Renderer::renderNode(const Matrix44& prefab_model, GTR::Node* node, Camera*
 }
 
 // set render call vector
-void Renderer::setRenderCallVector(const Matrix44& prefab_model, GTR::Node* node, Camera* camera)
+void Renderer::gatherRenderCalls(const Matrix44& prefab_model, GTR::Node* node, const Matrix44* parent_global, Camera* camera, FrameVector<RenderCall>& calls)
 {
     if (!node->visible)
         return;
 
-    //compute global matrix
-    Matrix44 node_model = node->getGlobalMatrix(true) * prefab_model;
+    //compute global matrix (like getGlobalMatrix(true) but without storing it, other entities can be using the same prefab)
+    Matrix44 global = parent_global ? node->model * (*parent_global) : node->model;
+    Matrix44 node_model = global * prefab_model;
 
     //does this node have a mesh? then we must render it
     if (node->mesh && node->material)
@@ -213,19 +297,79 @@ void Renderer::setRenderCallVector(const Matrix44& prefab_model, GTR::Node* node
         rc.camera_distance = camera->eye.distance(center_node);
         
         rc.camera = camera;
+        rc.pixels_per_unit = getPixelsPerUnit(node_model, world_bounding, camera);
         
         // store node information
-        this->render_call_vector.push_back(rc);
+        calls.push_back(rc);
 
     }
 
     //iterate recursively with children
     for (int i = 0; i < node->children.size(); ++i)
-    setRenderCallVector(prefab_model, node->children[i], camera);
+    gatherRenderCalls(prefab_model, node->children[i], &global, camera, calls);
+}
+
+// choose the level of detail starting from the one of the last frame
+void Renderer::updateRenderCallLOD(RenderCall& rc)
+{
+    rc.lod = selectLOD(rc.mesh, rc.pixels_per_unit, rc.last_lod ? *rc.last_lod : -1);
+    if (rc.last_lod)
+        *rc.last_lod = rc.lod;
+}
+
+// pixels covered by one unit of the mesh at the closest point of its bounding
+float Renderer::getPixelsPerUnit(const Matrix44& model, const BoundingBox& world_bounding, Camera* camera)
+{
+    const float* m = model.m;
+    float scale = sqrtf(std::max(m[0] * m[0] + m[1] * m[1] + m[2] * m[2], std::max(m[4] * m[4] + m[5] * m[5] + m[6] * m[6], m[8] * m[8] + m[9] * m[9] + m[10] * m[10])));
+    float h = Application::instance->window_height;
+    float pixels_per_unit;
+    if (camera->type == Camera::ORTHOGRAPHIC)
+        pixels_per_unit = h / fabsf(camera->top - camera->bottom);
+    else
+    {
+        float distance = std::max((float)camera->eye.distance(world_bounding.center) - (float)world_bounding.halfsize.length(), camera->near_plane);
+        pixels_per_unit = h / (2.0f * distance * tanf(camera->fov * 0.5f * DEG2RAD));
+    }
+    return pixels_per_unit * scale;
+}
+
+// chooses the coarsest level whose error covers less than lod_error_pixels on screen
+int Renderer::selectLOD(Mesh* mesh, float pixels_per_unit, int previous)
+{
+    int num_lods = mesh->getNumLODs();
+    if (!use_lods || num_lods == 1)
+        return 0;
+    
+    // keep the previous level while it is inside the margin to avoid popping
+    if (previous >= 0 && previous < num_lods)
+    {
+        bool fine_enough = mesh->lods[previous].error * pixels_per_unit <= lod_error_pixels * (1.0f + lod_hysteresis);
+        bool coarse_enough = previous == num_lods - 1 || mesh->lods[previous + 1].error * pixels_per_unit > lod_error_pixels * (1.0f - lod_hysteresis);
+        if (fine_enough && coarse_enough)
+            return previous;
+    }
+    
+    int lod = 0;
+    while (lod + 1 < num_lods && mesh->lods[lod + 1].error * pixels_per_unit <= lod_error_pixels)
+        lod++;
+    return lod;
+}
+
+// tells the texture streaming the size on screen of one uv unit of the mesh, every texture computes the mip it needs
+void Renderer::requestTextureMips(GTR::Material* material, Mesh* mesh, float pixels_per_unit)
+{
+    // the textures are touched even without streaming, the visible ones are uploaded first
+    float pixels_per_uv = Texture::use_streaming ? pixels_per_unit / mesh->getUVDensity() : 0.0f;
+    GTR::Sampler* samplers[] = { &material->color_texture, &material->emissive_texture, &material->opacity_texture,
+        &material->metallic_roughness_texture, &material->occlusion_texture, &material->normal_texture };
+    for (int i = 0; i < 6; ++i)
+        if (samplers[i]->texture)
+            samplers[i]->texture->requestMip(pixels_per_uv);
 }
 
 // forward
-void Renderer::renderForward(Camera* camera, GTR::Scene* scene, std::vector<RenderCall> render_vector){
+void Renderer::renderForward(Camera* camera, GTR::Scene* scene, const std::vector<RenderCall>& render_vector){
     //set the clear color (the background color)
     glClearColor(scene->background_color.x, scene->background_color.y, scene->background_color.z, 1.0);
 
@@ -234,24 +378,56 @@ void Renderer::renderForward(Camera* camera, GTR::Scene* scene, std::vector<Rend
     checkGLErrors();
  
     for(int i=0; i < render_vector.size(); ++i){
-        RenderCall& rc = render_vector[i];
-        //if bounding box is inside the camera frustum then the object is probably visible
-        if (camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) )
+        const RenderCall& rc = render_vector[i];
+        //if bounding box is inside the camera frustum then the object is probably visible (already tested for the camera of the frame)
+        if (rc.camera == camera ? rc.visible : camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) )
         {
-            renderMeshWithMaterial( rc.node_model, rc.mesh, rc.material, camera);
+            renderMeshWithMaterial( rc.node_model, rc.mesh, rc.material, camera, rc.lod);
         }
     }
     
 }
 
+// picks the level of detail or culls the meshlets of big meshes against the camera, the ranges are used by drawMesh
+bool Renderer::prepareMeshDraw(const Matrix44& model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod, bool cone_culling){
+    culled_mesh = NULL;
+    
+    // simplified levels are far enough to be drawn whole
+    if (lod > 0 && mesh->getNumLODs() > 1)
+    {
+        culled_mesh = mesh;
+        visible_ranges.resize(1);
+        visible_ranges[0] = mesh->getLODRange(lod);
+        return true;
+    }
+    
+    if (!use_meshlet_culling || mesh->meshlets.empty())
+        return true;
+    
+    culled_mesh = mesh;
+    //two sided materials show the back of the triangles, so the normal cone can't be used
+    return mesh->cullMeshlets(model, camera, visible_ranges, cone_culling && !material->two_sided);
+}
+
+void Renderer::drawMesh(Mesh* mesh){
+    if (mesh == culled_mesh)
+        mesh->renderRanges(GL_TRIANGLES, visible_ranges);
+    else
+        mesh->render(GL_TRIANGLES);
+}
+
 //renders a mesh given its transform and material
-void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod)
 {
     //in case there is nothing to do
     if (!mesh || !mesh->getNumVertices() || !material )
         return;
     assert(glGetError() == GL_NO_ERROR);
 
+    //only some parts of the mesh may be visible
+    if (!prepareMeshDraw(model, mesh, material, camera, lod))
+        return;
+
     //define locals to simplify coding
     Shader* shader = NULL;
     GTR::Scene* scene = GTR::Scene::instance;
@@ -307,7 +483,7 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
     shader->setUniform("u_alpha_cutoff", material->alpha_mode == GTR::eAlphaMode::MASK ? material->alpha_cutoff : 0);
     
     //do the draw call that renders the mesh into the screen
-    if(this->rendering_mode ==  eRenderingMode::TEXTURE) mesh->render(GL_TRIANGLES);
+    if(this->rendering_mode ==  eRenderingMode::TEXTURE) drawMesh(mesh);
     
     
     //render lights
@@ -318,7 +494,7 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
         // show scene elements even if there's no light
         if(this->lights.size() == 0) {
             shader->setUniform("u_light_color", Vector3(0,0,0));
-            mesh->render(GL_TRIANGLES);
+            drawMesh(mesh);
         }
         // if there are more lights
         else{
@@ -348,7 +524,7 @@ void Renderer::renderLightMultiPass(Mesh* mesh, Shader* shader){
         uploadLight(light, shader);
         
         //do the draw call that renders the mesh into the screen
-        mesh->render(GL_TRIANGLES);
+        drawMesh(mesh);
         
         // enable blending
         glEnable(GL_BLEND);
@@ -363,39 +539,45 @@ void Renderer::renderLightMultiPass(Mesh* mesh, Shader* shader){
     glFrontFace(GL_CCW);
 }
 
-void Renderer::renderLightSinglePass(Mesh* mesh, GTR::Material* material, Shader* shader){
-    const int max_lights = 8;
-    Vector3 light_position[max_lights];
-    Vector3 light_color[max_lights];
-    float light_max_dist[max_lights];
-    eLightType light_type[max_lights];
-    Vector3 light_vector[max_lights];
-    Vector3 light_cone[max_lights];
-    
-    for(int i = 0; i < this->lights.size(); ++i){
-        light_position[i] = lights[i]->model * Vector3();
-        light_color[i] = lights[i]->color * lights[i]->intensity;
-        light_max_dist[i] = lights[i]->max_dist;
-        light_type[i] = lights[i]->light_type;
-        light_vector[i] = lights[i]->model.rotateVector(Vector3(0,0,-1));
-        light_cone[i] = Vector3(lights[i]->cone_angle, lights[i]->cone_exp, cos(lights[i]->cone_angle*DEG2RAD));
+// the shader takes up to max_lights, the rest are ignored
+void Renderer::packLightUniforms(){
+    sLightUniforms& u = light_uniforms;
+    u.num_lights = std::min((int)this->lights.size(), (int)sLightUniforms::max_lights);
+    for(int i = 0; i < sLightUniforms::max_lights; ++i){
+        if(i >= u.num_lights){
+            u.position[i] = u.color[i] = u.vector[i] = u.cone[i] = Vector3();
+            u.max_dist[i] = 0;
+            u.type[i] = 0;
+            continue;
+        }
+        u.position[i] = lights[i]->model * Vector3();
+        u.color[i] = lights[i]->color * lights[i]->intensity;
+        u.max_dist[i] = lights[i]->max_dist;
+        u.type[i] = lights[i]->light_type;
+        u.vector[i] = lights[i]->model.rotateVector(Vector3(0,0,-1));
+        u.cone[i] = Vector3(lights[i]->cone_angle, lights[i]->cone_exp, cos(lights[i]->cone_angle*DEG2RAD));
     }
-    
-    //upload uniforms to shader
-    shader->setUniform1("u_num_lights", (int)this->lights.size());
-    shader->setUniform3Array("u_light_pos",(float*)light_position, max_lights);
-    shader->setUniform3Array("u_light_color",(float*)&light_color, max_lights);
-    shader->setUniform1Array("u_light_max_dist",(float*)&light_max_dist, max_lights);
-    shader->setUniform1Array("u_light_type", (int*)&light_type, max_lights);
-    shader->setUniform3Array("u_light_vec",(float*)&light_vector, max_lights);
-    shader->setUniform3Array("u_light_cone",(float*)&light_cone, max_lights);
+}
+
+void Renderer::renderLightSinglePass(Mesh* mesh, GTR::Material* material, Shader* shader){
+    const sLightUniforms& u = light_uniforms;
+    const int max_lights = sLightUniforms::max_lights;
+    
+    //upload uniforms to shader (packed in prepareFrame)
+    shader->setUniform1("u_num_lights", u.num_lights);
+    shader->setUniform3Array("u_light_pos",(float*)u.position, max_lights);
+    shader->setUniform3Array("u_light_color",(float*)u.color, max_lights);
+    shader->setUniform1Array("u_light_max_dist",(float*)u.max_dist, max_lights);
+    shader->setUniform1Array("u_light_type", (int*)u.type, max_lights);
+    shader->setUniform3Array("u_light_vec",(float*)u.vector, max_lights);
+    shader->setUniform3Array("u_light_cone",(float*)u.cone, max_lights);
     
     //do the draw call that renders the mesh into the screen
-    mesh->render(GL_TRIANGLES);
+    drawMesh(mesh);
 }
 
 // deferred
-void Renderer::renderDeferred(Camera* camera, GTR::Scene* scene, std::vector<RenderCall> render_vector){
+void Renderer::renderDeferred(Camera* camera, GTR::Scene* scene, const std::vector<RenderCall>& render_vector){
     // Render GBuffers -> propiedades de cada objeto las guardamos en distintas texturas
     float w = Application::instance->window_width;
     float h = Application::instance->window_height;
@@ -410,11 +592,11 @@ void Renderer::renderDeferred(Camera* camera, GTR::Scene* scene, std::vector<Ren
     checkGLErrors();
     
     for(int i=0; i < render_vector.size(); ++i){
-        RenderCall& rc = render_vector[i];
-        //if bounding box is inside the camera frustum then the object is probably visible
-        if (camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) )
+        const RenderCall& rc = render_vector[i];
+        //if bounding box is inside the camera frustum then the object is probably visible (already tested for the camera of the frame)
+        if (rc.camera == camera ? rc.visible : camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) )
         {
-            renderMeshWithMaterialToGBuffers(rc.node_model, rc.mesh, rc.material, rc.camera);
+            renderMeshWithMaterialToGBuffers(rc.node_model, rc.mesh, rc.material, rc.camera, rc.lod);
         }
     }
     gbuffers_fbo->unbind();
@@ -505,7 +687,7 @@ void Renderer::renderDeferred(Camera* camera, GTR::Scene* scene, std::vector<Ren
 }
 
 // render to gbuffers
-void Renderer::renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+void Renderer::renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod)
 {
     //in case the material has transparencies
     if(!use_dither)
@@ -517,6 +699,10 @@ void Renderer::renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh
         return;
     assert(glGetError() == GL_NO_ERROR);
     
+    //only some parts of the mesh may be visible
+    if (!prepareMeshDraw(model, mesh, material, camera, lod))
+        return;
+    
     //define locals to simplify coding
     Shader* shader = NULL;
     
@@ -558,7 +744,7 @@ void Renderer::renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh
     shader->setUniform("u_alpha_cutoff", material->alpha_mode == GTR::eAlphaMode::MASK ? material->alpha_cutoff : 0);
     
     //do the draw call that renders the mesh into the screen
-    mesh->render(GL_TRIANGLES);
+    drawMesh(mesh);
     
     //disable shader
     shader->disable();
@@ -700,7 +886,7 @@ void Renderer::illuminationDeferred(Camera* camera, GTR::Scene* scene){
     glBlendFunc(GL_SRC_ALPHA, GL_ONE); //sumar el color ya pintado con la luz que le llegue
     
     // initialize a vector to store directional lights
-    std::vector<LightEntity*> directional_lights;
+    FrameVector<LightEntity*> directional_lights;
     for (int i = 0; i < this->lights.size(); ++i) {
             LightEntity* light = this->lights[i];
             uploadLight(light, shader);
@@ -766,7 +952,7 @@ void Renderer::illuminationDeferred(Camera* camera, GTR::Scene* scene){
     // render directional lights
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE); //sumar el color ya pintado con la luz que le llegue
-    for(int i = 0; i < directional_lights.size(); ++i)
+    for(size_t i = 0; i < directional_lights.size(); ++i)
     {
         LightEntity* light = directional_lights[i];
         uploadLight(light, shader_quad);
@@ -865,13 +1051,17 @@ void Renderer::uploadLight(LightEntity* light, Shader* shader)
 }
 
 
-void GTR::Renderer::renderFlatMesh(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+void GTR::Renderer::renderFlatMesh(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod)
 {
     //in case there is nothing to do
     if (!mesh || !mesh->getNumVertices() || !material )
         return;
     assert(glGetError() == GL_NO_ERROR);
 
+    //only some parts of the mesh may be visible from the light, the faces turned away from it also cast shadows so only the frustum is used
+    if (!prepareMeshDraw(model, mesh, material, camera, lod, false))
+        return;
+
     //define locals to simplify coding
     Shader* shader = NULL;
 
@@ -895,14 +1085,39 @@ void GTR::Renderer::renderFlatMesh(const Matrix44 model, Mesh* mesh, GTR::Materi
     
     glDepthFunc(GL_LESS);
     glDisable(GL_BLEND);
-    mesh->render(GL_TRIANGLES);
+    drawMesh(mesh);
     //disable shader
     shader->disable();
 }
 
 
 // generate shadowmap
-void GTR::Renderer::generateShadowmap(LightEntity* light)
+// the shadow maps are square, the aspect is the one of the map once it exists
+void GTR::Renderer::updateLightCamera(LightEntity* light)
+{
+    if(!light->light_camera)
+        light->light_camera = new Camera();
+    Camera* light_camera = light->light_camera;  // light camera
+    
+    // set light camera in light position
+    float aspect = light->shadowmap ? light->shadowmap->width/(float)light->shadowmap->height : 1.0f;
+    light_camera->lookAt(light->model.getTranslation(), light->model*Vector3(0,0,1), light->model.rotateVector(Vector3(0,1,0)));
+    
+    // SPOT LIGHT->PERSPECTIVE CAMERA
+    if(light->light_type == eLightType::SPOT)
+    {
+        light_camera->setPerspective(light->cone_angle*2, aspect, 0.1, light->max_dist);
+    }
+    // DIRECTIONAL LIGHT->ORTHOGORAPHIC CAMERA
+    else if (light->light_type == eLightType::DIRECTIONAL)
+    {
+        //use light area to define how big the frustum is
+        float halfarea = light->area_size / 2;
+        light_camera->setOrthographic( -halfarea, halfarea, halfarea*aspect, -halfarea*aspect, 0.1, light->max_dist);
+    }
+}
+
+void GTR::Renderer::generateShadowmap(LightEntity* light, const std::vector<int>& casters)
 {
     if(light->light_type == eLightType::POINT)
         return;
@@ -925,45 +1140,22 @@ void GTR::Renderer::generateShadowmap(LightEntity* light)
         light->shadowmap = light->fbo->depth_texture; //get depth texture just created
     }
     if(!light->light_camera)
-        light->light_camera = new Camera();
+        updateLightCamera(light);
     
     light->fbo->bind();                     // activate fbo
     glColorMask(false,false,false,false);   //disable writing to the color buffer to speed up the rendering
     glClear(GL_DEPTH_BUFFER_BIT);           // Clear the depth buffer
     
     Camera* view_camera = Camera::current;       // store current camera
-    Camera* light_camera = light->light_camera;  // light camera
-    
-    // set light camera in light position
-    float aspect = light->shadowmap->width/(float)light->shadowmap->height;
-    light_camera->lookAt(light->model.getTranslation(), light->model*Vector3(0,0,1), light->model.rotateVector(Vector3(0,1,0)));
-    
-    // SPOT LIGHT->PERSPECTIVE CAMERA
-    if(light->light_type == eLightType::SPOT)
-    {
-        light_camera->setPerspective(light->cone_angle*2, aspect, 0.1, light->max_dist);
-    }
-    // DIRECTIONAL LIGHT->ORTHOGORAPHIC CAMERA
-    else if (light->light_type == eLightType::DIRECTIONAL)
-    {
-        //use light area to define how big the frustum is
-        float halfarea = light->area_size / 2;
-        light_camera->setOrthographic( -halfarea, halfarea, halfarea*aspect, -halfarea*aspect, 0.1, light->max_dist);
-    }
+    Camera* light_camera = light->light_camera;  // placed and culled in prepareFrame
     
     light_camera->enable();  // enable new camera
     
-    for(int i = 0; i<this->render_call_vector.size(); i++)
+    // the render calls inside the light camera (transparent elements don't generate shadows)
+    for(size_t i = 0; i < casters.size(); i++)
     {
-        RenderCall& rc = render_call_vector[i];
-        if(rc.material->alpha_mode == eAlphaMode::BLEND)
-            continue; //asume that transparent elements don't generate shadows
-        
-        //if bounding box is inside the camera frustum then the object is probably visible
-        if (light_camera->testBoxInFrustum(rc.world_bounding.center, rc.world_bounding.halfsize) )
-        {
-            renderFlatMesh(rc.node_model, rc.mesh, rc.material, light_camera);
-        }
+        const RenderCall& rc = render_call_vector[casters[i]];
+        renderFlatMesh(rc.node_model, rc.mesh, rc.material, light_camera, rc.lod + shadow_lod_bias);
     }
     
     light->fbo->unbind();             // deactivate fbo
@@ -1134,23 +1326,19 @@ void GTR::Renderer::uploadProbes()
         
     
     //we must create the color information for the texture. because every SH are 27 floats in the RGB,RGB,... order, we can create an array of SphericalHarmonics and use it as pixels of the texture
-    SphericalHarmonics* sh_data = NULL;
-    sh_data = new SphericalHarmonics[dim.x * dim.y * dim.z];
+    FrameVector<SphericalHarmonics> sh_data(dim.x * dim.y * dim.z);
 
     //here we fill the data of the array with our probes in x,y,z order
     for (int i = 0; i < probes.size(); ++i)
         sh_data[i] = probes[i].sh;
 
     //now upload the data to the GPU as a texture
-    probes_texture->upload( GL_RGB, GL_FLOAT, false, (uint8*)sh_data);
+    probes_texture->upload( GL_RGB, GL_FLOAT, false, (uint8*)&sh_data[0]);
 
     //disable any texture filtering when reading
     probes_texture->bind();
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    //always free memory after allocating it!!!
-    delete[] sh_data;
 }
 
 // to consider irradiance for the ambient light
@@ -1,7 +1,9 @@
 #pragma once
 #include "prefab.h"
+#include "mesh.h"
 #include "shader.h"
 #include "sphericalharmonics.h"
+#include "allocators.h"
 
 
 //forward declarations
@@ -11,6 +13,9 @@ namespace GTR {
 
 	class Prefab;
 	class Material;
+	class Node;
+	class BaseEntity;
+	class LightEntity;
 	
     enum eRenderingMode {
         TEXTURE,
@@ -52,17 +57,38 @@ namespace GTR {
             Mesh* mesh;
             Camera* camera;
             BoundingBox world_bounding;
+            int lod; //level of detail of the mesh for the camera
+            int* last_lod; //level of the last frame, kept in the entity (NULL if there is no history)
+            float pixels_per_unit;
+            bool visible; //inside the frustum of the camera
             
             RenderCall() {
+                lod = 0;
                 material = NULL;
                 camera_distance = 0.0;
                 node_model.setIdentity();
                 mesh = NULL;
                 camera = NULL;
+                last_lod = NULL;
+                pixels_per_unit = 0.0;
+                visible = true;
             }
             
         };
 
+    //uniforms of the lights for the single pass shader, packed once per frame
+    struct sLightUniforms
+        {
+            static const int max_lights = 8;
+            int num_lights;
+            Vector3 position[max_lights];
+            Vector3 color[max_lights];
+            float max_dist[max_lights];
+            int type[max_lights];
+            Vector3 vector[max_lights];
+            Vector3 cone[max_lights];
+        };
+
     //struct to store probes
     struct sProbe
         {
@@ -105,6 +131,21 @@ namespace GTR {
         bool show_irradiance;
         bool add_irradiance;
         bool interpolate_irradiance;
+        bool use_meshlet_culling;
+        bool use_lods;
+        float lod_error_pixels;   //max error on screen allowed when using a simplified level
+        float lod_hysteresis;     //margin around the previous level to avoid popping
+        int shadow_lod_bias;      //shadow maps use coarser levels
+        
+        //visible parts of the mesh being rendered, reused every call
+        std::vector<sDrawRange> visible_ranges;
+        Mesh* culled_mesh;
+        
+        //the frame is prepared by a job graph in the worker pool, off runs the same jobs in the main thread to debug them
+        bool use_frame_jobs;
+        //render calls inside the frustum of every light (indices of render_call_vector), only for the shadow casters
+        std::vector<std::vector<int>> shadow_casters;
+        sLightUniforms light_uniforms;
         
         FBO* gbuffers_fbo;
         FBO* illumination_fbo;
@@ -120,20 +161,45 @@ namespace GTR {
 		//renders several elements of the scene
 		void renderScene(GTR::Scene* scene, Camera* camera);
         
-		//to render a whole prefab (with all its nodes)
-		void renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera);
+        // gathers, sorts and culls the render calls for the camera and the shadow lights, and packs the lights
+        void prepareFrame(GTR::Scene* scene, Camera* camera);
+        
+		//to render a whole prefab (with all its nodes), the entity is used to keep the levels of detail between frames
+		void renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera, GTR::PrefabEntity* entity = NULL);
 
 		//to render one node from the prefab and its children
 		void renderNode(const Matrix44& model, GTR::Node* node, Camera* camera);
         
-        // set render call vector
-        void setRenderCallVector(const Matrix44& model, GTR::Node* node, Camera* camera);
+        // adds the render calls of a node and its children, the nodes are not modified so it can run in a worker
+        void gatherRenderCalls(const Matrix44& prefab_model, GTR::Node* node, const Matrix44* parent_global, Camera* camera, FrameVector<RenderCall>& calls);
+        
+        // adds the render calls of a prefab with their levels of detail, only touches the entity so it can run in a worker
+        void gatherEntityRenderCalls(const Matrix44& model, GTR::Prefab* prefab, Camera* camera, GTR::PrefabEntity* entity, FrameVector<RenderCall>& calls);
+        
+        // chooses the level of detail of a render call starting from the one of the last frame
+        void updateRenderCallLOD(RenderCall& rc);
+        
+        // size on screen of one unit of the mesh, used to choose the level of detail and the mips of the textures
+        float getPixelsPerUnit(const Matrix44& model, const BoundingBox& world_bounding, Camera* camera);
+        
+        // to choose the level of detail of a mesh according to its size on screen
+        int selectLOD(Mesh* mesh, float pixels_per_unit, int previous);
+        
+        // to ask the texture streaming for the mips the material needs
+        void requestTextureMips(GTR::Material* material, Mesh* mesh, float pixels_per_unit);
         
         // render forward
-        void renderForward(Camera* camera, GTR::Scene* scene, std::vector<RenderCall> render_vector);
+        void renderForward(Camera* camera, GTR::Scene* scene, const std::vector<RenderCall>& render_vector);
+        
+        // to pick the parts of a mesh to draw (visible meshlets or a level of detail), returns false if nothing is visible
+        // cone_culling discards the meshlets facing away from the camera, only valid for passes that see the front faces
+        bool prepareMeshDraw(const Matrix44& model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod, bool cone_culling = true);
+        
+        // to draw the mesh (only the parts chosen by prepareMeshDraw)
+        void drawMesh(Mesh* mesh);
         
 		//to render one mesh given its material and transformation matrix
-		void renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+		void renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod = 0);
         
         // to render lights -> multipass mode
         void renderLightMultiPass(Mesh* mesh, Shader* shader);
@@ -141,11 +207,14 @@ namespace GTR {
         // to render lights -> singlepass mode
         void renderLightSinglePass(Mesh* mesh, GTR::Material* material, Shader* shader);
         
+        // to fill light_uniforms with the lights of the frame
+        void packLightUniforms();
+        
         // render deferred
-        void renderDeferred(Camera* camera, GTR::Scene* scene, std::vector<RenderCall> render_vector);
+        void renderDeferred(Camera* camera, GTR::Scene* scene, const std::vector<RenderCall>& render_vector);
         
         //to render one mesh given its material and transformation matrix
-        void renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+        void renderMeshWithMaterialToGBuffers(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod = 0);
         
         //render SSAO
         void renderSSAO(Camera* camera, GTR::Scene* scene);
@@ -160,10 +229,13 @@ namespace GTR {
         void uploadLight(LightEntity* light, Shader* shader);
         
         //to render a flat mesh
-        void renderFlatMesh(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+        void renderFlatMesh(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, int lod = 0);
+        
+        // to place the camera of a light for its shadow map
+        void updateLightCamera(LightEntity* light);
         
-        // to generate shadow map
-        void generateShadowmap(LightEntity* light);
+        // to generate shadow map with the render calls inside the light camera
+        void generateShadowmap(LightEntity* light, const std::vector<int>& casters);
         
         // to show shadowmap
         void showShadowmap(LightEntity* light);
@@ -0,0 +1,177 @@
+#include "resources.h"
+#include "includes.h"
+
+#include <iostream>
+#include <cassert>
+
+long ResourceManager::frame = 0;
+size_t ResourceManager::cpu_budget = 0;
+size_t ResourceManager::gpu_budget = 0;
+
+const char* resource_type_names[] = { "Meshes", "Textures", "Materials", "Prefabs", "Animations" };
+
+Resource::Resource(eResourceType type)
+{
+	resource_type = type;
+	ref_count = 0;
+	evictable = false;
+	last_used = ResourceManager::frame;
+	ResourceManager::registerResource(this);
+}
+
+Resource::Resource(const Resource& other)
+{
+	resource_type = other.resource_type;
+	ref_count = 0;
+	evictable = false;
+	last_used = ResourceManager::frame;
+	ResourceManager::registerResource(this);
+}
+
+Resource::~Resource()
+{
+	assert(ref_count == 0 && "deleting a resource that is still referenced");
+	ResourceManager::unregisterResource(this);
+}
+
+void Resource::addRef()
+{
+	ref_count.fetch_add(1, std::memory_order_relaxed);
+	last_used = ResourceManager::frame;
+}
+
+void Resource::release()
+{
+	int refs = ref_count.fetch_sub(1, std::memory_order_acq_rel);
+	assert(refs > 0);
+	if (refs == 1)
+		evictable = true;
+	last_used = ResourceManager::frame;
+}
+
+void Resource::touch()
+{
+	last_used = ResourceManager::frame;
+}
+
+//never deleted, resources can be destroyed after the static objects at exit
+std::vector<Resource*>& ResourceManager::getResources()
+{
+	static std::vector<Resource*>* resources = new std::vector<Resource*>();
+	return *resources;
+}
+
+std::recursive_mutex& ResourceManager::getMutex()
+{
+	static std::recursive_mutex* mutex = new std::recursive_mutex();
+	return *mutex;
+}
+
+void ResourceManager::registerResource(Resource* res)
+{
+	std::lock_guard<std::recursive_mutex> lock(getMutex());
+	getResources().push_back(res);
+}
+
+void ResourceManager::unregisterResource(Resource* res)
+{
+	std::lock_guard<std::recursive_mutex> lock(getMutex());
+	std::vector<Resource*>& resources = getResources();
+	for (size_t i = resources.size(); i-- > 0; ) //the newest ones are usually the first to go
+		if (resources[i] == res)
+		{
+			resources[i] = resources.back();
+			resources.pop_back();
+			return;
+		}
+}
+
+void ResourceManager::getMemoryUsage(size_t& cpu, size_t& gpu, eResourceType type)
+{
+	std::lock_guard<std::recursive_mutex> lock(getMutex());
+	std::vector<Resource*>& resources = getResources();
+	cpu = gpu = 0;
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		if (type != RESOURCE_TYPES && resources[i]->resource_type != type)
+			continue;
+		size_t res_cpu = 0, res_gpu = 0;
+		resources[i]->getMemoryUsage(res_cpu, res_gpu);
+		cpu += res_cpu;
+		gpu += res_gpu;
+	}
+}
+
+int ResourceManager::getNumResources(eResourceType type)
+{
+	std::lock_guard<std::recursive_mutex> lock(getMutex());
+	std::vector<Resource*>& resources = getResources();
+	if (type == RESOURCE_TYPES)
+		return (int)resources.size();
+	int num = 0;
+	for (size_t i = 0; i < resources.size(); ++i)
+		if (resources[i]->resource_type == type)
+			num++;
+	return num;
+}
+
+int ResourceManager::evict(size_t cpu_target, size_t gpu_target)
+{
+	std::lock_guard<std::recursive_mutex> lock(getMutex());
+	std::vector<Resource*>& resources = getResources();
+
+	size_t cpu = 0, gpu = 0;
+	getMemoryUsage(cpu, gpu);
+
+	int num_evicted = 0;
+	while (cpu > cpu_target || gpu > gpu_target)
+	{
+		//deleting a prefab releases its meshes and materials, so candidates are searched every time
+		Resource* oldest = NULL;
+		for (size_t i = 0; i < resources.size(); ++i)
+		{
+			Resource* res = resources[i];
+			if (res->evictable && res->ref_count == 0 && (!oldest || res->last_used < oldest->last_used))
+				oldest = res;
+		}
+		if (!oldest)
+			break;
+
+		size_t res_cpu = 0, res_gpu = 0;
+		oldest->getMemoryUsage(res_cpu, res_gpu);
+		delete oldest; //the dtors remove it from its manager
+		cpu -= std::min(cpu, res_cpu);
+		gpu -= std::min(gpu, res_gpu);
+		num_evicted++;
+	}
+	return num_evicted;
+}
+
+void ResourceManager::update()
+{
+	frame++;
+	if (!cpu_budget && !gpu_budget)
+		return;
+	int num = evict(cpu_budget ? cpu_budget : (size_t)-1, gpu_budget ? gpu_budget : (size_t)-1);
+	if (num)
+		std::cout << " - Resources evicted: " << num << std::endl;
+}
+
+void ResourceManager::renderInMenu()
+{
+#ifndef SKIP_IMGUI
+	for (int i = 0; i < RESOURCE_TYPES; ++i)
+	{
+		size_t cpu = 0, gpu = 0;
+		getMemoryUsage(cpu, gpu, (eResourceType)i);
+		ImGui::Text("%s: %d  RAM %d KB  VRAM %d KB", resource_type_names[i], getNumResources((eResourceType)i), (int)(cpu / 1024), (int)(gpu / 1024));
+	}
+
+	int cpu_mb = (int)(cpu_budget / (1024 * 1024));
+	int gpu_mb = (int)(gpu_budget / (1024 * 1024));
+	if (ImGui::SliderInt("RAM budget (MB, 0 no limit)", &cpu_mb, 0, 8192))
+		cpu_budget = (size_t)cpu_mb * 1024 * 1024;
+	if (ImGui::SliderInt("VRAM budget (MB, 0 no limit)", &gpu_mb, 0, 8192))
+		gpu_budget = (size_t)gpu_mb * 1024 * 1024;
+#endif
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+
+//types tracked by the resource manager (every manager of the engine)
+enum eResourceType {
+	RESOURCE_MESH,
+	RESOURCE_TEXTURE,
+	RESOURCE_MATERIAL,
+	RESOURCE_PREFAB,
+	RESOURCE_ANIMATION,
+	RESOURCE_TYPES
+};
+
+//base class of Mesh, Texture, Material, Prefab and Animation
+//ref counts come from ResourceHandles, once the last handle is gone the resource stays cached
+//until the ResourceManager needs the memory, the ones never referenced by a handle are never evicted
+class Resource {
+public:
+	eResourceType resource_type;
+	std::atomic<int> ref_count; //handles are copied and released from worker threads too
+	std::atomic<bool> evictable; //it was referenced by handles and all of them were released
+	long last_used; //ResourceManager::frame of the last addRef/release/touch
+
+	Resource(eResourceType type);
+	Resource(const Resource& other); //copies don't inherit the refs
+	virtual ~Resource();
+
+	void addRef();
+	void release();
+	void touch();
+
+	//bytes in RAM and in VRAM
+	virtual void getMemoryUsage(size_t& cpu, size_t& gpu) = 0;
+};
+
+//keeps a reference to a resource, it behaves like a pointer to T
+template<typename T> class ResourceHandle {
+public:
+	ResourceHandle() { ptr = NULL; }
+	ResourceHandle(T* p) { ptr = p; if (ptr) ptr->addRef(); }
+	ResourceHandle(const ResourceHandle& other) { ptr = other.ptr; if (ptr) ptr->addRef(); }
+	~ResourceHandle() { if (ptr) ptr->release(); }
+
+	ResourceHandle& operator = (T* p) { if (p) p->addRef(); if (ptr) ptr->release(); ptr = p; return *this; }
+	ResourceHandle& operator = (const ResourceHandle& other) { return *this = other.ptr; }
+
+	T* get() const { return ptr; }
+	T* operator -> () const { return ptr; }
+	T& operator * () const { return *ptr; }
+	operator T* () const { return ptr; }
+
+private:
+	T* ptr;
+};
+
+class ResourceManager {
+public:
+	static long frame;
+	static size_t cpu_budget; //bytes, 0 means no limit
+	static size_t gpu_budget;
+
+	//call it once per frame, evicts the least recently used resources without refs while over budget
+	static void update();
+
+	//memory in use of one type or of all of them (RESOURCE_TYPES)
+	static void getMemoryUsage(size_t& cpu, size_t& gpu, eResourceType type = RESOURCE_TYPES);
+	static int getNumResources(eResourceType type = RESOURCE_TYPES);
+	static int evict(size_t cpu_target, size_t gpu_target); //returns how many were deleted
+
+	static void renderInMenu();
+
+	static void registerResource(Resource* res);
+	static void unregisterResource(Resource* res);
+
+private:
+	static std::vector<Resource*>& getResources();
+	static std::recursive_mutex& getMutex(); //resources are created in worker threads too
+};
@@ -60,6 +60,18 @@ bool GTR::Scene::load(const char* filename)
 	//entities
 	cJSON* entities_json = cJSON_GetObjectItemCaseSensitive(json, "entities");
 	cJSON* entity_json;
+
+	//load all the prefabs in parallel first, configure will find them loaded
+	std::vector<std::string> prefab_filenames;
+	cJSON_ArrayForEach(entity_json, entities_json)
+	{
+		cJSON* type_json = cJSON_GetObjectItem(entity_json, "type");
+		cJSON* filename_json = cJSON_GetObjectItem(entity_json, "filename");
+		if (type_json && filename_json && std::string(type_json->valuestring) == "PREFAB")
+			prefab_filenames.push_back(std::string("data/") + filename_json->valuestring);
+	}
+	GTR::Prefab::Preload(prefab_filenames);
+
 	cJSON_ArrayForEach(entity_json, entities_json)
 	{
 		std::string type_str = cJSON_GetObjectItem(entity_json, "type")->valuestring;
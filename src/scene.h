@@ -3,6 +3,7 @@
 
 #include "framework.h"
 #include "camera.h"
+#include "resources.h"
 #include <string>
 
 //forward declaration
@@ -53,7 +54,8 @@ namespace GTR {
 	{
 	public:
 		std::string filename;
-		Prefab* prefab;
+		ResourceHandle<Prefab> prefab;
+		std::vector<int> node_lods; //level of detail of every drawn node in the last frame, so the renderer doesn't flicker between levels
 		
 		PrefabEntity();
 		virtual void renderInMenu();
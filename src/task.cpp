@@ -3,14 +3,34 @@
 #include <thread>         // std::thread
 #include <chrono>		  //ms
 #include <cassert>
+#include <algorithm>
+
+#ifndef SKIP_IMGUI
+#include "includes.h"
+#endif
 
 TaskManager TaskManager::foreground;
-TaskManager TaskManager::background;
+TaskManager TaskManager::background(true);
 
-TaskManager::TaskManager()
+//seconds from a fixed point, for the latencies
+static double getTaskTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TaskManager::TaskManager(bool use_pool)
 {
 	must_loop = false;
+	has_overflow = false;
+	this->use_pool = use_pool;
 	_thread = NULL;
+	budget_ms = 4.0f;
+	budget_bytes = 32 * 1024 * 1024;
+	last_num_tasks = 0;
+	last_ms = 0;
+	last_bytes = 0;
+	last_max_latency_ms = 0;
+	latency_ms = 0;
 }
 
 void TaskManager::loop()
@@ -20,41 +40,96 @@ void TaskManager::loop()
 
 	while (must_loop)
 	{
-		if (pending_tasks.empty())
-		{
+		if (!fetchTask())
 			std::this_thread::sleep_for(10ms);
-			continue;
-		}
-
-		fetchTask();
 	}
 
 	std::cout << "Ending Task Manager" << std::endl;
 }
 
-void TaskManager::fetchTask()
+void TaskManager::collectTasks()
 {
-	Task* task = NULL;
-	try
+	Task* task;
+	while (queue.pop(task))
+		pending_tasks.push_back(task);
+
+	//the ones that did not fit go after, the queue is only full when the consumer is far behind
+	if (has_overflow)
 	{
-		//lock
-		const std::lock_guard<std::mutex> lock(tasks_mutex);
-		if (pending_tasks.empty())
-			return;
-		task = pending_tasks.front();
-		pending_tasks.pop_front();
-		//unlock after finishing scope
-	}
-	catch (std::logic_error&) {
-		std::cout << "[exception caught]\n";
+		const std::lock_guard<std::mutex> lock(overflow_mutex);
+		//the cells taken before the overflow started are older, a producer can still be writing one
+		size_t pushed = queue.getNumPushed();
+		while (queue.getNumPopped() != pushed)
+		{
+			if (queue.pop(task))
+				pending_tasks.push_back(task);
+			else
+				std::this_thread::yield();
+		}
+		pending_tasks.insert(pending_tasks.end(), overflow.begin(), overflow.end());
+		overflow.clear();
+		has_overflow = false;
 	}
+}
+
+bool TaskManager::fetchTask()
+{
+	if (pending_tasks.empty())
+		collectTasks();
+	if (pending_tasks.empty())
+		return false;
+	Task* task = pending_tasks.front();
+	pending_tasks.pop_front();
 
-	if (task)
+	task->onExecute();
+	delete task;
+	return true;
+}
+
+void TaskManager::drainTasks()
+{
+	double start = getTaskTime();
+	last_num_tasks = 0;
+	last_bytes = 0;
+	last_max_latency_ms = 0;
+
+	//the priorities can change while waiting (a texture became visible), the sort keeps the order of each one
+	collectTasks();
+	std::stable_sort(pending_tasks.begin(), pending_tasks.end(), [](Task* a, Task* b) { return a->getPriority() < b->getPriority(); });
+
+	while (!pending_tasks.empty())
 	{
+		Task* task = pending_tasks.front();
+		//the next one would go over the bytes left, it waits for the next frame
+		if (last_num_tasks && budget_bytes && last_bytes + task->bytes > budget_bytes)
+			break;
+		pending_tasks.pop_front();
+
+		double now = getTaskTime();
+		float latency = float(now - task->queued_time) * 1000.0f;
+		last_max_latency_ms = std::max(last_max_latency_ms, latency);
+		latency_ms = latency_ms ? latency_ms * 0.95f + latency * 0.05f : latency;
+		last_bytes += task->bytes;
+		last_num_tasks++;
+
 		task->onExecute();
 		delete task;
-		task = NULL;
+
+		if (budget_ms && (getTaskTime() - start) * 1000.0 >= budget_ms)
+			break;
 	}
+	last_ms = float(getTaskTime() - start) * 1000.0f;
+}
+
+int TaskManager::getNumPending()
+{
+	size_t num = pending_tasks.size() + queue.size();
+	if (has_overflow)
+	{
+		const std::lock_guard<std::mutex> lock(overflow_mutex);
+		num += overflow.size();
+	}
+	return (int)num;
 }
 
 void thread_loop_func(TaskManager* manager)
@@ -65,15 +140,358 @@ void thread_loop_func(TaskManager* manager)
 
 void TaskManager::startThread()
 {
+	if (use_pool)
+	{
+		ThreadPool::get(); //the workers start with it
+		return;
+	}
 	assert(!_thread && "TaskManager already in a thread");
 	must_loop = true;
 	_thread = new std::thread(thread_loop_func, this);
 }
 
-void TaskManager::addTask(Task* task)
+void TaskManager::addTask(Task* task, eTaskPriority priority)
+{
+	task->priority = priority;
+	task->queued_time = getTaskTime();
+	if (use_pool)
+	{
+		ThreadPool::get().add(task, priority);
+		return;
+	}
+
+	//while there is overflow the new ones go after it, not to the free cells of the queue
+	if (!has_overflow && queue.push(task))
+		return;
+	const std::lock_guard<std::mutex> lock(overflow_mutex);
+	overflow.push_back(task);
+	has_overflow = true;
+}
+
+void TaskManager::renderInMenu()
+{
+#ifndef SKIP_IMGUI
+	ImGui::Text("Queued: %d  Last frame: %d tasks  %.2f ms  %d KB", getNumPending(), last_num_tasks, last_ms, (int)(last_bytes / 1024));
+	ImGui::Text("Latency: %.1f ms average  %.1f ms max last frame", latency_ms, last_max_latency_ms);
+	ImGui::SliderFloat("Budget (ms, 0 no limit)", &budget_ms, 0.0f, 16.0f);
+	int budget_mb = (int)(budget_bytes / (1024 * 1024));
+	if (ImGui::SliderInt("Budget (MB, 0 no limit)", &budget_mb, 0, 256))
+		budget_bytes = (size_t)budget_mb * 1024 * 1024;
+#endif
+}
+
+//worker of the pool running in this thread, so it pushes to its own deque
+static thread_local ThreadPool* current_pool = NULL;
+static thread_local int current_worker = -1;
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	num_pending = 0;
+	next_worker = 0;
+	must_exit = false;
+	for (int i = 0; i < num_threads; ++i)
+		workers.push_back(new Worker());
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		must_exit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		for (int j = 0; j < TASK_PRIORITIES; ++j)
+			for (size_t k = 0; k < workers[i]->queues[j].size(); ++k)
+				delete workers[i]->queues[j][k];
+		delete workers[i];
+	}
+}
+
+ThreadPool& ThreadPool::get()
 {
-	//block pending_tasks
-	const std::lock_guard<std::mutex> lock(tasks_mutex);
-	pending_tasks.push_back(task);
-	//release pending_tasks automatically
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::add(Task* task, eTaskPriority priority)
+{
+	int index = current_pool == this ? current_worker : (int)(next_worker++ % workers.size());
+	{
+		std::lock_guard<std::mutex> lock(workers[index]->mutex);
+		workers[index]->queues[priority].push_back(task);
+	}
+	{
+		//under the lock so a worker about to sleep does not miss it
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		num_pending++;
+	}
+	wake.notify_one();
+}
+
+Task* ThreadPool::pop(int worker, eTaskPriority lowest)
+{
+	if (num_pending == 0)
+		return NULL;
+	int num_workers = (int)workers.size();
+	for (int priority = 0; priority <= lowest; ++priority)
+	{
+		if (worker != -1)
+		{
+			Worker* own = workers[worker];
+			std::lock_guard<std::mutex> lock(own->mutex);
+			std::deque<Task*>& queue = own->queues[priority];
+			if (!queue.empty())
+			{
+				Task* task = queue.back();
+				queue.pop_back();
+				num_pending--;
+				return task;
+			}
+		}
+		for (int i = 1; i <= num_workers; ++i)
+		{
+			int victim = (worker + i + num_workers) % num_workers;
+			if (victim == worker)
+				continue;
+			Worker* other = workers[victim];
+			std::lock_guard<std::mutex> lock(other->mutex);
+			std::deque<Task*>& queue = other->queues[priority];
+			if (!queue.empty())
+			{
+				Task* task = queue.front();
+				queue.pop_front();
+				num_pending--;
+				return task;
+			}
+		}
+	}
+	return NULL;
+}
+
+bool ThreadPool::runPendingTask(eTaskPriority lowest)
+{
+	Task* task = pop(current_pool == this ? current_worker : -1, lowest);
+	if (!task)
+		return false;
+	task->onExecute();
+	delete task;
+	return true;
+}
+
+void ThreadPool::workerLoop(int index)
+{
+	current_pool = this;
+	current_worker = index;
+	while (true)
+	{
+		Task* task = pop(index, TASK_PRIORITY_LOW);
+		if (task)
+		{
+			task->onExecute();
+			delete task;
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this]() { return must_exit || num_pending > 0; });
+		if (must_exit)
+			return;
+	}
+}
+
+void ThreadPool::finishSignal(std::shared_ptr<sTaskSignal> signal)
+{
+	std::vector<std::pair<Task*, eTaskPriority>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(signal->mutex);
+		signal->done = true;
+		continuations.swap(signal->continuations);
+	}
+	for (size_t i = 0; i < continuations.size(); ++i)
+		add(continuations[i].first, continuations[i].second);
+}
+
+void ThreadPool::parallel_for(int begin, int end, std::function<void(int, int)> func, int grain_size)
+{
+	if (end <= begin)
+		return;
+	int count = end - begin;
+	int num_chunks = std::min((count + grain_size - 1) / std::max(grain_size, 1), (getNumThreads() + 1) * 4);
+	if (num_chunks <= 1)
+	{
+		func(begin, end);
+		return;
+	}
+
+	auto chunkStart = [&](int i) { return begin + (int)((long long)count * i / num_chunks); };
+	std::atomic<int> remaining(num_chunks);
+	for (int i = 1; i < num_chunks; ++i)
+		add(new Task([&, i]() { func(chunkStart(i), chunkStart(i + 1)); remaining--; }), TASK_PRIORITY_HIGH);
+	func(begin, chunkStart(1));
+	remaining--;
+
+	//helps with the chunks left, not with longer tasks that would make the caller wait more
+	while (remaining > 0)
+		if (!runPendingTask(TASK_PRIORITY_HIGH))
+			std::this_thread::yield();
+}
+
+JobGraph::JobGraph()
+{
+	remaining = 0;
+}
+
+JobGraph::~JobGraph()
+{
+}
+
+int JobGraph::addJob(std::function<void()> func, bool main_thread, const std::vector<int>& depends_on)
+{
+	return addJob(std::move(func), main_thread, depends_on.empty() ? NULL : &depends_on[0], (int)depends_on.size());
+}
+
+int JobGraph::addJob(std::function<void()> func, bool main_thread, int depends_on)
+{
+	return addJob(std::move(func), main_thread, &depends_on, 1);
+}
+
+int JobGraph::addJob(std::function<void()> func, bool main_thread, const int* depends_on, int num_depends)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	int index = (int)jobs.size();
+	jobs.push_back(Job());
+	Job* job = &jobs.back();
+	job->func = std::move(func);
+	job->pending = 0;
+	job->main_thread = main_thread;
+	job->done = false;
+	remaining++;
+	for (int i = 0; i < num_depends; ++i)
+	{
+		Job* other = &jobs[depends_on[i]];
+		if (other->done)
+			continue;
+		other->dependants.push_back(index);
+		job->pending++;
+	}
+	if (job->pending == 0)
+		(main_thread ? ready_main : ready).push_back(index);
+	condition.notify_all();
+	return index;
+}
+
+void JobGraph::addDependency(int job, int depends_on)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	assert(jobs[job].pending > 0 && "job already started");
+	Job* other = &jobs[depends_on];
+	if (other->done)
+		return;
+	other->dependants.push_back(job);
+	jobs[job].pending++;
+}
+
+void JobGraph::finishJob(int index)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Job* job = &jobs[index];
+	job->done = true;
+	remaining--;
+	for (size_t i = 0; i < job->dependants.size(); ++i)
+	{
+		Job* dependant = &jobs[job->dependants[i]];
+		if (--dependant->pending == 0)
+			(dependant->main_thread ? ready_main : ready).push_back(job->dependants[i]);
+	}
+	condition.notify_all();
+}
+
+void JobGraph::workerLoop(bool is_main)
+{
+	while (true)
+	{
+		int index = -1;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			//the main thread also helps with the worker jobs
+			condition.wait(lock, [&]() { return remaining == 0 || !ready.empty() || (is_main && !ready_main.empty()); });
+			if (is_main && !ready_main.empty())
+			{
+				index = ready_main.front();
+				ready_main.pop_front();
+			}
+			else if (!ready.empty())
+			{
+				index = ready.front();
+				ready.pop_front();
+			}
+			else
+				return; //nothing left
+		}
+		Job* job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &jobs[index]; //the deque can grow while running
+		}
+		job->func();
+		finishJob(index);
+	}
+}
+
+void JobGraph::run(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&JobGraph::workerLoop, this, false));
+	workerLoop(true);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+//shared with the pool tasks that help with a graph, the ones that start once it is done find no graph
+struct sGraphHelpers {
+	std::mutex mutex;
+	std::condition_variable finished;
+	JobGraph* graph;
+	int active;
+};
+
+void JobGraph::runInPool(ThreadPool* pool)
+{
+	std::shared_ptr<sGraphHelpers> helpers = std::make_shared<sGraphHelpers>();
+	helpers->graph = this;
+	helpers->active = 0;
+
+	int num_helpers = pool ? pool->getNumThreads() : 0;
+	for (int i = 0; i < num_helpers; ++i)
+		pool->add(new Task([helpers]() {
+			JobGraph* graph;
+			{
+				std::lock_guard<std::mutex> lock(helpers->mutex);
+				graph = helpers->graph;
+				if (!graph)
+					return;
+				helpers->active++;
+			}
+			graph->workerLoop(false);
+			std::lock_guard<std::mutex> lock(helpers->mutex);
+			helpers->active--;
+			helpers->finished.notify_all();
+		}), TASK_PRIORITY_HIGH);
+
+	workerLoop(true);
+
+	std::unique_lock<std::mutex> lock(helpers->mutex);
+	helpers->graph = NULL;
+	helpers->finished.wait(lock, [&]() { return helpers->active == 0; });
 }
\ No newline at end of file
@@ -5,30 +5,296 @@
 #include <mutex>
 #include <thread>         // std::thread
 #include <functional>
+#include <deque>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+
+#include "allocators.h"
+
+enum eTaskPriority {
+	TASK_PRIORITY_HIGH, //needed to finish the frame (parallel_for chunks, uploads of visible textures)
+	TASK_PRIORITY_NORMAL,
+	TASK_PRIORITY_LOW, //nobody waits for it, like the streaming of better mips
+	TASK_PRIORITIES
+};
 
 //any task executed in BG should inherit from this one
 class Task {
 public:
 	std::function<void()> callback;
-	Task() { callback = NULL; };
-	Task(std::function<void()> func) { callback = func; };
+	eTaskPriority priority; //the one given to addTask
+	size_t bytes; //sent to the GPU when executed, for the budget of the foreground
+	double queued_time; //seconds, when it was added
+
+	Task() { callback = NULL; priority = TASK_PRIORITY_NORMAL; bytes = 0; queued_time = 0; };
+	Task(std::function<void()> func) { callback = func; priority = TASK_PRIORITY_NORMAL; bytes = 0; queued_time = 0; };
 	virtual ~Task() {};
 	virtual void onExecute() { if (callback) callback(); }
+	virtual eTaskPriority getPriority() { return priority; } //checked again every frame while in the foreground
+
+	//tasks are created and deleted all the time from every thread, they come from a pool of small blocks
+	static void* operator new(size_t size) { return SmallObjectPool::get().allocate(size); }
+	static void operator delete(void* ptr, size_t size) { SmallObjectPool::get().deallocate(ptr, size); }
+};
+
+class ThreadPool;
+
+//shared by a future and the continuations waiting for it
+struct sTaskSignal {
+	std::mutex mutex;
+	bool done;
+	std::vector<std::pair<Task*, eTaskPriority>> continuations;
+	sTaskSignal() { done = false; }
+};
+
+//result of ThreadPool::async, the continuations added with then() go to the pool once it is done
+template<typename T>
+class TaskFuture {
+public:
+	std::shared_future<T> future;
+	std::shared_ptr<sTaskSignal> signal;
+	ThreadPool* pool;
+
+	TaskFuture() { pool = NULL; }
+	bool isReady() const { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+	void wait() const; //runs other tasks of the pool while waiting, so a worker waiting here does not block it
+	auto get() const -> decltype(std::declval<std::shared_future<T>&>().get()) { wait(); return future.get(); }
+
+	//func receives the std::shared_future of this one
+	template<typename F>
+	auto then(F func, eTaskPriority priority = TASK_PRIORITY_NORMAL) -> TaskFuture<decltype(func(std::declval<std::shared_future<T>&>()))>;
+};
+
+//work stealing pool: every worker has a deque per priority, it runs its own tasks from the back (the last ones added are still in cache)
+//and steals from the front of the others when it has nothing, the workers sleep on a condition variable while there is no work
+class ThreadPool {
+public:
+	ThreadPool(int num_threads = 0); //0 uses a thread per core minus the main one
+	~ThreadPool(); //queued tasks are deleted without running
+
+	static ThreadPool& get(); //the one of the engine, created on first use
+
+	int getNumThreads() { return (int)threads.size(); }
+
+	//takes ownership of the task, it is deleted after onExecute like in the TaskManager
+	void add(Task* task, eTaskPriority priority = TASK_PRIORITY_NORMAL);
+
+	template<typename F>
+	auto async(F func, eTaskPriority priority = TASK_PRIORITY_NORMAL) -> TaskFuture<decltype(func())>;
+
+	//calls func(start, end) for chunks of [begin, end) of at least grain_size in the pool and in the calling thread, returns once all are done
+	void parallel_for(int begin, int end, std::function<void(int, int)> func, int grain_size = 1);
+
+	//runs a queued task in the calling thread, only of the given priority or higher, false if there was none
+	bool runPendingTask(eTaskPriority lowest = TASK_PRIORITY_LOW);
+
+	void finishSignal(std::shared_ptr<sTaskSignal> signal); //sends the continuations to the pool
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task*> queues[TASK_PRIORITIES];
+	};
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+	std::atomic<int> num_pending; //queued, not running
+	std::atomic<unsigned int> next_worker; //for tasks added from outside the pool
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	bool must_exit;
+
+	Task* pop(int worker, eTaskPriority lowest);
+	void workerLoop(int index);
+};
+
+//a Task with the result of a function for ThreadPool::async
+template<typename T>
+class FutureTask : public Task {
+public:
+	std::packaged_task<T()> work;
+	std::shared_ptr<sTaskSignal> signal;
+	ThreadPool* pool;
+
+	template<typename F>
+	FutureTask(F func, ThreadPool* pool, TaskFuture<T>& future) : work(func) {
+		this->pool = pool;
+		signal = std::make_shared<sTaskSignal>();
+		future.future = work.get_future().share();
+		future.signal = signal;
+		future.pool = pool;
+	}
+	void onExecute() { work(); pool->finishSignal(signal); }
+};
+
+template<typename F>
+auto ThreadPool::async(F func, eTaskPriority priority) -> TaskFuture<decltype(func())>
+{
+	typedef decltype(func()) R;
+	TaskFuture<R> future;
+	add(new FutureTask<R>(func, this, future), priority);
+	return future;
+}
+
+template<typename T>
+void TaskFuture<T>::wait() const
+{
+	while (!isReady())
+		if (!pool->runPendingTask())
+			future.wait_for(std::chrono::microseconds(100));
+}
+
+template<typename T>
+template<typename F>
+auto TaskFuture<T>::then(F func, eTaskPriority priority) -> TaskFuture<decltype(func(std::declval<std::shared_future<T>&>()))>
+{
+	typedef decltype(func(std::declval<std::shared_future<T>&>())) R;
+	std::shared_future<T> previous = future;
+	TaskFuture<R> result;
+	Task* task = new FutureTask<R>([func, previous]() mutable { return func(previous); }, pool, result);
+	{
+		std::lock_guard<std::mutex> lock(signal->mutex);
+		if (!signal->done)
+		{
+			signal->continuations.push_back(std::make_pair(task, priority));
+			return result;
+		}
+	}
+	pool->add(task, priority);
+	return result;
+}
+
+//bounded lock free queue, any thread can push but only one can pop (a ring where every cell has a sequence number that tells
+//if it is the turn of a producer or of the consumer, so the producers only compete in the atomic increment of the tail)
+template<typename T, int SIZE>
+class MPSCQueue {
+public:
+	MPSCQueue() {
+		static_assert((SIZE & (SIZE - 1)) == 0, "size must be a power of two");
+		for (int i = 0; i < SIZE; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		head = 0;
+	}
+
+	bool push(const T& value) { //false when full
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells[pos & (SIZE - 1)];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if (diff == 0)
+			{
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false; //the consumer has not read this cell yet
+			else
+				pos = tail.load(std::memory_order_relaxed);
+		}
+		cell->value = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& value) { //false when empty, only from the consumer thread
+		Cell& cell = cells[head & (SIZE - 1)];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		if ((intptr_t)sequence - (intptr_t)(head + 1) < 0)
+			return false; //empty or still being written
+		value = cell.value;
+		cell.sequence.store(head + SIZE, std::memory_order_release);
+		head++;
+		return true;
+	}
+
+	size_t size() { return tail.load(std::memory_order_relaxed) - head; } //consumer thread, approximate
+	size_t getNumPushed() { return tail.load(std::memory_order_acquire); } //cells taken by the producers, some can still be being written
+	size_t getNumPopped() { return head; } //consumer thread
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	Cell cells[SIZE];
+	alignas(64) std::atomic<size_t> tail; //producers
+	alignas(64) size_t head; //consumer
 };
 
+//the tasks are added from any thread but executed by only one: the main loop (foreground) or the thread of startThread
 class TaskManager {
 public:
-	std::list<Task*> pending_tasks;
-	std::mutex tasks_mutex;  // protects pending_tasks
+	MPSCQueue<Task*, 4096> queue; //tasks added and not collected yet
+	std::deque<Task*> pending_tasks; //collected, only used by the thread that executes them
+	std::list<Task*> overflow; //when the queue is full, the next tasks also go here until it is collected so the order is kept
+	std::mutex overflow_mutex; //protects overflow
+	std::atomic<bool> has_overflow;
 	bool must_loop;
+	bool use_pool; //the tasks go to ThreadPool::get() instead of the pending list
 	std::thread* _thread;
 
 	static TaskManager foreground;
-	static TaskManager background;
+	static TaskManager background; //uses the pool
 
-	TaskManager();
-	void addTask(Task* task);
-	void fetchTask();
+	//limits of drainTasks, 0 means no limit
+	float budget_ms;
+	size_t budget_bytes;
+
+	//stats of the last drainTasks
+	int last_num_tasks;
+	float last_ms;
+	size_t last_bytes;
+	float last_max_latency_ms; //the longest wait in the queue of the ones executed
+	float latency_ms; //average wait in the queue
+
+	TaskManager(bool use_pool = false);
+	void addTask(Task* task, eTaskPriority priority = TASK_PRIORITY_NORMAL);
+	bool fetchTask(); //false if there was none
+	void drainTasks(); //runs the pending ones by priority until a budget is spent, at least one
+	int getNumPending(); //from the thread that executes them
+	void collectTasks(); //moves the added tasks to pending_tasks
 	void loop();
 	void startThread();
+	void renderInMenu();
+};
+
+//a set of jobs with dependencies, a job runs when all the jobs it depends on are done
+//main thread jobs (GPU uploads) run in the thread that calls run(), the rest in worker threads
+//jobs can add more jobs while the graph is running, and dependencies to jobs that still wait for them
+class JobGraph {
+public:
+	struct Job {
+		std::function<void()> func;
+		std::vector<int> dependants;
+		int pending; //jobs left before it can run
+		bool main_thread;
+		bool done;
+	};
+
+	JobGraph();
+	~JobGraph();
+
+	int addJob(std::function<void()> func, bool main_thread = false, const std::vector<int>& depends_on = std::vector<int>());
+	int addJob(std::function<void()> func, bool main_thread, int depends_on); //with a single dependency
+	void addDependency(int job, int depends_on); //job must still be waiting for another one
+	void run(int num_threads = 0); //blocks until every job is done, 0 uses all the cores
+	void runInPool(ThreadPool* pool); //the same with the workers of the pool that are free, NULL runs everything in the calling thread
+
+private:
+	std::deque<Job> jobs; //a deque keeps the jobs in place while it grows
+	std::deque<int> ready;
+	std::deque<int> ready_main;
+	int remaining;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	int addJob(std::function<void()> func, bool main_thread, const int* depends_on, int num_depends);
+	void workerLoop(bool is_main);
+	void finishJob(int index);
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+/*  time per call of the Matrix44 operations of framework.cpp
+	The Makefile builds it with the SIMD code and with NO_SIMD to compare both.
+	Every operation runs over arrays of matrices bigger than the L1 but smaller than the L2, like the render calls of a frame.
+	usage: make bench_math
+*/
+
+#include "../framework.h"
+
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+#ifdef NO_SIMD
+	#define MATH_PATH "scalar"
+#else
+	#define MATH_PATH "SIMD"
+#endif
+
+const int NUM_MATRICES = 4096;
+
+static uint32 random_state = 0x12345678;
+static float randomFloat(float min, float max)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return min + (random_state & 0xFFFFFF) / (float)0xFFFFFF * (max - min);
+}
+static Vector3 randomVector(float min, float max) { return Vector3(randomFloat(min, max), randomFloat(min, max), randomFloat(min, max)); }
+
+//nanoseconds per element, the best of some repetitions so other processes do not count
+template<typename F> double measure(F func)
+{
+	double best = 1e30;
+	for (int i = 0; i < 20; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int j = 0; j < 10; ++j)
+			func();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (10.0 * NUM_MATRICES);
+		if (ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+volatile float sink; //so the compiler does not remove the loops
+
+int main(int argc, char** argv)
+{
+	std::vector<Matrix44> models(NUM_MATRICES), cameras(NUM_MATRICES), results(NUM_MATRICES);
+	std::vector<Vector3> points(NUM_MATRICES), points_result(NUM_MATRICES);
+	std::vector<BoundingBox> boxes(NUM_MATRICES), boxes_result(NUM_MATRICES);
+	for (int i = 0; i < NUM_MATRICES; ++i)
+	{
+		models[i].setRotation(randomFloat(-3.0f, 3.0f), randomVector(-1.0f, 1.0f).normalize());
+		models[i].scale(randomFloat(0.1f, 3.0f), randomFloat(0.1f, 3.0f), randomFloat(0.1f, 3.0f));
+		models[i].translateGlobal(randomFloat(-30.0f, 30.0f), randomFloat(-30.0f, 30.0f), randomFloat(-30.0f, 30.0f));
+
+		Matrix44 view, projection;
+		Vector3 eye = randomVector(-10.0f, 10.0f), center(0.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+		view.lookAt(eye, center, up);
+		projection.perspective(randomFloat(40.0f, 90.0f), 1.5f, 0.1f, 1000.0f);
+		cameras[i] = view * projection;
+
+		points[i] = randomVector(-10.0f, 10.0f);
+		boxes[i] = BoundingBox(randomVector(-10.0f, 10.0f), randomVector(0.0f, 5.0f));
+	}
+
+	printf("math: %s path, ns per call\n", MATH_PATH);
+	printf("%-24s %7.2f\n", "multiply", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+			results[i] = models[i] * cameras[i];
+	}));
+	printf("%-24s %7.2f\n", "inverse affine", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+		{
+			results[i] = models[i];
+			results[i].inverse();
+		}
+	}));
+	printf("%-24s %7.2f\n", "inverse view projection", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+		{
+			results[i] = cameras[i];
+			results[i].inverse();
+		}
+	}));
+	printf("%-24s %7.2f\n", "transpose", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+		{
+			results[i] = cameras[i];
+			results[i].transpose();
+		}
+	}));
+	printf("%-24s %7.2f\n", "matrix * vector3", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+			points_result[i] = models[i] * points[i];
+	}));
+	printf("%-24s %7.2f\n", "transformBoundingBox", measure([&]() {
+		for (int i = 0; i < NUM_MATRICES; ++i)
+			boxes_result[i] = transformBoundingBox(models[i], boxes[i]);
+	}));
+
+	sink = results[7].m[3] + points_result[5].x + boxes_result[3].center.x;
+	return 0;
+}
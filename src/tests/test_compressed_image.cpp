@@ -0,0 +1,364 @@
+/*  encodes images of gradients, flat colors and noise with every block format of compressed_image and decodes them
+	The PSNR of the stored channels must stay over a floor, the flat colors must come back almost exact.
+	The special modes of the decoders (BC1 with 3 colors, BC4 with 6 values) are checked with blocks written by hand,
+	and the DDS (with the DX10 header of BC7) and KTX2 files must give back the same blocks.
+	It uses the Image class so it links the engine like the cook tool.
+	usage: make test_compressed_image
+*/
+
+#include "../compressed_image.h"
+#include "../texture.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+//xorshift, the same inputs in every run
+static unsigned int random_state = 0x12345678;
+static unsigned int randomInt()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static int num_tests = 0;
+static int num_failed = 0;
+
+static bool check(bool ok, const char* format, const char* name, const char* detail = "")
+{
+	num_tests++;
+	if (!ok)
+	{
+		num_failed++;
+		printf("[FAIL] %s %s %s\n", format, name, detail);
+	}
+	return ok;
+}
+
+enum ePattern { PATTERN_GRADIENT, PATTERN_FLAT, PATTERN_RANDOM, PATTERNS };
+static const char* pattern_names[] = { "gradient", "flat", "random" };
+
+//odd sides so the last blocks repeat the border pixels
+static void fillImage(Image& image, ePattern pattern)
+{
+	image.resize(61, 37, 4);
+	for (unsigned int y = 0; y < image.height; ++y)
+		for (unsigned int x = 0; x < image.width; ++x)
+		{
+			unsigned char* pixel = image.data + (y * image.width + x) * 4;
+			if (pattern == PATTERN_GRADIENT)
+			{
+				pixel[0] = (unsigned char)(x * 255 / (image.width - 1));
+				pixel[1] = (unsigned char)(y * 255 / (image.height - 1));
+				pixel[2] = (unsigned char)((x + y) * 255 / (image.width + image.height - 2));
+				pixel[3] = (unsigned char)(255 - y * 200 / (image.height - 1));
+			}
+			else if (pattern == PATTERN_FLAT)
+			{
+				pixel[0] = 201;
+				pixel[1] = 117;
+				pixel[2] = 38;
+				pixel[3] = 172;
+			}
+			else
+				for (int c = 0; c < 4; ++c)
+					pixel[c] = (unsigned char)randomInt();
+		}
+}
+
+//minimum PSNR in dB of every pattern with every format, about 2 dB under what the encoders give now
+struct sFloor { eBlockFormat format; double psnr[PATTERNS]; };
+static const sFloor floors[] = {
+	{ BLOCK_BC1, { 35.0, 38.0, 12.0 } },
+	{ BLOCK_BC3, { 36.0, 39.0, 13.0 } },
+	{ BLOCK_BC4, { 52.0, 99.0, 27.0 } },
+	{ BLOCK_BC5, { 50.0, 99.0, 27.0 } },
+	{ BLOCK_BC7, { 38.0, 49.0, 12.0 } },
+};
+static const int num_formats = sizeof(floors) / sizeof(floors[0]);
+
+void testEncoders()
+{
+	for (int f = 0; f < num_formats; ++f)
+	{
+		eBlockFormat format = floors[f].format;
+		for (int p = 0; p < PATTERNS; ++p)
+		{
+			Image image, decoded;
+			fillImage(image, (ePattern)p);
+			CompressedImage compressed;
+			compressed.compress(image, format, false);
+			compressed.decompress(decoded);
+
+			//the channels that are not stored decode to 0 and the alpha to 255, the BC1 alpha is not compared
+			int num_channels = getBlockChannels(format);
+			double psnr = CompressedImage::computePSNR(image, decoded, num_channels);
+			char detail[128];
+			sprintf(detail, "PSNR %.2f dB, floor %.1f", psnr, floors[f].psnr[p]);
+			check(psnr >= floors[f].psnr[p], getBlockFormatName(format), pattern_names[p], detail);
+			printf("%-4s %-9s PSNR %6.2f dB\n", getBlockFormatName(format), pattern_names[p], psnr);
+
+			if (p == PATTERN_FLAT)
+			{
+				int max_error = 0;
+				for (size_t i = 0; i < (size_t)image.width * image.height; ++i)
+					for (int c = 0; c < num_channels; ++c)
+						max_error = std::max(max_error, abs(image.data[i * 4 + c] - decoded.data[i * 4 + c]));
+				int tolerance = format == BLOCK_BC4 || format == BLOCK_BC5 ? 0 : format == BLOCK_BC7 ? 1 : 3;
+				sprintf(detail, "max error %d", max_error);
+				check(max_error <= tolerance, getBlockFormatName(format), "flat exact", detail);
+			}
+		}
+	}
+}
+
+//the 565 color as the decoders expand it
+static void expand565(unsigned short color, int* rgb)
+{
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+void testDecoderModes()
+{
+	//c0 <= c1 selects 3 colors and a transparent black in BC1, BC3 always uses 4 colors
+	unsigned char block[16];
+	unsigned short c0 = (10 << 11) | (20 << 5) | 5, c1 = (25 << 11) | (50 << 5) | 30;
+	unsigned int indices = 0;
+	for (int i = 0; i < 16; ++i)
+		indices |= (i % 4) << (i * 2);
+	memcpy(block, &c0, 2);
+	memcpy(block + 2, &c1, 2);
+	memcpy(block + 4, &indices, 4);
+	int e0[3], e1[3];
+	expand565(c0, e0);
+	expand565(c1, e1);
+
+	unsigned char rgba[64];
+	decodeBlock(BLOCK_BC1, block, rgba);
+	int num_wrong = 0;
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+		{
+			int expected;
+			switch (i % 4)
+			{
+			case 0: expected = c < 3 ? e0[c] : 255; break;
+			case 1: expected = c < 3 ? e1[c] : 255; break;
+			case 2: expected = c < 3 ? (e0[c] + e1[c]) / 2 : 255; break;
+			default: expected = 0;
+			}
+			num_wrong += rgba[i * 4 + c] != expected;
+		}
+	check(num_wrong == 0, "BC1", "3 colors mode");
+
+	//the same color block inside BC3, with the alpha of the first 8 bytes
+	unsigned char block3[16];
+	memset(block3, 0, 8);
+	block3[0] = block3[1] = 99; //flat alpha
+	memcpy(block3 + 8, block, 8);
+	decodeBlock(BLOCK_BC3, block3, rgba);
+	num_wrong = 0;
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+		{
+			int expected;
+			switch (i % 4)
+			{
+			case 0: expected = c < 3 ? e0[c] : 99; break;
+			case 1: expected = c < 3 ? e1[c] : 99; break;
+			case 2: expected = c < 3 ? (2 * e0[c] + e1[c]) / 3 : 99; break;
+			default: expected = c < 3 ? (e0[c] + 2 * e1[c]) / 3 : 99;
+			}
+			num_wrong += rgba[i * 4 + c] != expected;
+		}
+	check(num_wrong == 0, "BC3", "always 4 colors");
+
+	//r0 <= r1 selects 6 values plus 0 and 255 in BC4, and r0 > r1 8 values
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		int r0 = mode ? 200 : 40, r1 = mode ? 40 : 200;
+		memset(block, 0, 8);
+		block[0] = (unsigned char)r0;
+		block[1] = (unsigned char)r1;
+		unsigned long long bits = 0;
+		for (int i = 0; i < 16; ++i)
+			bits |= (unsigned long long)(i % 8) << (i * 3);
+		for (int i = 0; i < 6; ++i)
+			block[2 + i] = (unsigned char)(bits >> (i * 8));
+		decodeBlock(BLOCK_BC4, block, rgba);
+		num_wrong = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			int index = i % 8;
+			int expected;
+			if (index < 2)
+				expected = index ? r1 : r0;
+			else if (mode)
+				expected = ((8 - index) * r0 + (index - 1) * r1) / 7;
+			else if (index < 6)
+				expected = ((6 - index) * r0 + (index - 1) * r1) / 5;
+			else
+				expected = index == 6 ? 0 : 255;
+			num_wrong += rgba[i * 4] != expected || rgba[i * 4 + 1] != 0 || rgba[i * 4 + 2] != 0 || rgba[i * 4 + 3] != 255;
+		}
+		check(num_wrong == 0, "BC4", mode ? "8 values mode" : "6 values mode");
+	}
+
+	//only the mode 6 of BC7 is decoded, the rest gives the error color
+	memset(block, 0, 16);
+	block[0] = 1 << 5; //mode 5
+	decodeBlock(BLOCK_BC7, block, rgba);
+	num_wrong = 0;
+	for (int i = 0; i < 16; ++i)
+		num_wrong += rgba[i * 4] != 255 || rgba[i * 4 + 1] != 0 || rgba[i * 4 + 2] != 255 || rgba[i * 4 + 3] != 255;
+	check(num_wrong == 0, "BC7", "other modes");
+}
+
+static bool sameBlocks(CompressedImage& a, CompressedImage& b)
+{
+	return a.format == b.format && a.width == b.width && a.height == b.height && a.mips == b.mips;
+}
+
+void testDDS()
+{
+	const char* filename = "test_compressed_image.tmp.dds";
+	for (int f = 0; f < num_formats; ++f)
+	{
+		eBlockFormat format = floors[f].format;
+		Image image;
+		fillImage(image, PATTERN_GRADIENT);
+		CompressedImage compressed, loaded;
+		compressed.compress(image, format, true);
+		//61x37 down to 1x1, every mip with the blocks of the size the loaders expect
+		bool chain_ok = compressed.mips.size() == 6;
+		for (size_t i = 0; i < compressed.mips.size() && chain_ok; ++i)
+			chain_ok = compressed.mips[i].size() == CompressedImage::getMipBytes(format, compressed.getMipWidth((int)i), compressed.getMipHeight((int)i));
+		check(chain_ok, getBlockFormatName(format), "mip chain");
+		if (!check(compressed.saveDDS(filename), getBlockFormatName(format), "saveDDS"))
+			continue;
+		check(loaded.loadDDS(filename) && sameBlocks(compressed, loaded), getBlockFormatName(format), "DDS round trip");
+
+		//BC7 has no fourCC of its own, it goes in the DX10 header
+		FILE* file = fopen(filename, "rb");
+		sDDSHeader header;
+		sDDSHeaderDX10 header10;
+		memset(&header10, 0, sizeof(header10));
+		bool read = file && fread(&header, 1, sizeof(header), file) == sizeof(header);
+		if (read && format == BLOCK_BC7)
+			read = fread(&header10, 1, sizeof(header10), file) == sizeof(header10);
+		if (file)
+			fclose(file);
+		if (format == BLOCK_BC7)
+			check(read && header.format.fourCC == 0x30315844 && header10.dxgi_format == 98 && header10.array_size == 1 && header.mipmaps == 6, "BC7", "DX10 header"); //"DX10", BC7_UNORM
+		else
+			check(read && header.format.fourCC != 0x30315844 && header.mipmaps == 6, getBlockFormatName(format), "DDS header");
+
+		//a file cut inside the last mip is rejected
+		file = fopen(filename, "rb");
+		std::vector<unsigned char> bytes;
+		if (file)
+		{
+			int c;
+			while ((c = fgetc(file)) != EOF)
+				bytes.push_back((unsigned char)c);
+			fclose(file);
+		}
+		file = fopen(filename, "wb");
+		if (file)
+		{
+			fwrite(&bytes[0], 1, bytes.size() - 1, file);
+			fclose(file);
+		}
+		CompressedImage truncated;
+		check(!truncated.loadDDS(filename) && truncated.mips.empty(), getBlockFormatName(format), "truncated DDS rejected");
+	}
+	remove(filename);
+}
+
+//the layout of the KTX2 files
+struct sKTX2File {
+	unsigned char identifier[12];
+	unsigned int vk_format, type_size, width, height, depth, layers, faces, levels, supercompression;
+	unsigned int dfd_offset, dfd_bytes, kvd_offset, kvd_bytes;
+	unsigned long long sgd_offset, sgd_bytes;
+};
+
+//the levels are stored from the smallest like the tools do, every one is found by its offset
+static bool writeKTX2(const char* filename, CompressedImage& image, unsigned int vk_format, unsigned int supercompression)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	sKTX2File header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.identifier, identifier, 12);
+	header.vk_format = vk_format;
+	header.type_size = 1;
+	header.width = image.width;
+	header.height = image.height;
+	header.faces = 1;
+	header.levels = (unsigned int)image.mips.size();
+	header.supercompression = supercompression;
+
+	std::vector<unsigned long long> index(image.mips.size() * 3);
+	unsigned long long offset = sizeof(header) + index.size() * sizeof(unsigned long long);
+	for (int i = (int)image.mips.size() - 1; i >= 0; --i)
+	{
+		index[i * 3] = offset;
+		index[i * 3 + 1] = index[i * 3 + 2] = image.mips[i].size();
+		offset += image.mips[i].size();
+	}
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+	ok = ok && fwrite(&index[0], sizeof(unsigned long long), index.size(), file) == index.size();
+	for (int i = (int)image.mips.size() - 1; i >= 0 && ok; --i)
+		ok = fwrite(&image.mips[i][0], 1, image.mips[i].size(), file) == image.mips[i].size();
+	fclose(file);
+	return ok;
+}
+
+void testKTX2()
+{
+	const char* filename = "test_compressed_image.tmp.ktx2";
+	Image image;
+	fillImage(image, PATTERN_GRADIENT);
+
+	//VkFormat of BC7 and of BC1 with alpha, that one keeps the GL variant
+	const unsigned int vk_formats[] = { 145, 133 };
+	const eBlockFormat formats[] = { BLOCK_BC7, BLOCK_BC1 };
+	for (int i = 0; i < 2; ++i)
+	{
+		CompressedImage compressed, loaded;
+		compressed.compress(image, formats[i], true);
+		if (!check(writeKTX2(filename, compressed, vk_formats[i], 0), getBlockFormatName(formats[i]), "write KTX2"))
+			continue;
+		check(loaded.loadKTX2(filename) && sameBlocks(compressed, loaded), getBlockFormatName(formats[i]), "KTX2 levels");
+		if (formats[i] == BLOCK_BC1)
+			check(loaded.getGLFormat() == 0x83F1, "BC1", "KTX2 with alpha"); //GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+	}
+
+	CompressedImage compressed, loaded;
+	compressed.compress(image, BLOCK_BC7, true);
+	writeKTX2(filename, compressed, 145, 2); //zstd
+	check(!loaded.loadKTX2(filename), "BC7", "supercompressed KTX2 rejected");
+	remove(filename);
+}
+
+int main(int argc, char** argv)
+{
+	testEncoders();
+	testDecoderModes();
+	testDDS();
+	testKTX2();
+
+	printf("compressed image: %d of %d checks pass\n", num_tests - num_failed, num_tests);
+	return num_failed ? 1 : 0;
+}
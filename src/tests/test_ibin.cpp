@@ -0,0 +1,319 @@
+/*  checks the pieces of the IBIN files: the LZ4 of utils, the half and RGB9E5 conversions of image_ops and FloatImageView
+	LZ4 must give back the same bytes for data with long runs, no repeats at all and matches around the 64KB window,
+	and reject streams that are cut or point outside what was decoded.
+	The float conversions must stay inside the error of their mantissas, and the first IBIN files (without magic)
+	must still open as 32 bits floats.
+	It uses utils and FloatImage so it links the engine like the cook tool.
+	usage: make test_ibin
+*/
+
+#include "../utils.h"
+#include "../image_ops.h"
+#include "../texture.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+//xorshift, the same inputs in every run
+static uint32 random_state = 0x12345678;
+static uint32 randomInt()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static float randomFloat(float min, float max) { return min + (randomInt() & 0xFFFFFF) / (float)0xFFFFFF * (max - min); }
+
+static int num_tests = 0;
+static int num_failed = 0;
+
+static bool check(bool ok, const char* group, const char* name, const char* detail = "")
+{
+	num_tests++;
+	if (!ok)
+	{
+		num_failed++;
+		printf("[FAIL] %s %s %s\n", group, name, detail);
+	}
+	return ok;
+}
+
+static bool roundTripLZ4(const std::vector<char>& data, size_t& packed_size)
+{
+	std::vector<char> packed;
+	compressLZ4(data.empty() ? NULL : &data[0], data.size(), packed);
+	packed_size = packed.size();
+	std::vector<char> result(data.size() + 1);
+	return decompressLZ4(&packed[0], packed.size(), &result[0], data.size()) && memcmp(&result[0], data.empty() ? "" : &data[0], data.size()) == 0;
+}
+
+void testLZ4()
+{
+	//every kind of sequence: short inputs without matches, lengths over 15 and 255, offsets up to the end of the window
+	std::vector< std::pair<std::string, std::vector<char> > > inputs;
+	inputs.push_back(std::make_pair("empty", std::vector<char>()));
+	inputs.push_back(std::make_pair("one byte", std::vector<char>(1, 'x')));
+	inputs.push_back(std::make_pair("shorter than a match", std::vector<char>(11, 'x')));
+	inputs.push_back(std::make_pair("zeros", std::vector<char>(100000, 0)));
+
+	std::vector<char> text;
+	const char* words[] = { "mesh ", "texture ", "prefab ", "shader ", "light ", "\n" };
+	while (text.size() < 50000)
+	{
+		const char* word = words[randomInt() % 6];
+		text.insert(text.end(), word, word + strlen(word));
+	}
+	inputs.push_back(std::make_pair("text", text));
+
+	std::vector<char> noise(70000);
+	for (size_t i = 0; i < noise.size(); ++i)
+		noise[i] = (char)randomInt();
+	inputs.push_back(std::make_pair("noise", noise));
+
+	//blocks of noise repeated at distances around 65535, the longest offset of the format
+	std::vector<char> far(200000);
+	for (size_t i = 0; i < far.size(); ++i)
+		far[i] = (char)randomInt();
+	for (size_t distance = 65530; distance <= 65540; ++distance)
+		memcpy(&far[(distance - 65530) * 1000 + distance], &far[(distance - 65530) * 1000], 300);
+	inputs.push_back(std::make_pair("far matches", far));
+
+	std::vector<size_t> packed_sizes(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		bool ok = roundTripLZ4(inputs[i].second, packed_sizes[i]);
+		char detail[128];
+		sprintf(detail, "%d bytes -> %d", (int)inputs[i].second.size(), (int)packed_sizes[i]);
+		check(ok, "LZ4 round trip", inputs[i].first.c_str(), detail);
+		printf("LZ4 %-22s %s\n", inputs[i].first.c_str(), detail);
+	}
+	//the runs must use the long lengths and the noise can't grow more than the literal lengths
+	check(packed_sizes[3] < 1000 && packed_sizes[5] < noise.size() + noise.size() / 255 + 16, "LZ4", "packed sizes");
+
+	//the stream of the text must decode only to its own size and only complete
+	std::vector<char> packed, result(text.size() + 16);
+	compressLZ4(&text[0], text.size(), packed);
+	check(!decompressLZ4(&packed[0], packed.size(), &result[0], text.size() - 1), "LZ4", "smaller output rejected");
+	check(!decompressLZ4(&packed[0], packed.size(), &result[0], text.size() + 1), "LZ4", "bigger output rejected");
+	check(!decompressLZ4(&packed[0], packed.size() - 1, &result[0], text.size()), "LZ4", "cut stream rejected");
+	check(!decompressLZ4(&packed[0], packed.size() / 2, &result[0], text.size()), "LZ4", "half stream rejected");
+
+	//sequences written by hand: a literal and then an offset of 0, before the start, or a length past the end of the input
+	const char zero_offset[] = { 0x10, 'a', 0, 0, 0x00 };
+	const char far_offset[] = { 0x10, 'a', 2, 0, 0x00 };
+	const char long_literals[] = { (char)0xF0, (char)255, (char)255, 'a', 'b' };
+	char out[64];
+	check(!decompressLZ4(zero_offset, sizeof(zero_offset), out, 5), "LZ4", "offset 0 rejected");
+	check(!decompressLZ4(far_offset, sizeof(far_offset), out, 5), "LZ4", "offset before the output rejected");
+	check(!decompressLZ4(long_literals, sizeof(long_literals), out, sizeof(out)), "LZ4", "literals past the input rejected");
+
+	//random damage must never write out of the output, it is checked with a guard after it
+	int num_accepted = 0, num_overflows = 0;
+	for (int i = 0; i < 2000; ++i)
+	{
+		std::vector<char> damaged = packed;
+		for (int j = 0; j < 1 + i % 4; ++j)
+			damaged[randomInt() % damaged.size()] = (char)randomInt();
+		std::vector<char> guarded(text.size() + 16, 0x5A);
+		num_accepted += decompressLZ4(&damaged[0], damaged.size(), &guarded[0], text.size());
+		for (size_t j = text.size(); j < guarded.size(); ++j)
+			if (guarded[j] != 0x5A)
+			{
+				num_overflows++;
+				break;
+			}
+	}
+	check(num_overflows == 0, "LZ4", "damaged streams stay inside the output");
+	printf("LZ4 damaged streams: %d of 2000 decode to the right size\n", num_accepted);
+}
+
+void testHalf()
+{
+	//every half must come back the same, the NaNs as NaNs
+	std::vector<uint16> halfs(65536), back(65536);
+	std::vector<float> floats(65536);
+	for (int i = 0; i < 65536; ++i)
+		halfs[i] = (uint16)i;
+	convertHalfToFloat(&halfs[0], &floats[0], halfs.size());
+	convertFloatToHalf(&floats[0], &back[0], floats.size());
+	int num_wrong = 0;
+	for (int i = 0; i < 65536; ++i)
+	{
+		bool is_nan = (i & 0x7C00) == 0x7C00 && (i & 0x3FF);
+		num_wrong += is_nan ? !std::isnan(floats[i]) || (back[i] & 0x7FFF) <= 0x7C00 : back[i] != halfs[i];
+	}
+	check(num_wrong == 0, "half", "every value round trip");
+
+	//floats of any exponent inside the range: half an ulp of the 10 bits mantissa, or of the subnormals
+	const size_t count = 100003; //not a multiple of the vector loops
+	std::vector<float> values(count), result(count);
+	std::vector<uint16> packed(count);
+	for (size_t i = 0; i < count; ++i)
+		values[i] = ldexpf(randomFloat(1.0f, 2.0f), (int)(randomInt() % 40) - 25) * (randomInt() & 1 ? -1.0f : 1.0f);
+	values[0] = 65504.0f;
+	values[1] = 65520.0f; //rounds to inf
+	values[2] = -1e10f;
+	values[3] = 0.0f;
+	convertFloatToHalf(&values[0], &packed[0], count);
+	convertHalfToFloat(&packed[0], &result[0], count);
+	double max_error = 0;
+	num_wrong = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		float v = values[i];
+		if (fabsf(v) >= 65520.0f)
+		{
+			num_wrong += !std::isinf(result[i]) || (result[i] > 0) != (v > 0);
+			continue;
+		}
+		double error = fabs((double)result[i] - v);
+		double bound = std::max(fabs(v) * ldexp(1.0, -11), ldexp(1.0, -25));
+		max_error = std::max(max_error, error / bound);
+		num_wrong += error > bound;
+	}
+	char detail[128];
+	sprintf(detail, "%d values over half an ulp", num_wrong);
+	check(num_wrong == 0, "half", "error bound", detail);
+	printf("half: max error %.3f of half an ulp\n", max_error);
+}
+
+void testRGB9E5()
+{
+	//the components share the exponent of the biggest one, the error is half an ulp of its 9 bits mantissa
+	//(a bit more when the biggest one rounds up to the next exponent)
+	const size_t num_pixels = 50000;
+	std::vector<float> values(num_pixels * 3), result(num_pixels * 3);
+	std::vector<uint32> packed(num_pixels);
+	for (size_t i = 0; i < values.size(); ++i)
+		values[i] = ldexpf(randomFloat(1.0f, 2.0f), (int)(randomInt() % 36) - 20) * (randomInt() % 8 ? 1.0f : randomFloat(0.0f, 1.0f));
+	//out of range: clamped to the biggest value, negative and NaN to 0
+	values[0] = 1e6f;
+	values[1] = -5.0f;
+	values[2] = NAN;
+	values[3] = 65408.0f;
+	values[4] = 65407.9f;
+	values[5] = 0.0f;
+	convertFloatToRGB9E5(&values[0], &packed[0], num_pixels);
+	convertRGB9E5ToFloat(&packed[0], &result[0], num_pixels);
+
+	int num_wrong = 0;
+	double max_error = 0;
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		float clamped[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			float v = values[i * 3 + c];
+			clamped[c] = v > 0 ? std::min(v, 65408.0f) : 0.0f;
+		}
+		float max_value = std::max(clamped[0], std::max(clamped[1], clamped[2]));
+		double bound = std::max(max_value * ldexp(1.0, -9) * 1.01, ldexp(1.0, -25));
+		for (int c = 0; c < 3; ++c)
+		{
+			double error = fabs((double)result[i * 3 + c] - clamped[c]);
+			max_error = std::max(max_error, error / bound);
+			num_wrong += error > bound || result[i * 3 + c] < 0;
+		}
+	}
+	char detail[128];
+	sprintf(detail, "%d components over half an ulp", num_wrong);
+	check(num_wrong == 0, "RGB9E5", "error bound", detail);
+	check(result[0] == 65408.0f && result[1] == 0.0f && result[2] == 0.0f && result[3] == 65408.0f, "RGB9E5", "clamping");
+	printf("RGB9E5: max error %.3f of half an ulp\n", max_error);
+}
+
+//the header of the first IBIN files, always 32 bits floats
+struct sIBINHeaderV1 {
+	int width;
+	int height;
+	int layers;
+	uint8 channels;
+	uint8 bytesperchannel;
+	uint8 flags[17];
+};
+
+void testIBIN()
+{
+	const char* filename = "test_ibin.tmp.ibin";
+	FloatImage image;
+	image.resize(37, 11, 3);
+	for (size_t i = 0; i < (size_t)image.width * image.height * 3; ++i)
+		image.data[i] = ldexpf(randomFloat(1.0f, 2.0f), (int)(randomInt() % 20) - 10);
+
+	//a file of the first version: two layers of 37x11 without magic
+	sIBINHeaderV1 header;
+	memset(&header, 0, sizeof(header));
+	header.width = 37;
+	header.height = 11;
+	header.layers = 2;
+	header.channels = 3;
+	header.bytesperchannel = 4;
+	size_t num_floats = (size_t)37 * 11 * 3;
+	FILE* file = fopen(filename, "wb");
+	if (!check(file != NULL, "IBIN", "write v1"))
+		return;
+	fwrite(&header, 1, sizeof(header), file);
+	fwrite(image.data, sizeof(float), num_floats, file);
+	fwrite(image.data, sizeof(float), num_floats, file);
+	fclose(file);
+
+	{
+		FloatImageView view;
+		bool opened = view.open(filename);
+		check(opened && view.width == 37 && view.height == 11 && view.layers == 2 && view.num_channels == 3 && view.payload == IBIN_FLOAT32 && !view.compressed, "IBIN", "v1 header");
+		const float* data = opened ? view.getData() : NULL;
+		check(data && memcmp(data, image.data, num_floats * sizeof(float)) == 0 && memcmp(data + num_floats, image.data, num_floats * sizeof(float)) == 0, "IBIN", "v1 pixels in place");
+		Vector4 pixel = opened ? view.getPixel(5, 7, 1) : Vector4(0, 0, 0, 0);
+		const float* expected = image.data + (7 * 37 + 5) * 3;
+		check(pixel.x == expected[0] && pixel.y == expected[1] && pixel.z == expected[2] && pixel.w == 1.0f, "IBIN", "v1 pixel of the second layer");
+	}
+
+	//the same file without its last float is rejected
+	file = fopen(filename, "wb");
+	fwrite(&header, 1, sizeof(header), file);
+	fwrite(image.data, sizeof(float), num_floats, file);
+	fwrite(image.data, sizeof(float), num_floats - 1, file);
+	fclose(file);
+	{
+		FloatImageView view;
+		check(!view.open(filename), "IBIN", "truncated v1 rejected");
+	}
+
+	//every payload, with and without LZ4, through saveIBIN and loadIBIN
+	const char* payload_names[] = { "float", "half", "RGB9E5" };
+	for (int payload = IBIN_FLOAT32; payload <= IBIN_RGB9E5; ++payload)
+		for (int compress = 0; compress < 2; ++compress)
+		{
+			char name[64];
+			sprintf(name, "v2 %s%s", payload_names[payload], compress ? " LZ4" : "");
+			FloatImage loaded;
+			if (!check(image.saveIBIN(filename, (eIBINPayload)payload, compress != 0) && loaded.loadIBIN(filename), "IBIN", name))
+				continue;
+			int num_wrong = loaded.width != image.width || loaded.height != image.height || loaded.num_channels != 3;
+			for (size_t i = 0; i < num_floats && !num_wrong; ++i)
+			{
+				const float* pixel = image.data + i / 3 * 3;
+				double bound = payload == IBIN_FLOAT32 ? 0.0 : payload == IBIN_HALF ? fabs(image.data[i]) * ldexp(1.0, -11) :
+					std::max(pixel[0], std::max(pixel[1], pixel[2])) * ldexp(1.0, -9) * 1.01;
+				num_wrong += fabs((double)loaded.data[i] - image.data[i]) > bound;
+			}
+			check(num_wrong == 0, "IBIN", name, "pixels");
+		}
+	remove(filename);
+}
+
+int main(int argc, char** argv)
+{
+	testLZ4();
+	testHalf();
+	testRGB9E5();
+	testIBIN();
+
+	printf("ibin: %d of %d checks pass\n", num_tests - num_failed, num_tests);
+	return num_failed ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*  compares the SIMD kernels of image_ops with their scalar versions on random inputs
+	The scalar reference is the same source built inside a namespace with IMAGE_OPS_NO_SIMD.
+	Sizes go through every tail length of the vector loops and odd image sides.
+	All the kernels must give exactly the same bytes, the floats are compared bit by bit.
+	usage: make test_image_ops
+*/
+
+#include "../image_ops.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace scalar {
+#define IMAGE_OPS_NO_SIMD
+#include "../image_ops.cpp"
+#undef IMAGE_OPS_NO_SIMD
+}
+
+//xorshift, the same inputs in every run
+static uint32 random_state = 0x12345678;
+static uint32 randomInt()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static float randomFloat(float min, float max) { return min + (randomInt() & 0xFFFFFF) / (float)0xFFFFFF * (max - min); }
+
+static void fillBytes(std::vector<uint8>& v, size_t size)
+{
+	v.resize(size);
+	for (size_t i = 0; i < size; ++i)
+		v[i] = (uint8)randomInt();
+}
+
+static void fillFloats(std::vector<float>& v, size_t size, float min, float max)
+{
+	v.resize(size);
+	for (size_t i = 0; i < size; ++i)
+		v[i] = randomFloat(min, max);
+}
+
+static int num_tests = 0;
+static int num_failed = 0;
+
+template<typename T> bool compare(const char* name, const std::vector<T>& simd, const std::vector<T>& ref, size_t size)
+{
+	num_tests++;
+	if (memcmp(simd.data(), ref.data(), size * sizeof(T)) == 0)
+		return true;
+	for (size_t i = 0; i < size; ++i)
+		if (memcmp(&simd[i], &ref[i], sizeof(T)) != 0)
+		{
+			printf("[FAIL] %s: size %d, first difference at %d\n", name, (int)size, (int)i);
+			break;
+		}
+	num_failed++;
+	return false;
+}
+
+//every tail of the loops of 4, 8 and 16 elements and some long rows
+static std::vector<size_t> getCounts()
+{
+	std::vector<size_t> counts;
+	for (size_t i = 1; i <= 70; ++i)
+		counts.push_back(i);
+	counts.push_back(1021);
+	counts.push_back(4099);
+	return counts;
+}
+
+void testPixelOps()
+{
+	std::vector<size_t> counts = getCounts();
+	for (size_t n : counts)
+	{
+		std::vector<uint8> src, a, b;
+		for (int ch = 3; ch <= 4; ++ch)
+		{
+			fillBytes(src, n * ch);
+			a = b = src;
+			swapRedBlue(a.data(), n, ch);
+			scalar::swapRedBlue(b.data(), n, ch);
+			compare("swapRedBlue", a, b, a.size());
+		}
+
+		fillBytes(src, n * 3);
+		a.assign(n * 4, 0);
+		b.assign(n * 4, 0);
+		expandRGBToRGBA(src.data(), a.data(), n, 200);
+		scalar::expandRGBToRGBA(src.data(), b.data(), n, 200);
+		compare("expandRGBToRGBA", a, b, a.size());
+
+		fillBytes(src, n * 4);
+		a.assign(n * 3, 0);
+		b.assign(n * 3, 0);
+		dropAlpha(src.data(), a.data(), n);
+		scalar::dropAlpha(src.data(), b.data(), n);
+		compare("dropAlpha", a, b, a.size());
+
+		a = b = src;
+		premultiplyAlpha(a.data(), n);
+		scalar::premultiplyAlpha(b.data(), n);
+		compare("premultiplyAlpha", a, b, a.size());
+	}
+}
+
+void testConversions()
+{
+	std::vector<size_t> counts = getCounts();
+	for (size_t n : counts)
+	{
+		std::vector<uint8> bytes, a8, b8;
+		std::vector<float> floats, af, bf;
+
+		for (int ch = 1; ch <= 4; ++ch)
+		{
+			fillBytes(bytes, n * ch);
+			af.assign(n * ch, 0);
+			bf.assign(n * ch, 0);
+			convertSRGBToLinear(bytes.data(), af.data(), n, ch);
+			scalar::convertSRGBToLinear(bytes.data(), bf.data(), n, ch);
+			compare("convertSRGBToLinear", af, bf, af.size());
+
+			//out of range values test the clamp
+			fillFloats(floats, n * ch, -0.25f, 1.25f);
+			a8.assign(n * ch, 0);
+			b8.assign(n * ch, 0);
+			convertLinearToSRGB(floats.data(), a8.data(), n, ch);
+			scalar::convertLinearToSRGB(floats.data(), b8.data(), n, ch);
+			compare("convertLinearToSRGB", a8, b8, a8.size());
+		}
+
+		fillBytes(bytes, n);
+		af.assign(n, 0);
+		bf.assign(n, 0);
+		convertUnorm8ToFloat(bytes.data(), af.data(), n);
+		scalar::convertUnorm8ToFloat(bytes.data(), bf.data(), n);
+		compare("convertUnorm8ToFloat", af, bf, n);
+
+		fillFloats(floats, n, -0.25f, 1.25f);
+		a8.assign(n, 0);
+		b8.assign(n, 0);
+		convertFloatToUnorm8(floats.data(), a8.data(), n);
+		scalar::convertFloatToUnorm8(floats.data(), b8.data(), n);
+		compare("convertFloatToUnorm8", a8, b8, n);
+
+		std::vector<float> row;
+		fillFloats(row, n, -2.0f, 2.0f);
+		fillFloats(af, n, -1.0f, 1.0f);
+		bf = af;
+		float weight = randomFloat(-0.5f, 1.0f);
+		addScaledRow(row.data(), weight, af.data(), n);
+		scalar::addScaledRow(row.data(), weight, bf.data(), n);
+		compare("addScaledRow", af, bf, n);
+
+		fillFloats(floats, n * 3, -10.0f, 70000.0f);
+		std::vector<uint32> a32(n), b32(n);
+		convertFloatToRGB9E5(floats.data(), a32.data(), n);
+		scalar::convertFloatToRGB9E5(floats.data(), b32.data(), n);
+		compare("convertFloatToRGB9E5", a32, b32, n);
+		af.assign(n * 3, 0);
+		bf.assign(n * 3, 0);
+		convertRGB9E5ToFloat(a32.data(), af.data(), n);
+		scalar::convertRGB9E5ToFloat(a32.data(), bf.data(), n);
+		compare("convertRGB9E5ToFloat", af, bf, af.size());
+	}
+}
+
+void testHalfs()
+{
+	//every exponent range: zeros, subnormals, normals, overflow, inf and NaN
+	const float specials[] = { 0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65519.0f, 65520.0f, 1e10f, 6.1e-5f, 6.0e-8f, 3.0e-8f, 2.9e-8f, 1e-20f,
+		INFINITY, -INFINITY, NAN, 0.5f + 1.0f / 4096.0f, 1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f };
+	int num_specials = sizeof(specials) / sizeof(float);
+
+	std::vector<size_t> counts = getCounts();
+	for (size_t n : counts)
+	{
+		std::vector<float> floats(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			uint32 r = randomInt();
+			if (r % 4 == 0)
+				floats[i] = specials[(r >> 8) % num_specials];
+			else
+			{
+				//any bit pattern of a float in the range of the halfs
+				float f = randomFloat(1.0f, 2.0f) * ldexpf(1.0f, (int)((r >> 8) % 48) - 30);
+				floats[i] = (r & 0x80000000) ? -f : f;
+			}
+		}
+		std::vector<uint16> a(n), b(n);
+		convertFloatToHalf(floats.data(), a.data(), n);
+		scalar::convertFloatToHalf(floats.data(), b.data(), n);
+		compare("convertFloatToHalf", a, b, n);
+	}
+
+	//all the halfs
+	std::vector<uint16> halfs(65536);
+	for (int i = 0; i < 65536; ++i)
+		halfs[i] = (uint16)i;
+	std::vector<float> a(65536), b(65536);
+	convertHalfToFloat(halfs.data(), a.data(), halfs.size());
+	scalar::convertHalfToFloat(halfs.data(), b.data(), halfs.size());
+	compare("convertHalfToFloat", a, b, a.size());
+	for (size_t n : counts)
+	{
+		convertHalfToFloat(halfs.data() + 65536 - n, a.data(), n);
+		scalar::convertHalfToFloat(halfs.data() + 65536 - n, b.data(), n);
+		compare("convertHalfToFloat", a, b, n);
+	}
+}
+
+void testResize()
+{
+	const int sides[] = { 1, 2, 3, 5, 7, 8, 9, 16, 17, 33, 63 };
+	int num_sides = sizeof(sides) / sizeof(int);
+	for (int ch = 1; ch <= 4; ++ch)
+		for (int i = 0; i < num_sides; ++i)
+			for (int j = 0; j < num_sides; j += 2)
+			{
+				int w = sides[i], h = sides[j];
+				std::vector<uint8> src;
+				fillBytes(src, (size_t)w * h * ch);
+
+				int new_w = std::max(w / 2, 1), new_h = std::max(h / 2, 1);
+				std::vector<uint8> a((size_t)new_w * new_h * ch), b(a.size());
+				downsample2x(src.data(), w, h, ch, a.data());
+				scalar::downsample2x(src.data(), w, h, ch, b.data());
+				compare("downsample2x", a, b, a.size());
+
+				//bigger and smaller
+				int dst_w = sides[(i + 3) % num_sides], dst_h = sides[(j + 5) % num_sides];
+				a.assign((size_t)dst_w * dst_h * ch, 0);
+				b.assign(a.size(), 0);
+				resizeBilinear(src.data(), w, h, ch, a.data(), dst_w, dst_h);
+				scalar::resizeBilinear(src.data(), w, h, ch, b.data(), dst_w, dst_h);
+				compare("resizeBilinear", a, b, a.size());
+			}
+}
+
+int main(int argc, char** argv)
+{
+	testPixelOps();
+	testConversions();
+	testHalfs();
+	testResize();
+
+	printf("image_ops: %d of %d comparisons match\n", num_tests - num_failed, num_tests);
+	return num_failed ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/*  compares the Matrix44 math of framework.cpp with a reference in doubles on random matrices
+	The Makefile builds it twice, with the SIMD code (SSE or NEON) and with NO_SIMD, both must pass.
+	Multiply, transforms and transpose only round like the float loops, the inverses can lose a little more
+	with badly conditioned matrices, so their tolerance grows with the condition number.
+	usage: make test_math
+*/
+
+#include "../framework.h"
+
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifdef NO_SIMD
+	#define MATH_PATH "scalar"
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define MATH_PATH "SSE"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define MATH_PATH "NEON"
+#else
+	#define MATH_PATH "scalar"
+#endif
+
+const int NUM_MATRICES = 4096;
+
+//xorshift, the same inputs in every run
+static uint32 random_state = 0x12345678;
+static uint32 randomInt()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static float randomFloat(float min, float max) { return min + (randomInt() & 0xFFFFFF) / (float)0xFFFFFF * (max - min); }
+static Vector3 randomVector(float min, float max) { return Vector3(randomFloat(min, max), randomFloat(min, max), randomFloat(min, max)); }
+
+//rotation, scale and translation like the model matrices
+static Matrix44 randomAffine()
+{
+	Matrix44 rotation, scale;
+	rotation.setRotation(randomFloat(-3.0f, 3.0f), randomVector(-1.0f, 1.0f).normalize());
+	scale.setScale(randomFloat(0.1f, 3.0f), randomFloat(0.1f, 3.0f), randomFloat(0.1f, 3.0f));
+	Matrix44 m = scale * rotation;
+	m.m[12] = randomFloat(-30.0f, 30.0f);
+	m.m[13] = randomFloat(-30.0f, 30.0f);
+	m.m[14] = randomFloat(-30.0f, 30.0f);
+	return m;
+}
+
+//view * projection like the cameras
+static Matrix44 randomViewProjection()
+{
+	Matrix44 view, projection;
+	Vector3 eye = randomVector(-10.0f, 10.0f);
+	Vector3 center = randomVector(-1.0f, 1.0f);
+	Vector3 up(0.0f, 1.0f, 0.0f);
+	view.lookAt(eye, center, up);
+	projection.perspective(randomFloat(40.0f, 90.0f), randomFloat(0.5f, 2.0f), 0.1f, 1000.0f);
+	return view * projection;
+}
+
+static Matrix44 randomGeneral()
+{
+	Matrix44 m;
+	for (int i = 0; i < 16; ++i)
+		m.m[i] = randomFloat(-3.0f, 3.0f);
+	return m;
+}
+
+//the reference in doubles, with the same layout as Matrix44: M[row][column], the vectors multiply the rows
+struct DMatrix {
+	double M[4][4];
+	DMatrix() {}
+	DMatrix(const Matrix44& m) { for (int i = 0; i < 4; ++i) for (int j = 0; j < 4; ++j) M[i][j] = m.M[i][j]; }
+};
+
+static DMatrix multiply(const DMatrix& a, const DMatrix& b)
+{
+	DMatrix r;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+		{
+			r.M[i][j] = 0.0;
+			for (int k = 0; k < 4; ++k)
+				r.M[i][j] += a.M[i][k] * b.M[k][j];
+		}
+	return r;
+}
+
+//gauss-jordan with partial pivoting, false if singular
+static bool inverse(const DMatrix& m, DMatrix& result)
+{
+	double a[4][8];
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+		{
+			a[i][j] = m.M[i][j];
+			a[i][j + 4] = i == j ? 1.0 : 0.0;
+		}
+	for (int col = 0; col < 4; ++col)
+	{
+		int pivot = col;
+		for (int i = col + 1; i < 4; ++i)
+			if (fabs(a[i][col]) > fabs(a[pivot][col]))
+				pivot = i;
+		if (a[pivot][col] == 0.0)
+			return false;
+		for (int j = 0; j < 8; ++j)
+			std::swap(a[col][j], a[pivot][j]);
+		double scale = 1.0 / a[col][col];
+		for (int j = 0; j < 8; ++j)
+			a[col][j] *= scale;
+		for (int i = 0; i < 4; ++i)
+			if (i != col)
+			{
+				double factor = a[i][col];
+				for (int j = 0; j < 8; ++j)
+					a[i][j] -= factor * a[col][j];
+			}
+	}
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			result.M[i][j] = a[i][j + 4];
+	return true;
+}
+
+static double maxAbs(const DMatrix& m)
+{
+	double r = 0.0;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			r = std::max(r, fabs(m.M[i][j]));
+	return r;
+}
+
+//largest difference relative to the largest value of the reference
+static double matrixError(const Matrix44& m, const DMatrix& ref)
+{
+	double error = 0.0;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			error = std::max(error, fabs(m.M[i][j] - ref.M[i][j]));
+	return error / std::max(maxAbs(ref), 1e-30);
+}
+
+static int num_tests = 0;
+static int num_failed = 0;
+
+static void check(const char* name, double max_error, double tolerance)
+{
+	num_tests++;
+	bool ok = max_error <= tolerance;
+	if (!ok)
+		num_failed++;
+	printf("%s %-28s max error %.2e  tolerance %.1e\n", ok ? "[OK]  " : "[FAIL]", name, max_error, tolerance);
+}
+
+void testMultiply()
+{
+	double max_error = 0.0;
+	for (int i = 0; i < NUM_MATRICES; ++i)
+	{
+		Matrix44 a = i % 2 ? randomAffine() : randomViewProjection();
+		Matrix44 b = randomGeneral();
+		max_error = std::max(max_error, matrixError(a * b, multiply(DMatrix(a), DMatrix(b))));
+	}
+	check("multiply", max_error, 1e-5);
+}
+
+void testTranspose()
+{
+	int num_different = 0;
+	for (int i = 0; i < NUM_MATRICES; ++i)
+	{
+		Matrix44 m = randomGeneral();
+		Matrix44 t = m;
+		t.transpose();
+		for (int j = 0; j < 4; ++j)
+			for (int k = 0; k < 4; ++k)
+				if (t.M[j][k] != m.M[k][j])
+					num_different++;
+	}
+	check("transpose", num_different, 0.0);
+}
+
+//the error of an inverse in floats is around the epsilon times the condition number
+static void testInverse(const char* name, Matrix44 (*generate)())
+{
+	double max_error = 0.0;
+	double max_ratio = 0.0; //error / condition number
+	int num_failed_inverses = 0;
+	for (int i = 0; i < NUM_MATRICES; ++i)
+	{
+		Matrix44 m = generate();
+		DMatrix ref;
+		if (!inverse(DMatrix(m), ref))
+			continue;
+		double condition = maxAbs(DMatrix(m)) * maxAbs(ref) * 16.0;
+		if (condition > 1e5)
+			continue; //too close to singular to say anything of the float versions
+		Matrix44 inv = m;
+		if (!inv.inverse())
+		{
+			num_failed_inverses++;
+			continue;
+		}
+		double error = matrixError(inv, ref);
+		max_error = std::max(max_error, error);
+		max_ratio = std::max(max_ratio, error / condition);
+	}
+	char label[64];
+	sprintf(label, "inverse %s", name);
+	check(label, max_ratio, 1e-6);
+	sprintf(label, "inverse %s rejected", name);
+	check(label, num_failed_inverses, 0.0);
+	printf("       (max error %.2e)\n", max_error);
+}
+
+void testSingular()
+{
+	int num_wrong = 0;
+	for (int i = 0; i < 64; ++i)
+	{
+		//two equal rows or a flat scale, the rounding can make the determinant a bit different from 0
+		Matrix44 m = i % 2 ? randomGeneral() : randomAffine();
+		if (i % 2)
+			memcpy(m.M[2], m.M[1], sizeof(float) * 4);
+		else if (i % 4)
+			memcpy(m.M[1], m.M[0], sizeof(float) * 3);
+		else
+			for (int j = 0; j < 4; ++j)
+				m.M[j][1] = 0.0f;
+		Matrix44 inv = m;
+		if (inv.inverse() || memcmp(inv.m, m.m, sizeof(m.m)) != 0)
+			num_wrong++;
+	}
+	check("singular rejected", num_wrong, 0.0);
+}
+
+void testTransforms()
+{
+	double error_vec3 = 0.0, error_vec4 = 0.0, error_box = 0.0;
+	for (int i = 0; i < NUM_MATRICES; ++i)
+	{
+		Matrix44 m = i % 2 ? randomAffine() : randomViewProjection();
+		DMatrix d(m);
+		Vector3 v = randomVector(-10.0f, 10.0f);
+		float w = randomFloat(-2.0f, 2.0f);
+
+		double ref[4];
+		for (int j = 0; j < 4; ++j)
+			ref[j] = v.x * d.M[0][j] + v.y * d.M[1][j] + v.z * d.M[2][j] + w * d.M[3][j];
+		double scale = std::max(maxAbs(d) * 10.0, 1e-30);
+		Vector4 r4 = m * Vector4(v, w);
+		for (int j = 0; j < 4; ++j)
+			error_vec4 = std::max(error_vec4, fabs(r4.v[j] - ref[j]) / scale);
+
+		for (int j = 0; j < 3; ++j)
+			ref[j] = v.x * d.M[0][j] + v.y * d.M[1][j] + v.z * d.M[2][j] + d.M[3][j];
+		Vector3 r3 = m * v;
+		for (int j = 0; j < 3; ++j)
+			error_vec3 = std::max(error_vec3, fabs(r3.v[j] - ref[j]) / scale);
+
+		//the box of the 8 transformed corners
+		BoundingBox box(randomVector(-10.0f, 10.0f), randomVector(0.0f, 5.0f));
+		double box_min[3] = { 1e30, 1e30, 1e30 }, box_max[3] = { -1e30, -1e30, -1e30 };
+		for (int c = 0; c < 8; ++c)
+		{
+			double p[3] = { box.center.x + (c & 1 ? 1 : -1) * box.halfsize.x, box.center.y + (c & 2 ? 1 : -1) * box.halfsize.y, box.center.z + (c & 4 ? 1 : -1) * box.halfsize.z };
+			for (int j = 0; j < 3; ++j)
+			{
+				double t = p[0] * d.M[0][j] + p[1] * d.M[1][j] + p[2] * d.M[2][j] + d.M[3][j];
+				box_min[j] = std::min(box_min[j], t);
+				box_max[j] = std::max(box_max[j], t);
+			}
+		}
+		BoundingBox result = transformBoundingBox(m, box);
+		scale = std::max(maxAbs(d) * 20.0, 1e-30);
+		for (int j = 0; j < 3; ++j)
+		{
+			error_box = std::max(error_box, fabs(result.center.v[j] - (box_min[j] + box_max[j]) * 0.5) / scale);
+			error_box = std::max(error_box, fabs(result.halfsize.v[j] - (box_max[j] - box_min[j]) * 0.5) / scale);
+		}
+	}
+	check("matrix * vector3", error_vec3, 1e-6);
+	check("matrix * vector4", error_vec4, 1e-6);
+	check("transformBoundingBox", error_box, 1e-6);
+}
+
+int main(int argc, char** argv)
+{
+	printf("math: %s path\n", MATH_PATH);
+	testMultiply();
+	testTranspose();
+	testInverse("affine", randomAffine);
+	testInverse("view projection", randomViewProjection);
+	testInverse("general", randomGeneral);
+	testSingular();
+	testTransforms();
+
+	printf("math: %d of %d checks pass\n", num_tests - num_failed, num_tests);
+	return num_failed ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+/*  stress test of the queues and pools of task.h with many threads, built with the thread sanitizer
+	The MPSCQueue is tested with a small ring so it wraps and gets full all the time.
+	The TaskManager gets more tasks than its ring holds so part of them go to the overflow list,
+	the tasks of every producer must run once and in the order they were added.
+	The ThreadPool runs parallel_for ranges, chains of then() and workers waiting for other tasks,
+	and the JobGraph gets jobs that add more jobs and dependencies while it runs.
+	usage: make test_task_queue
+*/
+
+#include "../task.h"
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+static int num_errors = 0;
+
+//xorshift, the same graph in every run
+static unsigned int random_state = 0x12345678;
+static unsigned int randomInt()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+void testRing()
+{
+	const int num_producers = 6;
+	const int num_values = 100000;
+	MPSCQueue<int, 8> queue;
+	std::atomic<int> times_full(0);
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < num_producers; ++p)
+		producers.push_back(std::thread([&, p]() {
+			for (int i = 0; i < num_values; ++i)
+				while (!queue.push(p * num_values + i))
+				{
+					times_full++;
+					std::this_thread::yield();
+				}
+		}));
+
+	//every producer pushes its values in order, the consumer must see them in the same order
+	std::vector<int> last(num_producers, -1);
+	int received = 0;
+	int value;
+	while (received < num_producers * num_values)
+	{
+		if (!queue.pop(value))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		int p = value / num_values;
+		int i = value % num_values;
+		if (i != last[p] + 1 && num_errors++ < 10)
+			printf("[FAIL] ring: producer %d sent %d after %d\n", p, i, last[p]);
+		last[p] = i;
+		received++;
+	}
+	for (size_t i = 0; i < producers.size(); ++i)
+		producers[i].join();
+	if (queue.pop(value) && num_errors++ < 10)
+		printf("[FAIL] ring: more values than pushed\n");
+	printf("ring: %d values, full %d times\n", received, (int)times_full);
+}
+
+void testManager()
+{
+	const int num_producers = 8;
+	const int num_tasks = 10000; //of every producer, much more than the ring of the manager
+	static TaskManager manager;
+	manager.budget_ms = 0;
+	manager.budget_bytes = 0;
+
+	//only touched by the consumer thread, the one that runs the tasks
+	std::vector<int> last(num_producers, -1);
+	int executed = 0;
+
+	std::atomic<int> started(0);
+	std::vector<std::thread> producers;
+	for (int p = 0; p < num_producers; ++p)
+		producers.push_back(std::thread([&, p]() {
+			started++;
+			for (int i = 0; i < num_tasks; ++i)
+				manager.addTask(new Task([&, p, i]() {
+					if (i != last[p] + 1 && num_errors++ < 10)
+						printf("[FAIL] manager: task %d of producer %d ran after %d\n", i, p, last[p]);
+					last[p] = i;
+					executed++;
+				}));
+		}));
+
+	//the consumer starts late so the ring fills, then it alternates the two ways of running tasks
+	while (started < num_producers || manager.getNumPending() < 8192)
+		std::this_thread::yield();
+	int round = 0;
+	while (executed < num_producers * num_tasks)
+	{
+		if (round++ % 2)
+			manager.drainTasks();
+		else
+			for (int i = 0; i < 100 && manager.fetchTask(); ++i);
+		std::this_thread::yield();
+	}
+	for (size_t i = 0; i < producers.size(); ++i)
+		producers[i].join();
+	if (manager.fetchTask() && num_errors++ < 10)
+		printf("[FAIL] manager: more tasks than added\n");
+	printf("manager: %d tasks\n", executed);
+}
+
+void testParallelFor(ThreadPool& pool)
+{
+	struct sRange { int begin, end, grain_size; };
+	const sRange ranges[] = { { 0, 0, 1 }, { 5, 3, 1 }, { 0, 1, 1 }, { 0, 7, 1 }, { -50, 50, 1 }, { 0, 37, 10 }, { 0, 1000, 16 }, { 0, 1000, 1000 }, { 3, 100003, 1 } };
+	int num_ranges = sizeof(ranges) / sizeof(ranges[0]);
+
+	//every index must be called once and only inside the range, also from a worker of the same pool
+	for (int r = 0; r < num_ranges * 2; ++r)
+	{
+		const sRange& range = ranges[r % num_ranges];
+		int count = std::max(range.end - range.begin, 0);
+		std::unique_ptr<std::atomic<int>[]> hits(new std::atomic<int>[count + 1]);
+		for (int i = 0; i < count; ++i)
+			hits[i] = 0;
+		std::atomic<long long> sum(0);
+		std::atomic<int> num_calls(0), num_outside(0);
+		auto func = [&](int start, int end) {
+			num_calls++;
+			if (start < range.begin || end > range.end || start >= end)
+			{
+				num_outside++;
+				return;
+			}
+			long long local = 0;
+			for (int i = start; i < end; ++i)
+			{
+				hits[i - range.begin]++;
+				local += i;
+			}
+			sum += local;
+		};
+		if (r < num_ranges)
+			pool.parallel_for(range.begin, range.end, func, range.grain_size);
+		else
+			pool.async([&]() { pool.parallel_for(range.begin, range.end, func, range.grain_size); }).get();
+
+		int num_wrong = 0;
+		for (int i = 0; i < count; ++i)
+			if (hits[i] != 1)
+				num_wrong++;
+		long long expected = count ? (long long)(range.begin + range.end - 1) * count / 2 : 0;
+		if ((num_wrong || num_outside || sum != expected || (count == 0 && num_calls)) && num_errors++ < 10)
+			printf("[FAIL] parallel_for [%d, %d) grain %d%s: %d indices wrong, %d bad chunks, sum %lld instead of %lld\n",
+				range.begin, range.end, range.grain_size, r < num_ranges ? "" : " from a worker", num_wrong, (int)num_outside, (long long)sum, expected);
+	}
+	printf("parallel_for: %d ranges\n", num_ranges * 2);
+}
+
+void testFutures(ThreadPool& pool)
+{
+	//chains of continuations, some added once the first one is done so they go straight to the pool
+	const int num_chains = 500;
+	std::vector<TaskFuture<int>> chains;
+	for (int i = 0; i < num_chains; ++i)
+	{
+		TaskFuture<int> first = pool.async([i]() { return i; });
+		if (i % 3 == 0)
+			first.wait();
+		chains.push_back(first.then([](std::shared_future<int> previous) { return previous.get() * 2; })
+			.then([](std::shared_future<int> previous) { return previous.get() + 1; }, TASK_PRIORITY_HIGH));
+	}
+	for (int i = 0; i < num_chains; ++i)
+		if (chains[i].get() != i * 2 + 1 && num_errors++ < 10)
+			printf("[FAIL] then: chain %d gave %d\n", i, chains[i].get());
+
+	std::atomic<int> num_calls(0);
+	pool.async([&]() { num_calls++; }).then([&](std::shared_future<void> previous) { previous.get(); num_calls++; }).get();
+	if (num_calls != 2 && num_errors++ < 10)
+		printf("[FAIL] then: %d calls of the void chain\n", (int)num_calls);
+
+	//more waiting tasks than workers, the waits must run the inner tasks or the pool would block
+	const int num_outer = 64;
+	const int num_inner = 8;
+	std::vector<TaskFuture<long long>> outer;
+	for (int i = 0; i < num_outer; ++i)
+		outer.push_back(pool.async([&pool, i]() {
+			std::vector<TaskFuture<long long>> inner;
+			for (int j = 0; j < num_inner; ++j)
+				inner.push_back(pool.async([i, j]() { return (long long)i * num_inner + j; }));
+			long long sum = 0;
+			for (size_t j = 0; j < inner.size(); ++j)
+				sum += inner[j].get();
+			return sum;
+		}));
+	for (int i = 0; i < num_outer; ++i)
+	{
+		long long expected = (long long)i * num_inner * num_inner + num_inner * (num_inner - 1) / 2;
+		if (outer[i].get() != expected && num_errors++ < 10)
+			printf("[FAIL] nested wait: task %d gave %lld instead of %lld\n", i, outer[i].get(), expected);
+	}
+	printf("futures: %d chains, %d nested waits\n", num_chains, num_outer);
+}
+
+const int NUM_GRAPH_JOBS = 400;
+static std::atomic<int> job_done[NUM_GRAPH_JOBS * 3]; //the jobs added at first, then two added by some of them
+
+//without use_pool it uses run with its own threads, runInPool with a NULL pool does all in the caller
+void testGraph(const char* name, ThreadPool* pool, bool use_pool)
+{
+	for (int i = 0; i < NUM_GRAPH_JOBS * 3; ++i)
+		job_done[i] = 0;
+	std::thread::id main_id = std::this_thread::get_id();
+	std::atomic<int> num_wrong(0);
+	JobGraph graph;
+
+	//the dependencies must be done, the main thread jobs run in the caller and every job once
+	auto check = [&](int id, const std::vector<int>& depends_on, bool main_thread) {
+		for (size_t i = 0; i < depends_on.size(); ++i)
+			if (!job_done[depends_on[i]])
+				num_wrong++;
+		if (main_thread && std::this_thread::get_id() != main_id)
+			num_wrong++;
+		if (job_done[id]++)
+			num_wrong++;
+	};
+
+	for (int i = 0; i < NUM_GRAPH_JOBS; ++i)
+	{
+		std::vector<int> depends_on;
+		for (int j = 0; j < 3 && i > 0; ++j)
+			depends_on.push_back(randomInt() % i);
+		bool main_thread = i % 7 == 0;
+		int index = graph.addJob([&, i, depends_on, main_thread]() {
+			check(i, depends_on, main_thread);
+			if (i % 4)
+				return;
+			//one job waits for this one and for another one, added as a dependency after both exist
+			int first = NUM_GRAPH_JOBS + i;
+			int second = NUM_GRAPH_JOBS * 2 + i;
+			bool second_main = i % 8 == 0;
+			int job = graph.addJob([&, i, first, second]() { check(first, std::vector<int>{ i, second }, false); }, false, i);
+			int other = graph.addJob([&, i, second, second_main]() { check(second, std::vector<int>{ i }, second_main); }, second_main, i);
+			graph.addDependency(job, other);
+		}, main_thread, depends_on);
+		if (index != i && num_errors++ < 10)
+			printf("[FAIL] graph %s: job %d got index %d\n", name, i, index);
+	}
+
+	if (!use_pool)
+		graph.run(3);
+	else
+		graph.runInPool(pool);
+
+	for (int i = 0; i < NUM_GRAPH_JOBS * 3; ++i)
+		if (job_done[i] != (i < NUM_GRAPH_JOBS || i % NUM_GRAPH_JOBS % 4 == 0 ? 1 : 0))
+			num_wrong++;
+	if (num_wrong && num_errors++ < 10)
+		printf("[FAIL] graph %s: %d jobs wrong\n", name, (int)num_wrong);
+	printf("graph %s: %d jobs\n", name, NUM_GRAPH_JOBS + NUM_GRAPH_JOBS / 4 * 2);
+}
+
+int main(int argc, char** argv)
+{
+	testRing();
+	testManager();
+
+	//more threads than cores so they interleave also in small machines
+	ThreadPool pool(3);
+	testParallelFor(pool);
+	testFutures(pool);
+	testGraph("run", NULL, false);
+	testGraph("in pool", &pool, true);
+	testGraph("without pool", NULL, true);
+
+	printf("task queue: %s\n", num_errors ? "FAILED" : "ok");
+	return num_errors ? 1 : 0;
+}
@@ -2,9 +2,12 @@
 #include "texture.h"
 #include "fbo.h"
 #include "utils.h"
+#include "image_ops.h"
+#include "upload_ring.h"
 
 #include <iostream> //to output
 #include <cmath>
+#include <algorithm>
 
 #include "mesh.h"
 #include "shader.h"
@@ -27,6 +30,8 @@
 
 #endif
 
+bool Image::use_cooked = true;
+
 //bilinear interpolation
 Color Image::getPixelInterpolated(float x, float y, bool repeat) {
 	int ix = repeat ? fmod(x,width) : clamp(x,0,width-1);
@@ -63,7 +68,14 @@ int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
 
-Texture::Texture()
+bool Texture::use_streaming = true;
+size_t Texture::streaming_budget = 256 * 1024 * 1024;
+int Texture::streaming_start_size = 64;
+int Texture::streaming_max_loads = 4;
+int Texture::streaming_cold_frames = 300;
+int Texture::num_streaming_loads = 0;
+
+Texture::Texture() : Resource(RESOURCE_TEXTURE)
 {
 	width = 0;
 	height = 0;
@@ -73,19 +85,23 @@ Texture::Texture()
 	format = 0;
 	type = 0;
 	texture_type = GL_TEXTURE_2D;
+	block_format = BLOCK_NONE;
 	loading = false;
+	streamed = false;
 }
 
-Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
+Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format) : Resource(RESOURCE_TEXTURE)
 {
 	loading = false;
+	streamed = false;
 	texture_id = 0;
 	create(width, height, format, type, mipmaps, data, internal_format);
 }
 
-Texture::Texture(Image* img)
+Texture::Texture(Image* img) : Resource(RESOURCE_TEXTURE)
 {
 	loading = false;
+	streamed = false;
 	texture_id = 0;
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
 }
@@ -95,6 +111,35 @@ Texture::~Texture()
 	clear();
 }
 
+void Texture::getMemoryUsage(size_t& cpu, size_t& gpu)
+{
+	cpu = image.data ? (size_t)image.width * image.height * image.num_channels : 0;
+	gpu = 0;
+	if (!texture_id)
+		return;
+
+	int channels = 4;
+	if (format == GL_RED || format == GL_DEPTH_COMPONENT)
+		channels = 1;
+	else if (format == GL_RG)
+		channels = 2;
+	else if (format == GL_RGB)
+		channels = 3;
+	int bytes = 1;
+	if (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT)
+		bytes = 4;
+	else if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT)
+		bytes = 2;
+	int layers = texture_type == GL_TEXTURE_CUBE_MAP ? 6 : (int)std::max(depth, 1.0f);
+
+	if (block_format != BLOCK_NONE)
+		gpu = CompressedImage::getMipBytes(block_format, (unsigned int)width, (unsigned int)height) * layers;
+	else
+		gpu = (size_t)width * (size_t)height * layers * channels * bytes;
+	if (mipmaps)
+		gpu += gpu / 3;
+}
+
 void Texture::clear()
 {
 	glBindTexture(this->texture_type, 0);
@@ -152,6 +197,7 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	this->format = format;
 	this->internal_format = internal_format;
 	this->type = type;
+	this->block_format = BLOCK_NONE;
 	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
@@ -206,6 +252,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 	this->internal_format = internal_format;
 	this->type = type;
 	this->texture_type = GL_TEXTURE_CUBE_MAP;
+	this->block_format = BLOCK_NONE;
 	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
 
 	this->wrapS = GL_CLAMP_TO_EDGE;
@@ -251,6 +298,18 @@ Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
 	if (texture)
 		return texture;
 
+	//streamed ones only upload the start mip, the rest come when the renderer needs them
+	Texture* temp = createPlaceholder(filename, use_streaming && mipmaps);
+
+	//add action to BG Thread 
+	LoadTextureTask* task = new LoadTextureTask(filename, temp->streamed);
+	TaskManager::background.addTask(task);
+
+	return temp;
+}
+
+Texture* Texture::createPlaceholder(const char* filename, bool streamed)
+{
 	//create temp texture
 	Texture* temp = new Texture();
 	temp->create(1, 1);
@@ -258,15 +317,33 @@ Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
 	temp->setName(filename);
 	temp->loading = true;
 
-	//add action to BG Thread 
-	LoadTextureTask* task = new LoadTextureTask(filename);
-	TaskManager::background.addTask(task);
-
+	if (streamed)
+	{
+		temp->streamed = true;
+		temp->source_width = temp->source_height = 0;
+		temp->source_channels = 4;
+		temp->resident_mip = temp->wanted_mip = 0;
+		temp->wanted_frame = ResourceManager::frame;
+		temp->stream_loading = true;
+		num_streaming_loads++;
+	}
 	return temp;
 }
 
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
+	//block compressed files (or cooked ones) are uploaded with their own mips
+	if (type == GL_UNSIGNED_BYTE)
+	{
+		CompressedImage compressed;
+		if (compressed.loadForTexture(filename))
+		{
+			uploadCompressed(&compressed, 0);
+			setName(filename);
+			return true;
+		}
+	}
+
 	Image* image = new Image();
 	if (!image->load(filename))
 	{
@@ -291,6 +368,9 @@ void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int
 	// We have to synchronously upload for now because Image class is not ref-counted
 	create(image->width, image->height, (image->num_channels == 3 ? GL_RGB : GL_RGBA), type,  mipmaps, image->data, 0);
 
+	if (type == GL_UNSIGNED_BYTE)
+		uploadStoredMips(image);
+
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
@@ -301,6 +381,19 @@ void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+//the mips stored in the file replace the generated ones, they use a better filter
+void Texture::uploadStoredMips(Image* image)
+{
+	if (!this->mipmaps || image->mips.empty())
+		return;
+	glBindTexture(this->texture_type, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < image->mips.size(); ++i)
+		glTexImage2D(this->texture_type, (int)i + 1, this->format, std::max(image->width >> (i + 1), 1u), std::max(image->height >> (i + 1), 1u), 0, this->format, GL_UNSIGNED_BYTE, &image->mips[i][0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(this->texture_type, 0);
+}
+
 void Texture::upload(Image* img)
 {
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -493,6 +586,46 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 }
 
 
+void Texture::uploadCompressed(CompressedImage* img, int first_mip)
+{
+	assert(first_mip < (int)img->mips.size());
+	if (texture_id == 0)
+		glGenTextures(1, &texture_id);
+
+	this->width = (float)img->getMipWidth(first_mip);
+	this->height = (float)img->getMipHeight(first_mip);
+	this->depth = 0;
+	this->texture_type = GL_TEXTURE_2D;
+	this->type = GL_UNSIGNED_BYTE;
+	this->format = this->internal_format = img->getGLFormat();
+	this->block_format = img->format;
+	int num_levels = (int)img->mips.size() - first_mip;
+	this->mipmaps = num_levels > 1;
+
+	glBindTexture(this->texture_type, texture_id);
+	for (int i = 0; i < num_levels; ++i)
+	{
+		std::vector<unsigned char>& mip = img->mips[first_mip + i];
+		glCompressedTexImage2D(this->texture_type, i, format, img->getMipWidth(first_mip + i), img->getMipHeight(first_mip + i), 0, (GLsizei)mip.size(), &mip[0]);
+	}
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1); //files don't always have the whole chain
+
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	//single channel ones are grayscale images, not red
+	if (block_format == BLOCK_BC4)
+	{
+		glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_G, GL_RED);
+		glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error uploading compressed texture");
+}
+
 void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
@@ -537,6 +670,210 @@ void Texture::generateMipmaps()
 }
 
 
+int Texture::getNumMips()
+{
+	int size = std::max(source_width, source_height);
+	int num = 1;
+	while (size >>= 1)
+		num++;
+	return num;
+}
+
+int Texture::getStreamingStartMip(int width, int height)
+{
+	int mip = 0;
+	while (std::max(width >> mip, height >> mip) > streaming_start_size)
+		mip++;
+	return mip;
+}
+
+size_t Texture::getStreamedBytes(int mip)
+{
+	unsigned int w = std::max(source_width >> mip, 1), h = std::max(source_height >> mip, 1);
+	size_t bytes = block_format != BLOCK_NONE ? CompressedImage::getMipBytes(block_format, w, h) : (size_t)w * h * source_channels;
+	return bytes + bytes / 3; //with the mips below
+}
+
+void Texture::requestMip(float pixels_per_uv)
+{
+	touch(); //it is visible, its upload goes first if it is still loading
+	if (!use_streaming || !streamed || !source_width)
+		return;
+
+	//one uv unit covers the whole texture, so the mip is the one with a texel per pixel
+	float texels_per_pixel = std::max(source_width, source_height) / std::max(pixels_per_uv, 0.0001f);
+	int mip = texels_per_pixel > 1.0f ? (int)std::log2(texels_per_pixel) : 0;
+	mip = std::min(mip, getNumMips() - 1);
+
+	if (wanted_frame != ResourceManager::frame)
+	{
+		wanted_mip = mip;
+		wanted_frame = ResourceManager::frame;
+	}
+	else
+		wanted_mip = std::min(wanted_mip, mip);
+}
+
+void Texture::setResidentMip(Image* img, int mip)
+{
+	//the new GL texture is complete before the old one is deleted, so there is always something to bind
+	GLuint old_id = texture_id;
+	glGenTextures(1, &texture_id);
+
+	this->width = (float)img->width;
+	this->height = (float)img->height;
+	this->depth = 0;
+	this->format = img->num_channels == 3 ? GL_RGB : GL_RGBA;
+	this->type = GL_UNSIGNED_BYTE;
+	this->internal_format = 0;
+	this->texture_type = GL_TEXTURE_2D;
+	this->mipmaps = isPowerOfTwo(img->width) && isPowerOfTwo(img->height);
+	upload(format, type, mipmaps, img->data);
+	uploadStoredMips(img);
+
+	if (old_id)
+		glDeleteTextures(1, &old_id);
+	resident_mip = mip;
+}
+
+void Texture::setResidentMip(CompressedImage* img, int mip)
+{
+	GLuint old_id = texture_id;
+	texture_id = 0;
+	uploadCompressed(img, mip);
+	if (old_id)
+		glDeleteTextures(1, &old_id);
+	resident_mip = mip;
+}
+
+void Texture::adoptTexture(unsigned int id, int width, int height, int num_channels)
+{
+	GLuint old_id = texture_id;
+	texture_id = id;
+
+	this->width = (float)width;
+	this->height = (float)height;
+	this->depth = 0;
+	this->format = num_channels == 3 ? GL_RGB : GL_RGBA;
+	this->type = GL_UNSIGNED_BYTE;
+	this->internal_format = 0;
+	this->block_format = BLOCK_NONE;
+	this->texture_type = GL_TEXTURE_2D;
+	this->mipmaps = isPowerOfTwo(width) && isPowerOfTwo(height);
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	if (this->mipmaps)
+		generateMipmaps();
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (old_id && old_id != id)
+		glDeleteTextures(1, &old_id);
+}
+
+void Texture::updateStreaming()
+{
+	if (!use_streaming)
+		return;
+	long frame = ResourceManager::frame;
+
+	struct sStreamState {
+		Texture* texture;
+		int desired; //mip the renderer needs (the start mip if cold)
+		int target; //mip that will be resident
+	};
+	std::vector<sStreamState> states;
+	size_t total = 0;
+
+	for (auto it : sTexturesLoaded)
+	{
+		Texture* texture = it.second;
+		if (!texture->streamed || !texture->source_width)
+			continue;
+		sStreamState state;
+		state.texture = texture;
+		int start_mip = getStreamingStartMip(texture->source_width, texture->source_height);
+		bool cold = frame - texture->wanted_frame > streaming_cold_frames;
+		state.desired = cold ? start_mip : std::min(texture->wanted_mip, start_mip);
+		//the detail already in VRAM is kept until it goes cold or the budget needs it
+		state.target = cold ? state.desired : std::min(state.desired, texture->resident_mip);
+		if (texture->stream_loading) //it will be decided when the load finishes
+			state.target = texture->resident_mip;
+		total += texture->getStreamedBytes(state.target);
+		states.push_back(state);
+	}
+
+	//over budget: drop one mip at a time from the textures with more detail than needed, then from the biggest and coldest
+	while (streaming_budget && total > streaming_budget)
+	{
+		sStreamState* worst = NULL;
+		bool worst_surplus = false;
+		double worst_score = 0;
+		for (size_t i = 0; i < states.size(); ++i)
+		{
+			sStreamState& state = states[i];
+			Texture* texture = state.texture;
+			if (texture->stream_loading || state.target >= getStreamingStartMip(texture->source_width, texture->source_height))
+				continue;
+			bool surplus = state.target < state.desired;
+			double score = (double)texture->getStreamedBytes(state.target) * (1 + frame - texture->wanted_frame);
+			if (!worst || (surplus && !worst_surplus) || (surplus == worst_surplus && score > worst_score))
+			{
+				worst = &state;
+				worst_surplus = surplus;
+				worst_score = score;
+			}
+		}
+		if (!worst)
+			break;
+		total -= worst->texture->getStreamedBytes(worst->target) - worst->texture->getStreamedBytes(worst->target + 1);
+		worst->target++;
+	}
+
+	//the ones that free memory go first, then the ones that gain more detail
+	std::sort(states.begin(), states.end(), [](const sStreamState& a, const sStreamState& b) {
+		bool a_drops = a.target > a.texture->resident_mip;
+		bool b_drops = b.target > b.texture->resident_mip;
+		if (a_drops != b_drops)
+			return a_drops;
+		return a.texture->resident_mip - a.target > b.texture->resident_mip - b.target;
+	});
+
+	for (size_t i = 0; i < states.size() && num_streaming_loads < streaming_max_loads; ++i)
+	{
+		Texture* texture = states[i].texture;
+		if (texture->stream_loading || states[i].target == texture->resident_mip)
+			continue;
+		//dropping detail also reloads the file, a GL texture can't be shrunk without reading it back
+		texture->stream_loading = true;
+		num_streaming_loads++;
+		TaskManager::background.addTask(new LoadTextureTask(texture->filename.c_str(), true, states[i].target), TASK_PRIORITY_LOW); //after the first loads
+	}
+}
+
+void Texture::renderStreamingInMenu()
+{
+#ifndef SKIP_IMGUI
+	int num = 0;
+	size_t bytes = 0;
+	for (auto it : sTexturesLoaded)
+		if (it.second->streamed && it.second->source_width)
+		{
+			num++;
+			bytes += it.second->getStreamedBytes(it.second->resident_mip);
+		}
+	ImGui::Checkbox("Texture streaming", &use_streaming);
+	ImGui::Text("Streamed textures: %d  VRAM %d KB  Loading: %d", num, (int)(bytes / 1024), num_streaming_loads);
+	int budget_mb = (int)(streaming_budget / (1024 * 1024));
+	if (ImGui::SliderInt("Streaming budget (MB, 0 no limit)", &budget_mb, 0, 4096))
+		streaming_budget = (size_t)budget_mb * 1024 * 1024;
+	ImGui::SliderInt("Start size", &streaming_start_size, 1, 1024);
+#endif
+}
+
 void Texture::toViewport(Shader* shader)
 {
 	Mesh* quad = Mesh::getQuad();
@@ -625,13 +962,14 @@ void Texture::copyTo(Texture* destination, Shader* shader)
 
 void Image::fromScreen(int width, int height)
 {
-	if (data && (width != this->width || height != this->height))
+	if (data && (width != this->width || height != this->height || num_channels != 4))
 		clear();
 
 	if (!data)
 	{
 		this->width = width;
 		this->height = height;
+		num_channels = 4;
 		data = new uint8[width * height * 4];
 	}
 
@@ -642,13 +980,14 @@ void Image::fromTexture(Texture* texture)
 {
 	assert(texture);
 
-	if(data && (width != texture->width || height != texture->height ))
+	if(data && (width != texture->width || height != texture->height || num_channels != 4))
 		clear();
 
 	if (!data)
 	{
 		width = texture->width;
 		height = texture->height;
+		num_channels = 4;
 		data = new uint8[width * height * 4];
 	}
 	
@@ -664,8 +1003,14 @@ bool Image::load(const char* filename)
 	std::cout << " + Image loading: " << filename << " ... ";
 
 	bool found = false;
-
-	if (ext == ".tga" || ext == ".TGA")
+	mips.clear();
+
+	//the cooked version skips the decoding, unless the source was edited after cooking it
+	if (use_cooked && ext != ".dds" && ext != ".DDS" && isFileUpToDate(str + ".dds", str) && loadDDS((str + ".dds").c_str()))
+		found = true;
+	else if (ext == ".dds" || ext == ".DDS")
+		found = loadDDS(filename);
+	else if (ext == ".tga" || ext == ".TGA")
 		found = loadTGA(filename);
 	else if (ext == ".png" || ext == ".PNG")
 		found = loadPNG(filename);
@@ -753,13 +1098,7 @@ bool Image::loadTGA(const char* filename)
 		origin_topleft = true;
     
 	//flip BGR to RGB pixels
-	#pragma omp simd
-    for (GLuint i = 0; i < int(imageSize); i += num_channels)
-    {
-        uint8 temp = data[i];
-        data[i] = data[i + 2];
-        data[i + 2] = temp;
-    }
+	swapRedBlue(data, width * height, num_channels);
     
     fclose(file);
 	return true;
@@ -777,9 +1116,14 @@ bool Image::loadPNG(const char* filename, bool flip_y)
 }
 
 bool Image::loadPNG(std::vector<unsigned char>& buffer, bool flip_y)
+{
+	return loadPNG(buffer.empty() ? NULL : &buffer[0], buffer.size(), flip_y);
+}
+
+bool Image::loadPNG(const unsigned char* buffer, size_t size, bool flip_y)
 {
 #ifdef USE_SKIA
-    sk_sp<SkData> skData = SkData::MakeWithoutCopy(&buffer[0], buffer.size());
+    sk_sp<SkData> skData = SkData::MakeWithoutCopy(buffer, size);
     std::unique_ptr<SkCodec> codec(SkCodec::MakeFromData(skData));
     SkBitmap bitmap;
     const SkImageInfo skInfo = codec->getInfo();
@@ -802,7 +1146,7 @@ bool Image::loadPNG(std::vector<unsigned char>& buffer, bool flip_y)
 #else
     std::vector<unsigned char> out_image;
 
-	if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
+	if (decodePNG(out_image, width, height, buffer, size, true) != 0)
 		return false;
 
 	data = new Uint8[out_image.size()];
@@ -827,8 +1171,11 @@ bool Image::loadJPG(const char* filename, bool flip_y)
 
 bool Image::loadJPG(std::vector<unsigned char>& buffer, bool flip_y)
 {
-	std::vector<unsigned char> out_image;
+	return loadJPG(buffer.empty() ? NULL : &buffer[0], buffer.size(), flip_y);
+}
 
+bool Image::loadJPG(const unsigned char* buffer, size_t size, bool flip_y)
+{
 	int width;
 	int height;
 	int actual_comps;
@@ -846,7 +1193,7 @@ bool Image::loadJPG(std::vector<unsigned char>& buffer, bool flip_y)
 	*/
 
 #ifdef USE_SKIA
-    sk_sp<SkData> skData = SkData::MakeWithoutCopy(&buffer[0], buffer.size());
+    sk_sp<SkData> skData = SkData::MakeWithoutCopy(buffer, size);
     std::unique_ptr<SkCodec> codec(SkCodec::MakeFromData(skData));
     SkBitmap bitmap;
     const SkImageInfo skInfo = codec->getInfo();
@@ -868,7 +1215,9 @@ bool Image::loadJPG(std::vector<unsigned char>& buffer, bool flip_y)
     }
 #else
 	//stb_image
-	unsigned char* image_data = stbi_load_from_memory( (stbi_uc*) &buffer[0], (unsigned long)buffer.size(), &width, &height, &channels, STBI_rgb);
+	if (!buffer)
+		return false;
+	unsigned char* image_data = stbi_load_from_memory( (const stbi_uc*)buffer, (int)size, &width, &height, &channels, STBI_rgb);
 	if (!image_data)
 		return false;
 	this->width = (unsigned int)width;
@@ -914,44 +1263,296 @@ bool Image::saveTGA(const char* filename, bool flip_y)
 	fwrite(TGAheader, 1, sizeof(TGAheader), file);
 	fwrite(header, 1, 6, file);
 
-	//convert pixels to unsigned char
+	//TGA rows go from the bottom and the pixels are BGRA
 	unsigned char* bytes = new unsigned char[width*height * 4];
-	for (unsigned int y = 0; y < height; ++y)
-		for (unsigned int x = 0; x < width; ++x)
-		{
-			Uint8* p = data + (height - y - 1)*width*4 + x*4;
-			unsigned int pos = (y*width + x) * 4;
-			if(flip_y)
-				pos = ((height - y - 1)*width + x) * 4;
-			bytes[pos + 2] = *p;
-			bytes[pos + 1] = *(p+1);
-			bytes[pos] = *(p+2);
-			bytes[pos + 3] = *(p+3);
-		}
+	if (num_channels == 3)
+		expandRGBToRGBA(data, bytes, width * height);
+	else
+		memcpy(bytes, data, width * height * 4);
+	if (!flip_y)
+		flipRows(bytes, width * 4, height);
+	swapRedBlue(bytes, width * height, 4);
 
 	fwrite(bytes, 1, width*height * 4, file);
 	fclose(file);
+	delete[] bytes;
 	return true;
 }
 
-template<typename T>
-void tImage<T>::flipY()
+bool Image::saveDDS(const char* filename)
+{
+	assert(data && (num_channels == 3 || num_channels == 4));
+	sDDSHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = DDS_MAGIC;
+	header.size = sizeof(sDDSHeader) - 4;
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PITCH | DDSD_PIXELFORMAT | (mips.size() ? DDSD_MIPMAPCOUNT : 0);
+	header.width = width;
+	header.height = height;
+	header.pitch = width * num_channels;
+	header.mipmaps = mips.size() ? (unsigned int)mips.size() + 1 : 0;
+	header.format.size = sizeof(sDDSPixelFormat);
+	header.format.flags = DDPF_RGB | (num_channels == 4 ? DDPF_ALPHAPIXELS : 0);
+	header.format.bitcount = num_channels * 8;
+	header.format.masks[0] = 0x000000FF;
+	header.format.masks[1] = 0x0000FF00;
+	header.format.masks[2] = 0x00FF0000;
+	header.format.masks[3] = num_channels == 4 ? 0xFF000000 : 0;
+	header.caps[0] = DDSCAPS_TEXTURE | (mips.size() ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+	fwrite(&header, 1, sizeof(header), file);
+	bool ok = fwrite(data, 1, width * height * num_channels, file) == width * height * num_channels;
+	for (size_t i = 0; i < mips.size() && ok; ++i)
+		ok = fwrite(&mips[i][0], 1, mips[i].size(), file) == mips[i].size();
+	fclose(file);
+	return ok;
+}
+
+bool Image::loadDDS(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL)
+		return false;
+
+	sDDSHeader header;
+	if (fread(&header, 1, sizeof(header), file) != sizeof(header) || header.magic != DDS_MAGIC || header.size != sizeof(sDDSHeader) - 4 ||
+		!(header.format.flags & DDPF_RGB) || (header.format.bitcount != 24 && header.format.bitcount != 32) ||
+		header.format.masks[0] != 0x000000FF || header.format.masks[1] != 0x0000FF00 || header.format.masks[2] != 0x00FF0000)
+	{
+		fclose(file);
+		return false;
+	}
+
+	resize(header.width, header.height, header.format.bitcount / 8);
+	size_t size = width * height * num_channels;
+	bool ok = fread(data, 1, size, file) == size;
+
+	mips.clear();
+	int num_mips = (header.flags & DDSD_MIPMAPCOUNT) && header.mipmaps > 1 ? header.mipmaps : 1;
+	for (int i = 1; i < num_mips && ok && ((width >> (i - 1)) > 1 || (height >> (i - 1)) > 1); ++i)
+	{
+		unsigned int w = std::max(width >> i, 1u), h = std::max(height >> i, 1u);
+		mips.push_back(std::vector<uint8>((size_t)w * h * num_channels));
+		ok = fread(&mips.back()[0], 1, mips.back().size(), file) == mips.back().size();
+	}
+	fclose(file);
+	if (!ok)
+	{
+		clear();
+		mips.clear();
+	}
+	return ok;
+}
+
+void Image::downsample(int levels)
+{
+	assert(data);
+	for (int level = 0; level < levels && (width > 1 || height > 1); ++level)
+	{
+		int new_width = std::max(width / 2, 1u);
+		int new_height = std::max(height / 2, 1u);
+		uint8* new_data = new uint8[new_width * new_height * num_channels];
+		if (mips.size()) //the stored level has a better filter, the rest stay as its mips
+		{
+			memcpy(new_data, &mips[0][0], mips[0].size());
+			mips.erase(mips.begin());
+		}
+		else
+			downsample2x(data, width, height, num_channels, new_data);
+		delete[] data;
+		data = new_data;
+		width = new_width;
+		height = new_height;
+	}
+}
+
+static float besselI0(float x)
+{
+	float sum = 1, term = 1;
+	for (int k = 1; k < 16; ++k)
+	{
+		term *= (x * 0.5f / k) * (x * 0.5f / k);
+		sum += term;
+	}
+	return sum;
+}
+
+//built once, the cook tool builds mips in several threads
+struct sMipFilterTables {
+	float weights[6]; //taps of a 2x downsampling, at 0.25, 0.75 and 1.25 destination pixels from the center
+
+	sMipFilterTables()
+	{
+		const float radius = 1.5f, alpha = 4.0f;
+		float total = 0;
+		for (int i = 0; i < 6; ++i)
+		{
+			float x = (i - 2.5f) * 0.5f;
+			float t = x / radius;
+			float sinc = sinf((float)PI * x) / ((float)PI * x);
+			weights[i] = sinc * besselI0(alpha * sqrtf(1.0f - t * t)) / besselI0(alpha);
+			total += weights[i];
+		}
+		for (int i = 0; i < 6; ++i)
+			weights[i] /= total;
+	}
+};
+
+static const sMipFilterTables& getMipFilterTables()
+{
+	static sMipFilterTables tables;
+	return tables;
+}
+
+void Image::buildMip(Image& dest, int flags)
+{
+	assert(data && &dest != this);
+	int w = width, h = height, ch = num_channels;
+	int new_w = std::max(w / 2, 1);
+	int new_h = std::max(h / 2, 1);
+	const float* weights = getMipFilterTables().weights;
+	bool srgb = (flags & MIP_SRGB) && !(flags & MIP_NORMAL_MAP);
+
+	std::vector<float> source((size_t)w * h * ch);
+	if (srgb)
+		convertSRGBToLinear(data, &source[0], (size_t)w * h, ch);
+	else
+		convertUnorm8ToFloat(data, &source[0], source.size());
+
+	//horizontal pass, a side of one pixel is only copied
+	std::vector<float> temp((size_t)new_w * h * ch, 0.0f);
+	for (int y = 0; y < h; ++y)
+	{
+		const float* src = &source[(size_t)y * w * ch];
+		float* dst = &temp[(size_t)y * new_w * ch];
+		if (w == 1)
+		{
+			memcpy(dst, src, ch * sizeof(float));
+			continue;
+		}
+		for (int x = 0; x < new_w; ++x)
+			for (int k = 0; k < 6; ++k)
+			{
+				int sx = (x * 2 - 2 + k + w) % w;
+				for (int c = 0; c < ch; ++c)
+					dst[x * ch + c] += weights[k] * src[sx * ch + c];
+			}
+	}
+
+	//vertical pass, whole rows at once
+	std::vector<float> result((size_t)new_w * new_h * ch, 0.0f);
+	int row_size = new_w * ch;
+	for (int y = 0; y < new_h; ++y)
+	{
+		float* dst = &result[(size_t)y * row_size];
+		if (h == 1)
+		{
+			memcpy(dst, &temp[0], row_size * sizeof(float));
+			continue;
+		}
+		for (int k = 0; k < 6; ++k)
+		{
+			const float* src = &temp[(size_t)((y * 2 - 2 + k + h) % h) * row_size];
+			addScaledRow(src, weights[k], dst, row_size);
+		}
+	}
+
+	if ((flags & MIP_NORMAL_MAP) && ch >= 3)
+		for (int i = 0; i < new_w * new_h; ++i)
+		{
+			float* pixel = &result[(size_t)i * ch];
+			Vector3 normal(pixel[0] * 2.0f - 1.0f, pixel[1] * 2.0f - 1.0f, pixel[2] * 2.0f - 1.0f);
+			float length = normal.length();
+			if (length > 0.0001f)
+				normal = normal * (1.0f / length);
+			else
+				normal.set(0, 0, 1);
+			pixel[0] = normal.x * 0.5f + 0.5f;
+			pixel[1] = normal.y * 0.5f + 0.5f;
+			pixel[2] = normal.z * 0.5f + 0.5f;
+		}
+
+	//both clamp, the negative lobes can overshoot
+	dest.resize(new_w, new_h, ch);
+	if (srgb)
+		convertLinearToSRGB(&result[0], dest.data, (size_t)new_w * new_h, ch);
+	else
+		convertFloatToUnorm8(&result[0], dest.data, result.size());
+}
+
+void Image::buildMips(int flags, float alpha_cutoff)
+{
+	assert(data);
+	mips.clear();
+	float coverage = (flags & MIP_ALPHA_COVERAGE) ? getAlphaCoverage(alpha_cutoff) : 0;
+
+	//every mip is built from the previous one, the two buffers are swapped
+	Image levels[2];
+	Image* source = this;
+	for (int i = 0; source->width > 1 || source->height > 1; ++i)
+	{
+		Image& mip = levels[i % 2];
+		source->buildMip(mip, flags);
+		if (flags & MIP_ALPHA_COVERAGE)
+			mip.scaleAlphaToCoverage(coverage, alpha_cutoff);
+		mips.push_back(std::vector<uint8>(mip.data, mip.data + (size_t)mip.width * mip.height * mip.num_channels));
+		source = &mip;
+	}
+}
+
+float Image::getAlphaCoverage(float cutoff)
+{
+	assert(data);
+	if (num_channels != 4)
+		return 1.0f;
+	size_t num_pixels = (size_t)width * height, num_covered = 0;
+	uint8 limit = (uint8)clamp(cutoff * 255.0f, 0.0f, 255.0f);
+	for (size_t i = 0; i < num_pixels; ++i)
+		if (data[i * 4 + 3] > limit)
+			num_covered++;
+	return num_covered / (float)num_pixels;
+}
+
+void Image::scaleAlphaToCoverage(float coverage, float cutoff)
 {
 	assert(data);
-	int row_size = num_channels * width;
-	T* temp_row = new T[row_size];
-#pragma omp simd
-	for (int y = 0; y < height*0.5; y += 1)
+	if (num_channels != 4)
+		return;
+
+	//binary search of the scale, the coverage grows with it
+	size_t num_pixels = (size_t)width * height;
+	float min_scale = 0, max_scale = 4, scale = 1;
+	for (int i = 0; i < 10; ++i)
 	{
-		uint8* pos = data + y*row_size;
-		memcpy(temp_row, pos, row_size);
-		uint8* pos2 = data + (height - y - 1)*row_size;
-		memcpy(pos, pos2, row_size);
-		memcpy(pos2, temp_row, row_size);
+		size_t num_covered = 0;
+		for (size_t j = 0; j < num_pixels; ++j)
+			if (data[j * 4 + 3] * scale > cutoff * 255.0f)
+				num_covered++;
+		float current = num_covered / (float)num_pixels;
+		if (current < coverage)
+			min_scale = scale;
+		else if (current > coverage)
+			max_scale = scale;
+		else
+			break;
+		scale = (min_scale + max_scale) * 0.5f;
 	}
-	delete[] temp_row;
+
+	for (size_t i = 0; i < num_pixels; ++i)
+		data[i * 4 + 3] = (uint8)std::min(data[i * 4 + 3] * scale + 0.5f, 255.0f);
+}
+
+template<typename T>
+void tImage<T>::flipY()
+{
+	assert(data);
+	flipRows(data, (size_t)num_channels * width * sizeof(T), height);
 }
 
+//header of the first IBIN files, always 32 bits floats
 struct tImageHeader {
 	int width;
 	int height;
@@ -961,43 +1562,225 @@ struct tImageHeader {
 	uint8 flags[17]; //32 bytes header
 };
 
-bool FloatImage::saveIBIN(const char* filename)
+#define IBIN_MAGIC 0x324E4249 //"IBN2", the first files start with the width instead
+
+//32 bytes too, the pixels follow it
+struct sIBINHeader {
+	unsigned int magic;
+	unsigned int width;
+	unsigned int height;
+	unsigned int layers;
+	uint8 channels;
+	uint8 payload; //eIBINPayload
+	uint8 compressed; //LZ4
+	uint8 reserved;
+	unsigned int data_size; //bytes after the header
+	unsigned int raw_size; //bytes of the pixels once decompressed
+	unsigned int reserved2;
+};
+
+bool FloatImage::saveIBIN(const char* filename, eIBINPayload payload, bool compress)
 {
-	tImageHeader header;
+	assert(data);
+	if (payload == IBIN_RGB9E5 && num_channels != 3)
+	{
+		std::cout << "[WARN] RGB9E5 has no alpha, saving as half: " << filename << std::endl;
+		payload = IBIN_HALF;
+	}
+
+	size_t count = (size_t)width * height * num_channels;
+	std::vector<char> converted;
+	const char* bytes = (const char*)data;
+	size_t size = count * sizeof(float);
+	if (payload == IBIN_HALF)
+	{
+		converted.resize(count * sizeof(uint16));
+		convertFloatToHalf(data, (uint16*)&converted[0], count);
+	}
+	else if (payload == IBIN_RGB9E5)
+	{
+		converted.resize((size_t)width * height * sizeof(uint32));
+		convertFloatToRGB9E5(data, (uint32*)&converted[0], (size_t)width * height);
+	}
+	if (converted.size())
+	{
+		bytes = &converted[0];
+		size = converted.size();
+	}
+
+	std::vector<char> packed;
+	if (compress)
+		compressLZ4(bytes, size, packed);
+
+	sIBINHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = IBIN_MAGIC;
 	header.width = width;
 	header.height = height;
 	header.layers = 1;
-	header.bytesperchannel = 4;
-	header.channels = 3;
+	header.channels = num_channels;
+	header.payload = payload;
+	header.compressed = compress;
+	header.raw_size = (unsigned int)size;
+	header.data_size = (unsigned int)(compress ? packed.size() : size);
+
 	FILE* file = fopen(filename, "wb");
 	if (file == NULL)
-	{
-		fclose(file);
 		return false;
-	}
 	fwrite(&header, 1, sizeof(header), file);
-	fwrite(data, 1, sizeof(float) * width * height * num_channels * header.layers, file);
+	size_t written = fwrite(compress ? &packed[0] : bytes, 1, header.data_size, file);
 	fclose(file);
-	return true;
+	return written == header.data_size;
 }
 
 bool FloatImage::loadIBIN(const char* filename)
 {
-	FILE* file = fopen(filename, "rb");
-	if (file == NULL)
+	FloatImageView view;
+	if (!view.open(filename))
 		return false;
-	tImageHeader header;
-	fread(&header, 1, sizeof(header), file);
-	resize(header.width, header.height, header.channels);
-	fread(data, 1, sizeof(float) * width * height * num_channels * header.layers, file);
-	fclose(file);
+	view.toImage(*this);
 	return true;
 }
 
+FloatImageView::FloatImageView()
+{
+	width = height = num_channels = layers = 0;
+	payload = IBIN_FLOAT32;
+	compressed = false;
+	file = NULL;
+	pixels = NULL;
+	pixels_size = raw_size = 0;
+}
+
+bool FloatImageView::open(const char* filename)
+{
+	close();
+	file = new MappedFile();
+	if (!file->open(filename) || file->size < sizeof(sIBINHeader))
+	{
+		close();
+		return false;
+	}
+
+	unsigned int magic;
+	memcpy(&magic, file->data, sizeof(magic));
+	if (magic == IBIN_MAGIC)
+	{
+		sIBINHeader header;
+		memcpy(&header, file->data, sizeof(header));
+		width = header.width;
+		height = header.height;
+		layers = header.layers;
+		num_channels = header.channels;
+		payload = (eIBINPayload)header.payload;
+		compressed = header.compressed != 0;
+		pixels_size = header.data_size;
+		raw_size = header.raw_size;
+		if (header.payload > IBIN_RGB9E5 || (payload == IBIN_RGB9E5 && num_channels != 3))
+			pixels_size = (size_t)-1; //rejected below
+	}
+	else
+	{
+		tImageHeader header;
+		memcpy(&header, file->data, sizeof(header));
+		width = header.width;
+		height = header.height;
+		layers = header.layers;
+		num_channels = header.channels;
+		payload = IBIN_FLOAT32;
+		compressed = false;
+		pixels_size = raw_size = file->size - sizeof(header);
+	}
+	pixels = file->data + sizeof(sIBINHeader);
+
+	//the pixels must fit in what the file has
+	size_t needed = (size_t)width * height * layers * getPixelBytes();
+	if (num_channels < 1 || num_channels > 4 || pixels_size > file->size - sizeof(sIBINHeader) ||
+		needed > (compressed ? raw_size : pixels_size))
+	{
+		std::cout << "[ERROR] wrong IBIN file: " << filename << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void FloatImageView::close()
+{
+	if (file)
+		file->release();
+	file = NULL;
+	pixels = NULL;
+	pixels_size = raw_size = 0;
+	decompressed.clear();
+	width = height = num_channels = layers = 0;
+}
+
+size_t FloatImageView::getPixelBytes()
+{
+	if (payload == IBIN_HALF)
+		return num_channels * sizeof(uint16);
+	if (payload == IBIN_RGB9E5)
+		return sizeof(uint32);
+	return num_channels * sizeof(float);
+}
+
+const char* FloatImageView::getPixels()
+{
+	assert(pixels && "IBIN not opened");
+	if (!compressed)
+		return pixels;
+	if (decompressed.empty())
+	{
+		decompressed.resize(raw_size);
+		if (!decompressLZ4(pixels, pixels_size, &decompressed[0], raw_size))
+		{
+			std::cout << "[ERROR] corrupted IBIN data" << std::endl;
+			memset(&decompressed[0], 0, raw_size);
+		}
+	}
+	return &decompressed[0];
+}
+
+const float* FloatImageView::getData()
+{
+	return payload == IBIN_FLOAT32 ? (const float*)getPixels() : NULL;
+}
+
+void FloatImageView::decodePixels(size_t first, size_t count, float* dest)
+{
+	const char* src = getPixels() + first * getPixelBytes();
+	if (payload == IBIN_HALF)
+		convertHalfToFloat((const uint16*)src, dest, count * num_channels);
+	else if (payload == IBIN_RGB9E5)
+		convertRGB9E5ToFloat((const uint32*)src, dest, count);
+	else
+		memcpy(dest, src, count * num_channels * sizeof(float));
+}
+
+void FloatImageView::decodeRows(int first_row, int num_rows, float* dest)
+{
+	assert(first_row >= 0 && first_row + num_rows <= (int)(height * layers));
+	decodePixels((size_t)first_row * width, (size_t)num_rows * width, dest);
+}
+
+Vector4 FloatImageView::getPixel(int x, int y, int layer)
+{
+	assert(x >= 0 && x < (int)width && y >= 0 && y < (int)height && layer >= 0 && layer < (int)layers);
+	float v[4] = { 0, 0, 0, 1 };
+	decodePixels(((size_t)layer * height + y) * width + x, 1, v);
+	return Vector4(v[0], v[1], v[2], v[3]);
+}
+
+void FloatImageView::toImage(FloatImage& image)
+{
+	image.resize(width, height * layers, num_channels);
+	decodeRows(0, height * layers, image.data);
+}
+
 void FloatImage::fromTexture(Texture* texture)
 {
 	assert(texture);
-	assert(texture->type == GL_FLOAT);
 	if (data && (width != texture->width || height != texture->height))
 		clear();
 	if (!data)
@@ -1008,7 +1791,26 @@ void FloatImage::fromTexture(Texture* texture)
 	}
 
 	texture->bind();
-	glGetTexImage(GL_TEXTURE_2D, 0, num_channels == 3 ? GL_RGB : GL_RGBA, GL_FLOAT, data);
+	unsigned int format = num_channels == 3 ? GL_RGB : GL_RGBA;
+	size_t count = (size_t)width * height * num_channels;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	//reading in the type of the texture moves less data, the conversion here is vectorized
+	if (texture->type == GL_HALF_FLOAT)
+	{
+		std::vector<uint16> halfs(count);
+		glGetTexImage(GL_TEXTURE_2D, 0, format, GL_HALF_FLOAT, &halfs[0]);
+		convertHalfToFloat(&halfs[0], data, count);
+	}
+	else if (texture->type == GL_UNSIGNED_BYTE)
+	{
+		std::vector<uint8> bytes(count);
+		glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, &bytes[0]);
+		convertUnorm8ToFloat(&bytes[0], data, count);
+	}
+	else
+		glGetTexImage(GL_TEXTURE_2D, 0, format, GL_FLOAT, data);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
 }
 
 
@@ -1019,36 +1821,120 @@ bool isPowerOfTwo( int n )
 
 //*********************
 
-LoadTextureTask::LoadTextureTask(const char* str)
+LoadTextureTask::LoadTextureTask(const char* str, bool streamed, int mip)
 {
 	filename = str;
 	image = NULL;
+	compressed = NULL;
+	this->streamed = streamed;
+	this->mip = mip;
+	slot = -1;
+}
+
+bool LoadTextureTask::loadCompressed()
+{
+	return compressed->loadForTexture(filename.c_str());
+}
+
+bool LoadTextureTask::loadImage()
+{
+	return image->load(filename.c_str());
 }
 
 void LoadTextureTask::onExecute()
 {
-	image = new Image();
-	if (!image->load(filename.c_str()))
+	int source_width = 0, source_height = 0;
+
+	compressed = new CompressedImage();
+	if (!loadCompressed())
 	{
-		delete image;
-		image = NULL;
+		delete compressed;
+		compressed = NULL;
+	}
+
+	if (compressed)
+	{
+		//the blocks of every mip are already there, the streaming only skips the first ones
+		source_width = compressed->width;
+		source_height = compressed->height;
+		if (streamed && mip < 0)
+			mip = Texture::getStreamingStartMip(source_width, source_height);
+		mip = std::min(std::max(mip, 0), (int)compressed->mips.size() - 1);
+	}
+	else
+	{
+		image = new Image();
+		if (!loadImage())
+		{
+			delete image;
+			image = NULL;
+		}
+		else if (streamed)
+		{
+			//only the resident mip goes to the GPU
+			source_width = image->width;
+			source_height = image->height;
+			if (mip < 0)
+				mip = Texture::getStreamingStartMip(source_width, source_height);
+			image->downsample(mip);
+		}
+	}
+
+	//copied here to the staging buffer so the main thread only has to send it from there
+	//the ring only has the top level, images with cooked mips are uploaded with all of them by loadFromImage
+	if (image && image->mips.empty())
+	{
+		size_t size = (size_t)image->width * image->height * image->num_channels;
+		slot = UploadRing::acquire(size);
+		if (slot != -1)
+		{
+			memcpy(UploadRing::getData(slot), image->data, size);
+			delete[] image->data; //the size is still needed
+			image->data = NULL;
+		}
 	}
 
 	//image loaded, ready to go back to main thread
-	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image);
+	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image, streamed, mip, source_width, source_height);
+	upload_task->compressed = compressed;
+	upload_task->slot = slot;
+	//the ones staged in the upload ring are sent by it, with its own budget
+	if (compressed)
+		for (size_t i = mip; i < compressed->mips.size(); ++i)
+			upload_task->bytes += compressed->mips[i].size();
+	else if (image && slot == -1)
+		upload_task->bytes = (size_t)image->width * image->height * image->num_channels;
 	TaskManager::foreground.addTask(upload_task);
 }
 
-UploadTextureTask::UploadTextureTask(const char* filename, Image* image)
+UploadTextureTask::UploadTextureTask(const char* filename, Image* image, bool streamed, int mip, int source_width, int source_height)
 {
 	this->filename = filename;
 	this->image = image;
+	this->compressed = NULL;
+	this->streamed = streamed;
+	this->mip = mip;
+	this->source_width = source_width;
+	this->source_height = source_height;
+	this->slot = -1;
+}
+
+eTaskPriority UploadTextureTask::getPriority()
+{
+	//the renderer touches the textures of the visible materials
+	auto it = Texture::sTexturesLoaded.find(filename);
+	if (it != Texture::sTexturesLoaded.end() && it->second->last_used >= ResourceManager::frame - 1)
+		return TASK_PRIORITY_HIGH;
+	return priority;
 }
 
 void UploadTextureTask::onExecute()
 {
 	Texture* texture = NULL;
 
+	if (streamed)
+		Texture::num_streaming_loads--;
+
 	//in case somehow it got loaded while I was loading it in the background
 	auto it = Texture::sTexturesLoaded.find(filename);
 	if (it == Texture::sTexturesLoaded.end())
@@ -1059,14 +1945,83 @@ void UploadTextureTask::onExecute()
 			texture = new Texture();
 		*/
 		delete image;
+		delete compressed;
+		if (slot != -1)
+			UploadRing::release(slot);
 		std::cout << "Warning: image loaded in background not found foreground thread" << std::endl;
 		return;
 	}
 
 	texture = it->second;
 
+	if (compressed)
+	{
+		if (streamed && texture->streamed)
+		{
+			texture->source_width = source_width;
+			texture->source_height = source_height;
+			texture->setResidentMip(compressed, mip);
+			texture->stream_loading = false;
+		}
+		else
+			texture->uploadCompressed(compressed, 0);
+		texture->loading = false;
+		delete compressed;
+		return;
+	}
+
+	//the file could not be read, the temporary texture stays
+	if (!image)
+	{
+		texture->loading = texture->stream_loading = false;
+		texture->streamed = false;
+		return;
+	}
+
+	//the rows go to the GPU in the next frames, the texture keeps the old GL texture until then
+	if (slot != -1)
+	{
+		std::string name = filename;
+		bool streamed_mip = streamed && texture->streamed;
+		int mip = this->mip, source_width = this->source_width, source_height = this->source_height;
+		int width = image->width, height = image->height, num_channels = image->num_channels;
+		delete image;
+		UploadRing::upload(slot, width, height, num_channels, [=](unsigned int id) {
+			auto it = Texture::sTexturesLoaded.find(name);
+			if (it == Texture::sTexturesLoaded.end())
+			{
+				glDeleteTextures(1, &id);
+				return;
+			}
+			Texture* texture = it->second;
+			texture->adoptTexture(id, width, height, num_channels);
+			if (streamed_mip)
+			{
+				texture->source_width = source_width;
+				texture->source_height = source_height;
+				texture->source_channels = num_channels;
+				texture->resident_mip = mip;
+				texture->stream_loading = false;
+			}
+			texture->loading = false;
+		});
+		return;
+	}
+
 	//upload to GPU
-	texture->loadFromImage(image);
+	if (streamed && texture->streamed)
+	{
+		texture->source_width = source_width;
+		texture->source_height = source_height;
+		texture->source_channels = image->num_channels;
+		texture->setResidentMip(image, mip);
+		texture->stream_loading = false;
+	}
+	else
+	{
+		texture->loadFromImage(image);
+		texture->setName(filename.c_str()); //create() removes it from the manager when it replaces the temporary one
+	}
 	texture->loading = false;
 
 	//delete image
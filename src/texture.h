@@ -7,6 +7,8 @@
 #include "includes.h"
 #include "framework.h"
 #include "task.h"
+#include "resources.h"
+#include "compressed_image.h"
 #include <map>
 #include <set>
 #include <string>
@@ -15,6 +17,7 @@
 class Shader;
 class FBO;
 class Texture;
+class MappedFile;
 
 #ifndef OPENGL_ES3
 #define GL_RGBA32F 0x8814
@@ -28,6 +31,11 @@ class Texture;
 	#define GL_TEXTURE_EXTERNAL_OES 0x8D65
 #endif
 
+#ifndef GL_TEXTURE_SWIZZLE_G
+	#define GL_TEXTURE_SWIZZLE_G 0x8E43
+	#define GL_TEXTURE_SWIZZLE_B 0x8E44
+#endif
+
 //Simple class to handle images (stores RGBA always)
 template <typename T> class tImage
 {
@@ -47,6 +55,13 @@ public:
 	void flipY();
 };
 
+//how Image::buildMip filters the pixels
+enum eMipFlags {
+	MIP_SRGB = 1, //colors, filtered in linear space
+	MIP_NORMAL_MAP = 2, //vectors in RGB, renormalized after filtering
+	MIP_ALPHA_COVERAGE = 4 //alpha tested, see scaleAlphaToCoverage
+};
+
 class Image : public tImage<uint8>
 {
 public:
@@ -67,14 +82,38 @@ public:
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	std::vector< std::vector<uint8> > mips; //smaller levels stored in the file, the first one is half the size (DDS cooked with -u)
+
+	static bool use_cooked; //load the .dds written by the cook tool next to the source image when it exists
+
 	bool load(const char* filename);
 
 	bool loadTGA(const char* filename);
+	bool loadDDS(const char* filename); //uncompressed RGB8/RGBA8 only, with its mips if it has them
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool loadPNG(std::vector<unsigned char>& buffer, bool flip_y = false);
+	bool loadPNG(const unsigned char* buffer, size_t size, bool flip_y = false); //decodes in place, the buffer is not copied
 	bool loadJPG(const char* filename, bool flip_y = false);
 	bool loadJPG(std::vector<unsigned char>& buffer, bool flip_y = false);
+	bool loadJPG(const unsigned char* buffer, size_t size, bool flip_y = false);
 	bool saveTGA(const char* filename, bool flip_y = false);
+	bool saveDDS(const char* filename); //rows are stored in memory order so it loads exactly like the source, mips included
+
+	void downsample(int levels = 1); //halves the size the given times averaging every 2x2 block
+
+	//writes the next mip in dest using a Kaiser windowed sinc, the borders wrap like the textures
+	void buildMip(Image& dest, int flags = MIP_SRGB);
+	void buildMips(int flags = MIP_SRGB, float alpha_cutoff = 0.5f); //the whole chain in mips, the same filter
+	//alpha tested mips lose coverage as the alpha gets averaged, it is scaled to keep the one of the first mip
+	float getAlphaCoverage(float cutoff);
+	void scaleAlphaToCoverage(float coverage, float cutoff);
+};
+
+//pixel formats of the IBIN files
+enum eIBINPayload {
+	IBIN_FLOAT32,
+	IBIN_HALF, //half the size, enough for HDR colors
+	IBIN_RGB9E5 //a quarter of the size, only RGB with a shared exponent
 };
 
 class FloatImage : public tImage<float>
@@ -95,13 +134,48 @@ public:
 			data[pos + 3] = v.w;
 	};
 	void fromTexture(Texture* texture);
-	bool loadIBIN(const char* filename);
-	bool saveIBIN(const char* filename);
+	bool loadIBIN(const char* filename); //any version and payload, see FloatImageView to avoid the copy
+	bool saveIBIN(const char* filename, eIBINPayload payload = IBIN_HALF, bool compress = false); //compressed files can't be read in place
+};
+
+//an IBIN file mapped in memory that doesn't own the pixels, nothing is read until they are asked for
+//uncompressed 32 bits floats are used in place, the other payloads are decoded by rows when needed
+class FloatImageView
+{
+public:
+	unsigned int width;
+	unsigned int height; //of every layer, they go one after another
+	unsigned int num_channels;
+	unsigned int layers;
+	eIBINPayload payload;
+	bool compressed; //LZ4, the whole file is decompressed the first time the pixels are read
+
+	FloatImageView();
+	~FloatImageView() { close(); }
+
+	bool open(const char* filename);
+	void close();
+
+	const float* getData(); //the pixels without copying them when they are 32 bits floats, NULL otherwise
+	void decodeRows(int first_row, int num_rows, float* dest); //num_channels floats per pixel
+	Vector4 getPixel(int x, int y, int layer = 0);
+	void toImage(FloatImage& image); //all the layers
+
+private:
+	MappedFile* file;
+	const char* pixels; //after the header in the mapped file
+	size_t pixels_size;
+	size_t raw_size; //once decompressed
+	std::vector<char> decompressed;
+
+	const char* getPixels();
+	size_t getPixelBytes();
+	void decodePixels(size_t first, size_t count, float* dest);
 };
 
 
 // TEXTURE CLASS
-class Texture
+class Texture : public Resource
 {
 public:
 	static int default_mag_filter;
@@ -124,6 +198,7 @@ public:
 	unsigned int type; //GL_UNSIGNED_INT, GL_FLOAT
 	unsigned int internal_format;
 	unsigned int texture_type; //GL_TEXTURE_2D, GL_TEXTURE_CUBE, GL_TEXTURE_2D_ARRAY
+	eBlockFormat block_format; //BLOCK_NONE unless it was uploaded from a CompressedImage
 	bool mipmaps;
 
 	unsigned int wrapS;
@@ -132,11 +207,30 @@ public:
 	//original data info
 	Image image;
 
+	//streaming: textures loaded with GetAsync start at a small mip and the renderer requests the detail they need
+	static bool use_streaming;
+	static size_t streaming_budget; //bytes of VRAM for the streamed textures, 0 means no limit
+	static int streaming_start_size; //streamed textures start with the first mip not bigger than this
+	static int streaming_max_loads; //mips being loaded at the same time
+	static int streaming_cold_frames; //frames without requests before a texture goes back to the start mip
+	static int num_streaming_loads;
+
+	bool streamed;
+	int source_width; //size of the mip 0 of the file, 0 until the first mip is uploaded
+	int source_height;
+	int source_channels;
+	int resident_mip; //mip of the file that is in VRAM (as the mip 0 of the GL texture)
+	int wanted_mip; //finest mip requested in the frame wanted_frame
+	long wanted_frame;
+	bool stream_loading; //a mip is being loaded in the background
+
 	Texture();
 	Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	Texture(Image* img);
 	~Texture();
 
+	void getMemoryUsage(size_t& cpu, size_t& gpu);
+
 	static void Release();
 
 
@@ -147,11 +241,13 @@ public:
 	void createCubemap(unsigned int width, unsigned int height, Uint8** data = NULL, unsigned int format = GL_RGBA, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, unsigned int internal_format = 0);
 
 	void upload(Image* img);
+	void uploadStoredMips(Image* image); //the levels of image->mips over the generated ones, the texture must be created with mipmaps
 	void upload(FloatImage* img);
 	void upload(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	//void upload3D(unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	void uploadCubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8** data = NULL, unsigned int internal_format = 0, int level = 0);
 	void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
+	void uploadCompressed(CompressedImage* img, int first_mip = 0); //the precompressed mips from first_mip, with glCompressedTexImage2D
 
 	void bind();
 	void unbind();
@@ -170,6 +266,7 @@ public:
 	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
 	static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true);
 	static Texture* Find(const char* filename);
+	static Texture* createPlaceholder(const char* filename, bool streamed = false); //registered 1x1 texture, replaced by the UploadTextureTask of that name
 	void setName(const char* name) {
 		filename = name;
 		sTexturesLoaded[filename] = this;
@@ -177,6 +274,17 @@ public:
 
 	void generateMipmaps();
 
+	//streaming
+	void requestMip(float pixels_per_uv); //called by the renderer with the pixels covered by one uv unit, keeps the finest of the frame
+	int getNumMips(); //of the file
+	size_t getStreamedBytes(int mip); //VRAM used when the given mip is resident
+	void setResidentMip(Image* img, int mip); //replaces the VRAM copy with the given mip of the file
+	void setResidentMip(CompressedImage* img, int mip); //uses the mips of the file from the given one
+	void adoptTexture(unsigned int id, int width, int height, int num_channels); //takes a GL texture with its first mip already uploaded (upload ring)
+	static int getStreamingStartMip(int width, int height);
+	static void updateStreaming(); //once per frame: picks the mip of every streamed texture within the budget and starts the loads
+	static void renderStreamingInMenu();
+
 	//show the texture on the current viewport
 	void toViewport( Shader* shader = NULL );
 	//copy to another texture
@@ -193,22 +301,38 @@ bool isPowerOfTwo(int n);
 //afterwards we pass the data to the main thread as bg threads cannot access opengl, and main thread
 //uploads to GPU. While loading a fake 1x1 texture is created
 
+//Streamed textures use the same tasks to load the mip chosen by Texture::updateStreaming, the image is
+//downsampled in the background thread so only the resident mip goes to the GPU
+
 class LoadTextureTask : public Task {
 public:
 	std::string filename;
 	Image* image;
+	CompressedImage* compressed; //files with blocks skip the decoding and go to the GPU as they are
+	bool streamed;
+	int mip; //mip of the file to upload when streamed, -1 for the start mip
+	int slot; //upload ring slot where the pixels were copied
 
-	LoadTextureTask(const char* filename);
+	LoadTextureTask(const char* filename, bool streamed = false, int mip = -1);
 	void onExecute();
+	virtual bool loadCompressed(); //the file or the cooked one if they are block compressed
+	virtual bool loadImage(); //reads the file, tasks that decode from memory override it
 };
 
 class UploadTextureTask : public Task {
 public:
 	std::string filename;
 	Image* image;
-
-	UploadTextureTask(const char* filename, Image* image);
+	CompressedImage* compressed; //used instead of the image when set
+	bool streamed;
+	int mip;
+	int source_width;
+	int source_height;
+	int slot; //upload ring slot with the pixels, -1 when they are in the image
+
+	UploadTextureTask(const char* filename, Image* image, bool streamed = false, int mip = 0, int source_width = 0, int source_height = 0);
 	void onExecute();
+	eTaskPriority getPriority(); //high while the texture is visible
 };
 
 
@@ -0,0 +1,414 @@
+/*  offline asset cooker
+	Converts the source assets of a data folder to the formats the runtime loads directly:
+	OBJ/ASE/MESH -> .mbin, glTF -> one .mbin per primitive, PNG/JPG/TGA -> block compressed .dds
+	Textures are BC5 when used as normal maps, BC4 when grayscale, BC3 (or BC7) with alpha and BC1 (or BC7) otherwise.
+	Their mips are filtered here (sRGB colors, renormalized normals, alpha coverage of MASK materials) and stored with them.
+	A manifest with the content hash of every asset is stored in the folder so unchanged assets are skipped.
+
+	usage: cook [data_folder] [-f (force)] [-j num_threads] [-u (uncompressed textures)] [-bc7 (BC7 for color)]
+*/
+
+#include "../mesh.h"
+#include "../texture.h"
+#include "../compressed_image.h"
+#include "../gltf_loader.h"
+#include "../utils.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cstring>
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <sys/stat.h>
+#endif
+
+#define COOK_VERSION 3 //change it to force a full recook when the cooking code changes
+#define COOK_MANIFEST ".cook_manifest"
+
+enum eAssetType { ASSET_NONE, ASSET_MESH, ASSET_GLTF, ASSET_TEXTURE, ASSET_HDRE };
+
+struct sCookJob {
+	std::string filename;
+	eAssetType type;
+	uint64_t hash;
+	bool skipped;
+	bool ok;
+	double time;
+	std::string info; //shown after the name, like the format and PSNR of the textures
+};
+
+std::mutex output_mutex;
+
+bool compress_textures = true;
+bool use_bc7 = false;
+int encode_threads = 1; //per texture, the workers split the rows of blocks
+sGLTFTextureUsage texture_usage; //of the materials of every glTF
+
+std::string toLower(std::string str)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+		str[i] = tolower(str[i]);
+	return str;
+}
+
+eAssetType getAssetType(const std::string& filename)
+{
+	size_t pos = filename.find_last_of(".");
+	if (pos == std::string::npos)
+		return ASSET_NONE;
+	std::string ext = toLower(filename.substr(pos + 1));
+	if (ext == "obj" || ext == "ase" || ext == "mesh")
+		return ASSET_MESH;
+	if (ext == "gltf" || ext == "glb")
+		return ASSET_GLTF;
+	if (ext == "png" || ext == "jpg" || ext == "jpeg" || ext == "tga")
+		return ASSET_TEXTURE;
+	if (ext == "hdre")
+		return ASSET_HDRE;
+	return ASSET_NONE;
+}
+
+void listFiles(const std::string& folder, std::vector<std::string>& files)
+{
+#ifdef WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((folder + "/*").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		std::string name = data.cFileName;
+		if (name == "." || name == "..")
+			continue;
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			listFiles(folder + "/" + name, files);
+		else
+			files.push_back(folder + "/" + name);
+	} while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(folder.c_str());
+	if (!dir)
+		return;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		std::string path = folder + "/" + name;
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			continue;
+		if (S_ISDIR(info.st_mode))
+			listFiles(path, files);
+		else
+			files.push_back(path);
+	}
+	closedir(dir);
+#endif
+}
+
+//FNV-1a
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	return hash;
+}
+
+bool hashFile(const std::string& filename, uint64_t& hash)
+{
+	MappedFile file;
+	if (!file.open(filename.c_str()))
+		return fileExists(filename); //empty files cannot be mapped
+	hash = hashBytes(file.data, file.size, hash);
+	return true;
+}
+
+//the content of the asset and its dependencies plus the options that change the output
+bool computeAssetHash(sCookJob& job)
+{
+	std::vector<std::string> files;
+	if (job.type == ASSET_GLTF)
+	{
+		if (!getGLTFDependencies(job.filename.c_str(), files))
+			return false;
+	}
+	else
+		files.push_back(job.filename);
+
+	std::map<std::string, float>::iterator cutoff = texture_usage.alpha_cutoffs.find(job.filename);
+	int options[] = { COOK_VERSION, MESH_BIN_VERSION, Mesh::interleave_meshes, Mesh::quantize_meshes, Mesh::optimize_meshes, job.type, compress_textures, use_bc7,
+		(int)texture_usage.normal_maps.count(job.filename), (int)texture_usage.linear.count(job.filename), cutoff != texture_usage.alpha_cutoffs.end() ? (int)(cutoff->second * 1000) : -1 };
+	uint64_t hash = hashBytes((const char*)options, sizeof(options));
+	for (size_t i = 0; i < files.size(); ++i)
+		if (!hashFile(files[i], hash))
+			return false;
+	job.hash = hash;
+	return true;
+}
+
+//all the files the asset produces, so it is cooked again if any of them was deleted
+bool outputExists(const sCookJob& job)
+{
+	std::vector<std::string> outputs;
+	if (job.type == ASSET_MESH)
+		outputs.push_back(job.filename + ".mbin");
+	else if (job.type == ASSET_TEXTURE)
+		outputs.push_back(job.filename + ".dds");
+	else if (job.type == ASSET_GLTF && !getGLTFCookedFiles(job.filename.c_str(), outputs))
+		return false;
+
+	for (size_t i = 0; i < outputs.size(); ++i)
+		if (!fileExists(outputs[i]))
+			return false;
+	return true;
+}
+
+//by the materials that use it or by the usual suffixes
+bool isNormalMap(const std::string& filename)
+{
+	if (texture_usage.normal_maps.count(filename))
+		return true;
+	std::string name = toLower(filename.substr(filename.find_last_of("/") + 1));
+	return name.find("normal") != std::string::npos || name.find("_nor") != std::string::npos ||
+		name.find("_nrm") != std::string::npos || name.find("_n.") != std::string::npos;
+}
+
+eBlockFormat chooseBlockFormat(const std::string& filename, Image& image)
+{
+	if (isNormalMap(filename))
+		return BLOCK_BC5;
+
+	bool grayscale = true, alpha = false;
+	size_t num_pixels = (size_t)image.width * image.height;
+	for (size_t i = 0; i < num_pixels; ++i)
+	{
+		const uint8* pixel = image.data + i * image.num_channels;
+		if (image.num_channels >= 3 && (pixel[0] != pixel[1] || pixel[0] != pixel[2]))
+			grayscale = false;
+		if (image.num_channels == 4 && pixel[3] != 255)
+			alpha = true;
+	}
+	if (alpha)
+		return use_bc7 ? BLOCK_BC7 : BLOCK_BC3;
+	if (grayscale)
+		return BLOCK_BC4;
+	return use_bc7 ? BLOCK_BC7 : BLOCK_BC1;
+}
+
+bool cookTexture(sCookJob& job)
+{
+	Image image;
+	if (!image.load(job.filename.c_str()))
+		return false;
+
+	eBlockFormat format = chooseBlockFormat(job.filename, image);
+
+	//grayscale ones are usually masks, roughness or occlusion
+	int mip_flags = MIP_SRGB;
+	if (format == BLOCK_BC5)
+		mip_flags = MIP_NORMAL_MAP;
+	else if (format == BLOCK_BC4 || texture_usage.linear.count(job.filename))
+		mip_flags = 0;
+	float alpha_cutoff = 0.5f;
+	std::map<std::string, float>::iterator it = texture_usage.alpha_cutoffs.find(job.filename);
+	if (it != texture_usage.alpha_cutoffs.end())
+	{
+		mip_flags |= MIP_ALPHA_COVERAGE;
+		alpha_cutoff = it->second;
+	}
+
+	//uncompressed ones store the whole chain too, filtered like the compressed ones
+	if (!compress_textures)
+	{
+		image.buildMips(mip_flags, alpha_cutoff);
+		return image.saveDDS((job.filename + ".dds").c_str());
+	}
+
+	CompressedImage compressed;
+	compressed.compress(image, format, true, encode_threads, mip_flags, alpha_cutoff);
+
+	//quality of the first mip against the source
+	Image decoded;
+	compressed.decompress(decoded, 0);
+	std::stringstream ss;
+	ss << getBlockFormatName(format) << " PSNR " << std::fixed << std::setprecision(1) << CompressedImage::computePSNR(image, decoded, getBlockChannels(format)) << "dB";
+	job.info = ss.str();
+
+	return compressed.saveDDS((job.filename + ".dds").c_str());
+}
+
+bool cookAsset(sCookJob& job)
+{
+	if (job.type == ASSET_MESH)
+	{
+		Mesh mesh;
+		return mesh.loadSource(job.filename.c_str()) && mesh.writeBin(job.filename.c_str());
+	}
+	if (job.type == ASSET_GLTF)
+		return cookGLTF(job.filename.c_str());
+	if (job.type == ASSET_TEXTURE)
+		return cookTexture(job);
+	//HDRE is already the runtime format
+	return true;
+}
+
+void loadManifest(const std::string& filename, std::map<std::string, uint64_t>& manifest)
+{
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t pos = line.find(' ');
+		if (pos == std::string::npos)
+			continue;
+		manifest[line.substr(pos + 1)] = strtoull(line.substr(0, pos).c_str(), NULL, 16);
+	}
+}
+
+bool saveManifest(const std::string& filename, const std::vector<sCookJob>& jobs)
+{
+	std::ofstream file(filename);
+	if (!file)
+		return false;
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (jobs[i].ok)
+			file << std::hex << jobs[i].hash << std::dec << " " << jobs[i].filename << "\n";
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::string folder = "data";
+	bool force = false;
+	int num_threads = std::thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-f") == 0)
+			force = true;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			num_threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-u") == 0)
+			compress_textures = false;
+		else if (strcmp(argv[i], "-bc7") == 0)
+			use_bc7 = true;
+		else
+			folder = argv[i];
+	}
+	if (num_threads < 1)
+		num_threads = 1;
+
+	//the offline passes only run here, the runtime reads their result from the .mbin
+	Mesh::optimize_meshes = true;
+	Mesh::quantize_meshes = true;
+
+	//no GPU here, and the sources must be read instead of the previous cooked files
+	Mesh::auto_upload_to_vram = false;
+	Mesh::use_binary = false;
+	Image::use_cooked = false;
+
+	long start_time = getTime();
+
+	std::vector<std::string> files;
+	listFiles(folder, files);
+
+	std::vector<sCookJob> jobs;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		sCookJob job;
+		job.filename = files[i];
+		job.type = getAssetType(files[i]);
+		job.hash = 0;
+		job.skipped = job.ok = false;
+		job.time = 0;
+		job.info = "";
+		if (job.type != ASSET_NONE)
+			jobs.push_back(job);
+	}
+
+	std::string manifest_filename = folder + "/" + COOK_MANIFEST;
+	std::map<std::string, uint64_t> manifest;
+	if (!force)
+		loadManifest(manifest_filename, manifest);
+
+	//the format of a texture depends on the glTFs that use it, so they are read before any hash
+	int num_textures = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (jobs[i].type == ASSET_GLTF)
+			getGLTFTextureUsage(jobs[i].filename.c_str(), texture_usage);
+		if (jobs[i].type == ASSET_TEXTURE)
+			num_textures++;
+	}
+	encode_threads = std::max(1, num_threads / std::max(1, num_textures));
+
+	std::cout << "Cooking " << jobs.size() << " assets from " << folder << " using " << num_threads << " threads" << std::endl;
+
+	//every worker takes the next job until there are no more
+	std::atomic<int> next_job(0);
+	auto worker = [&]() {
+		int index;
+		while ((index = next_job++) < (int)jobs.size())
+		{
+			sCookJob& job = jobs[index];
+			long time = getTime();
+			if (!computeAssetHash(job))
+			{
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cout << "[ERROR] cannot read " << job.filename << std::endl;
+				continue;
+			}
+
+			std::map<std::string, uint64_t>::iterator it = manifest.find(job.filename);
+			if (it != manifest.end() && it->second == job.hash && outputExists(job))
+			{
+				job.skipped = job.ok = true;
+				continue;
+			}
+
+			job.ok = cookAsset(job);
+			job.time = (getTime() - time) * 0.001;
+
+			std::lock_guard<std::mutex> lock(output_mutex);
+			std::cout << (job.ok ? "[COOKED] " : "[ERROR] ") << job.filename << " " << job.time << "sec";
+			if (!job.info.empty())
+				std::cout << " " << job.info;
+			std::cout << std::endl;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(worker));
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	int num_cooked = 0, num_skipped = 0, num_errors = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (!jobs[i].ok)
+			num_errors++;
+		else if (jobs[i].skipped)
+			num_skipped++;
+		else
+			num_cooked++;
+	}
+
+	if (!saveManifest(manifest_filename, jobs))
+		std::cout << "[ERROR] cannot write " << manifest_filename << std::endl;
+
+	std::cout << "Cooked: " << num_cooked << " Up to date: " << num_skipped << " Errors: " << num_errors << " Time: " << (getTime() - start_time) * 0.001 << "sec" << std::endl;
+	return num_errors ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+#include "upload_ring.h"
+#include "includes.h"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstdio>
+#include <algorithm>
+
+bool UploadRing::enabled = true;
+size_t UploadRing::slot_size = 16 * 1024 * 1024; //a 2048x2048 RGBA image
+int UploadRing::num_slots = 4;
+size_t UploadRing::frame_budget = 4 * 1024 * 1024;
+size_t UploadRing::uploaded_bytes = 0;
+
+enum eSlotState {
+	SLOT_UNMAPPED, //waiting to be mapped by the main thread
+	SLOT_FREE, //mapped, ready for a loader
+	SLOT_WRITING, //a loader is copying an image into it
+	SLOT_UPLOADING, //unmapped, the rows are being sent
+	SLOT_FENCED //all the rows sent, waiting for the GPU to read them
+};
+
+struct sUploadSlot {
+	GLuint buffer;
+	unsigned char* data;
+	eSlotState state;
+	GLsync fence;
+};
+
+struct sUploadJob {
+	int slot;
+	int width;
+	int height;
+	int num_channels;
+	int next_row;
+	GLuint texture_id;
+	std::function<void(unsigned int)> callback;
+};
+
+//only the states are shared with the loaders, the jobs and the GL calls stay in the main thread
+static std::vector<sUploadSlot> slots;
+static std::deque<sUploadJob> jobs;
+static std::mutex slots_mutex;
+
+static bool mapSlot(sUploadSlot& slot)
+{
+	//the fence already passed, so there is no need to wait for the GPU when mapping
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+	void* data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, UploadRing::slot_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!data)
+		return false;
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	slot.data = (unsigned char*)data;
+	slot.state = SLOT_FREE;
+	return true;
+}
+
+bool UploadRing::init()
+{
+	//fences are core since 3.2, the legacy context of macOS does not have them
+	int major = 0, minor = 0;
+	const char* version = (const char*)glGetString(GL_VERSION);
+	if (!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 32)
+	{
+		std::cout << "[WARN] Upload ring needs OpenGL 3.2, textures are uploaded directly" << std::endl;
+		enabled = false;
+		return false;
+	}
+
+	slots.resize(num_slots);
+	for (int i = 0; i < num_slots; ++i)
+	{
+		sUploadSlot& slot = slots[i];
+		slot.data = NULL;
+		slot.state = SLOT_UNMAPPED;
+		slot.fence = 0;
+		glGenBuffers(1, &slot.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_size, NULL, GL_STREAM_DRAW);
+		mapSlot(slot);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	std::cout << " * Upload ring: " << num_slots << " x " << (slot_size / (1024 * 1024)) << " MB" << std::endl;
+	return true;
+}
+
+int UploadRing::acquire(size_t size)
+{
+	if (!enabled || size > slot_size)
+		return -1;
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	for (size_t i = 0; i < slots.size(); ++i)
+		if (slots[i].state == SLOT_FREE)
+		{
+			slots[i].state = SLOT_WRITING;
+			return (int)i;
+		}
+	return -1;
+}
+
+unsigned char* UploadRing::getData(int slot)
+{
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	return slots[slot].data;
+}
+
+void UploadRing::release(int slot)
+{
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	slots[slot].state = SLOT_FREE; //still mapped
+}
+
+void UploadRing::upload(int slot, int width, int height, int num_channels, std::function<void(unsigned int)> callback)
+{
+	sUploadSlot& s = slots[slot];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+	if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+		std::cout << "[WARN] Upload ring buffer lost while mapped, the texture could be corrupted" << std::endl;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	{
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		s.data = NULL;
+		s.state = SLOT_UPLOADING;
+	}
+
+	sUploadJob job;
+	job.slot = slot;
+	job.width = width;
+	job.height = height;
+	job.num_channels = num_channels;
+	job.next_row = 0;
+	job.texture_id = 0;
+	job.callback = callback;
+	jobs.push_back(job);
+}
+
+void UploadRing::update()
+{
+	uploaded_bytes = 0;
+	if (slots.empty())
+		return;
+
+	//recycle the slots the GPU already read
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		sUploadSlot& slot = slots[i];
+		if (slot.state == SLOT_FENCED)
+		{
+			GLenum result = glClientWaitSync(slot.fence, 0, 0);
+			if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			slot.state = SLOT_UNMAPPED;
+		}
+		if (slot.state == SLOT_UNMAPPED)
+			mapSlot(slot);
+	}
+
+	//send the rows of the queued images in order until the budget is spent, at least one row per frame
+	size_t budget = frame_budget ? frame_budget : (size_t)-1;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	while (!jobs.empty() && budget)
+	{
+		sUploadJob& job = jobs.front();
+		sUploadSlot& slot = slots[job.slot];
+		GLenum format = job.num_channels == 3 ? GL_RGB : GL_RGBA;
+		size_t row_bytes = (size_t)job.width * job.num_channels;
+
+		if (!job.texture_id)
+		{
+			//the storage is allocated without a buffer bound, otherwise it would read from it
+			glGenTextures(1, &job.texture_id);
+			glBindTexture(GL_TEXTURE_2D, job.texture_id);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, job.width, job.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+		}
+		else
+			glBindTexture(GL_TEXTURE_2D, job.texture_id);
+
+		int rows = (int)std::min(std::max(budget / row_bytes, (size_t)1), (size_t)(job.height - job.next_row));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.next_row, job.width, rows, format, GL_UNSIGNED_BYTE, (void*)(job.next_row * row_bytes));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		job.next_row += rows;
+		size_t bytes = rows * row_bytes;
+		uploaded_bytes += bytes;
+		budget -= std::min(bytes, budget);
+		if (job.next_row < job.height)
+			break;
+
+		//the slot is reused once the GPU has copied it
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		{
+			std::lock_guard<std::mutex> lock(slots_mutex);
+			slot.state = SLOT_FENCED;
+		}
+		GLuint texture_id = job.texture_id;
+		std::function<void(unsigned int)> callback = job.callback;
+		jobs.pop_front();
+		callback(texture_id);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void UploadRing::renderInMenu()
+{
+#ifndef SKIP_IMGUI
+	int busy = 0;
+	{
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		for (size_t i = 0; i < slots.size(); ++i)
+			if (slots[i].state != SLOT_FREE)
+				busy++;
+	}
+	ImGui::Checkbox("Upload ring", &enabled);
+	ImGui::Text("Slots busy: %d/%d  Queued: %d  Last frame %d KB", busy, (int)slots.size(), (int)jobs.size(), (int)(uploaded_bytes / 1024));
+	int budget_kb = (int)(frame_budget / 1024);
+	if (ImGui::SliderInt("Upload budget (KB/frame, 0 no limit)", &budget_kb, 0, 16384))
+		frame_budget = (size_t)budget_kb * 1024;
+#endif
+}
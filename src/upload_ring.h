@@ -0,0 +1,35 @@
+/*  upload ring
+	Pixel buffers (PBOs) that stay mapped so the background loaders copy the decoded images straight into them.
+	The main thread only issues glTexSubImage2D from the buffer, a few rows per frame up to a byte budget,
+	and a fence tells when the GPU has read a buffer so it can be mapped again.
+*/
+#pragma once
+
+#include <functional>
+#include <cstddef>
+
+class UploadRing {
+public:
+	static bool enabled;
+	static size_t slot_size; //bytes of every buffer, bigger images use the direct upload
+	static int num_slots;
+	static size_t frame_budget; //bytes sent to the GPU every frame, 0 means no limit
+	static size_t uploaded_bytes; //in the last update
+
+	//creates the buffers, call it once the GL context exists (needs GL 3.2 for the fences)
+	static bool init();
+
+	//any thread: returns a free slot with at least size bytes mapped, -1 if there is none
+	static int acquire(size_t size);
+	static unsigned char* getData(int slot);
+	static void release(int slot); //when the slot was acquired but it will not be uploaded
+
+	//main thread: queues the upload of an 8 bit image written in the slot
+	//the callback receives the new GL texture once all the rows are in it
+	static void upload(int slot, int width, int height, int num_channels, std::function<void(unsigned int)> callback);
+
+	//main thread, once per frame: sends the queued rows and recycles the slots the GPU is done with
+	static void update();
+
+	static void renderInMenu();
+};
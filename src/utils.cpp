@@ -1,9 +1,16 @@
 #include "utils.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #ifdef WIN32
 	#include <windows.h>
 #else
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
 
 #include "includes.h"
@@ -137,6 +144,236 @@ bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer
 	return true;
 }
 
+bool fileExists(const std::string& filename)
+{
+	FILE* fp = fopen(filename.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+	fclose(fp);
+	return true;
+}
+
+bool getFileStamp(const std::string& filename, long long& size, long long& modified)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return false;
+	size = (long long)info.st_size;
+	modified = (long long)info.st_mtime;
+	return true;
+}
+
+bool isFileUpToDate(const std::string& output, const std::string& source)
+{
+	long long output_size, output_modified, source_size, source_modified;
+	if (!getFileStamp(output, output_size, output_modified))
+		return false;
+	if (!getFileStamp(source, source_size, source_modified))
+		return true; //only the cooked version was shipped
+	return output_modified >= source_modified;
+}
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+	ref_count = 1;
+#ifdef WIN32
+	file_handle = mapping_handle = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	data = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file alive
+	if (ptr == MAP_FAILED)
+		return false;
+	data = (char*)ptr;
+	size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+	file_handle = mapping_handle = NULL;
+#else
+	munmap(data, size);
+#endif
+	data = NULL;
+	size = 0;
+}
+
+void MappedFile::release()
+{
+	//acq_rel so the last owner sees every read the others did before deleting
+	int refs = ref_count.fetch_sub(1, std::memory_order_acq_rel);
+	assert(refs > 0 && "MappedFile released too many times");
+	if (refs == 1)
+		delete this;
+}
+
+#define LZ4_HASH_BITS 16
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 //the format requires the last bytes to be literals
+#define LZ4_MATCH_LIMIT 12 //and no match starting closer than this to the end
+
+inline unsigned int readUint32(const unsigned char* p) { unsigned int v; memcpy(&v, p, 4); return v; }
+
+void writeLZ4Length(std::vector<char>& dest, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		dest.push_back((char)255);
+	dest.push_back((char)length);
+}
+
+//greedy matching with a hash of the next 4 bytes, fast to decompress and good enough for cached data
+void compressLZ4(const char* src, size_t size, std::vector<char>& dest)
+{
+	const unsigned char* in = (const unsigned char*)src;
+	dest.clear();
+	dest.reserve(size + size / 255 + 16);
+	std::vector<size_t> table((size_t)1 << LZ4_HASH_BITS, (size_t)-1);
+
+	size_t anchor = 0, i = 0;
+	while (i + LZ4_MATCH_LIMIT <= size)
+	{
+		unsigned int sequence = readUint32(in + i);
+		unsigned int hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		size_t ref = table[hash];
+		table[hash] = i;
+		if (ref == (size_t)-1 || i - ref > 65535 || readUint32(in + ref) != sequence)
+		{
+			i++;
+			continue;
+		}
+
+		size_t length = LZ4_MIN_MATCH;
+		size_t max_length = size - LZ4_LAST_LITERALS - i;
+		while (length < max_length && in[ref + length] == in[i + length])
+			length++;
+
+		size_t num_literals = i - anchor;
+		size_t match = length - LZ4_MIN_MATCH;
+		dest.push_back((char)((std::min(num_literals, (size_t)15) << 4) | std::min(match, (size_t)15)));
+		if (num_literals >= 15)
+			writeLZ4Length(dest, num_literals - 15);
+		dest.insert(dest.end(), src + anchor, src + i);
+		size_t offset = i - ref;
+		dest.push_back((char)(offset & 0xFF));
+		dest.push_back((char)(offset >> 8));
+		if (match >= 15)
+			writeLZ4Length(dest, match - 15);
+
+		i += length;
+		anchor = i;
+	}
+
+	//the rest goes as literals in a last sequence without match
+	size_t num_literals = size - anchor;
+	dest.push_back((char)(std::min(num_literals, (size_t)15) << 4));
+	if (num_literals >= 15)
+		writeLZ4Length(dest, num_literals - 15);
+	dest.insert(dest.end(), src + anchor, src + size);
+}
+
+bool decompressLZ4(const char* src, size_t size, char* dest, size_t dest_size)
+{
+	const unsigned char* ip = (const unsigned char*)src;
+	const unsigned char* end = ip + size;
+	size_t op = 0;
+
+	auto readLength = [&](size_t& length) {
+		if (length != 15)
+			return true;
+		unsigned char byte;
+		do {
+			if (ip >= end)
+				return false;
+			byte = *ip++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	};
+
+	while (ip < end)
+	{
+		unsigned char token = *ip++;
+		size_t num_literals = token >> 4;
+		if (!readLength(num_literals) || num_literals > (size_t)(end - ip) || num_literals > dest_size - op)
+			return false;
+		memcpy(dest + op, ip, num_literals);
+		ip += num_literals;
+		op += num_literals;
+		if (ip == end) //the last sequence has no match
+			break;
+
+		if (end - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t length = token & 15;
+		if (offset == 0 || offset > op || !readLength(length))
+			return false;
+		length += LZ4_MIN_MATCH;
+		if (length > dest_size - op)
+			return false;
+		//byte by byte, the match can overlap what it is writing
+		for (size_t i = 0; i < length; ++i, ++op)
+			dest[op] = dest[op - offset];
+	}
+	return op == dest_size;
+}
+
 bool checkGLErrors()
 {
 	#ifndef _DEBUG
@@ -7,6 +7,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <atomic>
 #include "extra/cJSON.h"
 
 
@@ -18,6 +19,36 @@ long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
+bool fileExists(const std::string& filename);
+bool getFileStamp(const std::string& filename, long long& size, long long& modified); //to detect changes in source files
+bool isFileUpToDate(const std::string& output, const std::string& source); //the output exists and is not older than the source (for cooked files)
+
+//read-only view of a whole file mapped in memory, the OS pages the data in when accessed (no copies)
+class MappedFile
+{
+public:
+	char* data;
+	size_t size;
+	std::atomic<int> ref_count; //starts at 1, call release when done, the meshes are loaded and freed from any thread
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+
+	void addRef() { ref_count.fetch_add(1, std::memory_order_relaxed); }
+	void release(); //deletes the object when nobody uses it
+
+#ifdef WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+};
+
+//LZ4 block format (no frame), the size of the decompressed data must be stored apart
+void compressLZ4(const char* src, size_t size, std::vector<char>& dest);
+bool decompressLZ4(const char* src, size_t size, char* dest, size_t dest_size); //false if the data is corrupted
 
 //generic purposes fuctions
 void drawGrid();